@@ -48,9 +48,28 @@ typedef enum _RMI4_F12_OBJECT_TYPE
 
 #define RMI_F12_REPORTING_MODE_CONTINUOUS   0
 #define RMI_F12_REPORTING_MODE_REDUCED      1
+#define RMI_F12_REPORTING_MODE_WAKEUP       2
 #define RMI_F12_REPORTING_MODE_MASK         7
 
 #define F12_2D_CTRL20   20
+#define F12_2D_CTRL23   23
+
+//
+// Object types the controller classifies and reports, first byte of
+// F12_2D_CTRL23, bit n - 1 enables object type n
+//
+#define RMI_F12_OBJECT_REPORT_FINGER        0x01
+#define RMI_F12_OBJECT_REPORT_STYLUS        0x02
+#define RMI_F12_OBJECT_REPORT_PALM          0x04
+#define RMI_F12_OBJECT_REPORT_UNCLASSIFIED  0x08
+#define RMI_F12_OBJECT_REPORT_HAND_EDGE     0x80
+
+//
+// Object types a palm or other large object is classified as
+//
+#define RMI_F12_OBJECT_REPORT_LARGE         (RMI_F12_OBJECT_REPORT_PALM | \
+                                             RMI_F12_OBJECT_REPORT_UNCLASSIFIED | \
+                                             RMI_F12_OBJECT_REPORT_HAND_EDGE)
 
 //
 // Logical structure for getting registry config settings
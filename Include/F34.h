@@ -0,0 +1,83 @@
+#pragma once
+
+#include <wdf.h>
+#include <wdm.h>
+
+//
+// Defines from Synaptics RMI4 Data Sheet, please refer to
+// the spec for details about the fields and values.
+//
+
+//
+// Function $34 - Flash Memory Management
+//
+
+#include <pshpack1.h>
+
+typedef struct _RMI4_F34_QUERY_REGISTERS
+{
+	BYTE BootloaderId[2];
+	struct
+	{
+		BYTE RegMap : 1;
+		BYTE Unlocked : 1;
+		BYTE HasConfigId : 1;
+		BYTE Reserved0 : 5;
+	};
+	USHORT BlockSize;
+	USHORT FirmwareBlockCount;
+	USHORT ConfigBlockCount;
+} RMI4_F34_QUERY_REGISTERS;
+
+#include <poppack.h>
+
+//
+// Data registers, relative to the data base. The flash command register
+// directly follows the block data, so a block and its command can be
+// written in one transfer.
+//
+#define RMI4_F34_DATA_BLOCK_NUMBER        0
+#define RMI4_F34_DATA_BLOCK_DATA          2
+
+//
+// The block number auto-increments after each block command, its top
+// bits select the area the blocks belong to
+//
+#define RMI4_F34_BLOCK_AREA_CONFIG        (1 << 13)
+
+//
+// Flash command register, the controller clears the command once done
+// and reports the outcome in the status bits
+//
+#define RMI4_F34_COMMAND_MASK             0x0F
+#define RMI4_F34_STATUS_MASK              0x70
+#define RMI4_F34_PROGRAM_ENABLED          0x80
+
+#define RMI4_F34_COMMAND_WRITE_FW_BLOCK   0x02
+#define RMI4_F34_COMMAND_ERASE_ALL        0x03
+#define RMI4_F34_COMMAND_READ_CONFIG      0x05
+#define RMI4_F34_COMMAND_WRITE_CONFIG     0x06
+#define RMI4_F34_COMMAND_ENABLE_FLASH     0x0F
+
+//
+// F01 command register bit resetting the controller
+//
+#define RMI4_F01_COMMAND_RESET            0x01
+
+//
+// Firmware image layout, the firmware area follows the header and the
+// configuration area follows the firmware area. The checksum covers
+// everything past the checksum field.
+//
+#define RMI4_F34_IMAGE_DATA_OFFSET        0x100
+
+typedef struct _RMI4_F34_IMAGE_HEADER
+{
+	ULONG Checksum;
+	BYTE Reserved0[3];
+	BYTE BootloaderVersion;
+	ULONG FirmwareSize;
+	ULONG ConfigSize;
+	BYTE ProductId[10];
+	BYTE ProductInfo[2];
+} RMI4_F34_IMAGE_HEADER;
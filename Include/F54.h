@@ -0,0 +1,40 @@
+#pragma once
+
+#include <wdf.h>
+#include <wdm.h>
+
+//
+// Defines from Synaptics RMI4 Data Sheet, please refer to
+// the spec for details about the fields and values.
+//
+
+//
+// Function $54 - Test Reporting
+//
+
+typedef struct _RMI4_F54_QUERY_REGISTERS
+{
+	BYTE NumberOfReceivers;
+	BYTE NumberOfTransmitters;
+} RMI4_F54_QUERY_REGISTERS;
+
+//
+// Data registers, relative to the data base. Reading the report data
+// register returns the report byte at the FIFO index and advances it.
+//
+#define RMI4_F54_DATA_REPORT_TYPE         0
+#define RMI4_F54_DATA_FIFO_INDEX          1
+#define RMI4_F54_DATA_REPORT_DATA         3
+
+//
+// Command register bits, the controller clears GET_REPORT once the
+// requested report can be read
+//
+#define RMI4_F54_COMMAND_GET_REPORT       0x01
+#define RMI4_F54_COMMAND_FORCE_CAL        0x02
+
+//
+// Report types
+//
+#define RMI4_F54_REPORT_DELTA_16BIT       2
+#define RMI4_F54_REPORT_RAW_16BIT         3
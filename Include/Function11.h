@@ -9,19 +9,14 @@ GetTouchesFromF11(
 	IN SPB_CONTEXT* SpbContext
 );
 
-VOID
-UpdateLocalFingerCacheF11(
-	IN ULONG FingerStatusRegister,
-	IN RMI4_F11_DATA_POSITION* FingerPosRegisters,
-	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
-);
-
 NTSTATUS
 RmiConfigureFunction11(
 	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
 	IN SPB_CONTEXT* SpbContext
 );
 
+extern CONST RMI4_DIGITIZER_OPS RmiF11Ops;
+
 VOID
 RmiConvertF11ToPhysical(
 	IN RMI4_F11_CTRL_REGISTERS_LOGICAL* Logical,
@@ -3,19 +3,38 @@
 
 #pragma once
 
+NTSTATUS
+RmiReadF12Packet(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	OUT BYTE** Packet
+);
+
+VOID
+RmiParseF12Packet(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN BYTE* Packet
+);
+
 NTSTATUS
 GetTouchesFromF12(
 	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
 	IN SPB_CONTEXT* SpbContext
 );
 
-VOID
-UpdateLocalFingerCacheF12(
-	IN ULONG FingerStatusRegister,
-	IN RMI4_F12_DATA_POSITION* FingerPosRegisters,
+extern CONST RMI4_DIGITIZER_OPS RmiF12Ops;
+
+CONST RMI4_DIGITIZER_OPS*
+RmiSelectF12Ops(
 	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
 );
 
+NTSTATUS
+RmiAllocateF12PacketBuffer(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
 NTSTATUS
 RmiConfigureFunction12(
 	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
@@ -37,6 +56,11 @@ RmiReadRegisterDescriptor(
 	IN PRMI_REGISTER_DESCRIPTOR Rdesc
 );
 
+VOID
+RmiFreeRegisterDescriptors(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+);
+
 size_t
 RmiRegisterDescriptorCalcSize(
 	IN PRMI_REGISTER_DESCRIPTOR Rdesc
@@ -0,0 +1,65 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		Function34.h
+
+	Abstract:
+
+		F34 firmware reflash. Each block is written together with its
+		flash command in a single bus transfer, and completion is taken
+		from the attention interrupt instead of polling on a delay.
+		Touch reporting is suspended while the flash is in progress.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <wdf.h>
+#include "spbhelper.h"
+
+//
+// Bound on the wait for the attention interrupt of each flash step
+//
+#define RMI4_F34_ENABLE_TIMEOUT_MS        1000
+#define RMI4_F34_ERASE_TIMEOUT_MS         5000
+#define RMI4_F34_BLOCK_TIMEOUT_MS         200
+#define RMI4_F34_RESET_TIMEOUT_MS         1000
+
+typedef struct _RMI4_F34_FLASH_CONTEXT
+{
+	//
+	// While active the interrupt routine only acknowledges interrupts
+	// and signals the attention event
+	//
+	volatile BOOLEAN Active;
+	KEVENT Attention;
+} RMI4_F34_FLASH_CONTEXT;
+
+VOID
+TchF34FlashInitialize(
+	IN VOID* ControllerContext
+);
+
+NTSTATUS
+TchF34Reflash(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN PVOID Image,
+	IN ULONG Length
+);
+
+VOID
+RmiF34ServiceAttention(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
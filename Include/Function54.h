@@ -0,0 +1,120 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		Function54.h
+
+	Abstract:
+
+		F54 image streaming for diagnostics. A session captures one
+		F54 report every Decimation frames; each capture is stepped
+		along by the interrupt routine, which reads a bounded chunk of
+		the image per frame, so touch reporting carries on during a
+		session. A timer steps the capture while no frames arrive.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <wdf.h>
+#include "spbhelper.h"
+#include "diag.h"
+
+//
+// Image bytes read per step, bounding the time a frame spends on F54
+//
+#define RMI4_F54_READ_CHUNK               64
+
+//
+// Interval of the timer stepping a capture while the controller does not
+// interrupt, and number of steps a requested report may take
+//
+#define RMI4_F54_STEP_INTERVAL_MS         10
+#define RMI4_F54_REPORT_TIMEOUT_STEPS     100
+
+typedef enum _RMI4_F54_STREAM_STATE
+{
+	RMI4_F54_STREAM_IDLE = 0,               // no session
+	RMI4_F54_STREAM_WAIT,                   // counting frames to the next capture
+	RMI4_F54_STREAM_REQUESTED,              // report requested from the controller
+	RMI4_F54_STREAM_READING                 // reading the report in chunks
+} RMI4_F54_STREAM_STATE;
+
+typedef struct _RMI4_F54_STREAM
+{
+	//
+	// Capture state, owned by the controller lock
+	//
+	volatile BOOLEAN Active;
+	RMI4_F54_STREAM_STATE State;
+	BYTE ReportType;
+	ULONG Decimation;
+	ULONG Frames;
+	ULONG Steps;
+	USHORT Receivers;
+	USHORT Transmitters;
+	ULONG ImageSize;
+	ULONG Offset;
+	ULONG64 CaptureTime;
+	ULONG64 LastStep;
+	PUCHAR Image;
+	WDFTIMER StepTimer;
+
+	//
+	// Ring of captured images, each slot a TCH_F54_FRAME_HEADER followed
+	// by the image, guarded by the ring lock
+	//
+	WDFSPINLOCK RingLock;
+	PUCHAR Ring;
+	ULONG RingHead;
+	ULONG RingCount;
+	ULONG Sequence;
+	ULONG Dropped;
+} RMI4_F54_STREAM;
+
+#define RMI4_F54_RING_SLOT_SIZE \
+	(sizeof(TCH_F54_FRAME_HEADER) + TCH_F54_MAX_IMAGE_SIZE)
+
+NTSTATUS
+TchF54StreamInitialize(
+	IN VOID* ControllerContext
+);
+
+NTSTATUS
+TchF54StreamStart(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN PTCH_F54_STREAM_CONFIG Config
+);
+
+VOID
+TchF54StreamStop(
+	IN VOID* ControllerContext
+);
+
+VOID
+TchF54StreamFree(
+	IN VOID* ControllerContext
+);
+
+NTSTATUS
+TchF54StreamRead(
+	IN VOID* ControllerContext,
+	IN WDFREQUEST Request,
+	OUT ULONG_PTR* Information
+);
+
+VOID
+RmiF54StreamStep(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
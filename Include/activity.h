@@ -0,0 +1,56 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		activity.h
+
+	Abstract:
+
+		Touch activity policy. The controller runs at its configured
+		report rate while it is being touched, and is switched to
+		reduced reporting and a longer doze interval once no interrupt
+		arrived for the configured idle timeout. The first interrupt
+		after that restores the active settings.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <wdf.h>
+#include "spbhelper.h"
+
+typedef struct _TCH_ACTIVITY_CONTEXT
+{
+	WDFTIMER IdleTimer;
+
+	//
+	// Interrupt time of the last serviced interrupt, the idle timer is
+	// only armed once per active period and re-armed for the remainder
+	//
+	volatile LONG64 LastActivity;
+	BOOLEAN TimerArmed;
+
+	//
+	// Idle settings are programmed on the controller
+	//
+	BOOLEAN Idle;
+} TCH_ACTIVITY_CONTEXT;
+
+NTSTATUS
+TchActivityInitialize(
+	IN VOID* ControllerContext
+);
+
+VOID
+TchActivityStop(
+	IN VOID* ControllerContext
+);
@@ -37,7 +37,9 @@
 
 #define BKL_NUM_LEVELS_DEFAULT     4
 #define BKL_DEFAULT_INTENSITY      5        // percent
+#define BKL_INTENSITY_QUANTUM      5        // percent, smallest visible step
 #define BKL_ALS_SAMPLING_INTERVAL  5000000  // usec
+#define BKL_ACTIVITY_DEBOUNCE      20       // msec
 
 #define HUNDRED_NS_PER_MS 10000
 #define GetTickCount() (KeQueryInterruptTime() / HUNDRED_NS_PER_MS)
@@ -69,6 +71,20 @@ typedef struct _SENSOR_NOTIFICATION
 #define IOCTL_SENSOR_CLX_NOTIFICATION_STOP        \
     CTL_CODE(FILE_DEVICE_UNKNOWN, 7, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
+//
+// Notification configuration completing reads only once the reading
+// leaves the [ThreshMin, ThreshMax) range, the thresholds follow the
+// header with their sizes given in ThreshMinSize and ThreshMaxSize
+//
+#define SENSOR_NOTIFICATION_FLAG_THRESHOLDS       0x00000001
+
+typedef struct _BKL_ALS_NOTIFICATION
+{
+	SENSOR_NOTIFICATION Header;
+	ULONG ThreshMin;
+	ULONG ThreshMax;
+} BKL_ALS_NOTIFICATION;
+
 typedef struct _BKL_CONTEXT
 {
 	WDFDEVICE FxDevice;
@@ -78,26 +94,54 @@ typedef struct _BKL_CONTEXT
 	BOOLEAN HwnReady;
 	HWN_HEADER* HwnConfiguration;
 	size_t HwnConfigurationSize;
+
+	//
+	// All LEDs are programmed by a single preallocated request. Changes
+	// made while it is in flight are sent once it completes, only the
+	// latest intensity is sent.
+	//
+	WDFREQUEST HwnRequest;
+	WDFMEMORY HwnMemory;
+	WDFSPINLOCK HwnLock;
+	BOOLEAN HwnBusy;
+	BOOLEAN HwnUpdatePending;
 	ULONG HwnNumLeds;
 	PULONG HwnLedIndexList;
 
 	WDFIOTARGET AlsIoTarget;
 	PVOID AlsPnpNotificationEntry;
 	BOOLEAN AlsReady;
-	SENSOR_NOTIFICATION AlsConfiguration;
+	BKL_ALS_NOTIFICATION AlsConfiguration;
+	BOOLEAN AlsThresholdsSupported;
 	ALS_DATA AlsData;
 	NTSTATUS AlsStatus;
 
+	//
+	// A single read is kept pending on the ALS target while streaming,
+	// its completion hands the sample to the work item and reposts it
+	//
+	WDFREQUEST AlsRequest;
+	WDFMEMORY AlsMemory;
+	WDFTIMER AlsRetryTimer;
+	WDFWORKITEM AlsWorkItem;
+	volatile ULONG AlsSample;
+	volatile BOOLEAN AlsStreaming;
+
 	WDFWAITLOCK BacklightLock;
-	WDFWORKITEM TchBklPollAlsWorkItem;
-	BOOLEAN TchBklPollAls;
 	ULONG CurrentBklIntensity;
 
 	ULONG BklNumLevels;
 	BKL_LUX_TABLE_ENTRY* BklLuxTable;
 
+	//
+	// Touch input only records its time and arms the activity timer,
+	// which times the backlights out and brings them back
+	//
 	ULONG Timeout;
-	ULONG LastInputTime;
+	volatile LONG LastInputTime;
+	volatile LONG ActivityTimerArmed;
+	WDFTIMER ActivityTimer;
+	BOOLEAN TimedOut;
 
 	PVOID MonitorChangeNotificationHandle;
 } BKL_CONTEXT;
@@ -131,7 +175,15 @@ TchBklNotifyTouchActivity(
 	IN DWORD Time
 );
 
-EVT_WDF_WORKITEM TchBklGetLightSensorValue;
+EVT_WDF_WORKITEM TchBklProcessLightSensorValue;
+
+EVT_WDF_REQUEST_COMPLETION_ROUTINE TchBklOnAlsReadComplete;
+
+EVT_WDF_TIMER TchBklOnAlsRetryTimer;
+
+EVT_WDF_TIMER TchBklOnActivityTimer;
+
+EVT_WDF_REQUEST_COMPLETION_ROUTINE TchBklOnHwnSetStateComplete;
 
 DRIVER_NOTIFICATION_CALLBACK_ROUTINE TchBklOnAlsDeviceReady;
 
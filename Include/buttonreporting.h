@@ -11,6 +11,20 @@ typedef enum _REPORTED_BUTTON
 	BUTTON_UNKNOWN
 } REPORTED_BUTTON;
 
+NTSTATUS
+RmiReadCapacitiveButtons(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	OUT RMI4_F1A_DATA_REGISTERS* DataF1A
+);
+
+NTSTATUS
+RmiReportCapacitiveButtons(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN RMI4_F1A_DATA_REGISTERS* DataF1A,
+	IN BOOLEAN ReversedKeys
+);
+
 NTSTATUS
 RmiServiceCapacitiveButtonInterrupt(
 	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
@@ -18,13 +32,39 @@ RmiServiceCapacitiveButtonInterrupt(
 	IN BOOLEAN ReversedKeys
 );
 
+//
+// Registry value holding the virtual button regions, an array of
+// TCH_BUTTON_REGION_SETTING in display-oriented controller coordinates
+//
+#define TCH_BUTTON_REGIONS_VALUE_NAME   L"VirtualButtonRegions"
+
+typedef struct _TCH_BUTTON_REGION_SETTING
+{
+	ULONG Button;                       // REPORTED_BUTTON, BUTTON_UNKNOWN for a dead zone
+	ULONG XMin;                         // bounds are exclusive
+	ULONG YMin;
+	ULONG XMax;
+	ULONG YMax;
+} TCH_BUTTON_REGION_SETTING;
+
+VOID
+TchLoadButtonLayout(
+	OUT RMI4_BUTTON_LAYOUT* Layout,
+	IN PTOUCH_SCREEN_PROPERTIES Props
+);
+
 REPORTED_BUTTON
 TchHandleButtonArea(
 	IN ULONG ControllerX,
 	IN ULONG ControllerY,
-	IN PTOUCH_SCREEN_PROPERTIES Props
+	IN const RMI4_BUTTON_LAYOUT* Layout
 );
 
+//
+// Hold time after which a button triggers its long press action
+//
+#define RMI4_BUTTON_LONG_PRESS_MS       1500
+
 NTSTATUS
 FillButtonsReportFromCache(
     IN RMI4_CONTROLLER_CONTEXT* ControllerContext
@@ -35,7 +75,12 @@ ButtonsTimerHandler(
     WDFTIMER Timer
 );
 
-void
+NTSTATUS
 ButtonsInitTimer(
     RMI4_CONTROLLER_CONTEXT* ControllerContext
 );
+
+VOID
+ButtonsStopTimer(
+    RMI4_CONTROLLER_CONTEXT* ControllerContext
+);
@@ -1,4 +1,9 @@
 
+//
+// Expose the absolute mouse collection used in the mouse input mode
+//
+#define HID_MOUSE_PATH_SUPPORT
+
 #define TOUCH_SCREEN_PROPERTIES_REG_KEY   L"\\Registry\\Machine\\System\\TOUCH\\SCREENPROPERTIES"
 #define TOUCH_SETTINGS_REG_KEY            L"\\Registry\\Machine\\System\\TOUCH\\SETTINGS"
 #define TOUCH_CONTROLLER_SETTINGS_REG_KEY L"\\Registry\\Machine\\System\\TOUCH\\CONTROLLERSETTINGS"
@@ -26,8 +26,9 @@
 #define RESHUB_USE_HELPER_ROUTINES
 #include <reshub.h>
 #include <kbdmou.h>
-#include "spb.h"
+#include "spbhelper.h"
 #include "hid.h"
+#include "diag.h"
 
 #define TOUCH_POOL_TAG                  (ULONG)'cuoT'
 
@@ -58,7 +59,10 @@
 #define REPORTID_FEATURE                7
 #define REPORTID_MAX_COUNT              8
 
-#define  MAX_REPORTS_IN_QUEUE            10  //5 for 10 touches + 2 for keyboard + 2 for consumer + 1 reserved
+//
+// Reports buffered for HIDClass read requests, must be a power of two
+//
+#define HID_REPORT_QUEUE_DEPTH          32
 
 // 
 // Type defintions
@@ -90,6 +94,20 @@ typedef struct _HID_TOUCH_REPORT
 	};
 } HID_TOUCH_REPORT, * PHID_TOUCH_REPORT;
 
+typedef struct _HID_WIDE_TOUCH_REPORT
+{
+	union
+	{
+		struct
+		{
+			HID_CONTACT_POINT Contacts[SYNAPTICS_TOUCH_DIGITIZER_WIDE_FINGER_REPORT_COUNT];
+			UCHAR  ActualCount;
+			USHORT ScanTime;
+		} InputReport;
+		UCHAR RawInput[63];
+	};
+} HID_WIDE_TOUCH_REPORT, * PHID_WIDE_TOUCH_REPORT;
+
 typedef struct _HID_MOUSE_REPORT {
 	union
 	{
@@ -128,6 +146,7 @@ typedef struct _HID_INPUT_REPORT
 	union
 	{
 		HID_TOUCH_REPORT TouchReport;
+		HID_WIDE_TOUCH_REPORT WideTouchReport;
 		HID_MOUSE_REPORT MouseReport;
 		HID_KEY_REPORT   KeyReport;
 	};
@@ -139,6 +158,92 @@ typedef struct _HID_INPUT_REPORT
 #include <poppack.h>
 #pragma warning(pop)
 
+//
+// Time an interrupt was taken, as interrupt time (100ns units) for the
+// HID scan time and as performance counter for the latency statistics
+// and report timestamps
+//
+typedef struct _TCH_SCAN_TIMESTAMP
+{
+	ULONG64 InterruptTime;
+	ULONG64 PerformanceCounter;
+} TCH_SCAN_TIMESTAMP, * PTCH_SCAN_TIMESTAMP;
+
+__inline
+VOID
+TchQueryScanTimestamp(
+	OUT PTCH_SCAN_TIMESTAMP Timestamp
+)
+{
+	Timestamp->InterruptTime = KeQueryInterruptTimePrecise(
+		&Timestamp->PerformanceCounter);
+}
+
+//
+// Single-producer, single-consumer ring of HID reports. Reports are
+// staged by the report builders and published in one go once an
+// interrupt has been serviced, then drained whenever both a report and
+// a HIDClass read request are available. When the ring is full the
+// oldest queued frame that only moves contacts already down is discarded
+// to make room. Frames carrying a tip transition are never discarded:
+// if no move-only frame is left the new frame is refused instead, and
+// the tip-ups it carried are reported with the next frame that is queued.
+//
+// Frames that only move contacts which are already down carry a
+// coalescing key (the mask of contact ids they report). A frame with the
+// same key as the newest published frame that HIDClass has not started
+// reading yet replaces it in place, so under backpressure the queue only
+// holds the latest positions, while tip transitions are never merged.
+//
+typedef struct _HID_REPORT_QUEUE
+{
+	//
+	// Producer side, serialized by the controller's report lock
+	//
+	volatile LONG Head;
+	LONG Staged;
+	ULONG StagedKey;
+	LONG LastStart;
+	LONG LastLength;
+	ULONG LastKey;
+
+	//
+	// Per slot, the number of reports of the frame starting there (zero
+	// for the following reports of a frame) and its coalescing key, so
+	// that only move-only frames are discarded on overflow
+	//
+	LONG FrameReports[HID_REPORT_QUEUE_DEPTH];
+	ULONG FrameKey[HID_REPORT_QUEUE_DEPTH];
+
+	//
+	// Touch report format, fixed once the report descriptor is published,
+	// and whether a read request may carry several reports back to back
+	//
+	BOOLEAN WideTouchReports;
+	BOOLEAN BatchReadCompletion;
+
+	//
+	// Latency statistics, or NULL when instrumentation is disabled. Each
+	// report carries the ISR entry and build stamps of its frame.
+	//
+	PTCH_LATENCY_CONTEXT Latency;
+
+	//
+	// Runtime counters of the owning controller
+	//
+	PTCH_RUNTIME_COUNTERS Counters;
+	LONG64 FrameStart[HID_REPORT_QUEUE_DEPTH];
+	LONG64 ReadyTime[HID_REPORT_QUEUE_DEPTH];
+
+	//
+	// Consumer side
+	//
+	WDFSPINLOCK ConsumerLock;
+	volatile LONG Tail;
+
+	HID_INPUT_REPORT Reports[HID_REPORT_QUEUE_DEPTH];
+} HID_REPORT_QUEUE, * PHID_REPORT_QUEUE;
+
 NTSTATUS
 TchAllocateContext(
 	OUT VOID** ControllerContext,
@@ -179,12 +284,33 @@ TchRegistryGetControllerSettings(
 	IN VOID* ControllerContext
 );
 
+BOOLEAN
+TchRegistryIsWakeGestureStandby(
+	VOID
+);
+
 NTSTATUS
 TchServiceInterrupts(
 	IN VOID* ControllerContext,
 	IN SPB_CONTEXT* SpbContext,
 	IN UCHAR InputMode,
-    IN PHID_INPUT_REPORT* HidReports,
-    IN int* HidReportsLength
+	IN PTCH_SCAN_TIMESTAMP Timestamp
+);
+
+NTSTATUS
+TchServiceCapturedFrame(
+	IN VOID* ControllerContext,
+	IN UCHAR InputMode
+);
+
+VOID
+TchNotifyTouchActivity(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+PHID_REPORT_QUEUE
+TchGetReportQueue(
+	IN VOID* ControllerContext
 );
 
@@ -27,6 +27,8 @@ EVT_WDF_DEVICE_D0_EXIT OnD0Exit;
 
 EVT_WDF_INTERRUPT_ISR OnInterruptIsr;
 
+EVT_WDF_WORKITEM OnReportWorkItem;
+
 EVT_WDF_DEVICE_PREPARE_HARDWARE OnPrepareHardware;
 
 EVT_WDF_DEVICE_RELEASE_HARDWARE OnReleaseHardware;
\ No newline at end of file
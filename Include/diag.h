@@ -0,0 +1,334 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		diag.h
+
+	Abstract:
+
+		Latency instrumentation, runtime counters and the diagnostic
+		control device used to retrieve them from user mode
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+//
+// Diagnostic control device, opened as \\.\SynapticsTouchDiag. Each
+// further controller instance appends its number, \\.\SynapticsTouchDiag1
+// and so on.
+//
+#define TCH_DIAG_DEVICE_NAME            L"\\Device\\SynapticsTouchDiag"
+#define TCH_DIAG_SYMBOLIC_NAME          L"\\DosDevices\\SynapticsTouchDiag"
+#define TCH_DIAG_MAX_INSTANCES          8
+
+#define IOCTL_TCH_DIAG_GET_LATENCY      \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x900, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_TCH_DIAG_RESET_LATENCY    \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x901, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_TCH_DIAG_GET_COUNTERS     \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x902, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_TCH_DIAG_RESET_COUNTERS   \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x903, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_TCH_DIAG_START_F54_STREAM \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x904, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_TCH_DIAG_STOP_F54_STREAM  \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x905, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_TCH_DIAG_READ_F54_FRAME   \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x906, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_TCH_DIAG_MAP_TAP          \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x907, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_TCH_DIAG_UNMAP_TAP        \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x908, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// Input buffer holds a firmware image, completes once the controller
+// runs the new firmware or the flash failed
+//
+#define IOCTL_TCH_DIAG_FLASH_FIRMWARE   \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x909, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+//
+// Bus transfers whose failures are counted separately
+//
+typedef enum _TCH_SPB_SITE
+{
+	TchSpbSiteInterruptStatus,          // F01 interrupt status read
+	TchSpbSiteTouchData,                // F11/F12 data read
+	TchSpbSiteButtons,                  // F1A data read
+	TchSpbSiteConfiguration,            // reconfiguration after a reset
+	TchSpbSiteCount
+} TCH_SPB_SITE;
+
+#define TCH_COUNTERS_VERSION            3
+
+//
+// Always-on counters, each updated with interlocked operations from
+// whichever path observes the event and cleared by the reset IOCTL
+//
+typedef struct _TCH_RUNTIME_COUNTERS
+{
+	volatile LONG InterruptsServiced;
+	volatile LONG SpuriousInterrupts;
+	volatile LONG SpbErrors[TchSpbSiteCount];
+	volatile LONG CapturedFramesDropped;
+	volatile LONG ReportsGenerated;
+	volatile LONG ReportsDelivered;
+	volatile LONG ReportsDropped;
+	volatile LONG ReportsCoalesced;
+	volatile LONG ReportQueueOverflows;
+	volatile LONG ChipResets;
+	volatile LONG Reconfigurations;
+	volatile LONG InterruptStorms;
+	volatile LONG PalmSuppressions;
+} TCH_RUNTIME_COUNTERS, * PTCH_RUNTIME_COUNTERS;
+
+typedef struct _TCH_COUNTER_STATS
+{
+	ULONG Version;
+	ULONG SpbSiteCount;
+	TCH_RUNTIME_COUNTERS Counters;
+} TCH_COUNTER_STATS, * PTCH_COUNTER_STATS;
+
+#define TchCountEvent(Counters, Field) \
+	InterlockedIncrement(&(Counters)->Field)
+
+//
+// F54 image streaming. One image of the given F54 report type is
+// captured every Decimation frames and queued in a small ring, the
+// oldest image being dropped when the tool falls behind. A read request
+// completes with the oldest queued image or pends until one is
+// captured.
+//
+#define TCH_F54_REPORT_DELTA_IMAGE      2
+#define TCH_F54_REPORT_RAW_IMAGE        3
+
+#define TCH_F54_MAX_IMAGE_SIZE          4096
+#define TCH_F54_RING_FRAMES             4
+
+typedef struct _TCH_F54_STREAM_CONFIG
+{
+	ULONG ReportType;
+	ULONG Decimation;
+} TCH_F54_STREAM_CONFIG, * PTCH_F54_STREAM_CONFIG;
+
+#define TCH_F54_FRAME_VERSION           1
+
+//
+// Followed by DataLength bytes of image, 16-bit little endian values
+// ordered by transmitter then receiver
+//
+typedef struct _TCH_F54_FRAME_HEADER
+{
+	ULONG Version;
+	ULONG ReportType;
+	ULONG Sequence;
+	ULONG Dropped;
+	USHORT Receivers;
+	USHORT Transmitters;
+	ULONG DataLength;
+	ULONG64 Timestamp;
+} TCH_F54_FRAME_HEADER, * PTCH_F54_FRAME_HEADER;
+
+//
+// Raw frame tap. One client at a time maps a ring shared with the
+// driver into its address space, the interrupt routine appends each raw
+// F11/F12 data read and each F54 image to it as a record and signals
+// the client's event, if any. The mapping lasts until the unmap IOCTL or
+// until the handle it was made through is closed.
+//
+// The tap starts with a TCH_TAP_HEADER, records follow at HeaderSize.
+// Positions count the bytes ever appended, the record at position p
+// lives at HeaderSize + p % RingSize. ReservePosition is advanced before
+// a record is written and WritePosition once it is complete. A record
+// never wraps; when fewer bytes than a record header remain before the
+// end of the ring, or a record of source PADDING is found, reading
+// continues at the start of the ring. A reader at position p must check
+// after copying a record that ReservePosition - p did not exceed
+// RingSize, otherwise the record was overwritten while being copied.
+//
+#define TCH_TAP_VERSION                 1
+#define TCH_TAP_SIZE                    (256 * 1024)
+
+#define TCH_TAP_SOURCE_PADDING          0
+#define TCH_TAP_SOURCE_F11              1
+#define TCH_TAP_SOURCE_F12              2
+#define TCH_TAP_SOURCE_F54              3
+
+//
+// Event is a handle to an event of the calling process, or 0
+//
+typedef struct _TCH_TAP_MAP_INPUT
+{
+	ULONG64 Event;
+} TCH_TAP_MAP_INPUT, * PTCH_TAP_MAP_INPUT;
+
+typedef struct _TCH_TAP_MAP_OUTPUT
+{
+	ULONG64 Address;
+	ULONG Size;
+	ULONG Reserved;
+} TCH_TAP_MAP_OUTPUT, * PTCH_TAP_MAP_OUTPUT;
+
+typedef struct _TCH_TAP_HEADER
+{
+	ULONG Version;
+	ULONG HeaderSize;
+	ULONG RingSize;
+	ULONG Reserved;
+	volatile LONG64 ReservePosition;
+	volatile LONG64 WritePosition;
+} TCH_TAP_HEADER, * PTCH_TAP_HEADER;
+
+//
+// Length covers the record header and the data, rounded up to 8 bytes.
+// Timestamp is the interrupt time (100ns units) of the frame the data
+// was read for. F54 records carry a TCH_F54_FRAME_HEADER and the image.
+//
+typedef struct _TCH_TAP_RECORD
+{
+	ULONG Length;
+	USHORT Source;
+	USHORT Reserved;
+	ULONG Sequence;
+	ULONG DataLength;
+	ULONG64 Timestamp;
+} TCH_TAP_RECORD, * PTCH_TAP_RECORD;
+
+//
+// Stages of a touch frame, from the interrupt to the completion of the
+// HIDClass read request carrying its first report
+//
+typedef enum _TCH_LATENCY_STAGE
+{
+	TchLatencyStageInterruptStatus,     // ISR entry to interrupt status read
+	TchLatencyStageDataRead,            // interrupt status to touch data read
+	TchLatencyStageReportBuild,         // touch data read to HID reports built
+	TchLatencyStageCompletion,          // HID reports built to request completed
+	TchLatencyStageEndToEnd,            // ISR entry to request completed
+	TchLatencyStageCount
+} TCH_LATENCY_STAGE;
+
+//
+// Bucket 0 counts samples below 1us, bucket n samples in [2^(n-1), 2^n) us,
+// the last bucket everything above
+//
+#define TCH_LATENCY_HISTOGRAM_BUCKETS   24
+
+#define TCH_LATENCY_STATS_VERSION       1
+
+typedef struct _TCH_LATENCY_STAGE_STATS
+{
+	ULONG64 Count;
+	ULONG64 TotalUs;
+	ULONG MinUs;
+	ULONG MaxUs;
+	ULONG MeanUs;
+	ULONG Histogram[TCH_LATENCY_HISTOGRAM_BUCKETS];
+} TCH_LATENCY_STAGE_STATS, * PTCH_LATENCY_STAGE_STATS;
+
+typedef struct _TCH_LATENCY_STATS
+{
+	ULONG Version;
+	ULONG StageCount;
+	TCH_LATENCY_STAGE_STATS Stages[TchLatencyStageCount];
+} TCH_LATENCY_STATS, * PTCH_LATENCY_STATS;
+
+//
+// Performance counter stamps of the frame being serviced, zero when a
+// stage was not reached
+//
+typedef struct _TCH_LATENCY_STAMPS
+{
+	LONG64 Start;
+	LONG64 InterruptStatus;
+	LONG64 DataRead;
+	LONG64 Ready;
+} TCH_LATENCY_STAMPS, * PTCH_LATENCY_STAMPS;
+
+typedef struct _TCH_LATENCY_CONTEXT
+{
+	BOOLEAN Enabled;
+	LONG64 Frequency;
+
+	//
+	// Stamps of the frame being acquired, owned by the controller lock,
+	// and of the frame being reported, owned by the report lock
+	//
+	TCH_LATENCY_STAMPS Acquire;
+	TCH_LATENCY_STAMPS Build;
+
+	WDFSPINLOCK Lock;
+	TCH_LATENCY_STATS Stats;
+} TCH_LATENCY_CONTEXT, * PTCH_LATENCY_CONTEXT;
+
+__inline
+LONG64
+TchLatencyNow(
+	VOID
+)
+{
+	return KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+VOID
+TchLatencyInitialize(
+	IN PTCH_LATENCY_CONTEXT Latency,
+	IN BOOLEAN Enabled
+);
+
+VOID
+TchLatencyRecordFrame(
+	IN PTCH_LATENCY_CONTEXT Latency,
+	IN PTCH_LATENCY_STAMPS Stamps
+);
+
+VOID
+TchLatencyRecordCompletion(
+	IN PTCH_LATENCY_CONTEXT Latency,
+	IN LONG64 Start,
+	IN LONG64 Ready,
+	IN LONG64 Completed
+);
+
+VOID
+TchLatencyQuery(
+	IN PTCH_LATENCY_CONTEXT Latency,
+	OUT PTCH_LATENCY_STATS Stats
+);
+
+VOID
+TchLatencyReset(
+	IN PTCH_LATENCY_CONTEXT Latency
+);
+
+VOID
+TchCountersQuery(
+	IN PTCH_RUNTIME_COUNTERS Counters,
+	OUT PTCH_COUNTER_STATS Stats
+);
+
+VOID
+TchCountersReset(
+	IN PTCH_RUNTIME_COUNTERS Counters
+);
+
+NTSTATUS
+TchDiagCreateControlDevice(
+	IN WDFDEVICE FxDevice
+);
+
+VOID
+TchDiagDeleteControlDevice(
+	IN WDFDEVICE FxDevice
+);
+
+EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL OnDiagDeviceControl;
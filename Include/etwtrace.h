@@ -0,0 +1,67 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		etwtrace.h
+
+	Abstract:
+
+		TraceLogging provider used for structured events on the interrupt
+		and reporting paths. Events are only formatted when a session has
+		enabled the matching level and keyword, otherwise each site costs
+		a single enable check. Init-time messages keep using Trace.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+
+TRACELOGGING_DECLARE_PROVIDER(TchTraceProvider);
+
+//
+// Sessions enable the provider by name or by its GUID,
+// {5E4C1C7B-0A5D-4C86-9F0B-3D2E6B8A41F2}
+//
+#define TCH_TRACE_PROVIDER_NAME "Synaptics.RMI4.Touch"
+
+//
+// Keywords
+//
+#define TCH_TRACE_KEYWORD_FRAME         0x0000000000000001ull
+#define TCH_TRACE_KEYWORD_REPORTING     0x0000000000000002ull
+#define TCH_TRACE_KEYWORD_INTERRUPT     0x0000000000000004ull
+
+#define TchTraceEnabled(Level, Keyword) \
+	TraceLoggingProviderEnabled(TchTraceProvider, (Level), (Keyword))
+
+#define TchTraceFramesEnabled() \
+	TchTraceEnabled(WINEVENT_LEVEL_VERBOSE, TCH_TRACE_KEYWORD_FRAME)
+
+__inline
+ULONG
+TchTraceTicksToUs(
+	IN LONG64 Frequency,
+	IN LONG64 From,
+	IN LONG64 To
+)
+{
+	if (From == 0 || To < From || Frequency == 0)
+	{
+		return 0;
+	}
+
+	return (ULONG)min(
+		(ULONG64)(To - From) * 1000000ull / (ULONG64)Frequency,
+		(ULONG64)MAXULONG);
+}
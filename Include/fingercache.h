@@ -0,0 +1,73 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		fingercache.h
+
+	Abstract:
+
+		Finger tracking shared by the 2D sensor functions
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include "rmiinternal.h"
+
+#pragma once
+
+//
+// Alpha-beta gains of the contact tracks in 1/256 units. Beta follows
+// the usual alpha^2 / (2 - alpha) choice for alpha = 1/2
+//
+#define RMI4_TRACK_ALPHA                128
+#define RMI4_TRACK_BETA                 43
+
+//
+// A track older than this (scan time units) restarts from rest
+//
+#define RMI4_TRACK_MAX_GAP              500
+
+//
+// Largest distance a position is extrapolated, in controller units
+//
+#define RMI4_PREDICTION_MAX_OFFSET      128
+
+VOID
+RmiUpdateFingerCache(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN ULONG PresentMask,
+	IN RMI4_FINGER_INFO* Reported
+);
+
+BOOLEAN
+RmiFingerCacheHasChanged(
+	IN RMI4_FINGER_CACHE* Cache,
+	IN ULONG Deadband,
+	IN ULONG64 KeepAliveInterval
+);
+
+VOID
+RmiFingerCacheMarkReported(
+	IN RMI4_FINGER_CACHE* Cache
+);
+
+VOID
+RmiFingerCachePredict(
+	IN RMI4_FINGER_CACHE* Cache,
+	IN int Slot,
+	IN ULONG64 Horizon,
+	IN OUT int* X,
+	IN OUT int* Y
+);
+
+VOID
+RmiResetFingerCache(
+	IN RMI4_FINGER_CACHE* Cache
+);
@@ -27,6 +27,12 @@
 
 #define SYNAPTICS_TOUCH_DIGITIZER_FINGER_REPORT_COUNT 2
 
+//
+// Contacts per report in the wide format, every contact the controller
+// tracks (RMI4_MAX_TOUCHES) fits a single report
+//
+#define SYNAPTICS_TOUCH_DIGITIZER_WIDE_FINGER_REPORT_COUNT 10
+
 #define SYNAPTICS_TOUCH_DIGITIZER_FINGER_COLLECTION \
         BEGIN_COLLECTION, 0x02,                 /*   COLLECTION (Logical) */ \
             LOGICAL_MAXIMUM, 0x01,                  /*     LOGICAL_MAXIMUM (1) */ \
@@ -65,15 +71,12 @@
 		    UNIT, 0x00,                             /* Unit: None */ \
         END_COLLECTION
 
-#define SYNAPTICS_TOUCH_DIGITIZER_COLLECTION \
-		USAGE_PAGE, 0x0d,                       /*  USAGE_PAGE (Digitizers) */ \
-		USAGE, 0x04,                            /*  USAGE (Touch Screen) */ \
-		BEGIN_COLLECTION, 0x01,                 /*  COLLECTION (Application) */ \
-			REPORT_ID, REPORTID_MTOUCH,                      /*    REPORT_ID (Touch) */ \
-			SYNAPTICS_TOUCH_DIGITIZER_FINGER_COLLECTION,     /*    Finger 1 */ \
-			USAGE_PAGE, 0x0d,                                /*    USAGE_PAGE (Digitizers) */ \
-			SYNAPTICS_TOUCH_DIGITIZER_FINGER_COLLECTION,     /*    Finger 2 */ \
-			USAGE_PAGE, 0x0d,                                /*    USAGE_PAGE (Digitizers) */ \
+//
+// Contact count, scan time and the maximum count feature, shared by both
+// touch report formats. Maximum count is the number of contacts the
+// device tracks, not the number of contacts per report.
+//
+#define SYNAPTICS_TOUCH_DIGITIZER_COMMON_USAGES \
 			USAGE, 0x54,                                     /*    USAGE (Actual count) */ \
 			REPORT_COUNT, 0x01,                              /*    REPORT_COUNT (1) */ \
 			REPORT_SIZE, 0x08,                               /*    REPORT_SIZE (8) */ \
@@ -88,8 +91,47 @@
 			INPUT, 0x02,                                     /*      INPUT (Data,Var,Abs) */ \
 			REPORT_ID, REPORTID_MAX_COUNT,                   /*    REPORT_ID (Feature) */ \
 			USAGE, 0x55,                                     /*    USAGE(Maximum Count) */ \
-			LOGICAL_MAXIMUM, 0x02,                           /*    LOGICAL_MAXIMUM (2) */ \
-			FEATURE, 0x02,                                   /*    FEATURE (Data,Var,Abs) */ \
+			LOGICAL_MAXIMUM, 0x0a,                           /*    LOGICAL_MAXIMUM (10) */ \
+			FEATURE, 0x02,                                   /*    FEATURE (Data,Var,Abs) */
+
+#define SYNAPTICS_TOUCH_DIGITIZER_COLLECTION \
+		USAGE_PAGE, 0x0d,                       /*  USAGE_PAGE (Digitizers) */ \
+		USAGE, 0x04,                            /*  USAGE (Touch Screen) */ \
+		BEGIN_COLLECTION, 0x01,                 /*  COLLECTION (Application) */ \
+			REPORT_ID, REPORTID_MTOUCH,                      /*    REPORT_ID (Touch) */ \
+			SYNAPTICS_TOUCH_DIGITIZER_FINGER_COLLECTION,     /*    Finger 1 */ \
+			USAGE_PAGE, 0x0d,                                /*    USAGE_PAGE (Digitizers) */ \
+			SYNAPTICS_TOUCH_DIGITIZER_FINGER_COLLECTION,     /*    Finger 2 */ \
+			USAGE_PAGE, 0x0d,                                /*    USAGE_PAGE (Digitizers) */ \
+			SYNAPTICS_TOUCH_DIGITIZER_COMMON_USAGES \
+		END_COLLECTION
+
+#define SYNAPTICS_TOUCH_DIGITIZER_WIDE_COLLECTION \
+		USAGE_PAGE, 0x0d,                       /*  USAGE_PAGE (Digitizers) */ \
+		USAGE, 0x04,                            /*  USAGE (Touch Screen) */ \
+		BEGIN_COLLECTION, 0x01,                 /*  COLLECTION (Application) */ \
+			REPORT_ID, REPORTID_MTOUCH,                      /*    REPORT_ID (Touch) */ \
+			SYNAPTICS_TOUCH_DIGITIZER_FINGER_COLLECTION,     /*    Finger 1 */ \
+			USAGE_PAGE, 0x0d,                                /*    USAGE_PAGE (Digitizers) */ \
+			SYNAPTICS_TOUCH_DIGITIZER_FINGER_COLLECTION,     /*    Finger 2 */ \
+			USAGE_PAGE, 0x0d,                                /*    USAGE_PAGE (Digitizers) */ \
+			SYNAPTICS_TOUCH_DIGITIZER_FINGER_COLLECTION,     /*    Finger 3 */ \
+			USAGE_PAGE, 0x0d,                                /*    USAGE_PAGE (Digitizers) */ \
+			SYNAPTICS_TOUCH_DIGITIZER_FINGER_COLLECTION,     /*    Finger 4 */ \
+			USAGE_PAGE, 0x0d,                                /*    USAGE_PAGE (Digitizers) */ \
+			SYNAPTICS_TOUCH_DIGITIZER_FINGER_COLLECTION,     /*    Finger 5 */ \
+			USAGE_PAGE, 0x0d,                                /*    USAGE_PAGE (Digitizers) */ \
+			SYNAPTICS_TOUCH_DIGITIZER_FINGER_COLLECTION,     /*    Finger 6 */ \
+			USAGE_PAGE, 0x0d,                                /*    USAGE_PAGE (Digitizers) */ \
+			SYNAPTICS_TOUCH_DIGITIZER_FINGER_COLLECTION,     /*    Finger 7 */ \
+			USAGE_PAGE, 0x0d,                                /*    USAGE_PAGE (Digitizers) */ \
+			SYNAPTICS_TOUCH_DIGITIZER_FINGER_COLLECTION,     /*    Finger 8 */ \
+			USAGE_PAGE, 0x0d,                                /*    USAGE_PAGE (Digitizers) */ \
+			SYNAPTICS_TOUCH_DIGITIZER_FINGER_COLLECTION,     /*    Finger 9 */ \
+			USAGE_PAGE, 0x0d,                                /*    USAGE_PAGE (Digitizers) */ \
+			SYNAPTICS_TOUCH_DIGITIZER_FINGER_COLLECTION,     /*    Finger 10 */ \
+			USAGE_PAGE, 0x0d,                                /*    USAGE_PAGE (Digitizers) */ \
+			SYNAPTICS_TOUCH_DIGITIZER_COMMON_USAGES \
 		END_COLLECTION
 
 #define SYNAPTICS_KEYPAD_DIGITIZER_COLLECTION \
@@ -30,8 +30,9 @@ typedef struct _IDLE_WORKITEM_CONTEXT
 	// Handle to a WDF device object
 	WDFDEVICE FxDevice;
 
-	// Handle to a WDF request object
-	WDFREQUEST FxRequest;
+	// Idle notification request being handled, NULL while the work
+	// item is free
+	WDFREQUEST volatile FxRequest;
 
 } IDLE_WORKITEM_CONTEXT, * PIDLE_WORKITEM_CONTEXT;
 
@@ -47,6 +47,12 @@ typedef struct _DEVICE_EXTENSION
 	WDFINTERRUPT InterruptObject;
 	BOOLEAN ServiceInterruptsAfterD0Entry;
 
+	//
+	// Builds and completes HID reports from captured frames when
+	// pipelined reporting is enabled
+	//
+	WDFWORKITEM ReportWorkItem;
+
 	//
 	// Spb (I2C) related members used for the lifetime of the device
 	//
@@ -56,6 +62,8 @@ typedef struct _DEVICE_EXTENSION
 	// Test related
 	//
 	WDFQUEUE TestQueue;
+	WDFQUEUE TestReadQueue;
+	WDFDEVICE DiagDevice;
 	volatile LONG TestSessionRefCnt;
 	BOOLEAN DiagnosticMode;
 
@@ -64,6 +72,12 @@ typedef struct _DEVICE_EXTENSION
 	//
 	WDFQUEUE IdleQueue;
 
+	//
+	// Issues the HIDClass idle callback when the idle notification
+	// request cannot be handled inline, created once in OnDeviceAdd
+	//
+	WDFWORKITEM IdleWorkItem;
+
 	//
 	// Touch related members used for the lifetime of the device
 	//
@@ -75,6 +89,5 @@ WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_EXTENSION, GetDeviceContext)
 void
 SendHidReports(
     WDFQUEUE PingPongQueue,
-    PHID_INPUT_REPORT hidReportsFromDriver,
-    int hidReportsCount
+    PHID_REPORT_QUEUE ReportQueue
 );
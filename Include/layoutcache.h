@@ -0,0 +1,82 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		layoutcache.h
+
+	Abstract:
+
+		Persistent cache of the controller's register layout (page
+		description table and F12 register descriptors), so that
+		later starts can skip probing the chip register by register
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include "rmiinternal.h"
+
+#pragma once
+
+#define RMI4_LAYOUT_CACHE_VALUE_NAME      L"RmiLayoutCache"
+#define RMI4_LAYOUT_CACHE_VERSION         1
+
+//
+// The F01 query registers read on every start identify the chip and
+// its firmware, the cache is only used while they match
+//
+#define RMI4_LAYOUT_CACHE_QUERY_BYTES     \
+	FIELD_OFFSET(RMI4_F01_QUERY_REGISTERS, ProductID10)
+
+#define RMI4_LAYOUT_CACHE_REGISTER_DESCRIPTORS 3
+
+typedef struct _RMI4_LAYOUT_CACHE_DESCRIPTOR
+{
+	ULONG StructSize;
+	ULONG PresenceMap[BITS_TO_LONGS(RMI_REG_DESC_PRESENSE_BITS)];
+	ULONG NumRegisters;
+} RMI4_LAYOUT_CACHE_DESCRIPTOR;
+
+//
+// Registry value layout. The register items of the query, control and
+// data descriptors follow the header back to back, when present.
+//
+typedef struct _RMI4_LAYOUT_CACHE
+{
+	ULONG Version;
+	ULONG Size;
+	BYTE F01Query[RMI4_LAYOUT_CACHE_QUERY_BYTES];
+	int FunctionCount;
+	RMI4_FUNCTION_DESCRIPTOR Descriptors[RMI4_MAX_FUNCTIONS];
+	int FunctionOnPage[RMI4_MAX_FUNCTIONS];
+	ULONG RegisterDescriptorCount;
+	RMI4_LAYOUT_CACHE_DESCRIPTOR RegisterDescriptors[RMI4_LAYOUT_CACHE_REGISTER_DESCRIPTORS];
+	RMI_REGISTER_DESC_ITEM Items[ANYSIZE_ARRAY];
+} RMI4_LAYOUT_CACHE;
+
+#define RMI4_LAYOUT_CACHE_HEADER_SIZE     FIELD_OFFSET(RMI4_LAYOUT_CACHE, Items)
+#define RMI4_LAYOUT_CACHE_MAX_SIZE        (RMI4_LAYOUT_CACHE_HEADER_SIZE + \
+	RMI4_LAYOUT_CACHE_REGISTER_DESCRIPTORS * RMI_REG_DESC_PRESENSE_BITS * \
+	sizeof(RMI_REGISTER_DESC_ITEM))
+
+NTSTATUS
+RmiLoadLayoutCache(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+VOID
+RmiSaveLayoutCache(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+RmiDeleteLayoutCache(
+	VOID
+);
@@ -0,0 +1,91 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		regshadow.h
+
+	Abstract:
+
+		Write-combining shadow of a function's control register block.
+		Configuration updates the shadow, only bytes that change are
+		marked dirty and flushed in as few SPB writes as possible, and
+		later reads of shadowed registers are answered without bus
+		access.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <wdf.h>
+#include "spbhelper.h"
+
+#define RMI4_SHADOW_MAX_LENGTH      64
+
+//
+// Clean bytes between two dirty ranges are rewritten rather than
+// starting another transaction while the gap is at most this long
+//
+#define RMI4_SHADOW_MERGE_GAP       4
+
+typedef struct _RMI4_REGISTER_SHADOW
+{
+	int Page;
+	BYTE Base;
+	BYTE Length;
+
+	//
+	// One bit per register byte: contents known, and written to the
+	// shadow but not to the controller yet
+	//
+	ULONG64 Valid;
+	ULONG64 Dirty;
+
+	BYTE Data[RMI4_SHADOW_MAX_LENGTH];
+} RMI4_REGISTER_SHADOW;
+
+VOID
+RmiShadowInitialize(
+	IN RMI4_REGISTER_SHADOW* Shadow,
+	IN int Page,
+	IN BYTE Base,
+	IN ULONG Length
+);
+
+VOID
+RmiShadowInvalidate(
+	IN RMI4_REGISTER_SHADOW* Shadow
+);
+
+NTSTATUS
+RmiShadowRead(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN RMI4_REGISTER_SHADOW* Shadow,
+	IN ULONG Offset,
+	OUT PVOID Data,
+	IN ULONG Length
+);
+
+VOID
+RmiShadowWrite(
+	IN RMI4_REGISTER_SHADOW* Shadow,
+	IN ULONG Offset,
+	IN PVOID Data,
+	IN ULONG Length
+);
+
+NTSTATUS
+RmiShadowFlush(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN RMI4_REGISTER_SHADOW* Shadow
+);
@@ -21,6 +21,43 @@
 
 #pragma once
 
+//
+// Fixed point precision of the precomputed coordinate transform
+//
+#define TOUCH_TRANSFORM_SHIFT 16
+
+//
+// One axis of the controller to display mapping, folded from the screen
+// properties: optional inversion, then Out = (In * Scale - Offset) >> 16
+// clamped to [0, Max]
+//
+typedef struct _TOUCH_AXIS_TRANSFORM
+{
+	BOOLEAN Invert;
+	ULONG InvertLimit;
+	LONG64 Scale;
+	LONG64 Offset;
+	ULONG Max;
+
+	//
+	// Scale and offset split at the fixed point, for the vector paths
+	// working on 16 bit lanes. Only valid if Vector is set, which
+	// requires every partial result to fit 32 bit lanes.
+	//
+	BOOLEAN Vector;
+	USHORT ScaleLow;
+	USHORT ScaleHigh;
+	USHORT OffsetLow;
+	LONG OffsetHigh;
+} TOUCH_AXIS_TRANSFORM, * PTOUCH_AXIS_TRANSFORM;
+
+typedef struct _TOUCH_COORDINATE_TRANSFORM
+{
+	BOOLEAN SwapAxes;
+	TOUCH_AXIS_TRANSFORM X;
+	TOUCH_AXIS_TRANSFORM Y;
+} TOUCH_COORDINATE_TRANSFORM, * PTOUCH_COORDINATE_TRANSFORM;
+
 typedef struct _TOUCH_SCREEN_PROPERTIES
 {
 	ULONG TouchSwapAxes;
@@ -46,16 +83,36 @@ typedef struct _TOUCH_SCREEN_PROPERTIES
 	ULONG DisplayAdjustedHeight;
 	ULONG DisplayViewableWidth;
 	ULONG DisplayViewableHeight;
+
+	//
+	// Derived from the values above by TchGetScreenProperties
+	//
+	TOUCH_COORDINATE_TRANSFORM Transform;
 } TOUCH_SCREEN_PROPERTIES, * PTOUCH_SCREEN_PROPERTIES;
 
-VOID
-TchGetScreenProperties(
+PRTL_QUERY_REGISTRY_TABLE
+TchCreateScreenPropertiesQuery(
 	IN PTOUCH_SCREEN_PROPERTIES Props
 );
 
+NTSTATUS
+TchGetScreenProperties(
+	IN PRTL_QUERY_REGISTRY_TABLE QueryTable,
+	OUT PTOUCH_SCREEN_PROPERTIES Props,
+	IN PTOUCH_SCREEN_PROPERTIES Started OPTIONAL
+);
+
 VOID
 TchTranslateToDisplayCoordinates(
 	IN PUSHORT X,
 	IN PUSHORT Y,
 	IN PTOUCH_SCREEN_PROPERTIES Props
 );
+
+VOID
+TchTranslateToDisplayCoordinatesBatch(
+	IN OUT PUSHORT X,
+	IN OUT PUSHORT Y,
+	IN ULONG Count,
+	IN PTOUCH_SCREEN_PROPERTIES Props
+);
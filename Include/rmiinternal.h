@@ -31,6 +31,15 @@
 #include "F11.h"
 #include "F12.h"
 #include "F1A.h"
+#include "F34.h"
+#include "F54.h"
+#include "regshadow.h"
+#include "activity.h"
+#include "storm.h"
+#include "Function34.h"
+#include "Function54.h"
+#include "tap.h"
+#include "settings.h"
 
 //
 // Defines from Synaptics RMI4 Data Sheet, please refer to
@@ -48,6 +57,12 @@
 
 #define RMI4_MAX_BUTTONS                  3
 
+//
+// Largest gap of unused registers tolerated between the F01 interrupt
+// status and the F12 data packet before a coalesced read is abandoned
+//
+#define RMI4_MAX_BURST_READ_GAP           16
+
 #define LOGICAL_TO_PHYSICAL(LOGICAL_VALUE) ((LOGICAL_VALUE) & 0xff)
 
 typedef struct _RMI4_FUNCTION_DESCRIPTOR
@@ -70,6 +85,122 @@ typedef struct _RMI4_FUNCTION_DESCRIPTOR
 	BYTE Number;
 } RMI4_FUNCTION_DESCRIPTOR;
 
+//
+// Functions the driver resolves once the function table has been built,
+// used to index RMI4_CONTROLLER_CONTEXT::Functions
+//
+typedef enum _RMI4_FUNCTION_SLOT
+{
+	RMI4_FUNCTION_SLOT_F01 = 0,
+	RMI4_FUNCTION_SLOT_F11,
+	RMI4_FUNCTION_SLOT_F12,
+	RMI4_FUNCTION_SLOT_F1A,
+	RMI4_FUNCTION_SLOT_F34,
+	RMI4_FUNCTION_SLOT_F54,
+	RMI4_FUNCTION_SLOT_COUNT
+} RMI4_FUNCTION_SLOT;
+
+typedef struct _RMI4_RESOLVED_FUNCTION
+{
+	BOOLEAN Present;
+	int Index;
+	int Page;
+	BYTE QueryBase;
+	BYTE CommandBase;
+	BYTE ControlBase;
+	BYTE DataBase;
+	ULONG IrqMask;
+} RMI4_RESOLVED_FUNCTION;
+
+//
+// Interrupt sources visible through the F01 interrupt status register
+// read on each interrupt
+//
+#define RMI4_MAX_INTERRUPT_SOURCES        8
+
+struct _RMI4_CONTROLLER_CONTEXT;
+
+typedef NTSTATUS
+(*PRMI4_INTERRUPT_HANDLER)(
+	IN struct _RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR InputMode,
+	IN ULONG IrqMask
+);
+
+//
+// Functions servicing interrupts: the touch function, F$11 or F$12, and
+// the F$1A buttons
+//
+#define RMI4_INTERRUPT_HANDLER_COUNT      2
+
+typedef struct _RMI4_INTERRUPT_DISPATCH
+{
+	PRMI4_INTERRUPT_HANDLER Handler;
+	ULONG IrqMask;
+	int Slot;
+} RMI4_INTERRUPT_DISPATCH;
+
+//
+// Digitizer function operations, selected once when the functions are
+// configured so the reporting path does not test the function type or
+// its geometry on every frame
+//
+typedef struct _RMI4_DIGITIZER_OPS
+{
+	//
+	// Programs the function control registers and works out the packet
+	// geometry used by the other operations
+	//
+	NTSTATUS
+	(*Configure)(
+		IN struct _RMI4_CONTROLLER_CONTEXT* ControllerContext,
+		IN SPB_CONTEXT* SpbContext
+	);
+
+	//
+	// Reads the touch data of the current interrupt and updates the
+	// finger cache from it
+	//
+	NTSTATUS
+	(*GetTouches)(
+		IN struct _RMI4_CONTROLLER_CONTEXT* ControllerContext,
+		IN SPB_CONTEXT* SpbContext
+	);
+
+	//
+	// Updates the finger cache from a packet captured earlier, NULL if
+	// the function cannot be captured raw
+	//
+	VOID
+	(*ParsePacket)(
+		IN struct _RMI4_CONTROLLER_CONTEXT* ControllerContext,
+		IN BYTE* Packet
+	);
+
+	//
+	// Switches reporting for the idle state, NULL if the function has
+	// no reduced reporting mode
+	//
+	NTSTATUS
+	(*SetIdleReporting)(
+		IN struct _RMI4_CONTROLLER_CONTEXT* ControllerContext,
+		IN SPB_CONTEXT* SpbContext,
+		IN BOOLEAN Idle
+	);
+
+	//
+	// Arms or disarms wakeup gesture detection for standby, NULL if the
+	// function has no wakeup gesture mode
+	//
+	NTSTATUS
+	(*SetWakeGesture)(
+		IN struct _RMI4_CONTROLLER_CONTEXT* ControllerContext,
+		IN SPB_CONTEXT* SpbContext,
+		IN BOOLEAN Enable
+	);
+} RMI4_DIGITIZER_OPS;
+
 #define RMI4_MILLISECONDS_TO_TENTH_MILLISECONDS(n) n/10
 #define RMI4_SECONDS_TO_HALF_SECONDS(n) 2*n
 
@@ -88,36 +219,255 @@ typedef struct _RMI4_CONFIGURATION
 	RMI4_F01_CTRL_REGISTERS_LOGICAL DeviceSettings;
 	RMI4_F11_CTRL_REGISTERS_LOGICAL TouchSettings;
 	UINT32 PepRemovesVoltageInD3;
+	UINT32 F11SpeculativeReadSlots;
+	UINT32 PipelinedReporting;
+	UINT32 WideTouchReports;
+	UINT32 BatchedReadCompletion;
+	UINT32 ContactDeadband;
+	UINT32 ContactKeepAliveInterval;
+	UINT32 LatencyInstrumentation;
+	UINT32 IdleTimeout;
+	UINT32 IdleDozeInterval;
+	UINT32 IdleReducedReporting;
+	UINT32 StormWindow;
+	UINT32 StormInterruptLimit;
+	UINT32 StormSpuriousLimit;
+	UINT32 StormRecoveryDelay;
+	UINT32 PredictionHorizon;
+	UINT32 WakeGestureStandby;
+	UINT32 PalmSuppression;
 } RMI4_CONFIGURATION;
 
+//
+// Controller coordinates are 16 bit
+//
 typedef struct _RMI4_FINGER_INFO
 {
-	int x;
-	int y;
+	USHORT x;
+	USHORT y;
 	UCHAR fingerStatus;
 } RMI4_FINGER_INFO;
 
+//
+// Alpha-beta track of a contact, positions in 1/256 controller units and
+// velocities in 1/256 controller units per scan time unit (100us)
+//
+typedef struct _RMI4_CONTACT_TRACK
+{
+	LONG64 X;
+	LONG64 Y;
+	LONG64 VelocityX;
+	LONG64 VelocityY;
+	ULONG64 Time;
+	ULONG Samples;
+} RMI4_CONTACT_TRACK;
+
+//
+// Contact last queued to HID with the tip switch set, identified by its
+// finger cache sequence, and the display position it was reported at
+//
+typedef struct _RMI4_REPORTED_CONTACT
+{
+	ULONG Sequence;
+	USHORT X;
+	USHORT Y;
+} RMI4_REPORTED_CONTACT;
+
 typedef struct _RMI4_FINGER_CACHE
 {
 	RMI4_FINGER_INFO FingerSlot[RMI4_MAX_TOUCHES];
 	UINT32 FingerSlotValid;
 	UINT32 FingerSlotDirty;
-	int FingerDownOrder[RMI4_MAX_TOUCHES];
+	ULONG FingerSequence[RMI4_MAX_TOUCHES];
+	ULONG NextSequence;
+	UCHAR FingerDownOrder[RMI4_MAX_TOUCHES];
 	int FingerDownCount;
+
+	//
+	// Time of the interrupt the contacts were read for, in 100us units
+	// for the HID scan time and as performance counter
+	//
 	ULONG64 ScanTime;
-    BOOLEAN IsKey[RMI4_MAX_TOUCHES];
+	ULONG64 ScanPerformanceCounter;
+
+	//
+	// Bit set per FingerDownOrder entry that landed on a button area
+	//
+	ULONG IsKeyMask;
+
+	//
+	// State of the contacts as last reported to HID, used to skip frames
+	// where nothing moved beyond the deadband
+	//
+	ULONG ReportedMask;
+	RMI4_FINGER_INFO ReportedSlot[RMI4_MAX_TOUCHES];
+	ULONG64 ReportedScanTime;
+
+	//
+	// Per slot motion tracks used to extrapolate reported positions,
+	// only maintained while prediction is enabled
+	//
+	RMI4_CONTACT_TRACK Track[RMI4_MAX_TOUCHES];
 } RMI4_FINGER_CACHE;
 
+typedef enum _RMI4_BUTTON_STATE
+{
+	RMI4_BUTTON_STATE_UP = 0,
+	RMI4_BUTTON_STATE_DOWN,
+	RMI4_BUTTON_STATE_LONG_PRESS
+} RMI4_BUTTON_STATE;
+
+//
+// Per button state machine. Reports are only generated on press and
+// release edges; the buttons timer is only armed while a button with a
+// long press action is down.
+//
 typedef struct _RMI4_BUTTONS_CACHE
 {
-    BOOLEAN prevPhysicalState[RMI4_MAX_BUTTONS];
-    BOOLEAN PhysicalState[RMI4_MAX_BUTTONS];
-    BOOLEAN LogicalState[RMI4_MAX_BUTTONS];
+    ULONG PhysicalMask;
+    RMI4_BUTTON_STATE State[RMI4_MAX_BUTTONS];
+    ULONG64 PressTime[RMI4_MAX_BUTTONS];
+    BOOLEAN TimerArmed;
 } RMI4_BUTTONS_CACHE;
 
+//
+// Virtual button regions below the display, converted to raw controller
+// coordinates once at start. Regions share a band on the axis running
+// across the button strip and are sorted along the other one.
+//
+#define RMI4_MAX_BUTTON_REGIONS           8
+
+typedef struct _RMI4_BUTTON_REGION
+{
+	ULONG LookupMin;
+	ULONG LookupMax;
+	ULONG BandMin;
+	ULONG BandMax;
+	ULONG Button;
+} RMI4_BUTTON_REGION;
+
+typedef struct _RMI4_BUTTON_LAYOUT
+{
+	BOOLEAN BandIsX;
+	ULONG BandMin;
+	ULONG BandMax;
+	ULONG Count;
+	RMI4_BUTTON_REGION Regions[RMI4_MAX_BUTTON_REGIONS];
+} RMI4_BUTTON_LAYOUT;
+
+//
+// Settings as loaded from the registry, before they are put in use. The
+// query tables are built once and read straight into the snapshot.
+//
+typedef struct _RMI4_SETTINGS_SNAPSHOT
+{
+	TOUCH_SCREEN_PROPERTIES Props;
+	RMI4_CONFIGURATION Config;
+	RMI4_BUTTON_LAYOUT ButtonLayout;
+	PRTL_QUERY_REGISTRY_TABLE PropsQuery;
+	PRTL_QUERY_REGISTRY_TABLE ConfigQuery;
+} RMI4_SETTINGS_SNAPSHOT;
+
+//
+// Raw frames acquired by the interrupt service routine when pipelined
+// reporting is enabled, parsed and reported later by a work item. The
+// depth must be a power of two.
+//
+#define RMI4_PIPELINE_DEPTH               8
+#define RMI4_PIPELINE_FRAME_DATA_SIZE     128
+
+typedef struct _RMI4_RAW_FRAME
+{
+	ULONG InterruptStatus;
+	TCH_SCAN_TIMESTAMP Timestamp;
+	TCH_LATENCY_STAMPS Latency;
+	RMI4_F1A_DATA_REGISTERS ButtonData;
+	BYTE F12Packet[RMI4_PIPELINE_FRAME_DATA_SIZE];
+} RMI4_RAW_FRAME;
+
 typedef struct _RMI4_CONTROLLER_CONTEXT
 {
+	//
+	// Per-frame state, read or written on every interrupt. It is kept
+	// together at the start of the context, cache line aligned, so a
+	// frame touches as few lines as possible. Fields only used during
+	// configuration belong further down.
+	//
+	DECLSPEC_CACHEALIGN ULONG InterruptStatus;
+
+	//
+	// Register page currently selected on the controller, -1 if unknown
+	//
+	int CurrentPage;
+
+	//
+	// Time the interrupt being serviced was taken
+	//
+	TCH_SCAN_TIMESTAMP Timestamp;
+
+	//
+	// Digitizer operations and packet geometry, see RmiConfigureFunctions
+	//
+	CONST RMI4_DIGITIZER_OPS* DigitizerOps;
+	size_t PacketSize;
+	USHORT Data1Offset;
+	BYTE MaxFingers;
+	BOOLEAN HasButtons;
+	BOOLEAN PipelineEnabled;
+
+	//
+	// Contacts are withheld from a palm until the sensor is clear
+	//
+	BOOLEAN PalmSuppressionEnabled;
+	BOOLEAN PalmSuppressed;
+
+	//
+	// Coalesced F01 interrupt status + F12 data read window, planned
+	// at configuration time when both live on the same page
+	//
+	BOOLEAN BurstReadEnabled;
+	BOOLEAN BurstF12DataValid;
+	BYTE BurstReadAddress;
+	USHORT BurstReadLength;
+	USHORT BurstF01Offset;
+	USHORT BurstF12Offset;
+	WDFMEMORY BurstReadMemory;
+
+	//
+	// Preallocated buffers the F11/F12 data registers are read into
+	// and parsed from in place
+	//
+	WDFMEMORY F12PacketMemory;
+	WDFMEMORY F11DataMemory;
+
+	ULONG InterruptServicedMask;
+
+	//
+	// Functions with a handler in the order a frame services them,
+	// grouped by register page starting with the page the interrupt
+	// status is read from
+	//
+	ULONG ServiceOrderCount;
+	RMI4_INTERRUPT_DISPATCH ServiceOrder[RMI4_INTERRUPT_HANDLER_COUNT];
+
+	//
+	// Current touch state, starts a cache line of its own
+	//
+	DECLSPEC_CACHEALIGN RMI4_FINGER_CACHE FingerCache;
+
 	WDFDEVICE FxDevice;
+
+	//
+	// Lock hierarchy, all per controller instance, taken in this order:
+	//
+	//  ControllerLock  - controller registers and every SPB transfer
+	//  ReportLock      - finger and button caches, report queue producer
+	//  ConsumerLock    - report queue consumer side (spin lock)
+	//  Latency.Lock, F54Stream.RingLock - leaf spin locks
+	//
+	// The settings watch lock only guards arming its notifications and
+	// is never held together with the locks above.
+	//
 	WDFWAITLOCK ControllerLock;
 
 	//
@@ -126,21 +476,33 @@ typedef struct _RMI4_CONTROLLER_CONTEXT
 	int FunctionCount;
 	RMI4_FUNCTION_DESCRIPTOR Descriptors[RMI4_MAX_FUNCTIONS];
 	int FunctionOnPage[RMI4_MAX_FUNCTIONS];
-	int CurrentPage;
-
-	ULONG InterruptStatus;
+	RMI4_RESOLVED_FUNCTION Functions[RMI4_FUNCTION_SLOT_COUNT];
 
-	BOOLEAN HasButtons;
 	BOOLEAN ResetOccurred;
 	BOOLEAN InvalidConfiguration;
 	BOOLEAN DeviceFailure;
 	BOOLEAN UnknownStatus;
 	BOOLEAN IsF12Digitizer;
 
+	//
+	// Set while standby left the controller dozing in wakeup gesture
+	// mode instead of asleep
+	//
+	BOOLEAN WakeGestureArmed;
+
 	BYTE UnknownStatusMessage;
 
 	RMI4_F01_QUERY_REGISTERS F01QueryRegisters;
 
+	//
+	// Shadows of the control registers programmed by the driver, reset
+	// whenever the functions are (re)configured
+	//
+	RMI4_REGISTER_SHADOW F01ControlShadow;
+	RMI4_REGISTER_SHADOW F11ControlShadow;
+	RMI4_REGISTER_SHADOW F12ReportingShadow;
+	RMI4_REGISTER_SHADOW F12ObjectReportShadow;
+
 	//
 	// Power state
 	//
@@ -152,50 +514,113 @@ typedef struct _RMI4_CONTROLLER_CONTEXT
 	TOUCH_SCREEN_PROPERTIES Props;
 	RMI4_CONFIGURATION Config;
 
-	//
-	// Current touch state
-	//
-	RMI4_FINGER_CACHE FingerCache;
-
 	//
 	// Backlight keys
 	//
 	BKL_CONTEXT* BklContext;
 
 	//
-	// RMI4 F12 state
+	// F12 register descriptors. They own the pool allocations their
+	// Registers point to and are looked up again after configuration
+	// (reporting mode changes, layout cache), so they live as long as
+	// the context and are released by RmiFreeRegisterDescriptors.
 	//
-
-	/*
-		!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-	
-		DO NOT remove these. Even if the variables are not
-		used by any function down the line, these have an effect
-		on memory allocation. If you remove these and make them
-		local to a function, you will BREAK F12 and register
-		readings.
-
-		!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-	*/
-
 	RMI_REGISTER_DESCRIPTOR QueryRegDesc;
 	RMI_REGISTER_DESCRIPTOR ControlRegDesc;
 	RMI_REGISTER_DESCRIPTOR DataRegDesc;
-	size_t PacketSize;
+	BOOLEAN RegisterDescriptorsValid;
+	size_t F12PacketMemorySize;
 
-	USHORT Data1Offset;
-	BYTE MaxFingers;
+	//
+	// F11 speculative read statistics
+	//
+	ULONG F11SpeculativeReads;
+	ULONG F11SpeculativeMisses;
+
+	//
+	// Pipelined reporting. The interrupt service routine only produces
+	// raw frames (FrameHead) under ControllerLock, the report work item
+	// consumes them (FrameTail). The finger cache, button cache and the
+	// producer side of the HID report queue are always guarded by
+	// ReportLock. ControllerLock is always taken before ReportLock.
+	//
+	WDFWAITLOCK ReportLock;
+	volatile LONG FrameHead;
+	volatile LONG FrameTail;
+	RMI4_RAW_FRAME Frames[RMI4_PIPELINE_DEPTH];
+
+	//
+	// Page selects and reads of a frame, issued as one chain
+	//
+	SPB_CHAIN CaptureChain;
 
 	//
 	// Current button state
 	//
 	RMI4_BUTTONS_CACHE ButtonsCache;
+	RMI4_BUTTON_LAYOUT ButtonLayout;
     WDFTIMER ButtonsTimer;
 
-    HID_INPUT_REPORT HidQueue[MAX_REPORTS_IN_QUEUE];
-    int HidQueueCount;
+	//
+	// Reports waiting for HIDClass read requests, the contacts whose
+	// last queued report had the tip switch set, and the number of frames
+	// published so far (used to correlate trace events). A contact stays
+	// in the tip mask until a report lifting it has been queued.
+	//
+	HID_REPORT_QUEUE ReportQueue;
+	ULONG ReportedTipMask;
+	RMI4_REPORTED_CONTACT ReportedContacts[RMI4_MAX_TOUCHES];
+	ULONG FrameId;
+
+	//
+	// Per-stage latency instrumentation
+	//
+	TCH_LATENCY_CONTEXT Latency;
+
+	//
+	// Active/idle report rate policy, see activity.h
+	//
+	TCH_ACTIVITY_CONTEXT Activity;
+
+	//
+	// Interrupt storm monitor, see storm.h
+	//
+	TCH_STORM_CONTEXT Storm;
+
+	//
+	// Live settings changes, see settings.h. Settings is loaded by
+	// TchRegistryLoadSettings on start and on each change.
+	//
+	TCH_SETTINGS_WATCH SettingsWatch;
+	RMI4_SETTINGS_SNAPSHOT* Settings;
+
+	//
+	// F54 image streaming for diagnostic tools, see Function54.h
+	//
+	RMI4_F54_STREAM F54Stream;
+
+	//
+	// F34 firmware reflash, see Function34.h
+	//
+	RMI4_F34_FLASH_CONTEXT F34Flash;
+
+	//
+	// Raw frame tap shared with a user mode client, see tap.h
+	//
+	TCH_TAP_CONTEXT Tap;
+
+	//
+	// Always-on runtime counters, see diag.h
+	//
+	TCH_RUNTIME_COUNTERS Counters;
 } RMI4_CONTROLLER_CONTEXT;
 
+//
+// The per-frame header, everything before the finger cache, must stay
+// within two cache lines
+//
+C_ASSERT(FIELD_OFFSET(RMI4_CONTROLLER_CONTEXT, FingerCache) <= 128);
+
 NTSTATUS
 RmiCheckInterrupts(
 	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
@@ -217,12 +642,80 @@ RmiChangePage(
 	IN int DesiredPage
 );
 
+PRTL_QUERY_REGISTRY_TABLE
+TchRegistryCreateQueryTable(
+	IN const RTL_QUERY_REGISTRY_TABLE* Template,
+	IN ULONG TemplateSize,
+	IN PVOID Base
+);
+
+NTSTATUS
+TchRegistryQueryControllerSettings(
+	IN PRTL_QUERY_REGISTRY_TABLE QueryTable,
+	IN PTOUCH_SCREEN_PROPERTIES Props,
+	OUT RMI4_CONFIGURATION* Config
+);
+
+NTSTATUS
+TchRegistryCreateSettings(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+TchRegistryFreeSettings(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+);
+
+NTSTATUS
+TchRegistryLoadSettings(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN BOOLEAN Started
+);
+
+NTSTATUS
+RmiConfigureFunctions(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+NTSTATUS
+RmiBuildFunctionsTable(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+VOID
+RmiResolveFunctions(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+);
+
+NTSTATUS
+RmiGetFirmwareVersion(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
 NTSTATUS
 RmiGetTouchesFromController(
 	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
 	IN SPB_CONTEXT* SpbContext
 );
 
+VOID
+RmiBuildInterruptDispatch(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+RmiPlanServiceOrder(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+);
+
+VOID
+RmiPlanPipeline(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+);
+
 UINT8 RmiGetRegisterIndex(
 	PRMI_REGISTER_DESCRIPTOR Rdesc,
 	USHORT reg
@@ -233,3 +726,8 @@ GetNextHidReport(
     IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
     IN PHID_INPUT_REPORT* HidReport
 );
+
+VOID
+RmiPublishHidReports(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+);
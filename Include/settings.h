@@ -0,0 +1,101 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		settings.h
+
+	Abstract:
+
+		Live settings changes. The controller settings and screen
+		properties keys are watched while the device is started, and
+		a change to either is read into a new snapshot that replaces
+		the current one and reprograms the controller, without a PnP
+		restart of the device.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <wdf.h>
+
+//
+// Registry keys holding settings that can be changed at runtime
+//
+typedef enum _TCH_SETTINGS_KEY
+{
+	TchSettingsKeyController,
+	TchSettingsKeyScreenProperties,
+	TchSettingsKeyCount
+} TCH_SETTINGS_KEY;
+
+struct _TCH_SETTINGS_WATCH;
+
+typedef struct _TCH_SETTINGS_KEY_WATCH
+{
+	struct _TCH_SETTINGS_WATCH* Watch;
+	HANDLE Key;
+	IO_STATUS_BLOCK IoStatus;
+
+	//
+	// Queued by the configuration manager once the key changes
+	//
+	WORK_QUEUE_ITEM ChangeItem;
+} TCH_SETTINGS_KEY_WATCH;
+
+typedef struct _TCH_SETTINGS_WATCH
+{
+	TCH_SETTINGS_KEY_WATCH Keys[TchSettingsKeyCount];
+
+	//
+	// Serializes arming a notification against closing its key
+	//
+	WDFWAITLOCK Lock;
+	BOOLEAN Stopping;
+
+	//
+	// Pending counts the armed notifications plus one held until the
+	// watch is stopped, Idle is signaled once it drops to zero
+	//
+	volatile LONG Pending;
+	KEVENT Idle;
+
+	//
+	// Reads and applies the new settings at passive level
+	//
+	WDFWORKITEM ApplyItem;
+
+	//
+	// Settings changed while the controller was not in D0, they are
+	// programmed on the next wake
+	//
+	BOOLEAN ApplyOnWake;
+} TCH_SETTINGS_WATCH;
+
+NTSTATUS
+TchSettingsWatchInitialize(
+	IN VOID* ControllerContext
+);
+
+VOID
+TchSettingsWatchStart(
+	IN VOID* ControllerContext
+);
+
+VOID
+TchSettingsWatchStop(
+	IN VOID* ControllerContext
+);
+
+VOID
+TchSettingsWatchFree(
+	IN VOID* ControllerContext
+);
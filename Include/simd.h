@@ -0,0 +1,31 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		simd.h
+
+	Abstract:
+
+		Selects the vector code paths of the per-frame kernels. Kernel
+		code may use the NEON and SSE2 registers without saving them on
+		ARM64 and AMD64 only, other builds use the scalar code.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#if defined(ARM64) && !defined(TCH_NO_SIMD)
+#define TCH_SIMD_NEON
+#include <arm64_neon.h>
+#elif defined(AMD64) && !defined(TCH_NO_SIMD)
+#define TCH_SIMD_SSE2
+#include <emmintrin.h>
+#endif
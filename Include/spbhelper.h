@@ -0,0 +1,184 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		spbhelper.h
+
+	Abstract:
+
+		This module contains the touch driver I2C helper definitions.
+
+	Environment:
+
+		Kernel Mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <wdf.h>
+
+#define DEFAULT_SPB_BUFFER_SIZE 64
+
+//
+// Transaction chains. A chain is a short list of register reads and
+// small register writes issued back to back from the completion routine
+// of the previous one, on a request formatted once per transaction and
+// reused for the whole chain.
+//
+#define SPB_CHAIN_MAX_TRANSFERS 8
+#define SPB_CHAIN_MAX_WRITE     4
+
+typedef struct _SPB_CHAIN_TRANSFER
+{
+	BOOLEAN Write;
+	UCHAR Address;
+	ULONG Length;
+
+	//
+	// Reads land in the caller's nonpaged buffer, write data is copied
+	// into the chain
+	//
+	PVOID Buffer;
+	UCHAR WriteData[SPB_CHAIN_MAX_WRITE];
+} SPB_CHAIN_TRANSFER;
+
+struct _SPB_CHAIN;
+
+typedef
+VOID
+(*PFN_SPB_CHAIN_COMPLETION)(
+	IN struct _SPB_CHAIN* Chain,
+	IN PVOID Context
+);
+
+typedef struct _SPB_CHAIN
+{
+	SPB_CHAIN_TRANSFER Transfers[SPB_CHAIN_MAX_TRANSFERS];
+	ULONG Count;
+
+	//
+	// Outcome, Completed counts the transfers that succeeded before the
+	// first failure
+	//
+	ULONG Completed;
+	NTSTATUS Status;
+
+	PFN_SPB_CHAIN_COMPLETION Completion;
+	PVOID CompletionContext;
+} SPB_CHAIN, * PSPB_CHAIN;
+
+struct _SPB_CHAIN_ENGINE;
+
+//
+// SPB (I2C) context. It has no lock of its own: register accesses are
+// made of several transfers (page select, address, data) that have to
+// be serialized as a whole anyway, so every transfer is issued with the
+// controller lock held. The buffers, the reused request and the chain
+// engine depend on that.
+//
+
+typedef struct _SPB_CONTEXT
+{
+	WDFIOTARGET SpbIoTarget;
+	LARGE_INTEGER I2cResHubId;
+	WDFMEMORY WriteMemory;
+	WDFMEMORY ReadMemory;
+	ULONG WriteMemorySize;
+	ULONG ReadMemorySize;
+	BOOLEAN SequenceUnsupported;
+
+	//
+	// Request reused by every synchronous transaction
+	//
+	WDFREQUEST SyncRequest;
+
+	//
+	// Preformatted request and memory objects of the chain engine
+	//
+	WDFMEMORY ChainEngineMemory;
+	struct _SPB_CHAIN_ENGINE* ChainEngine;
+} SPB_CONTEXT;
+
+VOID
+SpbChainInitialize(
+	OUT PSPB_CHAIN Chain
+);
+
+NTSTATUS
+SpbChainAddRead(
+	IN OUT PSPB_CHAIN Chain,
+	IN UCHAR Address,
+	IN PVOID Buffer,
+	IN ULONG Length
+);
+
+NTSTATUS
+SpbChainAddWrite(
+	IN OUT PSPB_CHAIN Chain,
+	IN UCHAR Address,
+	IN PVOID Data,
+	IN ULONG Length
+);
+
+VOID
+SpbSubmitChain(
+	IN SPB_CONTEXT* SpbContext,
+	IN PSPB_CHAIN Chain,
+	IN PFN_SPB_CHAIN_COMPLETION Completion,
+	IN PVOID Context
+);
+
+NTSTATUS
+SpbExecuteChainSynchronously(
+	IN SPB_CONTEXT* SpbContext,
+	IN PSPB_CHAIN Chain
+);
+
+NTSTATUS
+SpbReadDataSynchronously(
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR Address,
+	IN PVOID Data,
+	IN ULONG Length
+);
+
+NTSTATUS
+SpbReadDataToMemorySynchronously(
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR Address,
+	IN WDFMEMORY Memory,
+	IN size_t Offset,
+	IN ULONG Length
+);
+
+NTSTATUS
+SpbReserveBufferSize(
+	IN SPB_CONTEXT* SpbContext,
+	IN ULONG Length
+);
+
+VOID
+SpbTargetDeinitialize(
+	IN WDFDEVICE FxDevice,
+	IN SPB_CONTEXT* SpbContext
+);
+
+NTSTATUS
+SpbTargetInitialize(
+	IN WDFDEVICE FxDevice,
+	IN SPB_CONTEXT* SpbContext
+);
+
+NTSTATUS
+SpbWriteDataSynchronously(
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR Address,
+	IN PVOID Data,
+	IN ULONG Length
+);
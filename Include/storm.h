@@ -0,0 +1,91 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		storm.h
+
+	Abstract:
+
+		Interrupt storm monitor. Interrupt and spurious interrupt rates
+		are estimated over a sliding window; a controller exceeding the
+		limits has its interrupts masked at F01 and is reconfigured after
+		a back-off delay.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <wdf.h>
+#include "spbhelper.h"
+
+//
+// Delay applied to each interrupt that still arrives while the controller
+// is masked, the line itself is misbehaving at that point
+//
+#define TCH_STORM_THROTTLE_MS       2
+
+//
+// Longest back-off, as a power of two multiple of the recovery delay
+//
+#define TCH_STORM_MAX_BACKOFF       4
+
+typedef struct _TCH_STORM_CONTEXT
+{
+	WDFTIMER RecoveryTimer;
+
+	//
+	// Counts of the current and previous window, the rate is estimated
+	// by weighting the previous window by the part still overlapping
+	// the sliding window
+	//
+	LONG64 WindowStart;
+	ULONG Interrupts;
+	ULONG Spurious;
+	ULONG PreviousInterrupts;
+	ULONG PreviousSpurious;
+
+	//
+	// Controller interrupts are masked until the recovery timer fires,
+	// Trips counts storms without a quiet window in between
+	//
+	BOOLEAN Masked;
+	BOOLEAN Throttle;
+	ULONG Trips;
+} TCH_STORM_CONTEXT;
+
+NTSTATUS
+TchStormInitialize(
+	IN VOID* ControllerContext
+);
+
+BOOLEAN
+RmiStormCheck(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN BOOLEAN Spurious
+);
+
+VOID
+RmiStormThrottle(
+	IN VOID* ControllerContext
+);
+
+NTSTATUS
+RmiStormRecover(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+);
+
+VOID
+TchStormStop(
+	IN VOID* ControllerContext
+);
@@ -0,0 +1,83 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		tap.h
+
+	Abstract:
+
+		Raw frame tap. The tap pages are allocated on the first mapping
+		and mapped into the client process, raw register data is written
+		to them once by the interrupt routine and read in place by the
+		client. See diag.h for the shared layout.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <wdf.h>
+#include "diag.h"
+
+//
+// The first 64 bytes of the tap hold the header, records are 8 byte
+// aligned
+//
+#define TCH_TAP_HEADER_SIZE         64
+#define TCH_TAP_RECORD_ALIGNMENT    8
+
+typedef struct _TCH_TAP_CONTEXT
+{
+	//
+	// Tap pages and their system mapping, kept until the context is
+	// freed once allocated
+	//
+	PMDL Mdl;
+	PTCH_TAP_HEADER Header;
+	PUCHAR Ring;
+
+	//
+	// Mapping of the current client, the client can write to the tap
+	// so the write position is never read back from it
+	//
+	volatile BOOLEAN Mapped;
+	PVOID UserAddress;
+	PEPROCESS Process;
+	PKEVENT Event;
+	LONG64 WritePosition;
+	ULONG Sequence;
+} TCH_TAP_CONTEXT;
+
+NTSTATUS
+TchTapMap(
+	IN VOID* ControllerContext,
+	IN HANDLE Event,
+	OUT PTCH_TAP_MAP_OUTPUT Output
+);
+
+VOID
+TchTapUnmap(
+	IN VOID* ControllerContext
+);
+
+VOID
+TchTapFree(
+	IN VOID* ControllerContext
+);
+
+VOID
+RmiTapWrite(
+	IN VOID* ControllerContext,
+	IN USHORT Source,
+	IN ULONG64 Timestamp,
+	IN CONST VOID* Data,
+	IN ULONG Length
+);
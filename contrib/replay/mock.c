@@ -0,0 +1,695 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		mock.c
+
+	Abstract:
+
+		User-mode implementations of the kernel, framework, SPB and driver
+		services referenced by the parsing and reporting code the replay
+		target is built from. The bus is replaced by the register image
+		of the record being replayed, everything the replay does not
+		exercise (configuration, diagnostics, storm monitor, backlights)
+		is reduced to a no-op.
+
+	Environment:
+
+		User mode
+
+	Revision History:
+
+--*/
+
+#include <stdio.h>
+#include <time.h>
+
+#include "controller.h"
+#include "rmiinternal.h"
+#include "spbhelper.h"
+#include "regshadow.h"
+#include "storm.h"
+#include "tap.h"
+#include "Function34.h"
+#include "Function54.h"
+#include "internal.h"
+#include "etwtrace.h"
+#include "replay.h"
+
+#define REPLAY_MAX_REGISTRY_VALUES   32
+#define REPLAY_MAX_VALUE_NAME        64
+
+typedef struct _REPLAY_REGISTRY_VALUE
+{
+	CHAR Name[REPLAY_MAX_VALUE_NAME];
+	ULONG Value;
+} REPLAY_REGISTRY_VALUE;
+
+typedef struct _WDF_MEMORY
+{
+	size_t Size;
+	PVOID Buffer;
+} WDF_MEMORY;
+
+ULONG64 ReplayInterruptTime;
+
+static CONST UCHAR* gReplayRegisters;
+static ULONG gReplayRegistersLength;
+static ULONG gReplayInterruptStatus;
+static ULONG64 gReplayAllocations;
+
+static REPLAY_REGISTRY_VALUE gReplayRegistry[REPLAY_MAX_REGISTRY_VALUES];
+static ULONG gReplayRegistryCount;
+
+const TraceLoggingHProvider TchTraceProvider = NULL;
+
+//
+// Harness interface
+//
+VOID
+ReplaySetRegisters(
+	IN CONST VOID* Data,
+	IN ULONG Length
+)
+{
+	gReplayRegisters = (CONST UCHAR*)Data;
+	gReplayRegistersLength = Length;
+}
+
+VOID
+ReplaySetInterruptStatus(
+	IN ULONG InterruptStatus
+)
+{
+	gReplayInterruptStatus = InterruptStatus;
+}
+
+NTSTATUS
+ReplaySetRegistryValue(
+	IN PCSTR Name,
+	IN ULONG Value
+)
+{
+	REPLAY_REGISTRY_VALUE* entry;
+
+	if (gReplayRegistryCount >= REPLAY_MAX_REGISTRY_VALUES ||
+		strlen(Name) >= REPLAY_MAX_VALUE_NAME)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	entry = &gReplayRegistry[gReplayRegistryCount++];
+	strcpy(entry->Name, Name);
+	entry->Value = Value;
+
+	return STATUS_SUCCESS;
+}
+
+ULONG64
+ReplayQueryPerformanceCounter(
+	VOID
+)
+{
+	struct timespec now;
+
+	timespec_get(&now, TIME_UTC);
+
+	return (ULONG64)now.tv_sec * 1000000000ull + (ULONG64)now.tv_nsec;
+}
+
+ULONG64
+ReplayQueryPerformanceFrequency(
+	VOID
+)
+{
+	return 1000000000ull;
+}
+
+ULONG64
+ReplayGetAllocationCount(
+	VOID
+)
+{
+	return gReplayAllocations;
+}
+
+static
+VOID
+ReplayReadRegisters(
+	IN UCHAR Address,
+	OUT PVOID Data,
+	IN ULONG Length
+)
+{
+	ULONG available;
+
+	available = (Address < gReplayRegistersLength) ?
+		gReplayRegistersLength - Address : 0;
+
+	if (available > Length)
+	{
+		available = Length;
+	}
+
+	if (available != 0)
+	{
+		RtlCopyMemory(Data, gReplayRegisters + Address, available);
+	}
+
+	RtlZeroMemory((PUCHAR)Data + available, Length - available);
+}
+
+//
+// Pool, allocations are aligned to a cache line whatever the pool type.
+// Pool allocations and memory objects each count as one allocation.
+//
+static
+PVOID
+ReplayAllocate(
+	IN SIZE_T NumberOfBytes
+)
+{
+	PUCHAR block;
+	PUCHAR aligned;
+
+	block = (PUCHAR)malloc(NumberOfBytes + SYSTEM_CACHE_ALIGNMENT_SIZE + sizeof(PVOID));
+
+	if (block == NULL)
+	{
+		return NULL;
+	}
+
+	aligned = (PUCHAR)(((ULONG_PTR)block + sizeof(PVOID) + SYSTEM_CACHE_ALIGNMENT_SIZE - 1) &
+		~((ULONG_PTR)SYSTEM_CACHE_ALIGNMENT_SIZE - 1));
+
+	((PVOID*)aligned)[-1] = block;
+
+	return aligned;
+}
+
+PVOID
+ExAllocatePoolWithTag(
+	IN POOL_TYPE PoolType,
+	IN SIZE_T NumberOfBytes,
+	IN ULONG Tag
+)
+{
+	UNREFERENCED_PARAMETER(PoolType);
+	UNREFERENCED_PARAMETER(Tag);
+
+	gReplayAllocations++;
+
+	return ReplayAllocate(NumberOfBytes);
+}
+
+VOID
+ExFreePoolWithTag(
+	IN PVOID P,
+	IN ULONG Tag
+)
+{
+	UNREFERENCED_PARAMETER(Tag);
+
+	if (P != NULL)
+	{
+		free(((PVOID*)P)[-1]);
+	}
+}
+
+NTSTATUS
+RtlQueryRegistryValues(
+	IN ULONG RelativeTo,
+	IN PCWSTR Path,
+	IN PRTL_QUERY_REGISTRY_TABLE QueryTable,
+	IN PVOID Context,
+	IN PVOID Environment OPTIONAL
+)
+/*++
+
+Routine Description:
+
+	Applies the values set with ReplaySetRegistryValue to a query table,
+	only direct REG_DWORD queries are supported
+
+--*/
+{
+	PRTL_QUERY_REGISTRY_TABLE entry;
+	ULONG i;
+	ULONG j;
+
+	UNREFERENCED_PARAMETER(RelativeTo);
+	UNREFERENCED_PARAMETER(Path);
+	UNREFERENCED_PARAMETER(Context);
+	UNREFERENCED_PARAMETER(Environment);
+
+	for (entry = QueryTable; entry->QueryRoutine != NULL || entry->Name != NULL; entry++)
+	{
+		if (!(entry->Flags & RTL_QUERY_REGISTRY_DIRECT) || entry->Name == NULL)
+		{
+			continue;
+		}
+
+		for (i = 0; i < gReplayRegistryCount; i++)
+		{
+			for (j = 0; gReplayRegistry[i].Name[j] != '\0'; j++)
+			{
+				if (entry->Name[j] != (WCHAR)gReplayRegistry[i].Name[j])
+				{
+					break;
+				}
+			}
+
+			if (gReplayRegistry[i].Name[j] == '\0' && entry->Name[j] == 0)
+			{
+				*(PULONG)entry->EntryContext = gReplayRegistry[i].Value;
+			}
+		}
+	}
+
+	return STATUS_SUCCESS;
+}
+
+//
+// Framework objects, the replay only creates memory objects
+//
+NTSTATUS
+WdfMemoryCreate(
+	IN PWDF_OBJECT_ATTRIBUTES Attributes OPTIONAL,
+	IN POOL_TYPE PoolType,
+	IN ULONG PoolTag OPTIONAL,
+	IN size_t BufferSize,
+	OUT WDFMEMORY* Memory,
+	OUT PVOID* Buffer OPTIONAL
+)
+{
+	WDF_MEMORY* memory;
+
+	UNREFERENCED_PARAMETER(Attributes);
+	UNREFERENCED_PARAMETER(PoolType);
+
+	gReplayAllocations++;
+
+	memory = (WDF_MEMORY*)ReplayAllocate(sizeof(WDF_MEMORY));
+
+	if (memory == NULL)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	memory->Size = BufferSize;
+	memory->Buffer = ReplayAllocate(BufferSize);
+
+	if (memory->Buffer == NULL)
+	{
+		ExFreePoolWithTag(memory, PoolTag);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	RtlZeroMemory(memory->Buffer, BufferSize);
+
+	*Memory = memory;
+
+	if (Buffer != NULL)
+	{
+		*Buffer = memory->Buffer;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+PVOID
+WdfMemoryGetBuffer(
+	IN WDFMEMORY Memory,
+	OUT size_t* BufferSize OPTIONAL
+)
+{
+	if (BufferSize != NULL)
+	{
+		*BufferSize = Memory->Size;
+	}
+
+	return Memory->Buffer;
+}
+
+VOID
+WdfObjectDelete(
+	IN PVOID Object
+)
+{
+	WDF_MEMORY* memory;
+
+	memory = (WDF_MEMORY*)Object;
+
+	ExFreePoolWithTag(memory->Buffer, 0);
+	ExFreePoolWithTag(memory, 0);
+}
+
+NTSTATUS
+WdfTimerCreate(
+	IN PWDF_TIMER_CONFIG Config,
+	IN PWDF_OBJECT_ATTRIBUTES Attributes,
+	OUT WDFTIMER* Timer
+)
+{
+	UNREFERENCED_PARAMETER(Config);
+	UNREFERENCED_PARAMETER(Attributes);
+
+	*Timer = NULL;
+
+	return STATUS_NOT_SUPPORTED;
+}
+
+WDFOBJECT
+WdfTimerGetParentObject(
+	IN WDFTIMER Timer
+)
+{
+	UNREFERENCED_PARAMETER(Timer);
+
+	return NULL;
+}
+
+PDEVICE_EXTENSION
+GetDeviceContext(
+	IN WDFOBJECT Handle
+)
+{
+	UNREFERENCED_PARAMETER(Handle);
+
+	return NULL;
+}
+
+void
+SendHidReports(
+	WDFQUEUE PingPongQueue,
+	PHID_REPORT_QUEUE ReportQueue
+)
+{
+	UNREFERENCED_PARAMETER(PingPongQueue);
+	UNREFERENCED_PARAMETER(ReportQueue);
+}
+
+//
+// SPB, reads are served from the current record
+//
+NTSTATUS
+SpbReadDataSynchronously(
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR Address,
+	IN PVOID Data,
+	IN ULONG Length
+)
+{
+	UNREFERENCED_PARAMETER(SpbContext);
+
+	ReplayReadRegisters(Address, Data, Length);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+SpbReadDataToMemorySynchronously(
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR Address,
+	IN WDFMEMORY Memory,
+	IN size_t Offset,
+	IN ULONG Length
+)
+{
+	UNREFERENCED_PARAMETER(SpbContext);
+
+	if (Offset + Length > Memory->Size)
+	{
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	ReplayReadRegisters(Address, (PUCHAR)Memory->Buffer + Offset, Length);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+SpbWriteDataSynchronously(
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR Address,
+	IN PVOID Data,
+	IN ULONG Length
+)
+{
+	UNREFERENCED_PARAMETER(SpbContext);
+	UNREFERENCED_PARAMETER(Address);
+	UNREFERENCED_PARAMETER(Data);
+	UNREFERENCED_PARAMETER(Length);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+SpbReserveBufferSize(
+	IN SPB_CONTEXT* SpbContext,
+	IN ULONG Length
+)
+{
+	UNREFERENCED_PARAMETER(SpbContext);
+	UNREFERENCED_PARAMETER(Length);
+
+	return STATUS_SUCCESS;
+}
+
+VOID
+SpbChainInitialize(
+	OUT PSPB_CHAIN Chain
+)
+{
+	Chain->Count = 0;
+	Chain->Completed = 0;
+	Chain->Status = STATUS_SUCCESS;
+	Chain->Completion = NULL;
+	Chain->CompletionContext = NULL;
+}
+
+static
+NTSTATUS
+SpbChainAdd(
+	IN OUT PSPB_CHAIN Chain,
+	IN BOOLEAN Write,
+	IN UCHAR Address,
+	IN PVOID Buffer,
+	IN ULONG Length
+)
+{
+	SPB_CHAIN_TRANSFER* transfer;
+
+	if (Chain->Count >= SPB_CHAIN_MAX_TRANSFERS)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	transfer = &Chain->Transfers[Chain->Count++];
+	transfer->Write = Write;
+	transfer->Address = Address;
+	transfer->Buffer = Buffer;
+	transfer->Length = Length;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+SpbChainAddRead(
+	IN OUT PSPB_CHAIN Chain,
+	IN UCHAR Address,
+	IN PVOID Buffer,
+	IN ULONG Length
+)
+{
+	return SpbChainAdd(Chain, FALSE, Address, Buffer, Length);
+}
+
+NTSTATUS
+SpbChainAddWrite(
+	IN OUT PSPB_CHAIN Chain,
+	IN UCHAR Address,
+	IN PVOID Data,
+	IN ULONG Length
+)
+{
+	if (Length > SPB_CHAIN_MAX_WRITE)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	return SpbChainAdd(Chain, TRUE, Address, NULL, Length);
+}
+
+NTSTATUS
+SpbExecuteChainSynchronously(
+	IN SPB_CONTEXT* SpbContext,
+	IN PSPB_CHAIN Chain
+)
+{
+	SPB_CHAIN_TRANSFER* transfer;
+	ULONG i;
+
+	UNREFERENCED_PARAMETER(SpbContext);
+
+	for (i = 0; i < Chain->Count; i++)
+	{
+		transfer = &Chain->Transfers[i];
+
+		if (!transfer->Write)
+		{
+			ReplayReadRegisters(transfer->Address, transfer->Buffer, transfer->Length);
+		}
+	}
+
+	Chain->Completed = Chain->Count;
+	Chain->Status = STATUS_SUCCESS;
+
+	return STATUS_SUCCESS;
+}
+
+//
+// Driver services outside the parsing and reporting path
+//
+NTSTATUS
+RmiChangePage(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN int DesiredPage
+)
+{
+	UNREFERENCED_PARAMETER(SpbContext);
+
+	ControllerContext->CurrentPage = DesiredPage;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+RmiCheckInterrupts(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN ULONG* InterruptStatus
+)
+{
+	UNREFERENCED_PARAMETER(ControllerContext);
+	UNREFERENCED_PARAMETER(SpbContext);
+
+	*InterruptStatus = gReplayInterruptStatus;
+
+	return STATUS_SUCCESS;
+}
+
+int
+RmiGetFunctionIndex(
+	IN RMI4_FUNCTION_DESCRIPTOR* FunctionDescriptors,
+	IN int FunctionCount,
+	IN int FunctionDesired
+)
+{
+	int i;
+
+	for (i = 0; i < FunctionCount; i++)
+	{
+		if (FunctionDescriptors[i].Number == FunctionDesired)
+		{
+			break;
+		}
+	}
+
+	return i;
+}
+
+BOOLEAN
+RmiStormCheck(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN BOOLEAN Spurious
+)
+{
+	UNREFERENCED_PARAMETER(ControllerContext);
+	UNREFERENCED_PARAMETER(SpbContext);
+	UNREFERENCED_PARAMETER(Spurious);
+
+	return FALSE;
+}
+
+VOID
+RmiStormThrottle(
+	IN VOID* ControllerContext
+)
+{
+	UNREFERENCED_PARAMETER(ControllerContext);
+}
+
+VOID
+RmiTapWrite(
+	IN VOID* ControllerContext,
+	IN USHORT Source,
+	IN ULONG64 Timestamp,
+	IN CONST VOID* Data,
+	IN ULONG Length
+)
+{
+	UNREFERENCED_PARAMETER(ControllerContext);
+	UNREFERENCED_PARAMETER(Source);
+	UNREFERENCED_PARAMETER(Timestamp);
+	UNREFERENCED_PARAMETER(Data);
+	UNREFERENCED_PARAMETER(Length);
+}
+
+VOID
+RmiF34ServiceAttention(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+{
+	UNREFERENCED_PARAMETER(ControllerContext);
+	UNREFERENCED_PARAMETER(SpbContext);
+}
+
+VOID
+RmiF54StreamStep(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+{
+	UNREFERENCED_PARAMETER(ControllerContext);
+	UNREFERENCED_PARAMETER(SpbContext);
+}
+
+VOID
+TchLatencyRecordFrame(
+	IN PTCH_LATENCY_CONTEXT Latency,
+	IN PTCH_LATENCY_STAMPS Stamps
+)
+{
+	UNREFERENCED_PARAMETER(Latency);
+	UNREFERENCED_PARAMETER(Stamps);
+}
+
+VOID
+TchLatencyInitialize(
+	IN PTCH_LATENCY_CONTEXT Latency,
+	IN BOOLEAN Enabled
+)
+{
+	//
+	// The replay measures whole frames itself
+	//
+	UNREFERENCED_PARAMETER(Enabled);
+
+	Latency->Enabled = FALSE;
+}
+
+VOID
+TchBklNotifyTouchActivity(
+	IN BKL_CONTEXT* BklContext,
+	IN DWORD Time
+)
+{
+	UNREFERENCED_PARAMETER(BklContext);
+	UNREFERENCED_PARAMETER(Time);
+}
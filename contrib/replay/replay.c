@@ -0,0 +1,809 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		replay.c
+
+	Abstract:
+
+		Replays F11/F12 data recorded through the raw frame tap against the
+		driver's parsing and reporting code, built for user mode, and
+		measures the time spent per frame.
+
+		Each touch record is served as the register image of one
+		interrupt and goes through TchServiceInterrupts, and with
+		PipelinedReporting through TchServiceCapturedFrame, exactly as
+		on the device. The reports queued are consumed after every frame,
+		as by a HIDClass that keeps up, and folded into a digest so runs
+		of two builds can be compared report for report. Frames are also
+		broken down by the number of contacts they report, with the
+		time and the pool allocations and memory objects spent on each.
+
+	Environment:
+
+		User mode
+
+	Revision History:
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "controller.h"
+#include "rmiinternal.h"
+#include "spbhelper.h"
+#include "fingercache.h"
+#include "resolutions.h"
+#include "Function11.h"
+#include "Function12.h"
+#include "replay.h"
+
+#define REPLAY_DEFAULT_ITERATIONS   10
+#define REPLAY_F11_REGISTER_SPACE   256
+
+#define REPLAY_DIGEST_BASIS         0xCBF29CE484222325ull
+#define REPLAY_DIGEST_PRIME         0x00000100000001B3ull
+
+typedef struct _REPLAY_OPTIONS
+{
+	PCSTR Path;
+	UCHAR InputMode;
+	ULONG Iterations;
+	ULONG MaxFingers;
+	ULONG Data1Offset;
+} REPLAY_OPTIONS;
+
+typedef struct _REPLAY_DUMP
+{
+	PUCHAR Data;
+	ULONG Length;
+
+	//
+	// Touch source of the records replayed and the largest data length
+	// found, F12 records all hold one packet
+	//
+	USHORT Source;
+	ULONG Frames;
+	ULONG DataLength;
+} REPLAY_DUMP;
+
+//
+// Frames of one contact count, contacts being the objects the record
+// reports present, whatever their type
+//
+typedef struct _REPLAY_BUCKET
+{
+	ULONG64 Elapsed;
+	ULONG64 Allocations;
+	ULONG Frames;
+} REPLAY_BUCKET;
+
+typedef struct _REPLAY_RESULT
+{
+	ULONG64 Elapsed;
+	ULONG64 Digest;
+	ULONG Reports;
+	REPLAY_BUCKET Buckets[RMI4_MAX_TOUCHES + 1];
+} REPLAY_RESULT;
+
+static
+VOID
+ReplayUsage(
+	VOID
+)
+{
+	fprintf(stderr,
+		"usage: SynapticsTouchReplay [options] dump\n"
+		"\n"
+		"  -m multi|single|mouse  input mode, multi by default\n"
+		"  -n count               iterations over the dump, %u by default\n"
+		"  -f count               objects per frame, by default the F12\n"
+		"                         packet size or %u for F11\n"
+		"  -o offset              offset of the F12 Data1 register in the\n"
+		"                         packet, 0 by default\n"
+		"  -r Name=Value          registry DWORD, screen properties and\n"
+		"                         controller settings alike, may repeat\n",
+		REPLAY_DEFAULT_ITERATIONS,
+		RMI4_MAX_TOUCHES);
+}
+
+static
+NTSTATUS
+ReplayParseOptions(
+	IN int Argc,
+	IN char** Argv,
+	OUT REPLAY_OPTIONS* Options
+)
+{
+	PCSTR value;
+	char* end;
+	int i;
+
+	RtlZeroMemory(Options, sizeof(REPLAY_OPTIONS));
+	Options->InputMode = MODE_MULTI_TOUCH;
+	Options->Iterations = REPLAY_DEFAULT_ITERATIONS;
+
+	for (i = 1; i < Argc; i++)
+	{
+		if (Argv[i][0] != '-')
+		{
+			if (Options->Path != NULL)
+			{
+				return STATUS_INVALID_PARAMETER;
+			}
+
+			Options->Path = Argv[i];
+			continue;
+		}
+
+		if (Argv[i][1] == '\0' || Argv[i][2] != '\0' || i + 1 >= Argc)
+		{
+			return STATUS_INVALID_PARAMETER;
+		}
+
+		value = Argv[++i];
+
+		switch (Argv[i - 1][1])
+		{
+		case 'm':
+			if (strcmp(value, "multi") == 0)
+			{
+				Options->InputMode = MODE_MULTI_TOUCH;
+			}
+			else if (strcmp(value, "single") == 0)
+			{
+				Options->InputMode = MODE_SINGLE_TOUCH;
+			}
+			else if (strcmp(value, "mouse") == 0)
+			{
+				Options->InputMode = MODE_MOUSE;
+			}
+			else
+			{
+				return STATUS_INVALID_PARAMETER;
+			}
+			break;
+
+		case 'n':
+			Options->Iterations = strtoul(value, &end, 0);
+
+			if (*end != '\0' || Options->Iterations == 0)
+			{
+				return STATUS_INVALID_PARAMETER;
+			}
+			break;
+
+		case 'f':
+			Options->MaxFingers = strtoul(value, &end, 0);
+
+			if (*end != '\0' || Options->MaxFingers == 0 ||
+				Options->MaxFingers > RMI4_MAX_TOUCHES)
+			{
+				return STATUS_INVALID_PARAMETER;
+			}
+			break;
+
+		case 'o':
+			Options->Data1Offset = strtoul(value, &end, 0);
+
+			if (*end != '\0' || Options->Data1Offset >= RMI4_PIPELINE_FRAME_DATA_SIZE)
+			{
+				return STATUS_INVALID_PARAMETER;
+			}
+			break;
+
+		case 'r':
+		{
+			char name[64];
+			PCSTR separator;
+
+			separator = strchr(value, '=');
+
+			if (separator == NULL || separator == value ||
+				(size_t)(separator - value) >= sizeof(name))
+			{
+				return STATUS_INVALID_PARAMETER;
+			}
+
+			RtlCopyMemory(name, value, separator - value);
+			name[separator - value] = '\0';
+
+			if (!NT_SUCCESS(ReplaySetRegistryValue(
+				name,
+				strtoul(separator + 1, &end, 0))) ||
+				*end != '\0')
+			{
+				return STATUS_INVALID_PARAMETER;
+			}
+			break;
+		}
+
+		default:
+			return STATUS_INVALID_PARAMETER;
+		}
+	}
+
+	return (Options->Path != NULL) ? STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
+}
+
+static
+NTSTATUS
+ReplayLoadDump(
+	IN PCSTR Path,
+	OUT REPLAY_DUMP* Dump
+)
+/*++
+
+Routine Description:
+
+	Reads a dump of tap records, as copied out of the tap one after the
+	other, and checks that every record is complete. Padding and F54
+	records are skipped, the touch records must all come from the same
+	function.
+
+Arguments:
+
+	Path - Dump file
+	Dump - Receives the records
+
+Return Value:
+
+	NTSTATUS indicating whether the dump can be replayed
+
+--*/
+{
+	PTCH_TAP_RECORD record;
+	FILE* file;
+	long size;
+	ULONG offset;
+	NTSTATUS status;
+
+	RtlZeroMemory(Dump, sizeof(REPLAY_DUMP));
+
+	file = fopen(Path, "rb");
+
+	if (file == NULL)
+	{
+		fprintf(stderr, "%s: cannot open\n", Path);
+		return STATUS_NOT_FOUND;
+	}
+
+	status = STATUS_INVALID_IMAGE_FORMAT;
+
+	if (fseek(file, 0, SEEK_END) != 0 ||
+		(size = ftell(file)) <= 0 ||
+		fseek(file, 0, SEEK_SET) != 0)
+	{
+		fprintf(stderr, "%s: empty or unreadable\n", Path);
+		goto exit;
+	}
+
+	Dump->Length = (ULONG)size;
+	Dump->Data = (PUCHAR)malloc(Dump->Length);
+
+	if (Dump->Data == NULL)
+	{
+		status = STATUS_NO_MEMORY;
+		goto exit;
+	}
+
+	if (fread(Dump->Data, 1, Dump->Length, file) != Dump->Length)
+	{
+		fprintf(stderr, "%s: short read\n", Path);
+		goto exit;
+	}
+
+	for (offset = 0; offset < Dump->Length; offset += record->Length)
+	{
+		record = (PTCH_TAP_RECORD)(Dump->Data + offset);
+
+		if (Dump->Length - offset < sizeof(TCH_TAP_RECORD) ||
+			record->Length < sizeof(TCH_TAP_RECORD) ||
+			record->Length % TCH_TAP_RECORD_ALIGNMENT != 0 ||
+			record->Length > Dump->Length - offset ||
+			record->DataLength > record->Length - sizeof(TCH_TAP_RECORD))
+		{
+			fprintf(stderr, "%s: malformed record at offset %u\n", Path, offset);
+			goto exit;
+		}
+
+		if (record->Source != TCH_TAP_SOURCE_F11 &&
+			record->Source != TCH_TAP_SOURCE_F12)
+		{
+			continue;
+		}
+
+		if (Dump->Source != 0 && record->Source != Dump->Source)
+		{
+			fprintf(stderr, "%s: F11 and F12 records mixed\n", Path);
+			goto exit;
+		}
+
+		if (record->Source == TCH_TAP_SOURCE_F12 &&
+			Dump->DataLength != 0 &&
+			record->DataLength != Dump->DataLength)
+		{
+			fprintf(stderr, "%s: F12 packet size changes at offset %u\n", Path, offset);
+			goto exit;
+		}
+
+		Dump->Source = record->Source;
+		Dump->DataLength = max(Dump->DataLength, record->DataLength);
+		Dump->Frames++;
+	}
+
+	if (Dump->Frames == 0)
+	{
+		fprintf(stderr, "%s: no F11 or F12 records\n", Path);
+		goto exit;
+	}
+
+	status = STATUS_SUCCESS;
+
+exit:
+	fclose(file);
+
+	if (!NT_SUCCESS(status))
+	{
+		free(Dump->Data);
+		Dump->Data = NULL;
+	}
+
+	return status;
+}
+
+static
+VOID
+ReplayFreeController(
+	IN RMI4_CONTROLLER_CONTEXT* Controller
+)
+{
+	if (Controller->F12PacketMemory != NULL)
+	{
+		WdfObjectDelete(Controller->F12PacketMemory);
+	}
+
+	if (Controller->F11DataMemory != NULL)
+	{
+		WdfObjectDelete(Controller->F11DataMemory);
+	}
+
+	TchRegistryFreeSettings(Controller);
+
+	ExFreePoolWithTag(Controller, TOUCH_POOL_TAG);
+}
+
+static
+NTSTATUS
+ReplayCreateController(
+	IN REPLAY_OPTIONS* Options,
+	IN REPLAY_DUMP* Dump,
+	IN SPB_CONTEXT* SpbContext,
+	OUT RMI4_CONTROLLER_CONTEXT** Controller
+)
+/*++
+
+Routine Description:
+
+	Builds the controller context a configured, started controller would
+	have, with the touch function alone mapped at register address 0 of
+	page 0 and the settings taken from the registry values given on the
+	command line
+
+Arguments:
+
+	Options - Replay options
+	Dump - The records to replay
+	SpbContext - Bus context the mocked transfers ignore
+	Controller - Receives the controller context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	RMI4_RESOLVED_FUNCTION* function;
+	NTSTATUS status;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ExAllocatePoolWithTag(
+		NonPagedPoolNxCacheAligned,
+		sizeof(RMI4_CONTROLLER_CONTEXT),
+		TOUCH_POOL_TAG);
+
+	if (controller == NULL)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	RtlZeroMemory(controller, sizeof(RMI4_CONTROLLER_CONTEXT));
+
+	controller->CurrentPage = 0;
+	controller->DevicePowerState = PowerDeviceD0;
+	controller->ReportQueue.Counters = &controller->Counters;
+
+	status = TchRegistryCreateSettings(controller);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	status = TchRegistryGetControllerSettings(controller);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	controller->Functions[RMI4_FUNCTION_SLOT_F01].Present = TRUE;
+
+	if (Dump->Source == TCH_TAP_SOURCE_F12)
+	{
+		function = &controller->Functions[RMI4_FUNCTION_SLOT_F12];
+
+		controller->IsF12Digitizer = TRUE;
+		controller->PacketSize = Dump->DataLength;
+		controller->Data1Offset = (USHORT)Options->Data1Offset;
+		controller->MaxFingers = (BYTE)((Options->MaxFingers != 0) ?
+			Options->MaxFingers :
+			min((Dump->DataLength - min(Dump->DataLength, Options->Data1Offset)) /
+				F12_DATA1_BYTES_PER_OBJ, RMI4_MAX_TOUCHES));
+
+		if (controller->MaxFingers == 0 ||
+			controller->Data1Offset +
+			controller->MaxFingers * F12_DATA1_BYTES_PER_OBJ > controller->PacketSize)
+		{
+			fprintf(stderr, "F12 packets of %u bytes hold no %u objects at offset %u\n",
+				(ULONG)controller->PacketSize,
+				(ULONG)controller->MaxFingers,
+				(ULONG)controller->Data1Offset);
+
+			status = STATUS_INVALID_PARAMETER;
+			goto exit;
+		}
+
+		controller->DigitizerOps = RmiSelectF12Ops(controller);
+		controller->PalmSuppressionEnabled = (controller->Config.PalmSuppression != 0);
+
+		status = RmiAllocateF12PacketBuffer(controller, SpbContext);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+	}
+	else
+	{
+		function = &controller->Functions[RMI4_FUNCTION_SLOT_F11];
+
+		controller->MaxFingers = (BYTE)((Options->MaxFingers != 0) ?
+			Options->MaxFingers : RMI4_MAX_TOUCHES);
+		controller->DigitizerOps = &RmiF11Ops;
+
+		//
+		// Reads are addressed within the record, see ReplaySetRegisters
+		//
+		status = WdfMemoryCreate(
+			WDF_NO_OBJECT_ATTRIBUTES,
+			NonPagedPoolNx,
+			TOUCH_POOL_TAG,
+			REPLAY_F11_REGISTER_SPACE,
+			&controller->F11DataMemory,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+	}
+
+	function->Present = TRUE;
+	function->IrqMask = RMI4_INTERRUPT_BIT_2D_TOUCH;
+
+	RmiBuildInterruptDispatch(controller);
+	RmiPlanServiceOrder(controller);
+	RmiPlanPipeline(controller);
+
+	RmiResetFingerCache(&controller->FingerCache);
+
+	*Controller = controller;
+	status = STATUS_SUCCESS;
+
+exit:
+	if (!NT_SUCCESS(status))
+	{
+		ReplayFreeController(controller);
+	}
+
+	return status;
+}
+
+static
+ULONG
+ReplayConsumeReports(
+	IN RMI4_CONTROLLER_CONTEXT* Controller,
+	IN OUT ULONG64* Digest
+)
+/*++
+
+Routine Description:
+
+	Stands in for HIDClass reading every report queued so far
+
+--*/
+{
+	PHID_REPORT_QUEUE queue;
+	PUCHAR report;
+	ULONG reports;
+	LONG tail;
+	ULONG i;
+
+	queue = &Controller->ReportQueue;
+	reports = 0;
+
+	WdfSpinLockAcquire(queue->ConsumerLock);
+
+	for (tail = queue->Tail; tail != queue->Head; tail++)
+	{
+		report = (PUCHAR)&queue->Reports[tail & (HID_REPORT_QUEUE_DEPTH - 1)];
+
+		for (i = 0; i < sizeof(HID_INPUT_REPORT); i++)
+		{
+			*Digest = (*Digest ^ report[i]) * REPLAY_DIGEST_PRIME;
+		}
+
+		reports++;
+	}
+
+	InterlockedExchange(&queue->Tail, tail);
+
+	WdfSpinLockRelease(queue->ConsumerLock);
+
+	InterlockedExchangeAdd(&queue->Counters->ReportsDelivered, (LONG)reports);
+
+	return reports;
+}
+
+static
+ULONG
+ReplayCountContacts(
+	IN RMI4_CONTROLLER_CONTEXT* Controller,
+	IN PTCH_TAP_RECORD Record
+)
+/*++
+
+Routine Description:
+
+	Counts the objects a record reports present: F12 objects of any
+	type but none, F11 fingers whose status is not zero
+
+--*/
+{
+	PUCHAR data;
+	ULONG contacts;
+	ULONG offset;
+	ULONG i;
+
+	data = (PUCHAR)(Record + 1);
+	contacts = 0;
+
+	for (i = 0; i < Controller->MaxFingers; i++)
+	{
+		if (Record->Source == TCH_TAP_SOURCE_F12)
+		{
+			offset = Controller->Data1Offset + i * F12_DATA1_BYTES_PER_OBJ;
+
+			if (offset < Record->DataLength &&
+				data[offset] != RMI_F12_OBJECT_NONE)
+			{
+				contacts++;
+			}
+		}
+		else
+		{
+			offset = i / 4;
+
+			if (offset < Record->DataLength &&
+				((data[offset] >> ((i % 4) * 2)) & 0x3) != 0)
+			{
+				contacts++;
+			}
+		}
+	}
+
+	return min(contacts, RMI4_MAX_TOUCHES);
+}
+
+static
+VOID
+ReplayRun(
+	IN REPLAY_OPTIONS* Options,
+	IN REPLAY_DUMP* Dump,
+	IN RMI4_CONTROLLER_CONTEXT* Controller,
+	IN SPB_CONTEXT* SpbContext,
+	OUT REPLAY_RESULT* Result
+)
+{
+	PTCH_TAP_RECORD record;
+	TCH_SCAN_TIMESTAMP timestamp;
+	REPLAY_BUCKET* bucket;
+	ULONG64 allocations;
+	ULONG64 start;
+	ULONG64 elapsed;
+	ULONG offset;
+
+	RtlZeroMemory(Result, sizeof(REPLAY_RESULT));
+	Result->Digest = REPLAY_DIGEST_BASIS;
+
+	//
+	// Each frame is timed on its own, the clock read is shared by all
+	// buckets alike
+	//
+	for (offset = 0; offset < Dump->Length; offset += record->Length)
+	{
+		record = (PTCH_TAP_RECORD)(Dump->Data + offset);
+
+		if (record->Source != Dump->Source)
+		{
+			continue;
+		}
+
+		bucket = &Result->Buckets[ReplayCountContacts(Controller, record)];
+		allocations = ReplayGetAllocationCount();
+		start = ReplayQueryPerformanceCounter();
+
+		ReplayInterruptTime = record->Timestamp;
+		ReplaySetRegisters(record + 1, record->DataLength);
+		ReplaySetInterruptStatus(RMI4_INTERRUPT_BIT_2D_TOUCH);
+
+		timestamp.InterruptTime = record->Timestamp;
+		timestamp.PerformanceCounter = ReplayQueryPerformanceCounter();
+
+		TchServiceInterrupts(
+			Controller,
+			SpbContext,
+			Options->InputMode,
+			&timestamp);
+
+		if (Controller->PipelineEnabled)
+		{
+			while (TchServiceCapturedFrame(
+				Controller,
+				Options->InputMode) != STATUS_NO_MORE_ENTRIES)
+			{
+			}
+		}
+
+		Result->Reports += ReplayConsumeReports(Controller, &Result->Digest);
+
+		elapsed = ReplayQueryPerformanceCounter() - start;
+
+		bucket->Elapsed += elapsed;
+		bucket->Allocations += ReplayGetAllocationCount() - allocations;
+		bucket->Frames++;
+		Result->Elapsed += elapsed;
+	}
+}
+
+int
+main(
+	int argc,
+	char** argv
+)
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	REPLAY_OPTIONS options;
+	REPLAY_DUMP dump;
+	REPLAY_RESULT result;
+	REPLAY_RESULT first;
+	REPLAY_BUCKET buckets[RMI4_MAX_TOUCHES + 1];
+	SPB_CONTEXT spb;
+	ULONG64 best;
+	ULONG64 total;
+	double frequency;
+	ULONG contacts;
+	ULONG i;
+	int exitCode;
+
+	if (!NT_SUCCESS(ReplayParseOptions(argc, argv, &options)))
+	{
+		ReplayUsage();
+		return 2;
+	}
+
+	if (!NT_SUCCESS(ReplayLoadDump(options.Path, &dump)))
+	{
+		return 1;
+	}
+
+	RtlZeroMemory(&spb, sizeof(spb));
+	RtlZeroMemory(&first, sizeof(first));
+	RtlZeroMemory(buckets, sizeof(buckets));
+	frequency = (double)ReplayQueryPerformanceFrequency();
+	best = MAXULONG64;
+	total = 0;
+	exitCode = 0;
+
+	//
+	// Every iteration starts from a freshly started controller, only the
+	// frames themselves are timed
+	//
+	for (i = 0; i < options.Iterations; i++)
+	{
+		if (!NT_SUCCESS(ReplayCreateController(&options, &dump, &spb, &controller)))
+		{
+			exitCode = 1;
+			goto exit;
+		}
+
+		ReplayRun(&options, &dump, controller, &spb, &result);
+
+		if (i == 0)
+		{
+			first = result;
+
+			printf("%s: %u %s frames, %u reports, %d coalesced, %d dropped, "
+				"pipelined %s\n",
+				options.Path,
+				dump.Frames,
+				(dump.Source == TCH_TAP_SOURCE_F12) ? "F12" : "F11",
+				result.Reports,
+				controller->Counters.ReportsCoalesced,
+				controller->Counters.ReportsDropped,
+				controller->PipelineEnabled ? "on" : "off");
+		}
+		else if (result.Digest != first.Digest || result.Reports != first.Reports)
+		{
+			fprintf(stderr, "iteration %u reported differently\n", i);
+			exitCode = 1;
+		}
+
+		ReplayFreeController(controller);
+
+		best = min(best, result.Elapsed);
+		total += result.Elapsed;
+
+		for (contacts = 0; contacts <= RMI4_MAX_TOUCHES; contacts++)
+		{
+			buckets[contacts].Elapsed += result.Buckets[contacts].Elapsed;
+			buckets[contacts].Allocations += result.Buckets[contacts].Allocations;
+			buckets[contacts].Frames += result.Buckets[contacts].Frames;
+		}
+	}
+
+	printf("digest %016llx\n", (unsigned long long)first.Digest);
+	printf("%.0f ns/frame best, %.0f ns/frame mean over %u iterations\n",
+		(double)best * 1e9 / frequency / dump.Frames,
+		(double)total * 1e9 / frequency / dump.Frames / options.Iterations,
+		options.Iterations);
+
+	//
+	// Means over all iterations, per number of contacts in the frame
+	//
+	printf("contacts    frames  ns/frame  allocations/frame\n");
+
+	for (contacts = 0; contacts <= RMI4_MAX_TOUCHES; contacts++)
+	{
+		if (buckets[contacts].Frames == 0)
+		{
+			continue;
+		}
+
+		printf("%8u  %8u  %8.0f  %17.2f\n",
+			contacts,
+			buckets[contacts].Frames / options.Iterations,
+			(double)buckets[contacts].Elapsed * 1e9 / frequency / buckets[contacts].Frames,
+			(double)buckets[contacts].Allocations / buckets[contacts].Frames);
+	}
+
+exit:
+	free(dump.Data);
+
+	return exitCode;
+}
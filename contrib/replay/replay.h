@@ -0,0 +1,76 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		replay.h
+
+	Abstract:
+
+		Interface between the replay harness and the mocked kernel, SPB
+		and driver services it links the parsing and reporting code
+		against
+
+	Environment:
+
+		User mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+
+//
+// Registers of the touch function are mapped at address 0, a read at
+// address a returns the bytes of the current record starting at offset a
+// and zeroes past its end. Every read succeeds.
+//
+VOID
+ReplaySetRegisters(
+	IN CONST VOID* Data,
+	IN ULONG Length
+);
+
+//
+// Interrupt status returned by the next F01 interrupt status read
+//
+VOID
+ReplaySetInterruptStatus(
+	IN ULONG InterruptStatus
+);
+
+//
+// Value returned for a REG_DWORD registry value queried with
+// RTL_QUERY_REGISTRY_DIRECT, values not set keep their defaults
+//
+NTSTATUS
+ReplaySetRegistryValue(
+	IN PCSTR Name,
+	IN ULONG Value
+);
+
+//
+// Performance counter in ticks of ReplayQueryPerformanceFrequency, the
+// host's monotonic clock
+//
+ULONG64
+ReplayQueryPerformanceCounter(
+	VOID
+);
+
+ULONG64
+ReplayQueryPerformanceFrequency(
+	VOID
+);
+
+//
+// Pool allocations and memory objects created so far
+//
+ULONG64
+ReplayGetAllocationCount(
+	VOID
+);
@@ -0,0 +1,46 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		TraceLoggingProvider.h
+
+	Abstract:
+
+		User-mode stand-in for the TraceLogging header, used by the replay
+		target. The provider is never enabled and events compile out, as
+		they do on a device without a listening session.
+
+	Environment:
+
+		User mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+
+typedef struct _TLG_PROVIDER
+{
+	ULONG Reserved;
+} TLG_PROVIDER;
+
+typedef const TLG_PROVIDER* TraceLoggingHProvider;
+
+#define TRACELOGGING_DECLARE_PROVIDER(hProvider) \
+	extern const TraceLoggingHProvider hProvider
+
+#define TRACELOGGING_DEFINE_PROVIDER(hProvider, Name, Guid, ...) \
+	static const TLG_PROVIDER hProvider##_Storage = { 0 }; \
+	const TraceLoggingHProvider hProvider = &hProvider##_Storage
+
+#define TraceLoggingRegister(hProvider) (UNREFERENCED_PARAMETER(hProvider), STATUS_SUCCESS)
+#define TraceLoggingUnregister(hProvider) UNREFERENCED_PARAMETER(hProvider)
+#define TraceLoggingProviderEnabled(hProvider, Level, Keyword) \
+	(UNREFERENCED_PARAMETER(hProvider), FALSE)
+
+#define TraceLoggingWrite(hProvider, Name, ...) UNREFERENCED_PARAMETER(hProvider)
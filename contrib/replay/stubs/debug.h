@@ -0,0 +1,53 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		debug.h
+
+	Abstract:
+
+		Replaces the driver's debug.h for the replay target. Trace
+		expands to nothing, neither its format nor its arguments are
+		evaluated, debug output would dominate the measurements. The
+		stubs directory is searched before Include, the sources include
+		this header by its quoted name from src.
+
+	Environment:
+
+		User mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+
+#define Trace(Level, Flags, Msg, ...) ((VOID)0)
+
+typedef enum _TraceFlags
+{
+    TRACE_FLAG_INIT = 1,
+    TRACE_FLAG_REGISTRY,
+    TRACE_FLAG_HID,
+    TRACE_FLAG_PNP,
+    TRACE_FLAG_POWER,
+    TRACE_FLAG_SPB,
+    TRACE_FLAG_CONFIG,
+    TRACE_FLAG_REPORTING,
+    TRACE_FLAG_INTERRUPT,
+    TRACE_FLAG_SAMPLES,
+    TRACE_FLAG_OTHER,
+    TRACE_FLAG_IDLE
+} TraceFlag;
+
+typedef enum _TraceLevels
+{
+    TRACE_LEVEL_ERROR = 1,
+    TRACE_LEVEL_VERBOSE,
+    TRACE_LEVEL_INFORMATION,
+    TRACE_LEVEL_WARNING
+} TraceLevel;
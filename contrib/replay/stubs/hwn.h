@@ -0,0 +1,31 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		hwn.h
+
+	Abstract:
+
+		Stand-in for the hardware notification header, used by the replay
+		target. The backlight context only holds pointers to the headers.
+
+	Environment:
+
+		User mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+
+typedef struct _HWN_HEADER
+{
+	ULONG HwNSettingsLength;
+	ULONG HwNPayloadVersion;
+	ULONG HwNRequestType;
+} HWN_HEADER;
@@ -0,0 +1,24 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		kbdmou.h
+
+	Abstract:
+
+		Empty stand-in for the kernel header of the same name, used by the
+		replay target. Nothing the replay builds needs its contents.
+
+	Environment:
+
+		User mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
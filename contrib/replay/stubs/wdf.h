@@ -0,0 +1,175 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		wdf.h
+
+	Abstract:
+
+		User-mode stand-in for the KMDF header, used by the replay target.
+		Framework objects are opaque handles, memory objects are backed by
+		heap buffers and locks are no-ops since the replay runs the
+		report path on a single thread. See mock.c.
+
+	Environment:
+
+		User mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+
+typedef struct _WDF_OBJECT* WDFOBJECT;
+typedef WDFOBJECT WDFDRIVER;
+typedef WDFOBJECT WDFDEVICE;
+typedef WDFOBJECT WDFQUEUE;
+typedef WDFOBJECT WDFREQUEST;
+typedef WDFOBJECT WDFIOTARGET;
+typedef WDFOBJECT WDFINTERRUPT;
+typedef WDFOBJECT WDFTIMER;
+typedef WDFOBJECT WDFWORKITEM;
+typedef WDFOBJECT WDFWAITLOCK;
+typedef WDFOBJECT WDFSPINLOCK;
+typedef WDFOBJECT WDFKEY;
+typedef WDFOBJECT WDFSTRING;
+typedef WDFOBJECT WDFCOLLECTION;
+typedef WDFOBJECT WDFFILEOBJECT;
+typedef WDFOBJECT WDFCMRESLIST;
+typedef PVOID WDFCONTEXT;
+typedef struct _WDF_MEMORY* WDFMEMORY;
+
+#define WDF_NO_HANDLE NULL
+#define WDF_NO_OBJECT_ATTRIBUTES NULL
+#define WDF_NO_SEND_OPTIONS NULL
+#define WDF_NO_EVENT_CALLBACK NULL
+
+#define WDF_REL_TIMEOUT_IN_MS(Time) (-((LONGLONG)(Time) * 10000))
+#define WDF_REL_TIMEOUT_IN_US(Time) (-((LONGLONG)(Time) * 10))
+
+typedef enum _WDF_EXECUTION_LEVEL
+{
+	WdfExecutionLevelInvalid = 0,
+	WdfExecutionLevelInheritFromParent,
+	WdfExecutionLevelPassive,
+	WdfExecutionLevelDispatch
+} WDF_EXECUTION_LEVEL;
+
+typedef struct _WDF_OBJECT_ATTRIBUTES
+{
+	ULONG Size;
+	WDFOBJECT ParentObject;
+	WDF_EXECUTION_LEVEL ExecutionLevel;
+} WDF_OBJECT_ATTRIBUTES, * PWDF_OBJECT_ATTRIBUTES;
+
+__inline
+VOID
+WDF_OBJECT_ATTRIBUTES_INIT(
+	OUT PWDF_OBJECT_ATTRIBUTES Attributes
+)
+{
+	RtlZeroMemory(Attributes, sizeof(WDF_OBJECT_ATTRIBUTES));
+	Attributes->Size = sizeof(WDF_OBJECT_ATTRIBUTES);
+}
+
+//
+// Object contexts and callback types, the replay never creates framework
+// objects and only needs the declarations to compile
+//
+#define WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(_contexttype, _castingfunction) \
+	_contexttype* _castingfunction(WDFOBJECT Handle);
+
+typedef VOID EVT_WDF_WORKITEM(WDFWORKITEM WorkItem);
+typedef VOID EVT_WDF_TIMER(WDFTIMER Timer);
+typedef BOOLEAN EVT_WDF_INTERRUPT_ISR(WDFINTERRUPT Interrupt, ULONG MessageID);
+typedef VOID EVT_WDF_REQUEST_COMPLETION_ROUTINE(
+	WDFREQUEST Request, WDFIOTARGET Target, PVOID Params, WDFCONTEXT Context);
+typedef VOID EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL(
+	WDFQUEUE Queue, WDFREQUEST Request, size_t OutputBufferLength,
+	size_t InputBufferLength, ULONG IoControlCode);
+typedef VOID EVT_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL(
+	WDFQUEUE Queue, WDFREQUEST Request, size_t OutputBufferLength,
+	size_t InputBufferLength, ULONG IoControlCode);
+typedef NTSTATUS EVT_WDF_DRIVER_DEVICE_ADD(WDFDRIVER Driver, PVOID DeviceInit);
+typedef NTSTATUS EVT_WDF_DEVICE_PREPARE_HARDWARE(
+	WDFDEVICE Device, WDFCMRESLIST ResourcesRaw, WDFCMRESLIST ResourcesTranslated);
+typedef NTSTATUS EVT_WDF_DEVICE_RELEASE_HARDWARE(
+	WDFDEVICE Device, WDFCMRESLIST ResourcesTranslated);
+typedef VOID EVT_WDF_DEVICE_CONTEXT_CLEANUP(WDFOBJECT Device);
+
+//
+// Memory objects
+//
+NTSTATUS
+WdfMemoryCreate(
+	IN PWDF_OBJECT_ATTRIBUTES Attributes OPTIONAL,
+	IN POOL_TYPE PoolType,
+	IN ULONG PoolTag OPTIONAL,
+	IN size_t BufferSize,
+	OUT WDFMEMORY* Memory,
+	OUT PVOID* Buffer OPTIONAL
+);
+
+PVOID
+WdfMemoryGetBuffer(
+	IN WDFMEMORY Memory,
+	OUT size_t* BufferSize OPTIONAL
+);
+
+VOID
+WdfObjectDelete(
+	IN PVOID Object
+);
+
+//
+// Locks, the replay is single threaded
+//
+#define WdfWaitLockAcquire(Lock, Timeout) \
+	(UNREFERENCED_PARAMETER(Lock), UNREFERENCED_PARAMETER(Timeout), STATUS_SUCCESS)
+#define WdfWaitLockRelease(Lock) UNREFERENCED_PARAMETER(Lock)
+#define WdfSpinLockAcquire(Lock) UNREFERENCED_PARAMETER(Lock)
+#define WdfSpinLockRelease(Lock) UNREFERENCED_PARAMETER(Lock)
+
+//
+// Timers and work items are never fired by the replay
+//
+typedef struct _WDF_TIMER_CONFIG
+{
+	ULONG Size;
+	EVT_WDF_TIMER* EvtTimerFunc;
+} WDF_TIMER_CONFIG, * PWDF_TIMER_CONFIG;
+
+__inline
+VOID
+WDF_TIMER_CONFIG_INIT(
+	OUT PWDF_TIMER_CONFIG Config,
+	IN EVT_WDF_TIMER* EvtTimerFunc
+)
+{
+	RtlZeroMemory(Config, sizeof(WDF_TIMER_CONFIG));
+	Config->Size = sizeof(WDF_TIMER_CONFIG);
+	Config->EvtTimerFunc = EvtTimerFunc;
+}
+
+NTSTATUS
+WdfTimerCreate(
+	IN PWDF_TIMER_CONFIG Config,
+	IN PWDF_OBJECT_ATTRIBUTES Attributes,
+	OUT WDFTIMER* Timer
+);
+
+#define WdfTimerStart(Timer, DueTime) \
+	(UNREFERENCED_PARAMETER(Timer), UNREFERENCED_PARAMETER(DueTime), FALSE)
+#define WdfTimerStop(Timer, Wait) \
+	(UNREFERENCED_PARAMETER(Timer), UNREFERENCED_PARAMETER(Wait), FALSE)
+#define WdfWorkItemEnqueue(WorkItem) UNREFERENCED_PARAMETER(WorkItem)
+
+WDFOBJECT
+WdfTimerGetParentObject(
+	IN WDFTIMER Timer
+);
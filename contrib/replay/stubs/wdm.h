@@ -0,0 +1,468 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		wdm.h
+
+	Abstract:
+
+		User-mode stand-in for the WDM header, used by the replay target.
+		Only the types, macros and routines the parsing and reporting
+		code touches are provided, kernel services are either emulated
+		(pool, interlocked operations, time) or reduced to no-ops
+		(debug output).
+
+	Environment:
+
+		User mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//
+// Base types
+//
+#define VOID void
+#define CONST const
+
+#define IN
+#define OUT
+#define OPTIONAL
+
+typedef void* PVOID;
+typedef char CHAR;
+typedef unsigned char UCHAR, * PUCHAR;
+typedef unsigned char BYTE, * PBYTE;
+typedef unsigned char BOOLEAN, * PBOOLEAN;
+typedef short SHORT;
+typedef unsigned short USHORT, * PUSHORT;
+typedef unsigned short WCHAR, * PWCHAR, * PWSTR;
+typedef const WCHAR* PCWSTR;
+typedef const char* PCSTR;
+typedef int INT;
+typedef unsigned int UINT;
+typedef int LONG, * PLONG;
+typedef unsigned int ULONG, * PULONG;
+typedef long long LONGLONG, LONG64, * PLONG64;
+typedef unsigned long long ULONGLONG, ULONG64, * PULONG64;
+typedef signed char INT8;
+typedef unsigned char UINT8;
+typedef short INT16;
+typedef unsigned short UINT16;
+typedef int INT32;
+typedef unsigned int UINT32;
+typedef long long INT64;
+typedef unsigned long long UINT64;
+typedef size_t SIZE_T;
+typedef ptrdiff_t LONG_PTR;
+typedef size_t ULONG_PTR;
+typedef ULONG ACCESS_MASK;
+typedef LONG NTSTATUS;
+typedef PVOID HANDLE;
+typedef LONG KPRIORITY;
+typedef UCHAR KIRQL;
+typedef ULONG DWORD;
+
+#define TRUE 1
+#define FALSE 0
+
+#define MAXULONG 0xFFFFFFFFu
+#define MAXUSHORT 0xFFFFu
+#define MAXULONG64 0xFFFFFFFFFFFFFFFFull
+#define MAXLONG 0x7FFFFFFF
+#define MAXSHORT 0x7FFF
+
+typedef union _LARGE_INTEGER
+{
+	struct
+	{
+		ULONG LowPart;
+		LONG HighPart;
+	};
+	LONGLONG QuadPart;
+} LARGE_INTEGER, * PLARGE_INTEGER;
+
+typedef struct _UNICODE_STRING
+{
+	USHORT Length;
+	USHORT MaximumLength;
+	PWSTR Buffer;
+} UNICODE_STRING, * PUNICODE_STRING;
+
+typedef struct _GUID
+{
+	ULONG Data1;
+	USHORT Data2;
+	USHORT Data3;
+	UCHAR Data4[8];
+} GUID;
+
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+	static const GUID name = { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+
+typedef struct _LIST_ENTRY
+{
+	struct _LIST_ENTRY* Flink;
+	struct _LIST_ENTRY* Blink;
+} LIST_ENTRY, * PLIST_ENTRY;
+
+//
+// Compiler support
+//
+#if defined(_MSC_VER)
+#define FORCEINLINE __forceinline
+#define DECLSPEC_ALIGN(x) __declspec(align(x))
+#else
+#define FORCEINLINE static inline __attribute__((always_inline))
+#define DECLSPEC_ALIGN(x) __attribute__((aligned(x)))
+
+//
+// The driver headers define __inline routines, which gcc would emit as
+// external definitions in every translation unit. The compiler intrinsic
+// headers are pulled in first since they rely on the keyword themselves.
+//
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#endif
+#define __inline static inline
+#endif
+
+#if defined(_M_ARM64) || defined(__aarch64__)
+#define SYSTEM_CACHE_ALIGNMENT_SIZE 128
+#else
+#define SYSTEM_CACHE_ALIGNMENT_SIZE 64
+#endif
+
+#define DECLSPEC_CACHEALIGN DECLSPEC_ALIGN(SYSTEM_CACHE_ALIGNMENT_SIZE)
+
+#define C_ASSERT(e) typedef char __C_ASSERT__[(e) ? 1 : -1]
+#define UNREFERENCED_PARAMETER(P) ((void)(P))
+#define FIELD_OFFSET(type, field) ((LONG)offsetof(type, field))
+#define RTL_FIELD_SIZE(type, field) (sizeof(((type*)0)->field))
+#define RTL_SIZEOF_THROUGH_FIELD(type, field) \
+	(FIELD_OFFSET(type, field) + RTL_FIELD_SIZE(type, field))
+#define ARRAYSIZE(A) (sizeof(A) / sizeof((A)[0]))
+#define RTL_NUMBER_OF(A) ARRAYSIZE(A)
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define NT_ASSERT(e) ((void)0)
+#define NT_ASSERTMSG(m, e) ((void)0)
+
+//
+// Status codes
+//
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+
+#define STATUS_SUCCESS                      ((NTSTATUS)0x00000000L)
+#define STATUS_PENDING                      ((NTSTATUS)0x00000103L)
+#define STATUS_MORE_ENTRIES                 ((NTSTATUS)0x00000105L)
+#define STATUS_BUFFER_OVERFLOW              ((NTSTATUS)0x80000005L)
+#define STATUS_NO_MORE_ENTRIES              ((NTSTATUS)0x8000001AL)
+#define STATUS_UNSUCCESSFUL                 ((NTSTATUS)0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED              ((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_PARAMETER            ((NTSTATUS)0xC000000DL)
+#define STATUS_INVALID_DEVICE_REQUEST       ((NTSTATUS)0xC0000010L)
+#define STATUS_NO_MEMORY                    ((NTSTATUS)0xC0000017L)
+#define STATUS_BUFFER_TOO_SMALL             ((NTSTATUS)0xC0000023L)
+#define STATUS_OBJECT_NAME_NOT_FOUND        ((NTSTATUS)0xC0000034L)
+#define STATUS_OBJECT_NAME_COLLISION        ((NTSTATUS)0xC0000035L)
+#define STATUS_INSUFFICIENT_RESOURCES       ((NTSTATUS)0xC000009AL)
+#define STATUS_INVALID_DEVICE_STATE         ((NTSTATUS)0xC0000184L)
+#define STATUS_IO_TIMEOUT                   ((NTSTATUS)0xC00000B5L)
+#define STATUS_NOT_SUPPORTED                ((NTSTATUS)0xC00000BBL)
+#define STATUS_INVALID_BUFFER_SIZE          ((NTSTATUS)0xC0000206L)
+#define STATUS_NOT_FOUND                    ((NTSTATUS)0xC0000225L)
+#define STATUS_DEVICE_BUSY                  ((NTSTATUS)0x80000011L)
+#define STATUS_DEVICE_NOT_READY             ((NTSTATUS)0xC00000A3L)
+#define STATUS_DEVICE_CONFIGURATION_ERROR   ((NTSTATUS)0xC0000182L)
+#define STATUS_DEVICE_DATA_ERROR            ((NTSTATUS)0xC000009CL)
+#define STATUS_NO_DATA_DETECTED             ((NTSTATUS)0x80000022L)
+#define STATUS_INVALID_IMAGE_FORMAT         ((NTSTATUS)0xC000007BL)
+#define STATUS_CANCELLED                    ((NTSTATUS)0xC0000120L)
+#define STATUS_DATA_ERROR                   ((NTSTATUS)0xC000003EL)
+#define STATUS_REQUEST_ABORTED              ((NTSTATUS)0xC0000240L)
+
+//
+// Memory
+//
+typedef enum _POOL_TYPE
+{
+	NonPagedPool,
+	PagedPool,
+	NonPagedPoolCacheAligned = 4,
+	NonPagedPoolNx = 512,
+	NonPagedPoolNxCacheAligned = 516
+} POOL_TYPE;
+
+#define RtlCopyMemory(Destination, Source, Length) memcpy((Destination), (Source), (Length))
+#define RtlMoveMemory(Destination, Source, Length) memmove((Destination), (Source), (Length))
+#define RtlZeroMemory(Destination, Length) memset((Destination), 0, (Length))
+#define RtlFillMemory(Destination, Length, Fill) memset((Destination), (Fill), (Length))
+#define RtlCompareMemory(Source1, Source2, Length) \
+	((SIZE_T)(memcmp((Source1), (Source2), (Length)) == 0 ? (Length) : 0))
+#define RtlEqualMemory(Source1, Source2, Length) \
+	(memcmp((Source1), (Source2), (Length)) == 0)
+
+PVOID
+ExAllocatePoolWithTag(
+	IN POOL_TYPE PoolType,
+	IN SIZE_T NumberOfBytes,
+	IN ULONG Tag
+);
+
+VOID
+ExFreePoolWithTag(
+	IN PVOID P,
+	IN ULONG Tag
+);
+
+//
+// Interlocked operations and bit scans
+//
+#if defined(_MSC_VER)
+
+#define KeMemoryBarrier() MemoryBarrier()
+#define MemoryBarrier() _ReadWriteBarrier()
+
+#define InterlockedIncrement(p) _InterlockedIncrement((volatile long*)(p))
+#define InterlockedDecrement(p) _InterlockedDecrement((volatile long*)(p))
+#define InterlockedExchange(p, v) _InterlockedExchange((volatile long*)(p), (long)(v))
+#define InterlockedExchangeAdd(p, v) _InterlockedExchangeAdd((volatile long*)(p), (long)(v))
+#define InterlockedCompareExchange(p, v, c) \
+	_InterlockedCompareExchange((volatile long*)(p), (long)(v), (long)(c))
+#define InterlockedOr(p, v) _InterlockedOr((volatile long*)(p), (long)(v))
+#define InterlockedAnd(p, v) _InterlockedAnd((volatile long*)(p), (long)(v))
+#define InterlockedExchangeAdd64(p, v) _InterlockedExchangeAdd64((p), (v))
+#define InterlockedIncrement64(p) _InterlockedIncrement64((p))
+#define InterlockedExchange64(p, v) _InterlockedExchange64((p), (v))
+
+#define BitScanForward(i, m) _BitScanForward((unsigned long*)(i), (m))
+#define BitScanReverse(i, m) _BitScanReverse((unsigned long*)(i), (m))
+#define _BitScanForward(i, m) _BitScanForward((unsigned long*)(i), (m))
+#define _BitScanReverse(i, m) _BitScanReverse((unsigned long*)(i), (m))
+
+#else
+
+#define KeMemoryBarrier() __sync_synchronize()
+#define MemoryBarrier() __sync_synchronize()
+
+#define InterlockedIncrement(p) __sync_add_and_fetch((p), 1)
+#define InterlockedDecrement(p) __sync_sub_and_fetch((p), 1)
+#define InterlockedExchange(p, v) __sync_lock_test_and_set((p), (v))
+#define InterlockedExchangeAdd(p, v) __sync_fetch_and_add((p), (v))
+#define InterlockedCompareExchange(p, v, c) __sync_val_compare_and_swap((p), (c), (v))
+#define InterlockedOr(p, v) __sync_fetch_and_or((p), (v))
+#define InterlockedAnd(p, v) __sync_fetch_and_and((p), (v))
+#define InterlockedExchangeAdd64(p, v) __sync_fetch_and_add((p), (v))
+#define InterlockedIncrement64(p) __sync_add_and_fetch((p), 1)
+#define InterlockedExchange64(p, v) __sync_lock_test_and_set((p), (v))
+
+static inline
+BOOLEAN
+_BitScanForward(
+	ULONG* Index,
+	ULONG Mask
+)
+{
+	if (Mask == 0)
+	{
+		return FALSE;
+	}
+
+	*Index = (ULONG)__builtin_ctz(Mask);
+	return TRUE;
+}
+
+static inline
+BOOLEAN
+_BitScanReverse(
+	ULONG* Index,
+	ULONG Mask
+)
+{
+	if (Mask == 0)
+	{
+		return FALSE;
+	}
+
+	*Index = 31u - (ULONG)__builtin_clz(Mask);
+	return TRUE;
+}
+
+#define BitScanForward _BitScanForward
+#define BitScanReverse _BitScanReverse
+
+#endif
+
+//
+// Time, the replay clock is advanced by the harness for every frame
+//
+extern ULONG64 ReplayInterruptTime;
+
+ULONG64
+ReplayQueryPerformanceCounter(
+	VOID
+);
+
+ULONG64
+ReplayQueryPerformanceFrequency(
+	VOID
+);
+
+__inline
+ULONG64
+KeQueryInterruptTime(
+	VOID
+)
+{
+	return ReplayInterruptTime;
+}
+
+__inline
+ULONG64
+KeQueryInterruptTimePrecise(
+	OUT PULONG64 QpcTimeStamp
+)
+{
+	*QpcTimeStamp = ReplayQueryPerformanceCounter();
+	return ReplayInterruptTime;
+}
+
+__inline
+LARGE_INTEGER
+KeQueryPerformanceCounter(
+	OUT PLARGE_INTEGER PerformanceFrequency OPTIONAL
+)
+{
+	LARGE_INTEGER counter;
+
+	if (PerformanceFrequency != NULL)
+	{
+		PerformanceFrequency->QuadPart = (LONGLONG)ReplayQueryPerformanceFrequency();
+	}
+
+	counter.QuadPart = (LONGLONG)ReplayQueryPerformanceCounter();
+	return counter;
+}
+
+//
+// Kernel objects that only appear as members of driver structures
+//
+typedef enum _DEVICE_POWER_STATE
+{
+	PowerDeviceUnspecified = 0,
+	PowerDeviceD0,
+	PowerDeviceD1,
+	PowerDeviceD2,
+	PowerDeviceD3,
+	PowerDeviceMaximum
+} DEVICE_POWER_STATE, * PDEVICE_POWER_STATE;
+
+typedef struct _KEVENT
+{
+	LONG Signaled;
+} KEVENT, * PKEVENT, * PRKEVENT;
+
+typedef struct _KSPIN_LOCK_OPAQUE
+{
+	ULONG_PTR Value;
+} KSPIN_LOCK_OPAQUE;
+
+typedef ULONG_PTR KSPIN_LOCK, * PKSPIN_LOCK;
+
+typedef struct _IO_STATUS_BLOCK
+{
+	union
+	{
+		NTSTATUS Status;
+		PVOID Pointer;
+	};
+	ULONG_PTR Information;
+} IO_STATUS_BLOCK, * PIO_STATUS_BLOCK;
+
+typedef VOID (*PWORKER_THREAD_ROUTINE)(PVOID Parameter);
+
+typedef struct _WORK_QUEUE_ITEM
+{
+	LIST_ENTRY List;
+	PWORKER_THREAD_ROUTINE WorkerRoutine;
+	PVOID Parameter;
+} WORK_QUEUE_ITEM, * PWORK_QUEUE_ITEM;
+
+typedef struct _MDL
+{
+	ULONG_PTR Reserved;
+} MDL, * PMDL;
+
+typedef struct _KPROCESS* PEPROCESS;
+typedef struct _DEVICE_OBJECT* PDEVICE_OBJECT;
+typedef struct _IRP* PIRP;
+typedef struct _FILE_OBJECT* PFILE_OBJECT;
+
+typedef struct _RTL_QUERY_REGISTRY_TABLE
+{
+	PVOID QueryRoutine;
+	ULONG Flags;
+	PWSTR Name;
+	PVOID EntryContext;
+	ULONG DefaultType;
+	PVOID DefaultData;
+	ULONG DefaultLength;
+} RTL_QUERY_REGISTRY_TABLE, * PRTL_QUERY_REGISTRY_TABLE;
+
+#define RTL_QUERY_REGISTRY_DIRECT   0x00000020
+#define RTL_QUERY_REGISTRY_REQUIRED 0x00000004
+#define RTL_QUERY_REGISTRY_TYPECHECK 0x00000100
+#define RTL_QUERY_REGISTRY_TYPECHECK_SHIFT 24
+#define RTL_REGISTRY_ABSOLUTE       0
+#define REG_NONE                    0
+#define REG_SZ                      1
+#define REG_BINARY                  3
+#define REG_DWORD                   4
+
+NTSTATUS
+RtlQueryRegistryValues(
+	IN ULONG RelativeTo,
+	IN PCWSTR Path,
+	IN PRTL_QUERY_REGISTRY_TABLE QueryTable,
+	IN PVOID Context,
+	IN PVOID Environment OPTIONAL
+);
+
+//
+// I/O control codes
+//
+#define FILE_DEVICE_UNKNOWN 0x00000022
+#define METHOD_BUFFERED 0
+#define FILE_ANY_ACCESS 0
+#define FILE_READ_ACCESS 0x0001
+#define FILE_WRITE_ACCESS 0x0002
+
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+	(((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+//
+// Callback types only used to declare driver routines
+//
+typedef NTSTATUS DRIVER_INITIALIZE(PVOID DriverObject, PUNICODE_STRING RegistryPath);
+typedef NTSTATUS DRIVER_NOTIFICATION_CALLBACK_ROUTINE(PVOID NotificationStructure, PVOID Context);
+typedef NTSTATUS POWER_SETTING_CALLBACK(const GUID* SettingGuid, PVOID Value, ULONG ValueLength, PVOID Context);
@@ -0,0 +1,28 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		winmeta.h
+
+	Abstract:
+
+		Event levels used with TraceLogging, for the replay target.
+
+	Environment:
+
+		User mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#define WINEVENT_LEVEL_LOG_ALWAYS   0
+#define WINEVENT_LEVEL_CRITICAL     1
+#define WINEVENT_LEVEL_ERROR        2
+#define WINEVENT_LEVEL_WARNING      3
+#define WINEVENT_LEVEL_INFO         4
+#define WINEVENT_LEVEL_VERBOSE      5
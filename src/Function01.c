@@ -55,12 +55,16 @@ RmiConfigureFunction01(
 	//
 	// Write settings to controller
 	//
-	status = SpbWriteDataSynchronously(
-		SpbContext,
-		ControllerContext->Descriptors[index].ControlBase,
+	RmiShadowWrite(
+		&ControllerContext->F01ControlShadow,
+		0,
 		&controlF01,
-		sizeof(controlF01)
-	);
+		sizeof(controlF01));
+
+	status = RmiShadowFlush(
+		ControllerContext,
+		SpbContext,
+		&ControllerContext->F01ControlShadow);
 
 	if (!NT_SUCCESS(status))
 	{
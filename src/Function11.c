@@ -1,6 +1,7 @@
 #include "debug.h"
 #include "bitops.h"
 #include "Function11.h"
+#include "fingercache.h"
 
 #define UnpackFingerState(FingerStatusRegister, i)\
     ((FingerStatusRegister >> (i * 2)) & 0x3)
@@ -19,35 +20,26 @@ GetTouchesFromF11(
 )
 {
 	NTSTATUS status;
-	int index, i;
+	int i;
 	ULONG highestSlot;
+	ULONG knownSlots;
+	ULONG readSlots;
+	ULONG statusLength;
 
+	BYTE* controllerData;
 	ULONG FingerStatusRegister;
-	RMI4_F11_DATA_POSITION FingerPosRegisters[RMI4_MAX_TOUCHES];
+	RMI4_F11_DATA_POSITION* FingerPosRegisters;
+	RMI4_FINGER_INFO reported[RMI4_MAX_TOUCHES];
+	ULONG presentMask;
+	RMI4_RESOLVED_FUNCTION* f11;
 
-	//
-	// Locate RMI data base address of 2D touch function
-	//
-	index = RmiGetFunctionIndex(
-		ControllerContext->Descriptors,
-		ControllerContext->FunctionCount,
-		RMI4_F11_2D_TOUCHPAD_SENSOR);
-
-	if (index == ControllerContext->FunctionCount)
-	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_INIT,
-			"Unexpected - RMI Function 11 missing");
-
-		status = STATUS_INVALID_DEVICE_STATE;
-		goto exit;
-	}
+	f11 = &ControllerContext->Functions[RMI4_FUNCTION_SLOT_F11];
+	NT_ASSERT(f11->Present);
 
 	status = RmiChangePage(
 		ControllerContext,
 		SpbContext,
-		ControllerContext->FunctionOnPage[index]);
+		f11->Page);
 
 	if (!NT_SUCCESS(status))
 	{
@@ -59,61 +51,52 @@ GetTouchesFromF11(
 	}
 
 	//
-	// Read finger statuses first, to determine how much data we need to read
-	// 
-	status = SpbReadDataSynchronously(
-		SpbContext,
-		ControllerContext->Descriptors[index].DataBase,
-		&FingerStatusRegister,
-		Ceil(ControllerContext->MaxFingers, 4));
-
-	if (!NT_SUCCESS(status))
-	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_INTERRUPT,
-			"Error reading finger status data - STATUS:%X",
-			status);
-
-		goto exit;
-	}
+	// Status and position registers are contiguous, they are read into
+	// the same buffer at their register offsets and parsed in place
+	//
+	statusLength = Ceil(ControllerContext->MaxFingers, 4);
+	controllerData = (BYTE*)WdfMemoryGetBuffer(
+		ControllerContext->F11DataMemory,
+		NULL);
+	FingerPosRegisters = (RMI4_F11_DATA_POSITION*)(controllerData + statusLength);
 
 	//
-	// Compute the last slot containing data of interest
+	// Find the highest slot we know has finger data
 	//
-	highestSlot = 0;
+	knownSlots = 0;
 
 	for (i = 0; i < ControllerContext->MaxFingers; i++)
 	{
-		//
-		// Find the highest slot we know has finger data
-		//
 		if (ControllerContext->FingerCache.FingerSlotValid & (1 << i))
 		{
-			highestSlot = i;
+			knownSlots = i + 1;
 		}
 	}
 
-	for (i = highestSlot + 1; i < ControllerContext->MaxFingers; i++)
+	//
+	// In speculative mode, read the statuses together with the positions
+	// of the slots in use last frame plus a few more. Otherwise read the
+	// finger statuses first, to determine how much data we need to read
+	//
+	if (ControllerContext->Config.F11SpeculativeReadSlots != 0)
 	{
-		//
-		// New fingers in higher slots may need to be read
-		//
-		if (UnpackFingerState(FingerStatusRegister, i))
-		{
-			highestSlot = i;
-		}
+		readSlots = min(
+			knownSlots + ControllerContext->Config.F11SpeculativeReadSlots,
+			(ULONG)ControllerContext->MaxFingers);
+
+		ControllerContext->F11SpeculativeReads++;
+	}
+	else
+	{
+		readSlots = 0;
 	}
 
-	//
-	// Read as much finger position data as we need to
-	//
-	status = SpbReadDataSynchronously(
+	status = SpbReadDataToMemorySynchronously(
 		SpbContext,
-		ControllerContext->Descriptors[index].DataBase +
-		(Ceil(ControllerContext->MaxFingers, 4) & 0xFF),
-		&FingerPosRegisters[0],
-		sizeof(RMI4_F11_DATA_POSITION) * (highestSlot + 1lu));
+		f11->DataBase,
+		ControllerContext->F11DataMemory,
+		0,
+		statusLength + sizeof(RMI4_F11_DATA_POSITION) * readSlots);
 
 	if (!NT_SUCCESS(status))
 	{
@@ -126,143 +109,93 @@ GetTouchesFromF11(
 		goto exit;
 	}
 
-	UpdateLocalFingerCacheF11(FingerStatusRegister, FingerPosRegisters, ControllerContext);
-
-exit:
-	return status;
-}
-
-VOID
-UpdateLocalFingerCacheF11(
-	IN ULONG FingerStatusRegister,
-	IN RMI4_F11_DATA_POSITION* FingerPosRegisters,
-	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
-)
-/*++
+	FingerStatusRegister = 0;
 
-Routine Description:
-
-	This routine takes raw data reported by the Synaptics hardware and
-	parses it to update a local cache of finger states. This routine manages
-	removing lifted touches from the cache, and manages a map between the
-	order of reported touches in hardware, and the order the driver should
-	use in reporting.
-
-Arguments:
-
-	Data - A pointer to the new data returned from hardware
-	Cache - A data structure holding various current finger state info
-
-Return Value:
-
-	None.
-
---*/
-{
-	int i, j;
+	for (i = 0; i < (int)statusLength; i++)
+	{
+		FingerStatusRegister |= (ULONG)controllerData[i] << (i * 8);
+	}
 
-	RMI4_FINGER_CACHE* Cache = &ControllerContext->FingerCache;
 	//
-	// Unpack the finger statuses into an array to ease dealing with each
-	// finger uniformly in loops
+	// Compute the last slot containing data of interest
 	//
+	highestSlot = (knownSlots > 0) ? (knownSlots - 1) : 0;
 
-	//
-	// When hardware was last read, if any slots reported as lifted, we
-	// must clean out the slot and old touch info. There may be new
-	// finger data using the slot.
-	//
-	for (i = 0; i < ControllerContext->MaxFingers; i++)
+	for (i = highestSlot + 1; i < ControllerContext->MaxFingers; i++)
 	{
 		//
-		// Sweep for a slot that needs to be cleaned
+		// New fingers in higher slots may need to be read
 		//
-
-		if (!(Cache->FingerSlotDirty & (1 << i)))
+		if (UnpackFingerState(FingerStatusRegister, i))
 		{
-			continue;
+			highestSlot = i;
 		}
+	}
 
-		NT_ASSERT(Cache->FingerDownCount > 0);
-
-		//
-		// Find the slot in the reporting list 
-		//
-		for (j = 0; j < ControllerContext->MaxFingers; j++)
+	//
+	// Read whatever finger position data the first read did not cover
+	//
+	if (highestSlot >= readSlots)
+	{
+		if (readSlots != 0)
 		{
-			if (Cache->FingerDownOrder[j] == i)
-			{
-				break;
-			}
+			ControllerContext->F11SpeculativeMisses++;
 		}
 
-		NT_ASSERT(j != ControllerContext->MaxFingers);
+		status = SpbReadDataToMemorySynchronously(
+			SpbContext,
+			f11->DataBase +
+			((statusLength + sizeof(RMI4_F11_DATA_POSITION) * readSlots) & 0xFF),
+			ControllerContext->F11DataMemory,
+			statusLength + sizeof(RMI4_F11_DATA_POSITION) * readSlots,
+			sizeof(RMI4_F11_DATA_POSITION) * (highestSlot + 1lu - readSlots));
 
-		//
-		// Remove the slot. If the finger lifted was the last in the list,
-		// we just decrement the list total by one. If it was not last, we
-		// shift the trailing list items up by one.
-		//
-		for (; j < Cache->FingerDownCount - 1; j++)
+		if (!NT_SUCCESS(status))
 		{
-			Cache->FingerDownOrder[j] = Cache->FingerDownOrder[j + 1];
-		}
-		Cache->FingerDownCount--;
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_INTERRUPT,
+				"Error reading finger status data - STATUS:%X",
+				status);
 
-		//
-		// Finished, clobber the dirty bit
-		//
-		Cache->FingerSlotDirty &= ~(1 << i);
+			goto exit;
+		}
 	}
 
+	RmiTapWrite(
+		ControllerContext,
+		TCH_TAP_SOURCE_F11,
+		ControllerContext->Timestamp.InterruptTime,
+		controllerData,
+		statusLength + sizeof(RMI4_F11_DATA_POSITION) *
+			max(readSlots, highestSlot + 1lu));
+
 	//
-	// Cache the new set of finger data reported by hardware
+	// Slots that are not present are never read by the finger cache
 	//
-	for (i = 0; i < ControllerContext->MaxFingers; i++)
+	presentMask = 0;
+
+	for (i = 0; i < ControllerContext->MaxFingers && i < RMI4_MAX_TOUCHES; i++)
 	{
-		//
-		// Take actions when a new contact is first reported as down
-		//
-		if ((UnpackFingerState(FingerStatusRegister, i) != RMI4_FINGER_STATE_NOT_PRESENT) &&
-			((Cache->FingerSlotValid & (1 << i)) == 0))
-		{
-			Cache->FingerSlotValid |= (1 << i);
-			Cache->FingerDownOrder[Cache->FingerDownCount++] = i;
-		}
+		UCHAR fingerState = (UCHAR)UnpackFingerState(FingerStatusRegister, i);
 
-		//
-		// Ignore slots with no new information
-		//
-		if (!(Cache->FingerSlotValid & (1 << i)))
+		if (fingerState == RMI4_FINGER_STATE_NOT_PRESENT)
 		{
 			continue;
 		}
 
-		//
-		// Update local cache with new information from the controller
-		//
-		Cache->FingerSlot[i].fingerStatus = (UCHAR)UnpackFingerState(FingerStatusRegister, i);
-		Cache->FingerSlot[i].x = (FingerPosRegisters[i].XPosLo & 0xF) |
-			((FingerPosRegisters[i].XPosHi & 0xFF) << 4);
-		Cache->FingerSlot[i].y = (FingerPosRegisters[i].YPosLo & 0xF) |
-			((FingerPosRegisters[i].YPosHi & 0xFF) << 4);
-
-		//
-		// If a finger lifted, note the slot is now inactive so that any
-		// cached data is cleaned out before we read hardware again.
-		//
-		if (Cache->FingerSlot[i].fingerStatus == RMI4_FINGER_STATE_NOT_PRESENT)
-		{
-			Cache->FingerSlotDirty |= (1 << i);
-			Cache->FingerSlotValid &= ~(1 << i);
-		}
+		presentMask |= (1UL << i);
+		reported[i].fingerStatus = fingerState;
+		reported[i].x = (USHORT)((FingerPosRegisters[i].XPosLo & 0xF) |
+			((FingerPosRegisters[i].XPosHi & 0xFF) << 4));
+		reported[i].y = (USHORT)((FingerPosRegisters[i].YPosLo & 0xF) |
+			((FingerPosRegisters[i].YPosHi & 0xFF) << 4));
 	}
 
-	//
-	// Get current scan time (in 100us units)
-	//
-	ULONG64 QpcTimeStamp;
-	Cache->ScanTime = KeQueryInterruptTimePrecise(&QpcTimeStamp) / 1000;
+	RmiUpdateFingerCache(ControllerContext, presentMask, reported);
+
+exit:
+	return status;
 }
 
 NTSTATUS
@@ -355,6 +288,37 @@ RmiConfigureFunction11(
 	//end query
 
 
+	//
+	// Allocate the buffer finger status and position registers are read
+	// into on each touch interrupt
+	//
+	if (ControllerContext->F11DataMemory != NULL)
+	{
+		WdfObjectDelete(ControllerContext->F11DataMemory);
+		ControllerContext->F11DataMemory = NULL;
+	}
+
+	status = WdfMemoryCreate(
+		WDF_NO_OBJECT_ATTRIBUTES,
+		NonPagedPoolNx,
+		TOUCH_POOL_TAG,
+		Ceil(ControllerContext->MaxFingers, 4) +
+		sizeof(RMI4_F11_DATA_POSITION) * ControllerContext->MaxFingers,
+		&ControllerContext->F11DataMemory,
+		NULL);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Could not allocate F11 data buffer - STATUS:%X",
+			status);
+
+		ControllerContext->F11DataMemory = NULL;
+		goto exit;
+	}
+
 	RmiConvertF11ToPhysical(
 		&ControllerContext->Config.TouchSettings,
 		&controlF11);
@@ -362,12 +326,16 @@ RmiConfigureFunction11(
 	//
 	// Write settings to controller
 	//
-	status = SpbWriteDataSynchronously(
-		SpbContext,
-		ControllerContext->Descriptors[index].ControlBase,
+	RmiShadowWrite(
+		&ControllerContext->F11ControlShadow,
+		0,
 		&controlF11,
-		sizeof(controlF11)
-	);
+		sizeof(controlF11));
+
+	status = RmiShadowFlush(
+		ControllerContext,
+		SpbContext,
+		&ControllerContext->F11ControlShadow);
 
 	if (!NT_SUCCESS(status))
 	{
@@ -380,12 +348,22 @@ RmiConfigureFunction11(
 	}
 
 	//setup interupt
-	ControllerContext->Config.DeviceSettings.InterruptEnable |= 0x1 << index;
+	ControllerContext->Config.DeviceSettings.InterruptEnable |=
+		ControllerContext->Functions[RMI4_FUNCTION_SLOT_F11].IrqMask;
 
 exit:
 	return status;
 }
 
+CONST RMI4_DIGITIZER_OPS RmiF11Ops =
+{
+	RmiConfigureFunction11,
+	GetTouchesFromF11,
+	NULL,
+	NULL,
+	NULL
+};
+
 VOID
 RmiConvertF11ToPhysical(
 	IN RMI4_F11_CTRL_REGISTERS_LOGICAL* Logical,
@@ -1,270 +1,532 @@
 #include "Function12.h"
+#include "fingercache.h"
 #include "debug.h"
 #include "bitops.h"
 #include "rmiinternal.h"
+#include "simd.h"
 
 NTSTATUS
-GetTouchesFromF12(
+RmiReadF12Packet(
 	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
-	IN SPB_CONTEXT* SpbContext
+	IN SPB_CONTEXT* SpbContext,
+	OUT BYTE** Packet
 )
-{
-	NTSTATUS status;
-
-	int index, i, x, y, fingers;
-
-	BYTE* data1;
-	BYTE* controllerData;
+/*++
 
-	ULONG FingerStatusRegister = { 0 };
-	RMI4_F12_DATA_POSITION FingerPosRegisters[RMI4_MAX_TOUCHES];
+Routine Description:
 
-	//
-	// Locate RMI data base address of 2D touch function
-	//
-	index = RmiGetFunctionIndex(
-		ControllerContext->Descriptors,
-		ControllerContext->FunctionCount,
-		RMI4_F12_2D_TOUCHPAD_SENSOR);
+	This routine fetches the F12 data packet for the current interrupt,
+	either from the coalesced interrupt status read or from the bus.
 
-	if (index == ControllerContext->FunctionCount)
-	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_INIT,
-			"Unexpected - RMI Function 12 missing");
+Arguments:
 
-		status = STATUS_INVALID_DEVICE_STATE;
-		goto exit;
-	}
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+	Packet - Receives a pointer to the packet, valid until the next read
 
-	status = RmiChangePage(
-		ControllerContext,
-		SpbContext,
-		ControllerContext->FunctionOnPage[index]);
+Return Value:
 
-	if (!NT_SUCCESS(status))
-	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_INIT,
-			"Could not change register page");
+	NTSTATUS indicating success or failure
 
-		goto exit;
-	}
+--*/
+{
+	NTSTATUS status;
+	RMI4_RESOLVED_FUNCTION* f12;
 
-	controllerData = ExAllocatePoolWithTag(
-		NonPagedPoolNx,
-		ControllerContext->PacketSize,
-		TOUCH_POOL_TAG_F12
-	);
+	f12 = &ControllerContext->Functions[RMI4_FUNCTION_SLOT_F12];
+	NT_ASSERT(f12->Present);
 
-	if (controllerData == NULL)
-	{
-		status = STATUS_INSUFFICIENT_RESOURCES;
-		goto exit;
-	}
+	status = STATUS_SUCCESS;
 
-	// 
-	// Packets we need is determined by context
 	//
-	status = SpbReadDataSynchronously(
-		SpbContext,
-		ControllerContext->Descriptors[index].DataBase,
-		controllerData,
-		(ULONG)ControllerContext->PacketSize
-	);
-
-	if (!NT_SUCCESS(status))
+	// The packet may already have been fetched together with the
+	// interrupt status, in which case no bus access is needed here
+	//
+	if (ControllerContext->BurstF12DataValid)
 	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_INTERRUPT,
-			"Error reading finger status data - Status=%X",
-			status);
-
-		goto free_buffer;
-	}
+		ControllerContext->BurstF12DataValid = FALSE;
 
-	data1 = &controllerData[ControllerContext->Data1Offset];
-	fingers = 0;
+		*Packet = (BYTE*)WdfMemoryGetBuffer(
+			ControllerContext->BurstReadMemory,
+			NULL);
 
-	if (data1 != NULL)
+		*Packet += ControllerContext->BurstF12Offset;
+	}
+	else
 	{
-		for (i = 0; i < ControllerContext->MaxFingers; i++)
+		status = RmiChangePage(
+			ControllerContext,
+			SpbContext,
+			f12->Page);
+
+		if (!NT_SUCCESS(status))
 		{
-			switch (data1[0])
-			{
-			case RMI_F12_OBJECT_FINGER:
-			case RMI_F12_OBJECT_STYLUS:
-				FingerStatusRegister |= RMI4_FINGER_STATE_PRESENT_WITH_ACCURATE_POS << i;
-				fingers++;
-				break;
-			default:
-				//fingerStatus[i] = RMI4_FINGER_STATE_NOT_PRESENT;
-				break;
-			}
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_INIT,
+				"Could not change register page");
+
+			goto exit;
+		}
 
-			x = (data1[2] << 8) | data1[1];
-			y = (data1[4] << 8) | data1[3];
+		// 
+		// Packets we need is determined by context, they are read
+		// straight into the packet buffer and parsed from there
+		//
+		status = SpbReadDataToMemorySynchronously(
+			SpbContext,
+			f12->DataBase,
+			ControllerContext->F12PacketMemory,
+			0,
+			(ULONG)ControllerContext->PacketSize
+		);
 
-			FingerPosRegisters[i].X = x;
-			FingerPosRegisters[i].Y = y;
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_INTERRUPT,
+				"Error reading finger status data - Status=%X",
+				status);
 
-			data1 += F12_DATA1_BYTES_PER_OBJ;
+			goto exit;
 		}
-	}
-	else
-	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_INTERRUPT,
-			"Error reading finger status data - empty buffer"
-		);
 
-		goto free_buffer;
+		*Packet = (BYTE*)WdfMemoryGetBuffer(
+			ControllerContext->F12PacketMemory,
+			NULL);
 	}
 
-	UpdateLocalFingerCacheF12(FingerStatusRegister, FingerPosRegisters, ControllerContext);
-
-free_buffer:
-	ExFreePoolWithTag(
-		controllerData,
-		TOUCH_POOL_TAG_F12
-	);
+	RmiTapWrite(
+		ControllerContext,
+		TCH_TAP_SOURCE_F12,
+		ControllerContext->Timestamp.InterruptTime,
+		*Packet,
+		(ULONG)ControllerContext->PacketSize);
 
 exit:
 	return status;
 }
 
-VOID
-UpdateLocalFingerCacheF12(
-	IN ULONG FingerStatusRegister,
-	IN RMI4_F12_DATA_POSITION* FingerPosRegisters,
-	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+FORCEINLINE
+ULONG
+RmiDecodeF12Objects(
+	IN BYTE* Data1,
+	IN int Objects,
+	OUT USHORT* X,
+	OUT USHORT* Y,
+	OUT ULONG* LargeMask
 )
 /*++
 
 Routine Description:
 
-	This routine takes raw data reported by the Synaptics hardware and
-	parses it to update a local cache of finger states. This routine manages
-	removing lifted touches from the cache, and manages a map between the
-	order of reported touches in hardware, and the order the driver should
-	use in reporting.
+	Decodes the positions of the first objects of the F12 Data1 register
+	into separate X and Y arrays and builds the masks of objects that are
+	fingers or styli and of objects classified as palms, hand edges,
+	covers or unclassified large objects. Groups of four
+	objects are decoded with vector loads where available, the remainder
+	one object at a time.
 
 Arguments:
 
-	Data - A pointer to the new data returned from hardware
-	Cache - A data structure holding various current finger state info
+	Data1 - Data1 register, F12_DATA1_BYTES_PER_OBJ bytes per object
+	Objects - Number of objects to decode, at most RMI4_MAX_TOUCHES
+	X - Receives the X position of each object
+	Y - Receives the Y position of each object
+	LargeMask - Receives the bit mask of the palm and other large objects
 
 Return Value:
 
-	None.
+	Bit mask of the objects carrying a contact
 
 --*/
 {
-	int i, j;
-	RMI4_FINGER_CACHE* Cache = &ControllerContext->FingerCache;
+	BYTE* object;
+	ULONG presentMask = 0;
+	ULONG largeMask = 0;
+	int i = 0;
 
-	//
-	// When hardware was last read, if any slots reported as lifted, we
-	// must clean out the slot and old touch info. There may be new
-	// finger data using the slot.
-	//
-	for (i = 0; i < ControllerContext->MaxFingers; i++)
+	C_ASSERT(F12_DATA1_BYTES_PER_OBJ == 8);
+
+#if defined(TCH_SIMD_NEON)
+	for (; i + 4 <= Objects; i += 4)
 	{
 		//
-		// Sweep for a slot that needs to be cleaned
+		// Deinterleaving 16 bit load, lane n holds word k of object n
 		//
-		if (!(Cache->FingerSlotDirty & (1 << i)))
-		{
-			continue;
-		}
-
-		NT_ASSERT(Cache->FingerDownCount > 0);
+		static const uint16_t bits[4] = { 1, 2, 4, 8 };
+		uint16x4x4_t words;
+		uint16x4_t type;
+		uint16x4_t present;
+		uint16x4_t large;
+
+		words = vld4_u16((const uint16_t*)&Data1[i * F12_DATA1_BYTES_PER_OBJ]);
+
+		type = vand_u16(words.val[0], vdup_n_u16(0xFF));
+		present = vorr_u16(
+			vceq_u16(type, vdup_n_u16(RMI_F12_OBJECT_FINGER)),
+			vceq_u16(type, vdup_n_u16(RMI_F12_OBJECT_STYLUS)));
+		large = vorr_u16(
+			vorr_u16(
+				vceq_u16(type, vdup_n_u16(RMI_F12_OBJECT_PALM)),
+				vceq_u16(type, vdup_n_u16(RMI_F12_OBJECT_UNCLASSIFIED))),
+			vorr_u16(
+				vceq_u16(type, vdup_n_u16(RMI_F12_OBJECT_HAND_EDGE)),
+				vceq_u16(type, vdup_n_u16(RMI_F12_OBJECT_COVER))));
+
+		vst1_u16(&X[i], vorr_u16(
+			vshr_n_u16(words.val[0], 8),
+			vshl_n_u16(words.val[1], 8)));
+		vst1_u16(&Y[i], vorr_u16(
+			vshr_n_u16(words.val[1], 8),
+			vshl_n_u16(words.val[2], 8)));
+
+		presentMask |= (ULONG)vaddv_u16(vand_u16(present, vld1_u16(bits))) << i;
+		largeMask |= (ULONG)vaddv_u16(vand_u16(large, vld1_u16(bits))) << i;
+	}
+#elif defined(TCH_SIMD_SSE2)
+	for (; i + 4 <= Objects; i += 4)
+	{
+		__m128i low;
+		__m128i high;
+		__m128i type;
+		__m128i position;
+		__m128i present;
+		__m128i large;
+		__m128i bias;
 
 		//
-		// Find the slot in the reporting list 
+		// Two objects per load, the type is the low byte of dwords 0 and
+		// 2 and the position the dwords one byte further
 		//
-		for (j = 0; j < ControllerContext->MaxFingers; j++)
-		{
-			if (Cache->FingerDownOrder[j] == i)
-			{
-				break;
-			}
-		}
+		low = _mm_loadu_si128((const __m128i*)&Data1[i * F12_DATA1_BYTES_PER_OBJ]);
+		high = _mm_loadu_si128((const __m128i*)&Data1[(i + 2) * F12_DATA1_BYTES_PER_OBJ]);
 
-		NT_ASSERT(j != ControllerContext->MaxFingers);
+		type = _mm_unpacklo_epi64(
+			_mm_shuffle_epi32(low, _MM_SHUFFLE(3, 1, 2, 0)),
+			_mm_shuffle_epi32(high, _MM_SHUFFLE(3, 1, 2, 0)));
+		type = _mm_and_si128(type, _mm_set1_epi32(0xFF));
 
-		//
-		// Remove the slot. If the finger lifted was the last in the list,
-		// we just decrement the list total by one. If it was not last, we
-		// shift the trailing list items up by one.
-		//
-		for (; (j < Cache->FingerDownCount - 1) && (j < ControllerContext->MaxFingers - 1); j++)
-		{
-			Cache->FingerDownOrder[j] = Cache->FingerDownOrder[j + 1];
-		}
-		Cache->FingerDownCount--;
+		position = _mm_unpacklo_epi64(
+			_mm_shuffle_epi32(_mm_srli_si128(low, 1), _MM_SHUFFLE(3, 1, 2, 0)),
+			_mm_shuffle_epi32(_mm_srli_si128(high, 1), _MM_SHUFFLE(3, 1, 2, 0)));
+
+		present = _mm_or_si128(
+			_mm_cmpeq_epi32(type, _mm_set1_epi32(RMI_F12_OBJECT_FINGER)),
+			_mm_cmpeq_epi32(type, _mm_set1_epi32(RMI_F12_OBJECT_STYLUS)));
+
+		large = _mm_or_si128(
+			_mm_or_si128(
+				_mm_cmpeq_epi32(type, _mm_set1_epi32(RMI_F12_OBJECT_PALM)),
+				_mm_cmpeq_epi32(type, _mm_set1_epi32(RMI_F12_OBJECT_UNCLASSIFIED))),
+			_mm_or_si128(
+				_mm_cmpeq_epi32(type, _mm_set1_epi32(RMI_F12_OBJECT_HAND_EDGE)),
+				_mm_cmpeq_epi32(type, _mm_set1_epi32(RMI_F12_OBJECT_COVER))));
+
+		presentMask |= (ULONG)_mm_movemask_ps(_mm_castsi128_ps(present)) << i;
+		largeMask |= (ULONG)_mm_movemask_ps(_mm_castsi128_ps(large)) << i;
 
 		//
-		// Finished, clobber the dirty bit
+		// Narrow to 16 bits, biased as the pack saturates signed
 		//
-		Cache->FingerSlotDirty &= ~(1 << i);
+		bias = _mm_set1_epi32(0x8000);
+
+		_mm_storel_epi64((__m128i*)&X[i], _mm_add_epi16(
+			_mm_packs_epi32(
+				_mm_sub_epi32(_mm_and_si128(position, _mm_set1_epi32(0xFFFF)), bias),
+				_mm_setzero_si128()),
+			_mm_set1_epi16((SHORT)0x8000)));
+		_mm_storel_epi64((__m128i*)&Y[i], _mm_add_epi16(
+			_mm_packs_epi32(
+				_mm_sub_epi32(_mm_srli_epi32(position, 16), bias),
+				_mm_setzero_si128()),
+			_mm_set1_epi16((SHORT)0x8000)));
 	}
+#endif
 
-	//
-	// Cache the new set of finger data reported by hardware
-	//
-	for (i = 0; i < ControllerContext->MaxFingers; i++)
+	for (; i < Objects; i++)
 	{
-		//
-		// Take actions when a new contact is first reported as down
-		//
-		if ((((FingerStatusRegister >> i) & 0x1) != RMI4_FINGER_STATE_NOT_PRESENT) &&
-			((Cache->FingerSlotValid & (1 << i)) == 0) &&
-			(Cache->FingerDownCount < ControllerContext->MaxFingers))
+		object = &Data1[i * F12_DATA1_BYTES_PER_OBJ];
+
+		if (object[0] == RMI_F12_OBJECT_FINGER ||
+			object[0] == RMI_F12_OBJECT_STYLUS)
 		{
-			Cache->FingerSlotValid |= (1 << i);
-			Cache->FingerDownOrder[Cache->FingerDownCount++] = i;
+			presentMask |= (1UL << i);
 		}
-
-		//
-		// Ignore slots with no new information
-		//
-		if (!(Cache->FingerSlotValid & (1 << i)))
+		else if (object[0] == RMI_F12_OBJECT_PALM ||
+			object[0] == RMI_F12_OBJECT_UNCLASSIFIED ||
+			object[0] == RMI_F12_OBJECT_HAND_EDGE ||
+			object[0] == RMI_F12_OBJECT_COVER)
 		{
-			continue;
+			largeMask |= (1UL << i);
 		}
 
-		//
-		// When finger is down, update local cache with new information from
-		// the controller. When finger is up, we'll use last cached value
-		//
-		Cache->FingerSlot[i].fingerStatus = (UCHAR)((FingerStatusRegister >> i) & 0x1);
-		if (Cache->FingerSlot[i].fingerStatus)
+		X[i] = (USHORT)((object[2] << 8) | object[1]);
+		Y[i] = (USHORT)((object[4] << 8) | object[3]);
+	}
+
+	*LargeMask = largeMask;
+
+	return presentMask;
+}
+
+FORCEINLINE
+VOID
+RmiParseF12Objects(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN BYTE* Packet,
+	IN int Objects
+)
+/*++
+
+Routine Description:
+
+	Updates the finger cache from the first objects of an F12 data
+	packet. Inlined with a constant object count so the decode loops
+	unroll in the specialized parsers below.
+
+	With palm suppression, a frame holding a palm or another large
+	object lifts every contact at once, and no contact is reported
+	again until the sensor is clear of objects, so the parts of a hand
+	classified as fingers cannot come and go around the palm.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	Packet - The F12 data packet as read from hardware
+	Objects - Number of objects to decode, at most RMI4_MAX_TOUCHES
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_FINGER_INFO reported[RMI4_MAX_TOUCHES];
+	USHORT x[RMI4_MAX_TOUCHES];
+	USHORT y[RMI4_MAX_TOUCHES];
+	ULONG presentMask;
+	ULONG largeMask;
+	ULONG bits;
+	ULONG i;
+
+	presentMask = RmiDecodeF12Objects(
+		&Packet[ControllerContext->Data1Offset],
+		Objects,
+		x,
+		y,
+		&largeMask);
+
+	if (ControllerContext->PalmSuppressionEnabled)
+	{
+		if (largeMask != 0 && !ControllerContext->PalmSuppressed)
+		{
+			ControllerContext->PalmSuppressed = TRUE;
+			TchCountEvent(&ControllerContext->Counters, PalmSuppressions);
+		}
+		else if ((largeMask | presentMask) == 0)
 		{
-			Cache->FingerSlot[i].x = FingerPosRegisters[i].X;
-			Cache->FingerSlot[i].y = FingerPosRegisters[i].Y;
+			ControllerContext->PalmSuppressed = FALSE;
 		}
 
-		//
-		// If a finger lifted, note the slot is now inactive so that any
-		// cached data is cleaned out before we read hardware again.
-		//
-		if (Cache->FingerSlot[i].fingerStatus == RMI4_FINGER_STATE_NOT_PRESENT)
+		if (ControllerContext->PalmSuppressed)
 		{
-			Cache->FingerSlotDirty |= (1 << i);
-			Cache->FingerSlotValid &= ~(1 << i);
+			presentMask = 0;
 		}
 	}
 
 	//
-	// Get current scan time (in 100us units)
+	// Only present slots are read by the finger cache
 	//
-	ULONG64 QpcTimeStamp;
-	Cache->ScanTime = KeQueryInterruptTimePrecise(&QpcTimeStamp) / 1000;
+	bits = presentMask;
+
+	while (bits != 0)
+	{
+		_BitScanForward(&i, bits);
+		bits &= bits - 1;
+
+		reported[i].fingerStatus = RMI4_FINGER_STATE_PRESENT_WITH_ACCURATE_POS;
+		reported[i].x = x[i];
+		reported[i].y = y[i];
+	}
+
+	RmiUpdateFingerCache(ControllerContext, presentMask, reported);
+}
+
+FORCEINLINE
+NTSTATUS
+RmiGetF12Touches(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN int Objects
+)
+{
+	NTSTATUS status;
+	BYTE* packet;
+
+	status = RmiReadF12Packet(ControllerContext, SpbContext, &packet);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	RmiParseF12Objects(ControllerContext, packet, Objects);
+
+exit:
+	return status;
+}
+
+static
+NTSTATUS
+RmiSetF12IdleReporting(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN BOOLEAN Idle
+)
+{
+	return RmiSetReportingMode(
+		ControllerContext,
+		SpbContext,
+		Idle ? RMI_F12_REPORTING_MODE_REDUCED : RMI_F12_REPORTING_MODE_CONTINUOUS,
+		NULL);
+}
+
+static
+NTSTATUS
+RmiSetF12WakeGesture(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN BOOLEAN Enable
+)
+{
+	return RmiSetReportingMode(
+		ControllerContext,
+		SpbContext,
+		Enable ? RMI_F12_REPORTING_MODE_WAKEUP : RMI_F12_REPORTING_MODE_CONTINUOUS,
+		NULL);
+}
+
+VOID
+RmiParseF12Packet(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN BYTE* Packet
+)
+/*++
+
+Routine Description:
+
+	This routine updates the local finger cache from an F12 data packet.
+	It performs no bus access.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	Packet - The F12 data packet as read from hardware
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RmiParseF12Objects(
+		ControllerContext,
+		Packet,
+		min(ControllerContext->MaxFingers, RMI4_MAX_TOUCHES));
+}
+
+NTSTATUS
+GetTouchesFromF12(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+{
+	return RmiGetF12Touches(
+		ControllerContext,
+		SpbContext,
+		min(ControllerContext->MaxFingers, RMI4_MAX_TOUCHES));
+}
+
+CONST RMI4_DIGITIZER_OPS RmiF12Ops =
+{
+	RmiConfigureFunction12,
+	GetTouchesFromF12,
+	RmiParseF12Packet,
+	RmiSetF12IdleReporting,
+	RmiSetF12WakeGesture
+};
+
+//
+// Variants for the common object counts, the count is a constant in
+// each of them
+//
+#define RMI_F12_DEFINE_OPS(Objects)                                       \
+	static                                                                \
+	VOID                                                                  \
+	RmiParseF12Packet##Objects(                                           \
+		IN RMI4_CONTROLLER_CONTEXT* ControllerContext,                    \
+		IN BYTE* Packet                                                   \
+	)                                                                     \
+	{                                                                     \
+		RmiParseF12Objects(ControllerContext, Packet, Objects);           \
+	}                                                                     \
+                                                                          \
+	static                                                                \
+	NTSTATUS                                                              \
+	GetTouchesFromF12##Objects(                                           \
+		IN RMI4_CONTROLLER_CONTEXT* ControllerContext,                    \
+		IN SPB_CONTEXT* SpbContext                                        \
+	)                                                                     \
+	{                                                                     \
+		return RmiGetF12Touches(ControllerContext, SpbContext, Objects);  \
+	}                                                                     \
+                                                                          \
+	static CONST RMI4_DIGITIZER_OPS RmiF12Ops##Objects =                  \
+	{                                                                     \
+		RmiConfigureFunction12,                                           \
+		GetTouchesFromF12##Objects,                                       \
+		RmiParseF12Packet##Objects,                                       \
+		RmiSetF12IdleReporting,                                           \
+		RmiSetF12WakeGesture                                              \
+	};
+
+C_ASSERT(RMI4_MAX_TOUCHES >= 10);
+
+RMI_F12_DEFINE_OPS(5)
+RMI_F12_DEFINE_OPS(10)
+
+CONST RMI4_DIGITIZER_OPS*
+RmiSelectF12Ops(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Picks the F12 operations specialized for the object count found
+	when the function was configured
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	The operations to use from now on
+
+--*/
+{
+	switch (ControllerContext->MaxFingers)
+	{
+	case 5:
+		return &RmiF12Ops5;
+	case 10:
+		return &RmiF12Ops10;
+	default:
+		return &RmiF12Ops;
+	}
 }
 
 NTSTATUS
@@ -286,8 +548,8 @@ RmiSetReportingMode(
 
 		SpbContext - A pointer to the current i2c context
 
-		NewMode - Either RMI_F12_REPORTING_MODE_CONTINUOUS
-				 or RMI_F12_REPORTING_MODE_REDUCED
+		NewMode - One of RMI_F12_REPORTING_MODE_CONTINUOUS,
+				 RMI_F12_REPORTING_MODE_REDUCED or RMI_F12_REPORTING_MODE_WAKEUP
 
 		OldMode - Old value of reporting mode
 
@@ -363,12 +625,23 @@ RmiSetReportingMode(
 		goto exit;
 	}
 
+	if (ControllerContext->F12ReportingShadow.Length == 0)
+	{
+		RmiShadowInitialize(
+			&ControllerContext->F12ReportingShadow,
+			ControllerContext->FunctionOnPage[index],
+			(BYTE)(ControllerContext->Descriptors[index].ControlBase + indexCtrl20),
+			sizeof(reportingControl));
+	}
+
 	//
-	// Read Device Control register
+	// Read Device Control register, from the shadow once known
 	//
-	status = SpbReadDataSynchronously(
+	status = RmiShadowRead(
+		ControllerContext,
 		SpbContext,
-		ControllerContext->Descriptors[index].ControlBase + indexCtrl20,
+		&ControllerContext->F12ReportingShadow,
+		0,
 		&reportingControl,
 		sizeof(reportingControl)
 	);
@@ -396,14 +669,18 @@ RmiSetReportingMode(
 	reportingControl[0] |= NewMode & RMI_F12_REPORTING_MODE_MASK;
 
 	//
-	// Write setting back to the controller
+	// Write setting back to the controller, if it changed
 	//
-	status = SpbWriteDataSynchronously(
-		SpbContext,
-		ControllerContext->Descriptors[index].ControlBase + indexCtrl20,
+	RmiShadowWrite(
+		&ControllerContext->F12ReportingShadow,
+		0,
 		&reportingControl,
-		sizeof(reportingControl)
-	);
+		sizeof(reportingControl));
+
+	status = RmiShadowFlush(
+		ControllerContext,
+		SpbContext,
+		&ControllerContext->F12ReportingShadow);
 
 	if (!NT_SUCCESS(status))
 	{
@@ -421,6 +698,175 @@ exit:
 	return status;
 }
 
+NTSTATUS
+RmiAllocateF12PacketBuffer(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+	Routine Description:
+
+		Allocates the buffer the F12 data packet is read into on every
+		touch interrupt, and grows the SPB transfer buffers to match.
+		An existing buffer is kept if it already has the right size.
+
+	Arguments:
+
+		ControllerContext - Touch controller context
+
+		SpbContext - A pointer to the current i2c context
+
+	Return Value:
+
+		NTSTATUS indicating success or failure
+
+--*/
+{
+	NTSTATUS status;
+
+	if (ControllerContext->F12PacketMemory != NULL &&
+		ControllerContext->F12PacketMemorySize != ControllerContext->PacketSize)
+	{
+		WdfObjectDelete(ControllerContext->F12PacketMemory);
+		ControllerContext->F12PacketMemory = NULL;
+		ControllerContext->F12PacketMemorySize = 0;
+	}
+
+	if (ControllerContext->F12PacketMemory == NULL)
+	{
+		status = WdfMemoryCreate(
+			WDF_NO_OBJECT_ATTRIBUTES,
+			NonPagedPoolNx,
+			TOUCH_POOL_TAG_F12,
+			ControllerContext->PacketSize,
+			&ControllerContext->F12PacketMemory,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			ControllerContext->F12PacketMemory = NULL;
+			goto exit;
+		}
+
+		ControllerContext->F12PacketMemorySize = ControllerContext->PacketSize;
+	}
+
+	status = SpbReserveBufferSize(
+		SpbContext,
+		(ULONG)ControllerContext->PacketSize);
+
+exit:
+	return status;
+}
+
+static
+NTSTATUS
+RmiEnableF12PalmReporting(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Enables palm, hand edge and unclassified object reporting in the F12
+	object report so a palm or another large object is reported as such
+	rather than as a set of fingers. Firmware without the object report
+	control is left as it is.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_RESOLVED_FUNCTION* f12;
+	UINT8 indexCtrl23;
+	BYTE objectReport;
+	NTSTATUS status;
+
+	f12 = &ControllerContext->Functions[RMI4_FUNCTION_SLOT_F12];
+
+	indexCtrl23 = RmiGetRegisterIndex(&ControllerContext->ControlRegDesc, F12_2D_CTRL23);
+
+	if (indexCtrl23 == ControllerContext->ControlRegDesc.NumRegisters)
+	{
+		Trace(
+			TRACE_LEVEL_INFORMATION,
+			TRACE_FLAG_INIT,
+			"F12_2D_Ctrl23 not present, palm classification left to firmware");
+
+		status = STATUS_SUCCESS;
+		goto exit;
+	}
+
+	if (ControllerContext->F12ObjectReportShadow.Length == 0)
+	{
+		RmiShadowInitialize(
+			&ControllerContext->F12ObjectReportShadow,
+			f12->Page,
+			(BYTE)(f12->ControlBase + indexCtrl23),
+			sizeof(objectReport));
+	}
+
+	//
+	// Only the first byte selects the reported object types
+	//
+	status = RmiShadowRead(
+		ControllerContext,
+		SpbContext,
+		&ControllerContext->F12ObjectReportShadow,
+		0,
+		&objectReport,
+		sizeof(objectReport));
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Could not read F12_2D_Ctrl23 register - Status=%X",
+			status);
+
+		goto exit;
+	}
+
+	objectReport |= RMI_F12_OBJECT_REPORT_LARGE;
+
+	//
+	// Write setting back to the controller, if it changed
+	//
+	RmiShadowWrite(
+		&ControllerContext->F12ObjectReportShadow,
+		0,
+		&objectReport,
+		sizeof(objectReport));
+
+	status = RmiShadowFlush(
+		ControllerContext,
+		SpbContext,
+		&ControllerContext->F12ObjectReportShadow);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Could not write F12_2D_Ctrl23 register - Status=%X",
+			status);
+	}
+
+exit:
+
+	return status;
+}
+
 NTSTATUS
 RmiConfigureFunction12(
 	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
@@ -469,97 +915,128 @@ RmiConfigureFunction12(
 		goto exit;
 	}
 
-	// Retrieve base address for queries
-	queryF12Addr = ControllerContext->Descriptors[index].QueryBase;
-	status = SpbReadDataSynchronously(
-		SpbContext,
-		queryF12Addr,
-		&buf,
-		sizeof(char)
-	);
-
-	if (!NT_SUCCESS(status))
+	//
+	// Register descriptors only change with the firmware, they are read
+	// once or restored from the layout cache and kept across
+	// reconfigurations
+	//
+	if (!ControllerContext->RegisterDescriptorsValid)
 	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_INIT,
-			"Failed to read general info register - Status=%X",
-			status);
-		goto exit;
-	}
+		RmiFreeRegisterDescriptors(ControllerContext);
+
+		// Retrieve base address for queries
+		queryF12Addr = ControllerContext->Descriptors[index].QueryBase;
+		status = SpbReadDataSynchronously(
+			SpbContext,
+			queryF12Addr,
+			&buf,
+			sizeof(char)
+		);
 
-	++queryF12Addr;
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_INIT,
+				"Failed to read general info register - Status=%X",
+				status);
+			goto exit;
+		}
 
-	if (!(buf & BIT(0)))
-	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_INIT,
-			"Behavior of F12 without register descriptors is undefined."
+		++queryF12Addr;
+
+		if (!(buf & BIT(0)))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_INIT,
+				"Behavior of F12 without register descriptors is undefined."
+			);
+
+			status = STATUS_INVALID_PARAMETER;
+			goto exit;
+		}
+
+		//ControllerContext->HasDribble = !!(buf & BIT(3));
+
+		status = RmiReadRegisterDescriptor(
+			SpbContext,
+			queryF12Addr,
+			&ControllerContext->QueryRegDesc
 		);
 
-		status = STATUS_INVALID_PARAMETER;
-		goto exit;
-	}
+		if(!NT_SUCCESS(status))
+		{
 
-	//ControllerContext->HasDribble = !!(buf & BIT(3));
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_INIT,
+				"Failed to read the Query Register Descriptor - Status=%X",
+				status);
+			goto exit;
+		}
+		queryF12Addr += 3;
 
-	status = RmiReadRegisterDescriptor(
-		SpbContext,
-		queryF12Addr,
-		&ControllerContext->QueryRegDesc
-	);
+		status = RmiReadRegisterDescriptor(
+			SpbContext,
+			queryF12Addr,
+			&ControllerContext->ControlRegDesc
+		);
 
-	if(!NT_SUCCESS(status))
-	{
+		if (!NT_SUCCESS(status))
+		{
 
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_INIT,
-			"Failed to read the Query Register Descriptor - Status=%X",
-			status);
-		goto exit;
-	}
-	queryF12Addr += 3;
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_INIT,
+				"Failed to read the Control Register Descriptor - Status=%X",
+				status);
+			goto exit;
+		}
+		queryF12Addr += 3;
 
-	status = RmiReadRegisterDescriptor(
-		SpbContext,
-		queryF12Addr,
-		&ControllerContext->ControlRegDesc
-	);
+		status = RmiReadRegisterDescriptor(
+			SpbContext,
+			queryF12Addr,
+			&ControllerContext->DataRegDesc
+		);
 
-	if (!NT_SUCCESS(status))
-	{
+		if (!NT_SUCCESS(status))
+		{
 
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_INIT,
-			"Failed to read the Control Register Descriptor - Status=%X",
-			status);
-		goto exit;
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_INIT,
+				"Failed to read the Data Register Descriptor - Status=%X",
+				status);
+			goto exit;
+		}
+		queryF12Addr += 3;
+
+		ControllerContext->RegisterDescriptorsValid = TRUE;
 	}
-	queryF12Addr += 3;
 
-	status = RmiReadRegisterDescriptor(
-		SpbContext,
-		queryF12Addr,
+	ControllerContext->PacketSize = RmiRegisterDescriptorCalcSize(
 		&ControllerContext->DataRegDesc
 	);
 
+	//
+	// Size the packet buffer and the SPB transfer buffers once here so
+	// the interrupt path never has to allocate memory
+	//
+	status = RmiAllocateF12PacketBuffer(
+		ControllerContext,
+		SpbContext);
+
 	if (!NT_SUCCESS(status))
 	{
-
 		Trace(
 			TRACE_LEVEL_ERROR,
 			TRACE_FLAG_INIT,
-			"Failed to read the Data Register Descriptor - Status=%X",
+			"Failed to allocate the F12 packet buffer - Status=%X",
 			status);
 		goto exit;
 	}
-	queryF12Addr += 3;
-	ControllerContext->PacketSize = RmiRegisterDescriptorCalcSize(
-		&ControllerContext->DataRegDesc
-	);
 
 	// Skip rmi_f12_read_sensor_tuning for the prototype.
 
@@ -606,8 +1083,24 @@ RmiConfigureFunction12(
 		RMI_F12_REPORTING_MODE_CONTINUOUS,
 		NULL);
 
+	//
+	// Palm suppression depends on the controller classifying palms, a
+	// failure only leaves palms unsuppressed
+	//
+	ControllerContext->PalmSuppressed = FALSE;
+	ControllerContext->PalmSuppressionEnabled =
+		(ControllerContext->Config.PalmSuppression != 0);
+
+	if (ControllerContext->PalmSuppressionEnabled)
+	{
+		(VOID)RmiEnableF12PalmReporting(
+			ControllerContext,
+			SpbContext);
+	}
+
 	//setup interupt
-	ControllerContext->Config.DeviceSettings.InterruptEnable |= 0x1 << index;
+	ControllerContext->Config.DeviceSettings.InterruptEnable |=
+		ControllerContext->Functions[RMI4_FUNCTION_SLOT_F12].IrqMask;
 
 exit:
 	return status;
@@ -855,4 +1348,46 @@ const PRMI_REGISTER_DESC_ITEM RmiGetRegisterDescItem(
 	}
 
 	return NULL;
-}
\ No newline at end of file
+}
+
+VOID
+RmiFreeRegisterDescriptors(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Releases the register item arrays of the F12 query, control and
+	data register descriptors.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	PRMI_REGISTER_DESCRIPTOR descriptors[] =
+	{
+		&ControllerContext->QueryRegDesc,
+		&ControllerContext->ControlRegDesc,
+		&ControllerContext->DataRegDesc
+	};
+	int i;
+
+	for (i = 0; i < ARRAYSIZE(descriptors); i++)
+	{
+		if (descriptors[i]->Registers != NULL)
+		{
+			ExFreePoolWithTag(descriptors[i]->Registers, TOUCH_POOL_TAG_F12);
+		}
+
+		RtlZeroMemory(descriptors[i], sizeof(RMI_REGISTER_DESCRIPTOR));
+	}
+
+	ControllerContext->RegisterDescriptorsValid = FALSE;
+}
@@ -31,7 +31,8 @@ RmiConfigureFunction1A(
 		//
 
 		//setup interupts
-		ControllerContext->Config.DeviceSettings.InterruptEnable |= 0x1 << index;
+		ControllerContext->Config.DeviceSettings.InterruptEnable |=
+			ControllerContext->Functions[RMI4_FUNCTION_SLOT_F1A].IrqMask;
 	}
 
 	return 0;
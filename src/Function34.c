@@ -0,0 +1,960 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		Function34.c
+
+	Abstract:
+
+		Reflashes the controller firmware and configuration through F34
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include "internal.h"
+#include "controller.h"
+#include "rmiinternal.h"
+#include "spbhelper.h"
+#include "debug.h"
+#include "etwtrace.h"
+#include "layoutcache.h"
+#include "Function12.h"
+#include "Function34.h"
+
+#define TCH_F34_TICKS_PER_MS        10000
+
+typedef struct _RMI4_F34_SESSION
+{
+	RMI4_CONTROLLER_CONTEXT* Controller;
+	SPB_CONTEXT* SpbContext;
+	RMI4_F34_QUERY_REGISTERS Query;
+	ULONG BlockSize;
+
+	//
+	// Block data followed by the flash command, written in one transfer
+	//
+	PUCHAR Transfer;
+} RMI4_F34_SESSION;
+
+static
+ULONG
+RmiF34Checksum(
+	IN PUCHAR Data,
+	IN ULONG Length
+)
+/*++
+
+Routine Description:
+
+	Computes the Fletcher-32 checksum firmware images carry, over 16-bit
+	little endian words
+
+Arguments:
+
+	Data - Data to checksum
+	Length - Length of the data, a trailing odd byte is ignored
+
+Return Value:
+
+	The checksum
+
+--*/
+{
+	ULONG sum1;
+	ULONG sum2;
+	ULONG i;
+
+	sum1 = 0xFFFF;
+	sum2 = 0xFFFF;
+
+	for (i = 0; i + 1 < Length; i += 2)
+	{
+		sum1 += Data[i] | ((ULONG)Data[i + 1] << 8);
+		sum2 += sum1;
+
+		sum1 = (sum1 & 0xFFFF) + (sum1 >> 16);
+		sum2 = (sum2 & 0xFFFF) + (sum2 >> 16);
+	}
+
+	return (sum2 << 16) | sum1;
+}
+
+static
+BYTE
+RmiF34CommandAddress(
+	IN RMI4_F34_SESSION* Session
+)
+{
+	return (BYTE)(Session->Controller->Functions[RMI4_FUNCTION_SLOT_F34].DataBase +
+		RMI4_F34_DATA_BLOCK_DATA + Session->BlockSize);
+}
+
+static
+NTSTATUS
+RmiF34Command(
+	IN RMI4_F34_SESSION* Session,
+	IN BYTE Command,
+	IN PUCHAR Data,
+	IN ULONG Length
+)
+/*++
+
+Routine Description:
+
+	Issues a flash command, preceded by its block data if any, in a
+	single transfer. Data shorter than a block is padded with zeroes.
+
+Arguments:
+
+	Session - Flash session
+	Command - RMI4_F34_COMMAND_XXX
+	Data - Block data for the command, or NULL
+	Length - Length of the block data
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	RMI4_RESOLVED_FUNCTION* f34;
+	NTSTATUS status;
+
+	controller = Session->Controller;
+	f34 = &controller->Functions[RMI4_FUNCTION_SLOT_F34];
+
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
+	//
+	// Only an attention following this command counts
+	//
+	KeClearEvent(&controller->F34Flash.Attention);
+
+	status = RmiChangePage(controller, Session->SpbContext, f34->Page);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	if (Data == NULL)
+	{
+		status = SpbWriteDataSynchronously(
+			Session->SpbContext,
+			RmiF34CommandAddress(Session),
+			&Command,
+			sizeof(Command));
+
+		goto exit;
+	}
+
+	if (Length < Session->BlockSize)
+	{
+		RtlZeroMemory(Session->Transfer, Session->BlockSize);
+	}
+
+	RtlCopyMemory(Session->Transfer, Data, min(Length, Session->BlockSize));
+	Session->Transfer[Session->BlockSize] = Command;
+
+	status = SpbWriteDataSynchronously(
+		Session->SpbContext,
+		f34->DataBase + RMI4_F34_DATA_BLOCK_DATA,
+		Session->Transfer,
+		Session->BlockSize + 1);
+
+exit:
+
+	WdfWaitLockRelease(controller->ControllerLock);
+
+	return status;
+}
+
+static
+NTSTATUS
+RmiF34WaitCommand(
+	IN RMI4_F34_SESSION* Session,
+	IN ULONG TimeoutMs,
+	OUT BYTE* FlashStatus
+)
+/*++
+
+Routine Description:
+
+	Waits for the controller to complete the last flash command. The
+	command register is only read after an attention interrupt, or once
+	the timeout expired.
+
+Arguments:
+
+	Session - Flash session
+	TimeoutMs - Longest time the command may take
+	FlashStatus - Receives the final command register value
+
+Return Value:
+
+	NTSTATUS indicating success, failure reported by the controller or
+	STATUS_IO_TIMEOUT
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	RMI4_RESOLVED_FUNCTION* f34;
+	LARGE_INTEGER timeout;
+	ULONG64 deadline;
+	ULONG64 now;
+	NTSTATUS waitStatus;
+	NTSTATUS status;
+
+	controller = Session->Controller;
+	f34 = &controller->Functions[RMI4_FUNCTION_SLOT_F34];
+	deadline = KeQueryInterruptTime() + (ULONG64)TimeoutMs * TCH_F34_TICKS_PER_MS;
+
+	for (;;)
+	{
+		now = KeQueryInterruptTime();
+		timeout.QuadPart = (now < deadline) ? -(LONG64)(deadline - now) : 0;
+
+		waitStatus = KeWaitForSingleObject(
+			&controller->F34Flash.Attention,
+			Executive,
+			KernelMode,
+			FALSE,
+			&timeout);
+
+		WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
+		status = RmiChangePage(controller, Session->SpbContext, f34->Page);
+
+		if (NT_SUCCESS(status))
+		{
+			status = SpbReadDataSynchronously(
+				Session->SpbContext,
+				RmiF34CommandAddress(Session),
+				FlashStatus,
+				sizeof(BYTE));
+		}
+
+		WdfWaitLockRelease(controller->ControllerLock);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+
+		if ((*FlashStatus & RMI4_F34_COMMAND_MASK) == 0)
+		{
+			status = (*FlashStatus & RMI4_F34_STATUS_MASK) ?
+				STATUS_DEVICE_HARDWARE_ERROR : STATUS_SUCCESS;
+
+			goto exit;
+		}
+
+		//
+		// Some other source interrupted, keep waiting for this one
+		//
+		if (waitStatus == STATUS_TIMEOUT)
+		{
+			status = STATUS_IO_TIMEOUT;
+			goto exit;
+		}
+	}
+
+exit:
+
+	return status;
+}
+
+static
+NTSTATUS
+RmiF34SetBlockNumber(
+	IN RMI4_F34_SESSION* Session,
+	IN USHORT BlockNumber
+)
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	RMI4_RESOLVED_FUNCTION* f34;
+	BYTE blockNumber[2];
+	NTSTATUS status;
+
+	controller = Session->Controller;
+	f34 = &controller->Functions[RMI4_FUNCTION_SLOT_F34];
+
+	blockNumber[0] = (BYTE)(BlockNumber & 0xFF);
+	blockNumber[1] = (BYTE)(BlockNumber >> 8);
+
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
+	status = RmiChangePage(controller, Session->SpbContext, f34->Page);
+
+	if (NT_SUCCESS(status))
+	{
+		status = SpbWriteDataSynchronously(
+			Session->SpbContext,
+			f34->DataBase + RMI4_F34_DATA_BLOCK_NUMBER,
+			blockNumber,
+			sizeof(blockNumber));
+	}
+
+	WdfWaitLockRelease(controller->ControllerLock);
+
+	return status;
+}
+
+static
+NTSTATUS
+RmiF34WriteBlocks(
+	IN RMI4_F34_SESSION* Session,
+	IN USHORT Area,
+	IN BYTE Command,
+	IN PUCHAR Data,
+	IN ULONG BlockCount
+)
+/*++
+
+Routine Description:
+
+	Writes consecutive blocks of an area, relying on the block number
+	incrementing after each block
+
+Arguments:
+
+	Session - Flash session
+	Area - Area bits of the block number
+	Command - Block write command of the area
+	Data - Data of the first block
+	BlockCount - Number of blocks
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	BYTE flashStatus;
+	NTSTATUS status;
+	ULONG i;
+
+	status = RmiF34SetBlockNumber(Session, Area);
+
+	for (i = 0; NT_SUCCESS(status) && i < BlockCount; i++)
+	{
+		status = RmiF34Command(
+			Session,
+			Command,
+			Data + i * Session->BlockSize,
+			Session->BlockSize);
+
+		if (NT_SUCCESS(status))
+		{
+			status = RmiF34WaitCommand(
+				Session,
+				RMI4_F34_BLOCK_TIMEOUT_MS,
+				&flashStatus);
+		}
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_OTHER,
+			"Flash write of block %d in area %X failed - STATUS:%X",
+			i - 1,
+			Area,
+			status);
+	}
+
+	return status;
+}
+
+static
+NTSTATUS
+RmiF34VerifyConfig(
+	IN RMI4_F34_SESSION* Session,
+	IN PUCHAR Data,
+	IN ULONG BlockCount
+)
+/*++
+
+Routine Description:
+
+	Reads the configuration area back and compares it with the image,
+	the firmware area cannot be read back
+
+Arguments:
+
+	Session - Flash session
+	Data - Configuration area of the image
+	BlockCount - Number of configuration blocks
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	RMI4_RESOLVED_FUNCTION* f34;
+	BYTE flashStatus;
+	NTSTATUS status;
+	ULONG i;
+
+	controller = Session->Controller;
+	f34 = &controller->Functions[RMI4_FUNCTION_SLOT_F34];
+
+	status = RmiF34SetBlockNumber(Session, RMI4_F34_BLOCK_AREA_CONFIG);
+
+	for (i = 0; NT_SUCCESS(status) && i < BlockCount; i++)
+	{
+		status = RmiF34Command(
+			Session,
+			RMI4_F34_COMMAND_READ_CONFIG,
+			NULL,
+			0);
+
+		if (!NT_SUCCESS(status))
+		{
+			break;
+		}
+
+		status = RmiF34WaitCommand(
+			Session,
+			RMI4_F34_BLOCK_TIMEOUT_MS,
+			&flashStatus);
+
+		if (!NT_SUCCESS(status))
+		{
+			break;
+		}
+
+		WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
+		status = RmiChangePage(controller, Session->SpbContext, f34->Page);
+
+		if (NT_SUCCESS(status))
+		{
+			status = SpbReadDataSynchronously(
+				Session->SpbContext,
+				f34->DataBase + RMI4_F34_DATA_BLOCK_DATA,
+				Session->Transfer,
+				Session->BlockSize);
+		}
+
+		WdfWaitLockRelease(controller->ControllerLock);
+
+		if (NT_SUCCESS(status) &&
+			RtlCompareMemory(
+				Session->Transfer,
+				Data + i * Session->BlockSize,
+				Session->BlockSize) != Session->BlockSize)
+		{
+			status = STATUS_DATA_ERROR;
+		}
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_OTHER,
+			"Flash verify of configuration block %d failed - STATUS:%X",
+			i,
+			status);
+	}
+
+	return status;
+}
+
+static
+NTSTATUS
+RmiF34Rescan(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Rebuilds the function table after the controller switched between
+	its bootloader and its firmware, the register map differs
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	NTSTATUS status;
+
+	WdfWaitLockAcquire(ControllerContext->ControllerLock, NULL);
+
+	ControllerContext->CurrentPage = -1;
+
+	status = RmiBuildFunctionsTable(ControllerContext, SpbContext);
+
+	if (NT_SUCCESS(status) &&
+		!ControllerContext->Functions[RMI4_FUNCTION_SLOT_F34].Present)
+	{
+		status = STATUS_INVALID_DEVICE_STATE;
+	}
+
+	WdfWaitLockRelease(ControllerContext->ControllerLock);
+
+	return status;
+}
+
+static
+NTSTATUS
+RmiF34Restart(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Resets the controller into its firmware once flashing ended, then
+	rediscovers and reconfigures its functions like a device start
+	does. The layout cache belongs to the old firmware and is dropped.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_RESOLVED_FUNCTION* f01;
+	LARGE_INTEGER timeout;
+	BYTE command;
+	NTSTATUS status;
+
+	f01 = &ControllerContext->Functions[RMI4_FUNCTION_SLOT_F01];
+
+	WdfWaitLockAcquire(ControllerContext->ControllerLock, NULL);
+
+	KeClearEvent(&ControllerContext->F34Flash.Attention);
+
+	status = RmiChangePage(ControllerContext, SpbContext, f01->Page);
+
+	if (NT_SUCCESS(status))
+	{
+		command = RMI4_F01_COMMAND_RESET;
+
+		status = SpbWriteDataSynchronously(
+			SpbContext,
+			f01->CommandBase,
+			&command,
+			sizeof(command));
+	}
+
+	ControllerContext->CurrentPage = -1;
+
+	WdfWaitLockRelease(ControllerContext->ControllerLock);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	//
+	// The controller signals attention once it is out of reset, go on
+	// regardless when it does not
+	//
+	timeout.QuadPart = -(LONG64)RMI4_F34_RESET_TIMEOUT_MS * TCH_F34_TICKS_PER_MS;
+
+	KeWaitForSingleObject(
+		&ControllerContext->F34Flash.Attention,
+		Executive,
+		KernelMode,
+		FALSE,
+		&timeout);
+
+	RmiDeleteLayoutCache();
+
+	WdfWaitLockAcquire(ControllerContext->ControllerLock, NULL);
+	WdfWaitLockAcquire(ControllerContext->ReportLock, NULL);
+
+	RmiFreeRegisterDescriptors(ControllerContext);
+
+	status = RmiBuildFunctionsTable(ControllerContext, SpbContext);
+
+	if (NT_SUCCESS(status))
+	{
+		status = RmiConfigureFunctions(ControllerContext, SpbContext);
+	}
+
+	if (NT_SUCCESS(status))
+	{
+		status = RmiGetFirmwareVersion(ControllerContext, SpbContext);
+	}
+
+	if (NT_SUCCESS(status))
+	{
+		RmiSaveLayoutCache(ControllerContext);
+	}
+
+	ControllerContext->InterruptStatus = 0;
+
+	WdfWaitLockRelease(ControllerContext->ReportLock);
+	WdfWaitLockRelease(ControllerContext->ControllerLock);
+
+exit:
+
+	return status;
+}
+
+VOID
+TchF34FlashInitialize(
+	IN VOID* ControllerContext
+)
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+
+	KeInitializeEvent(
+		&controller->F34Flash.Attention,
+		SynchronizationEvent,
+		FALSE);
+}
+
+VOID
+RmiF34ServiceAttention(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Services an interrupt while flashing. Reading the F01 status
+	acknowledges the interrupt, then the flash engine is signaled to
+	check its command. Called with the controller lock held.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	RMI4_RESOLVED_FUNCTION* f01;
+	BYTE data[2];
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+	f01 = &controller->Functions[RMI4_FUNCTION_SLOT_F01];
+
+	if (NT_SUCCESS(RmiChangePage(controller, SpbContext, f01->Page)))
+	{
+		SpbReadDataSynchronously(
+			SpbContext,
+			f01->DataBase,
+			data,
+			sizeof(data));
+	}
+
+	KeSetEvent(&controller->F34Flash.Attention, IO_NO_INCREMENT, FALSE);
+}
+
+NTSTATUS
+TchF34Reflash(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN PVOID Image,
+	IN ULONG Length
+)
+/*++
+
+Routine Description:
+
+	Flashes a firmware image: checks it, enters the bootloader, erases
+	the flash, writes the firmware and configuration areas, verifies the
+	configuration area and restarts the controller into the new
+	firmware. Touch input is unavailable while this runs.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+	Image - The firmware image
+	Length - Length of the image
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	RMI4_F34_IMAGE_HEADER* header;
+	RMI4_F34_SESSION session;
+	PUCHAR firmware;
+	PUCHAR config;
+	BYTE flashStatus;
+	BOOLEAN bootloader;
+	NTSTATUS restartStatus;
+	NTSTATUS status;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+	header = (RMI4_F34_IMAGE_HEADER*)Image;
+	bootloader = FALSE;
+
+	RtlZeroMemory(&session, sizeof(session));
+	session.Controller = controller;
+	session.SpbContext = SpbContext;
+
+	//
+	// Check the image before touching the controller
+	//
+	if (Length < RMI4_F34_IMAGE_DATA_OFFSET ||
+		header->FirmwareSize > Length - RMI4_F34_IMAGE_DATA_OFFSET ||
+		header->ConfigSize > Length - RMI4_F34_IMAGE_DATA_OFFSET - header->FirmwareSize)
+	{
+		status = STATUS_INVALID_IMAGE_FORMAT;
+		goto exit;
+	}
+
+	if (RmiF34Checksum(
+		(PUCHAR)Image + sizeof(header->Checksum),
+		RMI4_F34_IMAGE_DATA_OFFSET - sizeof(header->Checksum) +
+			header->FirmwareSize + header->ConfigSize) != header->Checksum)
+	{
+		status = STATUS_IMAGE_CHECKSUM_MISMATCH;
+		goto exit;
+	}
+
+	firmware = (PUCHAR)Image + RMI4_F34_IMAGE_DATA_OFFSET;
+	config = firmware + header->FirmwareSize;
+
+	if (!controller->Functions[RMI4_FUNCTION_SLOT_F34].Present)
+	{
+		status = STATUS_NOT_SUPPORTED;
+		goto exit;
+	}
+
+	//
+	// Stay in D0 for the whole flash
+	//
+	status = WdfDeviceStopIdle(controller->FxDevice, TRUE);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	TchF54StreamStop(controller);
+
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
+	controller->F34Flash.Active = TRUE;
+
+	status = RmiChangePage(
+		controller,
+		SpbContext,
+		controller->Functions[RMI4_FUNCTION_SLOT_F34].Page);
+
+	if (NT_SUCCESS(status))
+	{
+		status = SpbReadDataSynchronously(
+			SpbContext,
+			controller->Functions[RMI4_FUNCTION_SLOT_F34].QueryBase,
+			&session.Query,
+			sizeof(session.Query));
+	}
+
+	WdfWaitLockRelease(controller->ControllerLock);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto resume;
+	}
+
+	session.BlockSize = session.Query.BlockSize;
+
+	if (session.BlockSize == 0 ||
+		controller->Functions[RMI4_FUNCTION_SLOT_F34].DataBase +
+			RMI4_F34_DATA_BLOCK_DATA + session.BlockSize > 0xFF ||
+		header->FirmwareSize != session.BlockSize * session.Query.FirmwareBlockCount ||
+		header->ConfigSize != session.BlockSize * session.Query.ConfigBlockCount)
+	{
+		status = STATUS_INVALID_IMAGE_FORMAT;
+		goto resume;
+	}
+
+	session.Transfer = ExAllocatePoolWithTag(
+		NonPagedPoolNx,
+		session.BlockSize + 1,
+		TOUCH_POOL_TAG);
+
+	if (session.Transfer == NULL)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto resume;
+	}
+
+	//
+	// Blocks must go out without a bounce buffer allocation each, the
+	// buffers are replaced under the controller lock like any transfer
+	//
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
+	status = SpbReserveBufferSize(SpbContext, session.BlockSize + 1);
+
+	WdfWaitLockRelease(controller->ControllerLock);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto resume;
+	}
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_FLAG_OTHER,
+		"Flashing %d firmware and %d configuration blocks of %d bytes",
+		session.Query.FirmwareBlockCount,
+		session.Query.ConfigBlockCount,
+		session.BlockSize);
+
+	status = RmiF34Command(
+		&session,
+		RMI4_F34_COMMAND_ENABLE_FLASH,
+		session.Query.BootloaderId,
+		sizeof(session.Query.BootloaderId));
+
+	if (!NT_SUCCESS(status))
+	{
+		goto resume;
+	}
+
+	bootloader = TRUE;
+
+	status = RmiF34WaitCommand(
+		&session,
+		RMI4_F34_ENABLE_TIMEOUT_MS,
+		&flashStatus);
+
+	if (NT_SUCCESS(status) && !(flashStatus & RMI4_F34_PROGRAM_ENABLED))
+	{
+		status = STATUS_DEVICE_HARDWARE_ERROR;
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		goto restart;
+	}
+
+	status = RmiF34Rescan(controller, SpbContext);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto restart;
+	}
+
+	status = RmiF34Command(
+		&session,
+		RMI4_F34_COMMAND_ERASE_ALL,
+		session.Query.BootloaderId,
+		sizeof(session.Query.BootloaderId));
+
+	if (NT_SUCCESS(status))
+	{
+		status = RmiF34WaitCommand(
+			&session,
+			RMI4_F34_ERASE_TIMEOUT_MS,
+			&flashStatus);
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		goto restart;
+	}
+
+	status = RmiF34WriteBlocks(
+		&session,
+		0,
+		RMI4_F34_COMMAND_WRITE_FW_BLOCK,
+		firmware,
+		session.Query.FirmwareBlockCount);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto restart;
+	}
+
+	status = RmiF34WriteBlocks(
+		&session,
+		RMI4_F34_BLOCK_AREA_CONFIG,
+		RMI4_F34_COMMAND_WRITE_CONFIG,
+		config,
+		session.Query.ConfigBlockCount);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto restart;
+	}
+
+	status = RmiF34VerifyConfig(
+		&session,
+		config,
+		session.Query.ConfigBlockCount);
+
+restart:
+
+	//
+	// Leave the bootloader even after a failure, a controller left with
+	// a partial image stays in it and can be flashed again
+	//
+	restartStatus = RmiF34Restart(controller, SpbContext);
+
+	if (NT_SUCCESS(status))
+	{
+		status = restartStatus;
+	}
+
+resume:
+
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+	controller->F34Flash.Active = FALSE;
+	WdfWaitLockRelease(controller->ControllerLock);
+
+	WdfDeviceResumeIdle(controller->FxDevice);
+
+	if (session.Transfer != NULL)
+	{
+		ExFreePoolWithTag(session.Transfer, TOUCH_POOL_TAG);
+	}
+
+exit:
+
+	Trace(
+		NT_SUCCESS(status) ? TRACE_LEVEL_INFORMATION : TRACE_LEVEL_ERROR,
+		TRACE_FLAG_OTHER,
+		"Firmware flash %s - STATUS:%X",
+		bootloader ? "attempted" : "not started",
+		status);
+
+	return status;
+}
@@ -0,0 +1,929 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		Function54.c
+
+	Abstract:
+
+		Captures F54 delta and raw capacitance images for diagnostic
+		tools and queues them for the diagnostic control device
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include "internal.h"
+#include "controller.h"
+#include "rmiinternal.h"
+#include "spbhelper.h"
+#include "debug.h"
+#include "etwtrace.h"
+#include "Function54.h"
+
+#define TCH_F54_TICKS_PER_MS        10000
+
+static
+NTSTATUS
+RmiF54FillRequest(
+	IN RMI4_F54_STREAM* Stream,
+	IN WDFREQUEST Request,
+	OUT ULONG_PTR* Information
+)
+/*++
+
+Routine Description:
+
+	Copies the oldest queued image into the output buffer of a read
+	request and releases its ring slot. Must be called with the ring
+	lock held and at least one image queued.
+
+Arguments:
+
+	Stream - F54 stream context
+	Request - Handle to the read request
+	Information - Receives the number of bytes copied
+
+Return Value:
+
+	NTSTATUS indicating success or failure, the image stays queued if
+	the buffer is too small
+
+--*/
+{
+	PTCH_F54_FRAME_HEADER frame;
+	PVOID buffer;
+	size_t length;
+	NTSTATUS status;
+
+	*Information = 0;
+
+	frame = (PTCH_F54_FRAME_HEADER)
+		(Stream->Ring + Stream->RingHead * RMI4_F54_RING_SLOT_SIZE);
+	length = sizeof(TCH_F54_FRAME_HEADER) + frame->DataLength;
+
+	status = WdfRequestRetrieveOutputBuffer(
+		Request,
+		length,
+		&buffer,
+		NULL);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	RtlCopyMemory(buffer, frame, length);
+
+	Stream->RingHead = (Stream->RingHead + 1) % TCH_F54_RING_FRAMES;
+	Stream->RingCount--;
+
+	*Information = length;
+
+exit:
+
+	return status;
+}
+
+static
+VOID
+RmiF54PublishImage(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Queues the image just read into the ring, dropping the oldest image
+	if the tool fell behind, and completes pending read requests. Must
+	be called with the controller lock held.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_F54_STREAM* stream;
+	PTCH_F54_FRAME_HEADER frame;
+	PDEVICE_EXTENSION devContext;
+	WDFREQUEST request;
+	ULONG_PTR information;
+	NTSTATUS status;
+
+	stream = &ControllerContext->F54Stream;
+	devContext = GetDeviceContext(ControllerContext->FxDevice);
+
+	WdfSpinLockAcquire(stream->RingLock);
+
+	if (stream->RingCount == TCH_F54_RING_FRAMES)
+	{
+		stream->RingHead = (stream->RingHead + 1) % TCH_F54_RING_FRAMES;
+		stream->RingCount--;
+		stream->Dropped++;
+	}
+
+	frame = (PTCH_F54_FRAME_HEADER)(stream->Ring +
+		((stream->RingHead + stream->RingCount) % TCH_F54_RING_FRAMES) *
+		RMI4_F54_RING_SLOT_SIZE);
+
+	frame->Version = TCH_F54_FRAME_VERSION;
+	frame->ReportType = stream->ReportType;
+	frame->Sequence = stream->Sequence++;
+	frame->Dropped = stream->Dropped;
+	frame->Receivers = stream->Receivers;
+	frame->Transmitters = stream->Transmitters;
+	frame->DataLength = stream->ImageSize;
+	frame->Timestamp = stream->CaptureTime;
+
+	RtlCopyMemory(frame + 1, stream->Image, stream->ImageSize);
+
+	stream->RingCount++;
+
+	WdfSpinLockRelease(stream->RingLock);
+
+	//
+	// The slot is only rewritten by later captures, which run under the
+	// controller lock as well
+	//
+	RmiTapWrite(
+		ControllerContext,
+		TCH_TAP_SOURCE_F54,
+		stream->CaptureTime,
+		frame,
+		sizeof(TCH_F54_FRAME_HEADER) + stream->ImageSize);
+
+	//
+	// Read requests only pend while the ring is empty, so at most one
+	// is waiting for this image unless a buffer was too small
+	//
+	for (;;)
+	{
+		WdfSpinLockAcquire(stream->RingLock);
+
+		if (stream->RingCount == 0 ||
+			devContext->TestReadQueue == NULL ||
+			!NT_SUCCESS(WdfIoQueueRetrieveNextRequest(
+				devContext->TestReadQueue,
+				&request)))
+		{
+			WdfSpinLockRelease(stream->RingLock);
+			break;
+		}
+
+		status = RmiF54FillRequest(stream, request, &information);
+
+		WdfSpinLockRelease(stream->RingLock);
+
+		WdfRequestCompleteWithInformation(request, status, information);
+	}
+}
+
+static
+NTSTATUS
+RmiF54RequestReport(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Selects the stream's report type and asks the controller to
+	generate the report. Must be called with the controller lock held.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_RESOLVED_FUNCTION* f54;
+	BYTE command;
+	NTSTATUS status;
+
+	f54 = &ControllerContext->Functions[RMI4_FUNCTION_SLOT_F54];
+
+	status = RmiChangePage(
+		ControllerContext,
+		SpbContext,
+		f54->Page);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	status = SpbWriteDataSynchronously(
+		SpbContext,
+		f54->DataBase + RMI4_F54_DATA_REPORT_TYPE,
+		&ControllerContext->F54Stream.ReportType,
+		sizeof(BYTE));
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	command = RMI4_F54_COMMAND_GET_REPORT;
+
+	status = SpbWriteDataSynchronously(
+		SpbContext,
+		f54->CommandBase,
+		&command,
+		sizeof(command));
+
+exit:
+
+	return status;
+}
+
+static
+NTSTATUS
+RmiF54ReadChunk(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Reads the next chunk of the requested report. The FIFO index is
+	written each time as other F54 accesses may have moved it in
+	between. Must be called with the controller lock held.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_RESOLVED_FUNCTION* f54;
+	RMI4_F54_STREAM* stream;
+	BYTE fifoIndex[2];
+	ULONG length;
+	NTSTATUS status;
+
+	f54 = &ControllerContext->Functions[RMI4_FUNCTION_SLOT_F54];
+	stream = &ControllerContext->F54Stream;
+
+	status = RmiChangePage(
+		ControllerContext,
+		SpbContext,
+		f54->Page);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	fifoIndex[0] = (BYTE)(stream->Offset & 0xFF);
+	fifoIndex[1] = (BYTE)(stream->Offset >> 8);
+
+	status = SpbWriteDataSynchronously(
+		SpbContext,
+		f54->DataBase + RMI4_F54_DATA_FIFO_INDEX,
+		fifoIndex,
+		sizeof(fifoIndex));
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	length = min(RMI4_F54_READ_CHUNK, stream->ImageSize - stream->Offset);
+
+	status = SpbReadDataSynchronously(
+		SpbContext,
+		f54->DataBase + RMI4_F54_DATA_REPORT_DATA,
+		stream->Image + stream->Offset,
+		length);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	stream->Offset += length;
+
+exit:
+
+	return status;
+}
+
+VOID
+RmiF54StreamStep(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Advances the capture of a streaming session by one step: counts a
+	frame towards the next capture, polls a requested report or reads
+	one chunk of it. Called for each interrupt and from the step timer
+	with the controller lock held.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	RMI4_RESOLVED_FUNCTION* f54;
+	RMI4_F54_STREAM* stream;
+	BYTE command;
+	NTSTATUS status;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+	stream = &controller->F54Stream;
+
+	if (!stream->Active ||
+		controller->DevicePowerState != PowerDeviceD0 ||
+		controller->Storm.Masked)
+	{
+		return;
+	}
+
+	f54 = &controller->Functions[RMI4_FUNCTION_SLOT_F54];
+	stream->LastStep = KeQueryInterruptTime();
+	status = STATUS_SUCCESS;
+
+	switch (stream->State)
+	{
+	case RMI4_F54_STREAM_WAIT:
+		if (++stream->Frames < stream->Decimation)
+		{
+			break;
+		}
+
+		stream->Frames = 0;
+		stream->Steps = 0;
+		stream->CaptureTime = stream->LastStep;
+
+		status = RmiF54RequestReport(controller, SpbContext);
+
+		if (NT_SUCCESS(status))
+		{
+			stream->State = RMI4_F54_STREAM_REQUESTED;
+		}
+
+		break;
+
+	case RMI4_F54_STREAM_REQUESTED:
+		status = RmiChangePage(controller, SpbContext, f54->Page);
+
+		if (!NT_SUCCESS(status))
+		{
+			break;
+		}
+
+		status = SpbReadDataSynchronously(
+			SpbContext,
+			f54->CommandBase,
+			&command,
+			sizeof(command));
+
+		if (!NT_SUCCESS(status))
+		{
+			break;
+		}
+
+		if (command & RMI4_F54_COMMAND_GET_REPORT)
+		{
+			if (++stream->Steps >= RMI4_F54_REPORT_TIMEOUT_STEPS)
+			{
+				status = STATUS_IO_TIMEOUT;
+			}
+
+			break;
+		}
+
+		stream->Offset = 0;
+		stream->State = RMI4_F54_STREAM_READING;
+
+		//
+		// The report is ready, start reading it right away
+		//
+		__fallthrough;
+
+	case RMI4_F54_STREAM_READING:
+		status = RmiF54ReadChunk(controller, SpbContext);
+
+		if (!NT_SUCCESS(status))
+		{
+			break;
+		}
+
+		if (stream->Offset == stream->ImageSize)
+		{
+			RmiF54PublishImage(controller);
+			stream->State = RMI4_F54_STREAM_WAIT;
+		}
+
+		break;
+
+	default:
+		break;
+	}
+
+	//
+	// A failed capture is dropped, the next one starts over
+	//
+	if (!NT_SUCCESS(status))
+	{
+		TraceLoggingWrite(
+			TchTraceProvider,
+			"F54CaptureError",
+			TraceLoggingLevel(WINEVENT_LEVEL_WARNING),
+			TraceLoggingKeyword(TCH_TRACE_KEYWORD_INTERRUPT),
+			TraceLoggingUInt32(stream->State, "State"),
+			TraceLoggingNTStatus(status, "Status"));
+
+		stream->State = RMI4_F54_STREAM_WAIT;
+		stream->Frames = 0;
+	}
+}
+
+static
+VOID
+OnF54StepTimer(
+	IN WDFTIMER Timer
+)
+/*++
+
+Routine Description:
+
+	Steps the capture while the controller does not interrupt, for
+	instance while nothing touches the screen, and re-arms itself for
+	as long as the session lasts
+
+Arguments:
+
+	Timer - a handle to the framework timer object
+
+Return Value:
+
+	None.
+
+--*/
+{
+	PDEVICE_EXTENSION devContext;
+	RMI4_CONTROLLER_CONTEXT* controller;
+	RMI4_F54_STREAM* stream;
+	ULONG64 elapsed;
+
+	devContext = GetDeviceContext(WdfTimerGetParentObject(Timer));
+	controller = (RMI4_CONTROLLER_CONTEXT*)devContext->TouchContext;
+	stream = &controller->F54Stream;
+
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
+	if (!stream->Active)
+	{
+		goto exit;
+	}
+
+	elapsed = KeQueryInterruptTime() - stream->LastStep;
+
+	if (elapsed >= (ULONG64)RMI4_F54_STEP_INTERVAL_MS * TCH_F54_TICKS_PER_MS)
+	{
+		RmiF54StreamStep(controller, &devContext->I2CContext);
+	}
+
+	WdfTimerStart(Timer, WDF_REL_TIMEOUT_IN_MS(RMI4_F54_STEP_INTERVAL_MS));
+
+exit:
+
+	WdfWaitLockRelease(controller->ControllerLock);
+}
+
+NTSTATUS
+TchF54StreamInitialize(
+	IN VOID* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Creates the step timer and the ring lock of the F54 stream, the
+	ring itself is only allocated by the first session
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	WDF_TIMER_CONFIG timerConfig;
+	WDF_OBJECT_ATTRIBUTES timerAttributes;
+	NTSTATUS status;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+
+	status = WdfSpinLockCreate(
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&controller->F54Stream.RingLock);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Could not create F54 ring lock - STATUS:%X",
+			status);
+
+		goto exit;
+	}
+
+	WDF_TIMER_CONFIG_INIT(&timerConfig, OnF54StepTimer);
+	WDF_OBJECT_ATTRIBUTES_INIT(&timerAttributes);
+	timerAttributes.ParentObject = controller->FxDevice;
+
+	//
+	// The handler accesses the controller, run it at passive level
+	//
+	timerAttributes.ExecutionLevel = WdfExecutionLevelPassive;
+
+	status = WdfTimerCreate(
+		&timerConfig,
+		&timerAttributes,
+		&controller->F54Stream.StepTimer);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Could not create F54 step timer - STATUS:%X",
+			status);
+	}
+
+exit:
+
+	return status;
+}
+
+NTSTATUS
+TchF54StreamStart(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN PTCH_F54_STREAM_CONFIG Config
+)
+/*++
+
+Routine Description:
+
+	Starts a streaming session, sizing the image from the F54 query
+	registers. Images queued by a previous session are discarded.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+	Config - Report type and decimation requested by the tool
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	RMI4_RESOLVED_FUNCTION* f54;
+	RMI4_F54_STREAM* stream;
+	RMI4_F54_QUERY_REGISTERS query;
+	NTSTATUS status;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+	f54 = &controller->Functions[RMI4_FUNCTION_SLOT_F54];
+	stream = &controller->F54Stream;
+
+	if (Config->ReportType != TCH_F54_REPORT_DELTA_IMAGE &&
+		Config->ReportType != TCH_F54_REPORT_RAW_IMAGE)
+	{
+		status = STATUS_INVALID_PARAMETER;
+		goto exit;
+	}
+
+	if (!f54->Present)
+	{
+		status = STATUS_NOT_SUPPORTED;
+		goto exit;
+	}
+
+	if (stream->Ring == NULL)
+	{
+		stream->Ring = ExAllocatePoolWithTag(
+			NonPagedPoolNx,
+			TCH_F54_RING_FRAMES * RMI4_F54_RING_SLOT_SIZE,
+			TOUCH_POOL_TAG);
+
+		if (stream->Ring == NULL)
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			goto exit;
+		}
+	}
+
+	if (stream->Image == NULL)
+	{
+		stream->Image = ExAllocatePoolWithTag(
+			NonPagedPoolNx,
+			TCH_F54_MAX_IMAGE_SIZE,
+			TOUCH_POOL_TAG);
+
+		if (stream->Image == NULL)
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			goto exit;
+		}
+	}
+
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
+	if (stream->Active)
+	{
+		status = STATUS_DEVICE_BUSY;
+		goto release;
+	}
+
+	if (controller->DevicePowerState != PowerDeviceD0)
+	{
+		status = STATUS_DEVICE_NOT_READY;
+		goto release;
+	}
+
+	status = RmiChangePage(controller, SpbContext, f54->Page);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto release;
+	}
+
+	status = SpbReadDataSynchronously(
+		SpbContext,
+		f54->QueryBase,
+		&query,
+		sizeof(query));
+
+	if (!NT_SUCCESS(status))
+	{
+		goto release;
+	}
+
+	stream->Receivers = query.NumberOfReceivers;
+	stream->Transmitters = query.NumberOfTransmitters;
+	stream->ImageSize =
+		(ULONG)query.NumberOfReceivers * query.NumberOfTransmitters * sizeof(USHORT);
+
+	if (stream->ImageSize == 0 || stream->ImageSize > TCH_F54_MAX_IMAGE_SIZE)
+	{
+		status = STATUS_NOT_SUPPORTED;
+		goto release;
+	}
+
+	WdfSpinLockAcquire(stream->RingLock);
+
+	stream->RingHead = 0;
+	stream->RingCount = 0;
+	stream->Sequence = 0;
+	stream->Dropped = 0;
+
+	WdfSpinLockRelease(stream->RingLock);
+
+	stream->ReportType = (BYTE)Config->ReportType;
+	stream->Decimation = max(Config->Decimation, 1);
+	stream->Frames = 0;
+	stream->State = RMI4_F54_STREAM_WAIT;
+	stream->LastStep = KeQueryInterruptTime();
+	stream->Active = TRUE;
+
+	WdfTimerStart(
+		stream->StepTimer,
+		WDF_REL_TIMEOUT_IN_MS(RMI4_F54_STEP_INTERVAL_MS));
+
+release:
+
+	WdfWaitLockRelease(controller->ControllerLock);
+
+exit:
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_FLAG_REPORTING,
+		"F54 stream start, type %d decimation %d - STATUS:%X",
+		Config->ReportType,
+		Config->Decimation,
+		status);
+
+	return status;
+}
+
+VOID
+TchF54StreamStop(
+	IN VOID* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Ends a streaming session and cancels pending read requests. Images
+	still queued can be read until the next session starts. Also called
+	ahead of a power down and when the diagnostic device goes away.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	PDEVICE_EXTENSION devContext;
+	WDFREQUEST request;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+	devContext = GetDeviceContext(controller->FxDevice);
+
+	if (controller->F54Stream.StepTimer == NULL)
+	{
+		return;
+	}
+
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
+	controller->F54Stream.Active = FALSE;
+	controller->F54Stream.State = RMI4_F54_STREAM_IDLE;
+
+	WdfWaitLockRelease(controller->ControllerLock);
+
+	//
+	// Wait for a running handler, it takes the controller lock
+	//
+	WdfTimerStop(controller->F54Stream.StepTimer, TRUE);
+
+	if (devContext->TestReadQueue == NULL)
+	{
+		return;
+	}
+
+	while (NT_SUCCESS(WdfIoQueueRetrieveNextRequest(
+		devContext->TestReadQueue,
+		&request)))
+	{
+		WdfRequestComplete(request, STATUS_CANCELLED);
+	}
+}
+
+NTSTATUS
+TchF54StreamRead(
+	IN VOID* ControllerContext,
+	IN WDFREQUEST Request,
+	OUT ULONG_PTR* Information
+)
+/*++
+
+Routine Description:
+
+	Handles a read request of the diagnostic device, copying the oldest
+	queued image or holding the request until the next one is captured
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	Request - Handle to the read request
+	Information - Receives the number of bytes copied
+
+Return Value:
+
+	STATUS_PENDING if the request was queued and must not be completed
+	by the caller, otherwise the status to complete it with
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	PDEVICE_EXTENSION devContext;
+	RMI4_F54_STREAM* stream;
+	NTSTATUS status;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+	devContext = GetDeviceContext(controller->FxDevice);
+	stream = &controller->F54Stream;
+
+	*Information = 0;
+
+	if (stream->Ring == NULL || devContext->TestReadQueue == NULL)
+	{
+		status = STATUS_INVALID_DEVICE_STATE;
+		goto exit;
+	}
+
+	//
+	// The ring lock orders the queueing against the capture completing
+	// pending requests, an image cannot slip in between
+	//
+	WdfSpinLockAcquire(stream->RingLock);
+
+	if (stream->RingCount != 0)
+	{
+		status = RmiF54FillRequest(stream, Request, Information);
+	}
+	else if (!stream->Active)
+	{
+		status = STATUS_INVALID_DEVICE_STATE;
+	}
+	else
+	{
+		status = WdfRequestForwardToIoQueue(Request, devContext->TestReadQueue);
+
+		if (NT_SUCCESS(status))
+		{
+			status = STATUS_PENDING;
+		}
+	}
+
+	WdfSpinLockRelease(stream->RingLock);
+
+exit:
+
+	return status;
+}
+
+VOID
+TchF54StreamFree(
+	IN VOID* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Frees the image buffers of the F54 stream
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+
+	if (controller->F54Stream.Ring != NULL)
+	{
+		ExFreePoolWithTag(controller->F54Stream.Ring, TOUCH_POOL_TAG);
+		controller->F54Stream.Ring = NULL;
+	}
+
+	if (controller->F54Stream.Image != NULL)
+	{
+		ExFreePoolWithTag(controller->F54Stream.Image, TOUCH_POOL_TAG);
+		controller->F54Stream.Image = NULL;
+	}
+
+	if (controller->F54Stream.RingLock != NULL)
+	{
+		WdfObjectDelete(controller->F54Stream.RingLock);
+		controller->F54Stream.RingLock = NULL;
+	}
+}
@@ -0,0 +1,352 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		activity.c
+
+	Abstract:
+
+		Switches the controller between its active and idle report
+		rate and doze settings depending on touch activity
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include "internal.h"
+#include "controller.h"
+#include "rmiinternal.h"
+#include "spbhelper.h"
+#include "debug.h"
+#include "etwtrace.h"
+#include "Function12.h"
+#include "activity.h"
+
+#define TCH_ACTIVITY_TICKS_PER_MS   10000
+
+static
+NTSTATUS
+RmiApplyActivityState(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN BOOLEAN Idle
+)
+/*++
+
+Routine Description:
+
+	Programs either the idle or the configured doze interval and F12
+	reporting mode. Must be called with the controller lock held.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+	Idle - TRUE to program the idle settings
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	BYTE dozeInterval;
+	NTSTATUS status;
+
+	status = STATUS_SUCCESS;
+
+	if (ControllerContext->Config.IdleDozeInterval != 0)
+	{
+		dozeInterval = Idle ?
+			(BYTE)LOGICAL_TO_PHYSICAL(ControllerContext->Config.IdleDozeInterval) :
+			(BYTE)LOGICAL_TO_PHYSICAL(ControllerContext->Config.DeviceSettings.DozeInterval);
+
+		RmiShadowWrite(
+			&ControllerContext->F01ControlShadow,
+			FIELD_OFFSET(RMI4_F01_CTRL_REGISTERS, DozeInterval),
+			&dozeInterval,
+			sizeof(dozeInterval));
+
+		status = RmiShadowFlush(
+			ControllerContext,
+			SpbContext,
+			&ControllerContext->F01ControlShadow);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+	}
+
+	if (ControllerContext->Config.IdleReducedReporting != 0 &&
+		ControllerContext->DigitizerOps != NULL &&
+		ControllerContext->DigitizerOps->SetIdleReporting != NULL)
+	{
+		status = ControllerContext->DigitizerOps->SetIdleReporting(
+			ControllerContext,
+			SpbContext,
+			Idle);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+	}
+
+exit:
+
+	TraceLoggingWrite(
+		TchTraceProvider,
+		"ActivityStateChange",
+		TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+		TraceLoggingKeyword(TCH_TRACE_KEYWORD_INTERRUPT),
+		TraceLoggingBoolean(Idle, "Idle"),
+		TraceLoggingNTStatus(status, "Status"));
+
+	//
+	// A failed restore is retried on the next interrupt
+	//
+	ControllerContext->Activity.Idle = Idle || !NT_SUCCESS(status);
+
+	return status;
+}
+
+static
+VOID
+OnActivityTimer(
+	IN WDFTIMER Timer
+)
+/*++
+
+Routine Description:
+
+	Runs once the idle timeout may have expired. Switches the controller
+	to its idle settings if it really saw no interrupt for that long and
+	no contact is down, otherwise waits for the remainder.
+
+Arguments:
+
+	Timer - a handle to the framework timer object
+
+Return Value:
+
+	None.
+
+--*/
+{
+	PDEVICE_EXTENSION devContext;
+	RMI4_CONTROLLER_CONTEXT* controller;
+	LONG64 elapsed;
+	LONG64 timeout;
+
+	devContext = GetDeviceContext(WdfTimerGetParentObject(Timer));
+	controller = (RMI4_CONTROLLER_CONTEXT*)devContext->TouchContext;
+
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
+	//
+	// A controller being flashed is restarted with its default settings
+	//
+	if (controller->DevicePowerState != PowerDeviceD0 ||
+		controller->F34Flash.Active)
+	{
+		controller->Activity.TimerArmed = FALSE;
+		goto exit;
+	}
+
+	timeout = (LONG64)controller->Config.IdleTimeout * TCH_ACTIVITY_TICKS_PER_MS;
+	elapsed = (LONG64)KeQueryInterruptTime() - controller->Activity.LastActivity;
+
+	//
+	// A contact held still may not interrupt at all, keep the full rate
+	// until it is released
+	//
+	if (controller->ReportedTipMask != 0)
+	{
+		elapsed = 0;
+	}
+
+	if (elapsed < timeout)
+	{
+		WdfTimerStart(Timer, WDF_REL_TIMEOUT_IN_MS(
+			(ULONG)((timeout - elapsed) / TCH_ACTIVITY_TICKS_PER_MS) + 1));
+
+		goto exit;
+	}
+
+	controller->Activity.TimerArmed = FALSE;
+
+	RmiApplyActivityState(controller, &devContext->I2CContext, TRUE);
+
+exit:
+
+	WdfWaitLockRelease(controller->ControllerLock);
+}
+
+NTSTATUS
+TchActivityInitialize(
+	IN VOID* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Creates the idle timer of the activity policy
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	WDF_TIMER_CONFIG timerConfig;
+	WDF_OBJECT_ATTRIBUTES timerAttributes;
+	NTSTATUS status;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+
+	WDF_TIMER_CONFIG_INIT(&timerConfig, OnActivityTimer);
+	WDF_OBJECT_ATTRIBUTES_INIT(&timerAttributes);
+	timerAttributes.ParentObject = controller->FxDevice;
+
+	//
+	// The handler programs the controller, run it at passive level
+	//
+	timerAttributes.ExecutionLevel = WdfExecutionLevelPassive;
+
+	status = WdfTimerCreate(
+		&timerConfig,
+		&timerAttributes,
+		&controller->Activity.IdleTimer);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Could not create activity timer - STATUS:%X",
+			status);
+	}
+
+	return status;
+}
+
+VOID
+TchNotifyTouchActivity(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Called after each interrupt was serviced, restores the active
+	settings if the controller was idle and arms the idle timer.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+
+	if (controller->Config.IdleTimeout == 0)
+	{
+		return;
+	}
+
+	controller->Activity.LastActivity = (LONG64)KeQueryInterruptTime();
+
+	//
+	// Common case while the user interacts, the armed timer picks up the
+	// new timestamp when it fires
+	//
+	if (controller->Activity.TimerArmed && !controller->Activity.Idle)
+	{
+		return;
+	}
+
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
+	if (controller->DevicePowerState != PowerDeviceD0 ||
+		controller->F34Flash.Active)
+	{
+		goto exit;
+	}
+
+	if (controller->Activity.Idle)
+	{
+		RmiApplyActivityState(controller, SpbContext, FALSE);
+	}
+
+	if (!controller->Activity.TimerArmed)
+	{
+		controller->Activity.TimerArmed = TRUE;
+
+		WdfTimerStart(
+			controller->Activity.IdleTimer,
+			WDF_REL_TIMEOUT_IN_MS(controller->Config.IdleTimeout));
+	}
+
+exit:
+
+	WdfWaitLockRelease(controller->ControllerLock);
+}
+
+VOID
+TchActivityStop(
+	IN VOID* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Cancels the idle timer ahead of a power down. Idle settings still
+	programmed on the controller are restored by the first interrupt
+	after the next wake, like any other idle period.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+
+	if (controller->Activity.IdleTimer == NULL)
+	{
+		return;
+	}
+
+	//
+	// Wait for a running handler, it takes the controller lock
+	//
+	WdfTimerStop(controller->Activity.IdleTimer, TRUE);
+
+	controller->Activity.TimerArmed = FALSE;
+}
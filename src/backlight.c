@@ -28,7 +28,7 @@
 //
 // Default milllux-to-backlight-intensity-percentage table
 //
-static BKL_LUX_TABLE_ENTRY g_DefaultLuxMap[BKL_NUM_LEVELS_DEFAULT] =
+static const BKL_LUX_TABLE_ENTRY g_DefaultLuxMap[BKL_NUM_LEVELS_DEFAULT] =
 {
 	{
 		0,
@@ -52,35 +52,6 @@ static BKL_LUX_TABLE_ENTRY g_DefaultLuxMap[BKL_NUM_LEVELS_DEFAULT] =
 	},
 };
 
-__inline
-VOID
-TchBklSleepMillisec(
-	IN ULONG TimeMsec
-)
-/*++
-
-Routine Description:
-
-	This helper routine puts the caller to sleep
-
-Arguments:
-
-	TimeMsec - time to sleep in millisec
-
-Return Value:
-
-	None.
-
---*/
-{
-	LARGE_INTEGER Delay = { 0 };
-
-	Delay.QuadPart = WDF_REL_TIMEOUT_IN_MS(TimeMsec);
-
-	KeDelayExecutionThread(KernelMode, FALSE, &Delay);
-}
-
-
 NTSTATUS
 TchBklGetDefaultLuxIntensityMap(
 	IN BKL_CONTEXT* BklContext
@@ -619,6 +590,43 @@ exit:
 	return status;
 }
 
+ULONG
+TchBklGetLuxLevel(
+	IN BKL_CONTEXT* BklContext,
+	IN ULONG LuxValue
+)
+/*++
+
+Routine Description:
+
+	This helper routine looks up the lux table entry covering the
+	current light sensor reading.
+
+Arguments:
+
+	BklContext - backlight control context structure
+	LuxValue - current lux value
+
+Return Value:
+
+	Index of the matching entry, BklNumLevels if there is none
+
+--*/
+{
+	ULONG i;
+
+	for (i = 0; i < BklContext->BklNumLevels; i++)
+	{
+		if (LuxValue < BklContext->BklLuxTable[i].Max &&
+			LuxValue >= BklContext->BklLuxTable[i].Min)
+		{
+			break;
+		}
+	}
+
+	return i;
+}
+
 ULONG
 TchBklGetIntensity(
 	IN BKL_CONTEXT* BklContext,
@@ -642,18 +650,175 @@ Return Value:
 
 --*/
 {
+	ULONG level;
+
+	level = TchBklGetLuxLevel(BklContext, LuxValue);
+
+	if (level == BklContext->BklNumLevels)
+	{
+		return 0;
+	}
+
+	return BklContext->BklLuxTable[level].Intensity;
+}
+
+VOID
+TchBklSendHwnState(
+	IN BKL_CONTEXT* BklContext
+)
+/*++
+
+Routine Description:
+
+	Sends the current intensity of all LEDs to the HWN driver, unless a
+	previous update is still in flight, in which case it is sent when
+	that one completes. Callable at DISPATCH_LEVEL.
+
+Arguments:
+
+	BklContext - backlight control context structure
+
+Return Value:
+
+	None.
+
+--*/
+{
+	WDF_REQUEST_REUSE_PARAMS reuseParams;
+	ULONG intensity;
+	NTSTATUS status;
 	ULONG i;
 
-	for (i = 0; i < BklContext->BklNumLevels; i++)
+	WdfSpinLockAcquire(BklContext->HwnLock);
+
+	if (BklContext->HwnBusy)
 	{
-		if (LuxValue < BklContext->BklLuxTable[i].Max &&
-			LuxValue >= BklContext->BklLuxTable[i].Min)
+		BklContext->HwnUpdatePending = TRUE;
+		WdfSpinLockRelease(BklContext->HwnLock);
+		return;
+	}
+
+	BklContext->HwnBusy = TRUE;
+	intensity = BklContext->CurrentBklIntensity;
+
+	WdfSpinLockRelease(BklContext->HwnLock);
+
+	//
+	// The configuration is only touched while no request uses it
+	//
+	for (i = 0; i < BklContext->HwnNumLeds; i++)
+	{
+		BklContext->HwnConfiguration->HwNSettingsInfo[i].HwNSettings[HWN_INTENSITY] =
+			intensity;
+		BklContext->HwnConfiguration->HwNSettingsInfo[i].OffOnBlink =
+			(intensity == 0) ? HWN_OFF : HWN_ON;
+	}
+
+	WDF_REQUEST_REUSE_PARAMS_INIT(
+		&reuseParams,
+		WDF_REQUEST_REUSE_NO_FLAGS,
+		STATUS_SUCCESS);
+
+	status = WdfRequestReuse(BklContext->HwnRequest, &reuseParams);
+
+	if (NT_SUCCESS(status))
+	{
+		status = WdfIoTargetFormatRequestForIoctl(
+			BklContext->HwnIoTarget,
+			BklContext->HwnRequest,
+			IOCTL_HWN_SET_STATE,
+			BklContext->HwnMemory,
+			NULL,
+			NULL,
+			NULL);
+	}
+
+	if (NT_SUCCESS(status))
+	{
+		WdfRequestSetCompletionRoutine(
+			BklContext->HwnRequest,
+			TchBklOnHwnSetStateComplete,
+			BklContext);
+
+		if (!WdfRequestSend(
+			BklContext->HwnRequest,
+			BklContext->HwnIoTarget,
+			WDF_NO_SEND_OPTIONS))
 		{
-			return BklContext->BklLuxTable[i].Intensity;
+			status = WdfRequestGetStatus(BklContext->HwnRequest);
 		}
 	}
 
-	return 0;
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_OTHER,
+			"Failed to set new HWN state intensity: %u- STATUS:%X",//ST//
+			intensity,
+			status);
+
+		WdfSpinLockAcquire(BklContext->HwnLock);
+		BklContext->HwnBusy = FALSE;
+		BklContext->HwnUpdatePending = FALSE;
+		WdfSpinLockRelease(BklContext->HwnLock);
+	}
+}
+
+VOID
+TchBklOnHwnSetStateComplete(
+	IN WDFREQUEST Request,
+	IN WDFIOTARGET Target,
+	IN PWDF_REQUEST_COMPLETION_PARAMS Params,
+	IN WDFCONTEXT Context
+)
+/*++
+
+Routine Description:
+
+	Completion routine of the HWN state update, sends the intensity set
+	while the update was in flight.
+
+Arguments:
+
+	Request - The HWN request
+	Target - The HWN I/O target
+	Params - Completion parameters
+	Context - Backlight control context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	BKL_CONTEXT* context = (BKL_CONTEXT*)Context;
+	BOOLEAN pending;
+
+	UNREFERENCED_PARAMETER(Request);
+	UNREFERENCED_PARAMETER(Target);
+
+	if (!NT_SUCCESS(Params->IoStatus.Status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_OTHER,
+			"HWN driver failed to set new state - STATUS:%X",
+			Params->IoStatus.Status);
+	}
+
+	WdfSpinLockAcquire(context->HwnLock);
+
+	context->HwnBusy = FALSE;
+	pending = context->HwnUpdatePending;
+	context->HwnUpdatePending = FALSE;
+
+	WdfSpinLockRelease(context->HwnLock);
+
+	if (pending)
+	{
+		TchBklSendHwnState(context);
+	}
 }
 
 VOID
@@ -666,7 +831,9 @@ TchBklSetIntensity(
 Routine Description:
 
 	This helper routine sets any capacitive key backlights to the specified
-	intensity, represented as 0-100%, where 0% corresponds to OFF.
+	intensity, represented as 0-100%, where 0% corresponds to OFF. The
+	intensity is rounded to a visible step, and nothing is sent if that
+	does not change it.
 
 Arguments:
 
@@ -675,166 +842,393 @@ Arguments:
 
 Return Value:
 
-	NTSTATUS indicating success or failure
+	None.
 
 --*/
 {
-	ULONG i;
-	WDF_MEMORY_DESCRIPTOR memory;
-	NTSTATUS status;
+	if (Intensity != 0)
+	{
+		Intensity = max(
+			(Intensity + BKL_INTENSITY_QUANTUM / 2) / BKL_INTENSITY_QUANTUM * BKL_INTENSITY_QUANTUM,
+			BKL_INTENSITY_QUANTUM);
+	}
 
 	if (BklContext->CurrentBklIntensity == Intensity)
 	{
 		return;
 	}
 
-	for (i = 0; i < BklContext->HwnNumLeds; i++)
+	WdfSpinLockAcquire(BklContext->HwnLock);
+	BklContext->CurrentBklIntensity = Intensity;
+	WdfSpinLockRelease(BklContext->HwnLock);
+
+	TchBklSendHwnState(BklContext);
+}
+
+NTSTATUS
+TchBklConfigureAls(
+	IN BKL_CONTEXT* BklContext,
+	IN BOOLEAN Thresholds,
+	IN ULONG ThreshMin,
+	IN ULONG ThreshMax
+)
+/*++
+
+Routine Description:
+
+	Configures the ALS notification interval, and optionally the lux
+	range outside of which the next reading is reported.
+
+Arguments:
+
+	BklContext - Backlight control context
+	Thresholds - Whether to only report readings leaving the range
+	ThreshMin - Lower bound of the range in millilux
+	ThreshMax - Upper bound of the range in millilux, exclusive
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	WDF_MEMORY_DESCRIPTOR memory;
+	NTSTATUS status;
+
+	RtlZeroMemory(
+		&BklContext->AlsConfiguration,
+		sizeof(BKL_ALS_NOTIFICATION));
+
+	BklContext->AlsConfiguration.Header.Size = sizeof(SENSOR_NOTIFICATION);
+	BklContext->AlsConfiguration.Header.IntervalUs = BKL_ALS_SAMPLING_INTERVAL;
+
+	if (Thresholds)
 	{
-		BklContext->HwnConfiguration->HwNSettingsInfo[i].HwNSettings[HWN_INTENSITY] =
-			Intensity;
-		BklContext->HwnConfiguration->HwNSettingsInfo[i].OffOnBlink =
-			(Intensity == 0) ? HWN_OFF : HWN_ON;
+		BklContext->AlsConfiguration.Header.Size = sizeof(BKL_ALS_NOTIFICATION);
+		BklContext->AlsConfiguration.Header.Flags = SENSOR_NOTIFICATION_FLAG_THRESHOLDS;
+		BklContext->AlsConfiguration.Header.ThreshMinSize = sizeof(ULONG);
+		BklContext->AlsConfiguration.Header.ThreshMaxSize = sizeof(ULONG);
+		BklContext->AlsConfiguration.ThreshMin = ThreshMin;
+		BklContext->AlsConfiguration.ThreshMax = ThreshMax;
 	}
 
 	WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
 		&memory,
-		BklContext->HwnConfiguration,
-		(ULONG)BklContext->HwnConfigurationSize);
+		&BklContext->AlsConfiguration,
+		BklContext->AlsConfiguration.Header.Size);
 
 	status = WdfIoTargetSendIoctlSynchronously(
-		BklContext->HwnIoTarget,
+		BklContext->AlsIoTarget,
 		NULL,
-		IOCTL_HWN_SET_STATE,
+		IOCTL_SENSOR_CLX_NOTIFICATION_CONFIGURE,
 		&memory,
 		NULL,
 		NULL,
 		NULL);
 
+	return status;
+}
+
+VOID
+TchBklConfigureAlsThresholds(
+	IN BKL_CONTEXT* BklContext,
+	IN ULONG LuxValue
+)
+/*++
+
+Routine Description:
+
+	Asks the ALS driver to only report readings outside the lux table
+	entry covering the current reading, as readings within it would not
+	change the intensity. Falls back to interval based reporting for
+	good if the driver does not support thresholds.
+
+Arguments:
+
+	BklContext - Backlight control context
+	LuxValue - Current reading in millilux
+
+Return Value:
+
+	None.
+
+--*/
+{
+	ULONG level;
+	NTSTATUS status;
+
+	if (!BklContext->AlsThresholdsSupported)
+	{
+		return;
+	}
+
+	level = TchBklGetLuxLevel(BklContext, LuxValue);
+
+	if (level == BklContext->BklNumLevels)
+	{
+		return;
+	}
+
+	status = TchBklConfigureAls(
+		BklContext,
+		TRUE,
+		BklContext->BklLuxTable[level].Min,
+		BklContext->BklLuxTable[level].Max);
+
 	if (!NT_SUCCESS(status))
 	{
 		Trace(
-			TRACE_LEVEL_ERROR,
+			TRACE_LEVEL_WARNING,
 			TRACE_FLAG_OTHER,
-			"Failed to set new HWN state intensity: %u- STATUS:%X",//ST//
-			Intensity,
+			"ALS driver rejected lux thresholds, using interval notifications - STATUS:%X",
 			status);
+
+		BklContext->AlsThresholdsSupported = FALSE;
+
+		TchBklConfigureAls(BklContext, FALSE, 0, 0);
 	}
+}
 
-	BklContext->CurrentBklIntensity = Intensity;
+NTSTATUS
+TchBklPostAlsRead(
+	IN BKL_CONTEXT* BklContext
+)
+/*++
+
+Routine Description:
+
+	Sends the preallocated read request to the ALS driver, which holds
+	it until the next notification. Callable at DISPATCH_LEVEL.
+
+Arguments:
+
+	BklContext - Backlight control context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	WDF_REQUEST_REUSE_PARAMS reuseParams;
+	NTSTATUS status;
+
+	WDF_REQUEST_REUSE_PARAMS_INIT(
+		&reuseParams,
+		WDF_REQUEST_REUSE_NO_FLAGS,
+		STATUS_SUCCESS);
+
+	status = WdfRequestReuse(BklContext->AlsRequest, &reuseParams);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	status = WdfIoTargetFormatRequestForRead(
+		BklContext->AlsIoTarget,
+		BklContext->AlsRequest,
+		BklContext->AlsMemory,
+		NULL,
+		NULL);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	WdfRequestSetCompletionRoutine(
+		BklContext->AlsRequest,
+		TchBklOnAlsReadComplete,
+		BklContext);
+
+	if (!WdfRequestSend(
+		BklContext->AlsRequest,
+		BklContext->AlsIoTarget,
+		WDF_NO_SEND_OPTIONS))
+	{
+		status = WdfRequestGetStatus(BklContext->AlsRequest);
+	}
+
+exit:
+
+	if (!NT_SUCCESS(status))
+	{
+		BklContext->AlsStatus = status;
+	}
+
+	return status;
 }
 
 VOID
-TchBklGetLightSensorValue(
-	IN WDFWORKITEM WorkItem
+TchBklOnAlsReadComplete(
+	IN WDFREQUEST Request,
+	IN WDFIOTARGET Target,
+	IN PWDF_REQUEST_COMPLETION_PARAMS Params,
+	IN WDFCONTEXT Context
 )
 /*++
 
 Routine Description:
 
-	This work item polls the ambient light sensor for new readings, which
-	are used to dim/fade capacitive key backlights to a level appropriate
-	for the users eyes.
+	Completion routine of the ALS read. Hands the new reading to the
+	work item and reposts the read, or retries after the sampling
+	interval if the ALS driver reported an error.
 
 Arguments:
 
-	WorkItem - WDFWORKITEM object
+	Request - The ALS read request
+	Target - The ALS I/O target
+	Params - Completion parameters
+	Context - Backlight control context
 
 Return Value:
 
-	NTSTATUS indicating success or failure
+	None.
 
 --*/
 {
-	BKL_CONTEXT* context;
-	ULONG intensity;
-	WDF_MEMORY_DESCRIPTOR memory;
+	BKL_CONTEXT* context = (BKL_CONTEXT*)Context;
 	NTSTATUS status;
-	WORKITEM_CONTEXT* workItemContext;
 
-	workItemContext = GetTouchBacklightContext(WorkItem);
-	context = workItemContext->BklContext;
+	UNREFERENCED_PARAMETER(Request);
+	UNREFERENCED_PARAMETER(Target);
+
+	status = Params->IoStatus.Status;
 
 	//
-	// Get an ALS sample. Note the read will be held for the sampling interval
-	// that we've configured, so it is not necessary to sleep/wait here. 
+	// Streaming was stopped, the request was most likely cancelled
 	//
-	WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
-		&memory,
-		&context->AlsData,
-		sizeof(ALS_DATA));
+	if (context->AlsStreaming == FALSE)
+	{
+		return;
+	}
 
-	while (context->TchBklPollAls == TRUE)
+	if (!NT_SUCCESS(status))
 	{
-		status = WdfIoTargetSendReadSynchronously(
-			context->AlsIoTarget,
-			NULL,
-			&memory,
-			NULL,
-			NULL,
-			NULL);
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_OTHER,
+			"Als driver reported error getting data - STATUS:%X",
+			status);
 
-		if (!NT_SUCCESS(status))
-		{
-			Trace(
-				TRACE_LEVEL_ERROR,
-				TRACE_FLAG_OTHER,
-				"Als driver reported error getting data - STATUS:%X",
-				status);
+		context->AlsStatus = status;
 
-			context->AlsStatus = status;
-			TchBklSleepMillisec(BKL_ALS_SAMPLING_INTERVAL);
+		WdfTimerStart(
+			context->AlsRetryTimer,
+			WDF_REL_TIMEOUT_IN_US(BKL_ALS_SAMPLING_INTERVAL));
 
-			continue;
-		}
+		return;
+	}
 
 #ifdef ALS_BACKLIGHT_DEBUG
-		Trace(
-			TRACE_LEVEL_INFORMATION,
-			TRACE_FLAG_OTHER,
-			"ALS reading of %d lux",
-			context->AlsData.Sample);
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_FLAG_OTHER,
+		"ALS reading of %d lux",
+		context->AlsData.Sample);
 #endif
 
+	context->AlsSample = context->AlsData.Sample;
 
-		//
-		// Did we turn off the backlights while waiting?
-		//
-		if (context->TchBklPollAls == FALSE)
-		{
-			return;
-		}
+	WdfWorkItemEnqueue(context->AlsWorkItem);
+
+	if (!NT_SUCCESS(TchBklPostAlsRead(context)))
+	{
+		WdfTimerStart(
+			context->AlsRetryTimer,
+			WDF_REL_TIMEOUT_IN_US(BKL_ALS_SAMPLING_INTERVAL));
+	}
+}
+
+VOID
+TchBklOnAlsRetryTimer(
+	IN WDFTIMER Timer
+)
+/*++
+
+Routine Description:
+
+	Reposts the ALS read after a failed read.
+
+Arguments:
+
+	Timer - WDFTIMER object
+
+Return Value:
+
+	None.
+
+--*/
+{
+	BKL_CONTEXT* context;
+
+	context = GetTouchBacklightContext(Timer)->BklContext;
+
+	if (context->AlsStreaming == FALSE)
+	{
+		return;
+	}
+
+	if (!NT_SUCCESS(TchBklPostAlsRead(context)))
+	{
+		WdfTimerStart(
+			context->AlsRetryTimer,
+			WDF_REL_TIMEOUT_IN_US(BKL_ALS_SAMPLING_INTERVAL));
+	}
+}
+
+VOID
+TchBklProcessLightSensorValue(
+	IN WDFWORKITEM WorkItem
+)
+/*++
+
+Routine Description:
+
+	This work item applies a new ambient light sensor reading, which is
+	used to dim/fade capacitive key backlights to a level appropriate
+	for the users eyes.
+
+Arguments:
+
+	WorkItem - WDFWORKITEM object
+
+Return Value:
+
+	None.
+
+--*/
+{
+	BKL_CONTEXT* context;
+	ULONG intensity;
+	ULONG sample;
+
+	context = GetTouchBacklightContext(WorkItem)->BklContext;
+
+	WdfWaitLockAcquire(context->BacklightLock, NULL);
+
+	//
+	// Did we turn off the backlights while the item was queued?
+	//
+	if (context->AlsStreaming == FALSE)
+	{
+		goto exit;
+	}
 
-		//
-		// Do we have a timeout enabled, which has expired?
-		//
-		if (context->Timeout != 0 &&
-			GetTickCount() - context->LastInputTime > context->Timeout)
-		{
-			//
-			// Turn off backlights
-			//
-			WdfWaitLockAcquire(context->BacklightLock, NULL);
+	sample = context->AlsSample;
 
-			if (!NT_SUCCESS(TchBklEnable(context, FALSE)))
-			{
-				Trace(
-					TRACE_LEVEL_ERROR,
-					TRACE_FLAG_OTHER,
-					"Error disabling backlights, may be stuck on!");
+	//
+	// Initiate an intensity change if necessary
+	//
+	intensity = TchBklGetIntensity(context, sample);
+	TchBklSetIntensity(context, intensity);
 
-				NT_ASSERT(FALSE);
-			}
+	TchBklConfigureAlsThresholds(context, sample);
 
-			WdfWaitLockRelease(context->BacklightLock);
-			continue;
-		}
+exit:
 
-		//
-		// Initiate an intensity change if necessary
-		//
-		intensity = TchBklGetIntensity(context, context->AlsData.Sample);
-		TchBklSetIntensity(context, intensity);
-	}
+	WdfWaitLockRelease(context->BacklightLock);
 }
 
 NTSTATUS
@@ -860,7 +1254,6 @@ Return Value:
 
 --*/
 {
-	WDF_MEMORY_DESCRIPTOR memory;
 	NTSTATUS status;
 
 	status = STATUS_SUCCESS;
@@ -881,41 +1274,30 @@ Return Value:
 		//
 		if (BklContext->Timeout != 0)
 		{
-			BklContext->LastInputTime = (ULONG)GetTickCount();
+			InterlockedExchange(&BklContext->LastInputTime, (LONG)GetTickCount());
 		}
 
 		//
 		// Start ALS if not already started
 		//
-		if (BklContext->TchBklPollAls == TRUE)
+		if (BklContext->AlsStreaming == TRUE)
 		{
 			goto exit;
 		}
 
-		RtlZeroMemory(
-			&BklContext->AlsConfiguration,
-			sizeof(SENSOR_NOTIFICATION));
-
-		BklContext->AlsConfiguration.Size = sizeof(SENSOR_NOTIFICATION);
-		BklContext->AlsConfiguration.Flags = 0;
-		BklContext->AlsConfiguration.IntervalUs = BKL_ALS_SAMPLING_INTERVAL;
-
-		WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
-			&memory,
-			&BklContext->AlsConfiguration,
-			sizeof(SENSOR_NOTIFICATION));
-
-		// 
-		// Configure ALS sampling interval
 		//
-		status = WdfIoTargetSendIoctlSynchronously(
-			BklContext->AlsIoTarget,
-			NULL,
-			IOCTL_SENSOR_CLX_NOTIFICATION_CONFIGURE,
-			&memory,
-			NULL,
-			NULL,
-			NULL);
+		// The target was stopped when streaming was last disabled
+		//
+		status = WdfIoTargetStart(BklContext->AlsIoTarget);
+
+		if (NT_SUCCESS(status))
+		{
+			// 
+			// Configure ALS sampling interval, thresholds are set
+			// around the first reading
+			//
+			status = TchBklConfigureAls(BklContext, FALSE, 0, 0);
+		}
 
 		if (!NT_SUCCESS(status))
 		{
@@ -962,20 +1344,47 @@ Return Value:
 		TchBklSetIntensity(BklContext, BKL_DEFAULT_INTENSITY);
 
 		//
-		// Kick off a work item to continuously monitor ambient light 
-		// changes and adjust the backlight intensity accordingly
+		// Keep a read pending on the ALS driver to monitor ambient
+		// light changes and adjust the backlight intensity accordingly
 		//
-		BklContext->TchBklPollAls = TRUE;
+		BklContext->AlsStreaming = TRUE;
+		BklContext->TimedOut = FALSE;
+
+		if (BklContext->Timeout != 0 &&
+			InterlockedExchange(&BklContext->ActivityTimerArmed, TRUE) == FALSE)
+		{
+			WdfTimerStart(
+				BklContext->ActivityTimer,
+				WDF_REL_TIMEOUT_IN_MS(BklContext->Timeout));
+		}
+
+		status = TchBklPostAlsRead(BklContext);
+
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_OTHER,
+				"Could not post ALS read - STATUS:%X",
+				status);
 
+			WdfTimerStart(
+				BklContext->AlsRetryTimer,
+				WDF_REL_TIMEOUT_IN_US(BKL_ALS_SAMPLING_INTERVAL));
 
-		WdfWorkItemEnqueue(BklContext->TchBklPollAlsWorkItem);
+			status = STATUS_SUCCESS;
+		}
 	}
 	else
 	{
 		//
-		// Stop the ALS sensor
+		// Stop the ALS sensor, then cancel the pending read and wait
+		// for its completion
 		//
-		BklContext->TchBklPollAls = FALSE;
+		BklContext->AlsStreaming = FALSE;
+		BklContext->TimedOut = FALSE;
+
+		WdfTimerStop(BklContext->AlsRetryTimer, FALSE);
 
 		status = WdfIoTargetSendIoctlSynchronously(
 			BklContext->AlsIoTarget,
@@ -997,6 +1406,8 @@ Return Value:
 			BklContext->AlsStatus = status;
 		}
 
+		WdfIoTargetStop(BklContext->AlsIoTarget, WdfIoTargetCancelSentIo);
+
 		//
 		// Request all LEDs to fade to OFF state. 
 		//
@@ -1030,6 +1441,7 @@ Return Value:
 
 --*/
 {
+	WDF_OBJECT_ATTRIBUTES attributes;
 	WDF_IO_TARGET_OPEN_PARAMS openParams;
 	NTSTATUS status;
 
@@ -1092,9 +1504,48 @@ Return Value:
 				status);
 
 			WdfObjectDelete(BklContext->AlsIoTarget);
+			BklContext->AlsIoTarget = NULL;
+			goto exit;
+		}
+
+		//
+		// Preallocate the read request kept pending while streaming,
+		// both go away with the target
+		//
+		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+		attributes.ParentObject = BklContext->AlsIoTarget;
+
+		status = WdfRequestCreate(
+			&attributes,
+			BklContext->AlsIoTarget,
+			&BklContext->AlsRequest);
+
+		if (NT_SUCCESS(status))
+		{
+			status = WdfMemoryCreatePreallocated(
+				&attributes,
+				&BklContext->AlsData,
+				sizeof(ALS_DATA),
+				&BklContext->AlsMemory);
+		}
+
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_OTHER,
+				"Error: Could not allocate ALS read request - STATUS:%X",
+				status);
+
+			WdfObjectDelete(BklContext->AlsIoTarget);
+			BklContext->AlsIoTarget = NULL;
+			BklContext->AlsRequest = NULL;
+			BklContext->AlsMemory = NULL;
 			goto exit;
 		}
 
+		BklContext->AlsThresholdsSupported = TRUE;
+
 		//
 		// Enable the backlight if both ALS and HWN are ready
 		//
@@ -1156,6 +1607,8 @@ Return Value:
 		//
 		WdfObjectDelete(BklContext->AlsIoTarget);
 		BklContext->AlsIoTarget = NULL;
+		BklContext->AlsRequest = NULL;
+		BklContext->AlsMemory = NULL;
 	}
 
 	return STATUS_SUCCESS;
@@ -1183,6 +1636,7 @@ Return Value:
 
 --*/
 {
+	WDF_OBJECT_ATTRIBUTES attributes;
 	ULONG i;
 	WDF_IO_TARGET_OPEN_PARAMS openParams;
 	NTSTATUS status;
@@ -1248,6 +1702,9 @@ Return Value:
 			TRACE_FLAG_OTHER,
 			"Error: Could not allocate HWN descriptor memory");
 
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		WdfObjectDelete(BklContext->HwnIoTarget);
+		BklContext->HwnIoTarget = NULL;
 		goto exit;
 	}
 
@@ -1267,6 +1724,49 @@ Return Value:
 		BklContext->HwnConfiguration->HwNSettingsInfo[i].HwNSettings[HWN_INTENSITY] = 100;
 	}
 
+	//
+	// Preallocate the request carrying the configuration of all LEDs,
+	// both go away with the target
+	//
+	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+	attributes.ParentObject = BklContext->HwnIoTarget;
+
+	status = WdfRequestCreate(
+		&attributes,
+		BklContext->HwnIoTarget,
+		&BklContext->HwnRequest);
+
+	if (NT_SUCCESS(status))
+	{
+		status = WdfMemoryCreatePreallocated(
+			&attributes,
+			BklContext->HwnConfiguration,
+			BklContext->HwnConfigurationSize,
+			&BklContext->HwnMemory);
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_OTHER,
+			"Error: Could not allocate HWN request - STATUS:%X",
+			status);
+
+		WdfObjectDelete(BklContext->HwnIoTarget);
+		BklContext->HwnIoTarget = NULL;
+		BklContext->HwnRequest = NULL;
+		BklContext->HwnMemory = NULL;
+
+		ExFreePoolWithTag(BklContext->HwnConfiguration, TOUCH_POOL_TAG);
+		BklContext->HwnConfiguration = NULL;
+
+		goto exit;
+	}
+
+	BklContext->HwnBusy = FALSE;
+	BklContext->HwnUpdatePending = FALSE;
+
 	//
 	// Enable the backlight if both ALS and HWN are ready
 	//
@@ -1317,12 +1817,23 @@ Return Value:
 
 	WdfWaitLockRelease(BklContext->BacklightLock);
 
-	//
-	// Deleting the object will close the I/O target if it's not already 
-	// invalid.
-	//
-	WdfObjectDelete(BklContext->HwnIoTarget);
-	BklContext->HwnIoTarget = NULL;
+	if (BklContext->HwnIoTarget != NULL)
+	{
+		//
+		// Let the final update reach the LEDs, the configuration it uses
+		// is freed below
+		//
+		WdfIoTargetStop(BklContext->HwnIoTarget, WdfIoTargetWaitForSentIoToComplete);
+
+		//
+		// Deleting the object will close the I/O target if it's not
+		// already invalid.
+		//
+		WdfObjectDelete(BklContext->HwnIoTarget);
+		BklContext->HwnIoTarget = NULL;
+		BklContext->HwnRequest = NULL;
+		BklContext->HwnMemory = NULL;
+	}
 
 	//
 	// Free HWN related pool allocations
@@ -1510,6 +2021,7 @@ Return Value:
 {
 	WDF_OBJECT_ATTRIBUTES attributes;
 	WDF_WORKITEM_CONFIG config;
+	WDF_TIMER_CONFIG timerConfig;
 	BKL_CONTEXT* context;
 	NTSTATUS status;
 	WORKITEM_CONTEXT* workItemContext;
@@ -1541,7 +2053,7 @@ Return Value:
 	context->FxDevice = FxDevice;
 	context->HwnReady = FALSE;
 	context->AlsReady = FALSE;
-	context->LastInputTime = (ULONG)GetTickCount();
+	context->LastInputTime = (LONG)GetTickCount();
 
 	status = WdfWaitLockCreate(
 		WDF_NO_OBJECT_ATTRIBUTES,
@@ -1558,6 +2070,25 @@ Return Value:
 		goto exit;
 	}
 
+	//
+	// The HWN request completes at dispatch level, its state is guarded
+	// by a spin lock
+	//
+	status = WdfSpinLockCreate(
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&context->HwnLock);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_OTHER,
+			"Could not create WDFSPINLOCK object - STATUS:%X",
+			status);
+
+		goto exit;
+	}
+
 	//
 	// See if there are any LEDs to enable
 	//
@@ -1575,9 +2106,10 @@ Return Value:
 	}
 
 	//
-	// Allocate a work item which will poll the ALS sensor for light changes
+	// Allocate a work item which applies ALS readings, the read itself
+	// completes at dispatch level
 	//
-	WDF_WORKITEM_CONFIG_INIT(&config, TchBklGetLightSensorValue);
+	WDF_WORKITEM_CONFIG_INIT(&config, TchBklProcessLightSensorValue);
 	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
 	WDF_OBJECT_ATTRIBUTES_SET_CONTEXT_TYPE(&attributes, WORKITEM_CONTEXT);
 	attributes.ParentObject = context->FxDevice;
@@ -1585,7 +2117,7 @@ Return Value:
 	status = WdfWorkItemCreate(
 		&config,
 		&attributes,
-		&context->TchBklPollAlsWorkItem);
+		&context->AlsWorkItem);
 
 	if (!NT_SUCCESS(status))
 	{
@@ -1599,7 +2131,65 @@ Return Value:
 	}
 
 	workItemContext =
-		GetTouchBacklightContext(context->TchBklPollAlsWorkItem);
+		GetTouchBacklightContext(context->AlsWorkItem);
+	workItemContext->BklContext = context;
+
+	//
+	// And a timer reposting the ALS read after a failure
+	//
+	WDF_TIMER_CONFIG_INIT(&timerConfig, TchBklOnAlsRetryTimer);
+	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+	WDF_OBJECT_ATTRIBUTES_SET_CONTEXT_TYPE(&attributes, WORKITEM_CONTEXT);
+	attributes.ParentObject = context->FxDevice;
+
+	status = WdfTimerCreate(
+		&timerConfig,
+		&attributes,
+		&context->AlsRetryTimer);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_OTHER,
+			"Could not create WDFTIMER object - STATUS:%X",
+			status);
+
+		goto exit;
+	}
+
+	workItemContext =
+		GetTouchBacklightContext(context->AlsRetryTimer);
+	workItemContext->BklContext = context;
+
+	//
+	// And the timer running the inactivity timeout, it programs the
+	// backlights so it runs at passive level
+	//
+	WDF_TIMER_CONFIG_INIT(&timerConfig, TchBklOnActivityTimer);
+	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+	WDF_OBJECT_ATTRIBUTES_SET_CONTEXT_TYPE(&attributes, WORKITEM_CONTEXT);
+	attributes.ParentObject = context->FxDevice;
+	attributes.ExecutionLevel = WdfExecutionLevelPassive;
+
+	status = WdfTimerCreate(
+		&timerConfig,
+		&attributes,
+		&context->ActivityTimer);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_OTHER,
+			"Could not create WDFTIMER object - STATUS:%X",
+			status);
+
+		goto exit;
+	}
+
+	workItemContext =
+		GetTouchBacklightContext(context->ActivityTimer);
 	workItemContext->BklContext = context;
 
 	//
@@ -1782,6 +2372,30 @@ Return Value:
 		TchBklCloseHwnDriver(BklContext);
 	}
 
+	//
+	// Wait for work still referencing the context
+	//
+	if (BklContext->ActivityTimer != NULL)
+	{
+		WdfTimerStop(BklContext->ActivityTimer, TRUE);
+		WdfObjectDelete(BklContext->ActivityTimer);
+		BklContext->ActivityTimer = NULL;
+	}
+
+	if (BklContext->AlsRetryTimer != NULL)
+	{
+		WdfTimerStop(BklContext->AlsRetryTimer, TRUE);
+		WdfObjectDelete(BklContext->AlsRetryTimer);
+		BklContext->AlsRetryTimer = NULL;
+	}
+
+	if (BklContext->AlsWorkItem != NULL)
+	{
+		WdfWorkItemFlush(BklContext->AlsWorkItem);
+		WdfObjectDelete(BklContext->AlsWorkItem);
+		BklContext->AlsWorkItem = NULL;
+	}
+
 	//
 	// Deallocate Lux table if allocated
 	//
@@ -1801,7 +2415,7 @@ Return Value:
 	}
 
 	//
-	// Free the wait lock object
+	// Free the lock objects
 	//
 	if (BklContext->BacklightLock != NULL)
 	{
@@ -1809,6 +2423,12 @@ Return Value:
 		BklContext->BacklightLock = NULL;
 	}
 
+	if (BklContext->HwnLock != NULL)
+	{
+		WdfObjectDelete(BklContext->HwnLock);
+		BklContext->HwnLock = NULL;
+	}
+
 	//
 	// Free context
 	//
@@ -1816,20 +2436,21 @@ Return Value:
 }
 
 VOID
-TchBklNotifyTouchActivity(
-	IN BKL_CONTEXT* BklContext,
-	IN DWORD Time
+TchBklOnActivityTimer(
+	IN WDFTIMER Timer
 )
 /*++
 
 Routine Description:
 
-	Re-enables the backlights if they timed out and the user touched the screen
+	Backlight state machine. Turns the backlights off once no touch
+	input was seen for the inactivity timeout and back on after they
+	timed out and input was seen again, then re-arms itself for the
+	remainder of the timeout while the backlights are on.
 
 Arguments:
 
-	BklContext - Backlight control context
-	Time - Time of user input (touch or button)
+	Timer - WDFTIMER object
 
 Return Value:
 
@@ -1837,26 +2458,32 @@ Return Value:
 
 --*/
 {
+	BKL_CONTEXT* context;
+	ULONG elapsed;
 	NTSTATUS status;
 
-	//
-	// If no backlights are controlled or no timeout is specified, ignore
-	//
-	if ((BklContext == NULL) || (BklContext->Timeout == 0))
+	context = GetTouchBacklightContext(Timer)->BklContext;
+
+	WdfWaitLockAcquire(context->BacklightLock, NULL);
+
+	InterlockedExchange(&context->ActivityTimerArmed, FALSE);
+
+	if (context->Timeout == 0)
 	{
-		return;
+		goto exit;
 	}
 
-	BklContext->LastInputTime = Time;
+	elapsed = (ULONG)GetTickCount() - (ULONG)InterlockedCompareExchange(
+		&context->LastInputTime, 0, 0);
 
-	//
-	// If ALS monitoring is disabled, re-enable it
-	//
-	if (BklContext->TchBklPollAls == FALSE)
+	if (context->TimedOut)
 	{
-		WdfWaitLockAcquire(BklContext->BacklightLock, NULL);
+		if (elapsed >= context->Timeout)
+		{
+			goto exit;
+		}
 
-		status = TchBklEnable(BklContext, TRUE);
+		status = TchBklEnable(context, TRUE);
 
 		if (!NT_SUCCESS(status))
 		{
@@ -1864,10 +2491,93 @@ Return Value:
 				TRACE_LEVEL_ERROR,
 				TRACE_FLAG_OTHER,
 				"Error enabling backlights, may be stuck off!");
+		}
+
+		goto exit;
+	}
+
+	//
+	// Backlights were turned off for another reason, the monitor
+	// turning off for instance
+	//
+	if (context->AlsStreaming == FALSE)
+	{
+		goto exit;
+	}
 
-			NT_ASSERT(FALSE);
+	if (elapsed >= context->Timeout)
+	{
+		status = TchBklEnable(context, FALSE);
+
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_OTHER,
+				"Error disabling backlights, may be stuck on!");
 		}
 
-		WdfWaitLockRelease(BklContext->BacklightLock);
+		context->TimedOut = TRUE;
+
+		goto exit;
+	}
+
+	if (InterlockedExchange(&context->ActivityTimerArmed, TRUE) == FALSE)
+	{
+		WdfTimerStart(
+			Timer,
+			WDF_REL_TIMEOUT_IN_MS(context->Timeout - elapsed));
+	}
+
+exit:
+
+	WdfWaitLockRelease(context->BacklightLock);
+}
+
+VOID
+TchBklNotifyTouchActivity(
+	IN BKL_CONTEXT* BklContext,
+	IN DWORD Time
+)
+/*++
+
+Routine Description:
+
+	Records user input for the inactivity timeout. Called from the touch
+	interrupt path, so it never takes the backlight lock or talks to
+	other drivers; if the backlights timed out, the activity timer is
+	armed to bring them back.
+
+Arguments:
+
+	BklContext - Backlight control context
+	Time - Time of user input (touch or button)
+
+Return Value:
+
+	None.
+
+--*/
+{
+	//
+	// If no backlights are controlled or no timeout is specified, ignore
+	//
+	if ((BklContext == NULL) || (BklContext->Timeout == 0))
+	{
+		return;
+	}
+
+	InterlockedExchange(&BklContext->LastInputTime, (LONG)Time);
+
+	//
+	// The armed timer picks the new time up when it fires, bursts of
+	// input all land in the same debounce period
+	//
+	if (BklContext->TimedOut &&
+		InterlockedExchange(&BklContext->ActivityTimerArmed, TRUE) == FALSE)
+	{
+		WdfTimerStart(
+			BklContext->ActivityTimer,
+			WDF_REL_TIMEOUT_IN_MS(BKL_ACTIVITY_DEBOUNCE));
 	}
 }
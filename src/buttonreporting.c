@@ -21,35 +21,34 @@
 #include "debug.h"
 #include "buttonreporting.h"
 #include "internal.h"
+#include "config.h"
+#include "etwtrace.h"
 
 NTSTATUS
-RmiServiceCapacitiveButtonInterrupt(
+RmiReadCapacitiveButtons(
 	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
 	IN SPB_CONTEXT* SpbContext,
-	IN BOOLEAN ReversedKeys
+	OUT RMI4_F1A_DATA_REGISTERS* DataF1A
 )
 /*++
 
 Routine Description:
 
-	This routine services capacitive button (F$1A) interrupts, it reads
-	button data and fills a HID keyboard report with the relevant information
+	This routine reads the capacitive button (F$1A) data registers.
 
 Arguments:
 
 	ControllerContext - Touch controller context
 	SpbContext - A pointer to the current i2c context
-	HidReport- A HID report buffer to be filled with button data
+	DataF1A - Receives the button data registers
 
 Return Value:
 
-	NTSTATUS, where success indicates the request memory was updated with
-	button press information.
+	NTSTATUS indicating success or failure
 
 --*/
 {
-	RMI4_F1A_DATA_REGISTERS dataF1A;
-	int index;
+	RMI4_RESOLVED_FUNCTION* f1a;
 	NTSTATUS status;
 
 	//
@@ -58,38 +57,29 @@ Return Value:
 	if (ControllerContext->HasButtons == FALSE)
 	{
 		status = STATUS_NOT_IMPLEMENTED;
+
 		goto exit;
 	}
 
 	//
 	// Get the the key press/release information from the controller
 	//
-	index = RmiGetFunctionIndex(
-		ControllerContext->Descriptors,
-		ControllerContext->FunctionCount,
-		RMI4_F1A_0D_CAP_BUTTON_SENSOR);
-
-	if (index == ControllerContext->FunctionCount)
-	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_INIT,
-			"Unexpected - RMI Function 1A missing");
-		status = STATUS_INVALID_DEVICE_STATE;
-		goto exit;
-	}
+	f1a = &ControllerContext->Functions[RMI4_FUNCTION_SLOT_F1A];
+	NT_ASSERT(f1a->Present);
 
 	status = RmiChangePage(
 		ControllerContext,
 		SpbContext,
-		ControllerContext->FunctionOnPage[index]);
+		f1a->Page);
 
 	if (!NT_SUCCESS(status))
 	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_INIT,
-			"Could not change register page");
+		TraceLoggingWrite(
+			TchTraceProvider,
+			"ButtonPageChangeError",
+			TraceLoggingLevel(WINEVENT_LEVEL_ERROR),
+			TraceLoggingKeyword(TCH_TRACE_KEYWORD_INTERRUPT),
+			TraceLoggingNTStatus(status, "Status"));
 		goto exit;
 	}
 
@@ -98,267 +88,725 @@ Return Value:
 	// 
 	status = SpbReadDataSynchronously(
 		SpbContext,
-		ControllerContext->Descriptors[index].DataBase,
-		&dataF1A,
-		sizeof(dataF1A));
+		f1a->DataBase,
+		DataF1A,
+		sizeof(RMI4_F1A_DATA_REGISTERS));
 
 	if (!NT_SUCCESS(status))
 	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_INTERRUPT,
-			"Error reading finger status data - STATUS:%X",
-			status);
+		TraceLoggingWrite(
+			TchTraceProvider,
+			"ButtonDataReadError",
+			TraceLoggingLevel(WINEVENT_LEVEL_ERROR),
+			TraceLoggingKeyword(TCH_TRACE_KEYWORD_INTERRUPT),
+			TraceLoggingNTStatus(status, "Status"));
+
+		TchCountEvent(&ControllerContext->Counters, SpbErrors[TchSpbSiteButtons]);
 
 		goto exit;
 	}
 
+exit:
+	return status;
+}
+
+NTSTATUS
+RmiReportCapacitiveButtons(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN RMI4_F1A_DATA_REGISTERS* DataF1A,
+	IN BOOLEAN ReversedKeys
+)
+/*++
+
+Routine Description:
+
+	This routine updates the button cache from previously read F$1A data
+	and fills a HID keyboard report with the relevant information.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	DataF1A - The button data registers as read from hardware
+	ReversedKeys - TRUE if the part reports keys in the opposite order
+
+Return Value:
+
+	NTSTATUS, where success indicates a report was queued
+
+--*/
+{
+    ULONG physicalMask = 0;
+
     for(int i = 0; i < RMI4_MAX_BUTTONS; i++)
     {
         if(ReversedKeys)
         {
-            ControllerContext->ButtonsCache.PhysicalState[i] = ((dataF1A.Raw >> i) & 0x1);
+            physicalMask |= ((DataF1A->Raw >> i) & 0x1) << i;
         }
         else
         {
-            ControllerContext->ButtonsCache.PhysicalState[i] = ((dataF1A.Raw >> (RMI4_MAX_BUTTONS - i - 1)) & 0x1);
+            physicalMask |= ((DataF1A->Raw >> (RMI4_MAX_BUTTONS - i - 1)) & 0x1) << i;
         }
     }
 
-    status = FillButtonsReportFromCache(ControllerContext);
+    ControllerContext->ButtonsCache.PhysicalMask = physicalMask;
+
+    return FillButtonsReportFromCache(ControllerContext);
+}
+
+NTSTATUS
+RmiServiceCapacitiveButtonInterrupt(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN BOOLEAN ReversedKeys
+)
+/*++
+
+Routine Description:
+
+	This routine services capacitive button (F$1A) interrupts, it reads
+	button data and fills a HID keyboard report with the relevant information
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+	HidReport- A HID report buffer to be filled with button data
+
+Return Value:
+
+	NTSTATUS, where success indicates the request memory was updated with
+	button press information.
+
+--*/
+{
+	RMI4_F1A_DATA_REGISTERS dataF1A;
+	NTSTATUS status;
+
+	status = RmiReadCapacitiveButtons(
+		ControllerContext,
+		SpbContext,
+		&dataF1A);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	status = RmiReportCapacitiveButtons(
+		ControllerContext,
+		&dataF1A,
+		ReversedKeys);
 
 exit:
     return status;
 }
 
-NTSTATUS 
-FillButtonsReportFromCache(
-    IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+#define RMI4_BUTTON_TICKS_PER_MS    10000
+
+#define RMI4_KEY_START              (1 << 0)
+#define RMI4_KEY_TAB                (1 << 1)
+#define RMI4_KEY_ALT                (1 << 2)
+
+#define RMI4_CONSUMER_SEARCH        (1 << 0)
+#define RMI4_CONSUMER_BACK          (1 << 1)
+
+typedef struct _RMI4_BUTTON_ACTION
+{
+    BYTE ReportId;
+    BYTE Keys;
+    BOOLEAN LongPress;
+} RMI4_BUTTON_ACTION;
+
+//
+// Reports sent for a press of each button. This mapping should be made
+// registry configurable. Holding back opens the task switcher.
+//
+static const RMI4_BUTTON_ACTION gButtonActions[RMI4_MAX_BUTTONS] =
+{
+    { REPORTID_CAPKEY_CONSUMER, RMI4_CONSUMER_SEARCH, FALSE },
+    { REPORTID_CAPKEY_KEYBOARD, RMI4_KEY_START,       FALSE },
+    { REPORTID_CAPKEY_CONSUMER, RMI4_CONSUMER_BACK,   TRUE  },
+};
+
+static
+VOID
+RmiQueueButtonReport(
+    IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+    IN BYTE ReportId,
+    IN BYTE Keys
 )
 {
-    NTSTATUS status = STATUS_SUCCESS;
+    PHID_INPUT_REPORT hidReport = NULL;
+
+    GetNextHidReport(ControllerContext, &hidReport);
+    hidReport->ReportID = ReportId;
+    hidReport->KeyReport.bKeys |= Keys;
+}
 
-    BOOLEAN* prevData = ControllerContext->ButtonsCache.prevPhysicalState;
-    BOOLEAN* data = ControllerContext->ButtonsCache.PhysicalState;
-    BOOLEAN* Logical = ControllerContext->ButtonsCache.LogicalState;
+static
+VOID
+RmiButtonLongPress(
+    IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+    IN int Button
+)
+{
     //
-    // Update button states. This mapping should be made registry configurable
+    // Alt+Tab opens the task switcher, Alt stays down until the button
+    // is released
     //
+    RmiQueueButtonReport(ControllerContext, REPORTID_CAPKEY_KEYBOARD, RMI4_KEY_ALT | RMI4_KEY_TAB);
+    RmiQueueButtonReport(ControllerContext, REPORTID_CAPKEY_KEYBOARD, RMI4_KEY_ALT);
 
-    //
-    PHID_INPUT_REPORT hidReport = NULL;
-    PHID_KEY_REPORT hidKeys;
+    ControllerContext->ButtonsCache.State[Button] = RMI4_BUTTON_STATE_LONG_PRESS;
+}
 
-    for(int i = 0; i < RMI4_MAX_BUTTONS; i++)
+static
+VOID
+RmiArmButtonsTimer(
+    IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+    IN ULONG64 Now
+)
+/*++
+
+Routine Description:
+
+    Arms the buttons timer for the earliest pending long press, or stops
+    it if no button is waiting for one. Must be called with the report
+    lock held.
+
+Arguments:
+
+    ControllerContext - Touch controller context
+    Now - Current interrupt time
+
+Return Value:
+
+    None.
+
+--*/
+{
+    RMI4_BUTTONS_CACHE* buttons = &ControllerContext->ButtonsCache;
+    ULONG64 deadline = MAXULONG64;
+    ULONG64 due;
+    int i;
+
+    for(i = 0; i < RMI4_MAX_BUTTONS; i++)
     {
-        if(data[i] && !prevData[i])
+        if(buttons->State[i] == RMI4_BUTTON_STATE_DOWN && gButtonActions[i].LongPress)
         {
-            Logical[i] = TRUE;
-            WdfTimerStart(ControllerContext->ButtonsTimer, WDF_REL_TIMEOUT_IN_MS(1500));
+            due = buttons->PressTime[i] + RMI4_BUTTON_LONG_PRESS_MS * RMI4_BUTTON_TICKS_PER_MS;
+            deadline = min(deadline, due);
         }
     }
 
-    if(!data[1] && prevData[1]) //when up key
+    if(deadline == MAXULONG64)
     {
-        if(Logical[1]) //send key Down if Logical is true
+        if(buttons->TimerArmed)
         {
-            //get hidReports from Queue
-            GetNextHidReport(ControllerContext, &hidReport);
-            hidReport->ReportID = REPORTID_CAPKEY_KEYBOARD;
-            hidKeys = &(hidReport->KeyReport);
-            hidKeys->bKeys |= (1 << 0);
+            WdfTimerStop(ControllerContext->ButtonsTimer, FALSE);
+            buttons->TimerArmed = FALSE;
         }
 
-        GetNextHidReport(ControllerContext, &hidReport);
-        hidReport->ReportID = REPORTID_CAPKEY_KEYBOARD; //send empty report(up all keys)
-
-        Logical[1] = FALSE;
+        return;
     }
 
-    BOOLEAN b0 = !data[0] && prevData[0] && Logical[0];
-    BOOLEAN b2 = !data[2] && prevData[2] && Logical[2];
+    due = (deadline > Now) ? (deadline - Now) / RMI4_BUTTON_TICKS_PER_MS + 1 : 1;
 
-    if(b0 || b2)
-    {
-        //get two hidReports from Queue
-        GetNextHidReport(ControllerContext, &hidReport);
-        hidReport->ReportID = REPORTID_CAPKEY_CONSUMER;
-        hidKeys = &(hidReport->KeyReport);
-        hidKeys->bKeys |= (b0) ? (1 << 0) : 0;
-        hidKeys->bKeys |= (b2) ? (1 << 1) : 0;
-        
-        GetNextHidReport(ControllerContext, &hidReport);
-        hidReport->ReportID = REPORTID_CAPKEY_CONSUMER;
-
-        Logical[0] = FALSE;
-        Logical[2] = FALSE;
-    }
+    WdfTimerStart(ControllerContext->ButtonsTimer, WDF_REL_TIMEOUT_IN_MS(due));
+    buttons->TimerArmed = TRUE;
+}
 
-    //up ALT for alt+tab when button is up
-    if(!data[2] && prevData[2] && !Logical[2])
-    {
-        GetNextHidReport(ControllerContext, &hidReport);
-        hidReport->ReportID = REPORTID_CAPKEY_KEYBOARD;
-    }
+NTSTATUS 
+FillButtonsReportFromCache(
+    IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+    Runs the button state machines on the physical states last stored in
+    the button cache, queueing reports for press and release edges. Must
+    be called with the report lock held.
+
+Arguments:
+
+    ControllerContext - Touch controller context
+
+Return Value:
+
+    NTSTATUS indicating success or failure
+
+--*/
+{
+    RMI4_BUTTONS_CACHE* buttons = &ControllerContext->ButtonsCache;
+    const RMI4_BUTTON_ACTION* action;
+    ULONG64 now;
+    int i;
 
     //
-    // On return of success, this request will be completed up the stack
+    // Edges are timed by the interrupt they were read in, not by when
+    // this runs
     //
+    now = ControllerContext->FingerCache.ScanTime * 1000;
 
-    for(int i = 0; i < RMI4_MAX_BUTTONS; i++)
-        ControllerContext->ButtonsCache.prevPhysicalState[i] = ControllerContext->ButtonsCache.PhysicalState[i];
+    for(i = 0; i < RMI4_MAX_BUTTONS; i++)
+    {
+        action = &gButtonActions[i];
 
-//exit:
-    return status;
+        if(buttons->PhysicalMask & (1UL << i))
+        {
+            if(buttons->State[i] == RMI4_BUTTON_STATE_UP)
+            {
+                buttons->State[i] = RMI4_BUTTON_STATE_DOWN;
+                buttons->PressTime[i] = now;
+            }
+
+            continue;
+        }
+
+        if(buttons->State[i] == RMI4_BUTTON_STATE_UP)
+        {
+            continue;
+        }
+
+        //
+        // A release past the long press time counts as a long press even
+        // if the timer did not get to run yet
+        //
+        if(buttons->State[i] == RMI4_BUTTON_STATE_DOWN &&
+            action->LongPress &&
+            now - buttons->PressTime[i] >= RMI4_BUTTON_LONG_PRESS_MS * RMI4_BUTTON_TICKS_PER_MS)
+        {
+            RmiButtonLongPress(ControllerContext, i);
+        }
+
+        if(buttons->State[i] == RMI4_BUTTON_STATE_LONG_PRESS)
+        {
+            //
+            // Release Alt, closing the task switcher on the selection
+            //
+            RmiQueueButtonReport(ControllerContext, REPORTID_CAPKEY_KEYBOARD, 0);
+        }
+        else
+        {
+            RmiQueueButtonReport(ControllerContext, action->ReportId, action->Keys);
+            RmiQueueButtonReport(ControllerContext, action->ReportId, 0);
+        }
+
+        buttons->State[i] = RMI4_BUTTON_STATE_UP;
+    }
+
+    RmiArmButtonsTimer(ControllerContext, now);
+
+    return STATUS_SUCCESS;
 }
 
-REPORTED_BUTTON
-TchHandleButtonArea(
-	IN ULONG ControllerX,
-	IN ULONG ControllerY,
-	IN PTOUCH_SCREEN_PROPERTIES Props
+#ifdef EXPERIMENTAL_LEGACY_BUTTON_SUPPORT
+//
+// Hardcoded values for RX100, used when the registry has no regions
+//
+static const TCH_BUTTON_REGION_SETTING gLegacyButtonRegions[] =
+{
+    { BUTTON_UNKNOWN, 0,   1280, 768, 1390 },
+    { BUTTON_BACK,    0,   1300, 216, 1390 },
+    { BUTTON_START,   297, 1300, 472, 1390 },
+    { BUTTON_SEARCH,  553, 1300, 768, 1390 },
+};
+#endif
+
+static
+NTSTATUS
+TchButtonRegionsQueryRoutine(
+	IN PWSTR ValueName,
+	IN ULONG ValueType,
+	IN PVOID ValueData,
+	IN ULONG ValueLength,
+	IN PVOID Context,
+	IN PVOID EntryContext
 )
 {
-#ifdef EXPERIMENTAL_LEGACY_BUTTON_SUPPORT
-	//
-	// Hardcoded values now for RX100
-	//
-    ULONG ButtonAreaXMin = 0;
-    ULONG ButtonAreaYMin = 1280;
-    ULONG ButtonAreaXMax = 768;
-    ULONG ButtonAreaYMax = 1390;
-                           
-    ULONG BackAreaXMin =   0;
-    ULONG BackAreaYMin =   1300;
-    ULONG BackAreaXMax =   216;
-    ULONG BackAreaYMax =   1390;
-                           
-    ULONG StartAreaXMin =  297;
-    ULONG StartAreaYMin =  1300;
-    ULONG StartAreaXMax =  472;
-    ULONG StartAreaYMax =  1390;
-                           
-    ULONG SearchAreaXMin = 553;
-    ULONG SearchAreaYMin = 1300;
-    ULONG SearchAreaXMax = 768;
-    ULONG SearchAreaYMax = 1390;
+	TCH_BUTTON_REGION_SETTING* regions = (TCH_BUTTON_REGION_SETTING*)EntryContext;
+	ULONG* count = (ULONG*)Context;
+
+	UNREFERENCED_PARAMETER(ValueName);
+
+	if (ValueType != REG_BINARY ||
+		ValueLength == 0 ||
+		ValueLength % sizeof(TCH_BUTTON_REGION_SETTING) != 0)
+	{
+		return STATUS_SUCCESS;
+	}
 
+	*count = min(ValueLength / sizeof(TCH_BUTTON_REGION_SETTING), RMI4_MAX_BUTTON_REGIONS);
+
+	RtlCopyMemory(regions, ValueData, *count * sizeof(TCH_BUTTON_REGION_SETTING));
+
+	return STATUS_SUCCESS;
+}
+
+static
+VOID
+TchOrientRange(
+	IN ULONG Min,
+	IN ULONG Max,
+	IN const TOUCH_AXIS_TRANSFORM* Axis,
+	OUT ULONG* RawMin,
+	OUT ULONG* RawMax
+)
+{
 	//
-	// Swap the axes reported by the touch controller if requested
+	// Exclusive bounds stay exclusive under v' = Limit - v
 	//
-	if (Props->TouchSwapAxes)
+	if (Axis->Invert)
+	{
+		*RawMin = (Max > Axis->InvertLimit) ? 0 : Axis->InvertLimit - Max;
+		*RawMax = (Min > Axis->InvertLimit) ? 0 : Axis->InvertLimit - Min;
+	}
+	else
 	{
-		ULONG temp = ControllerY;
-		ControllerY = ControllerX;
-		ControllerX = temp;
+		*RawMin = Min;
+		*RawMax = Max;
 	}
+}
+
+VOID
+TchLoadButtonLayout(
+	OUT RMI4_BUTTON_LAYOUT* Layout,
+	IN PTOUCH_SCREEN_PROPERTIES Props
+)
+/*++
+
+Routine Description:
+
+	Reads the virtual button regions and converts them from display
+	oriented controller coordinates to raw controller coordinates, so
+	reported contacts can be tested without applying the orientation
+	transform to each of them. Regions are sorted along the axis running
+	along the button strip.
+
+Arguments:
+
+	Layout - Receives the converted button regions
+	Props - information on how to adjust X/Y coordinates to match the display
+
+Return Value:
+
+	None. The layout is empty if no regions are configured.
+
+--*/
+{
+	TCH_BUTTON_REGION_SETTING settings[RMI4_MAX_BUTTON_REGIONS];
+	RTL_QUERY_REGISTRY_TABLE regTable[2];
+	const TOUCH_COORDINATE_TRANSFORM* transform;
+	RMI4_BUTTON_REGION region;
+	ULONG count;
+	ULONG i;
+	ULONG j;
+
+	RtlZeroMemory(Layout, sizeof(RMI4_BUTTON_LAYOUT));
+
+	transform = &Props->Transform;
+	count = 0;
+
+	RtlZeroMemory(regTable, sizeof(regTable));
+	regTable[0].QueryRoutine = TchButtonRegionsQueryRoutine;
+	regTable[0].Name = TCH_BUTTON_REGIONS_VALUE_NAME;
+	regTable[0].EntryContext = settings;
+
+	RtlQueryRegistryValues(
+		RTL_REGISTRY_ABSOLUTE,
+		TOUCH_CONTROLLER_SETTINGS_REG_KEY,
+		regTable,
+		&count,
+		NULL);
+
+#ifdef EXPERIMENTAL_LEGACY_BUTTON_SUPPORT
+	if (count == 0)
+	{
+		count = ARRAYSIZE(gLegacyButtonRegions);
+
+		RtlCopyMemory(settings, gLegacyButtonRegions, sizeof(gLegacyButtonRegions));
+	}
+#endif
 
 	//
-	// Invert the coordinates as requested
+	// The oriented Y axis runs across the strip, it is the raw X axis
+	// when axes are swapped
 	//
-	if (Props->TouchInvertXAxis)
+	Layout->BandIsX = transform->SwapAxes;
+	Layout->BandMin = MAXULONG;
+	Layout->BandMax = 0;
+
+	for (i = 0; i < count; i++)
 	{
-		if (ControllerX >= Props->TouchPhysicalWidth)
+		if (settings[i].Button < BUTTON_SEARCH ||
+			settings[i].Button > BUTTON_UNKNOWN ||
+			settings[i].XMin >= settings[i].XMax ||
+			settings[i].YMin >= settings[i].YMax)
 		{
-			ControllerX = Props->TouchPhysicalWidth - 1u;
+			Trace(
+				TRACE_LEVEL_WARNING,
+				TRACE_FLAG_INIT,
+				"Ignoring invalid virtual button region %d",
+				i);
+
+			continue;
 		}
 
-		ControllerX = Props->TouchPhysicalWidth - ControllerX - 1u;
-	}
-	if (Props->TouchInvertYAxis)
-	{
-		if (ControllerY >= Props->TouchPhysicalHeight)
+		region.Button = settings[i].Button;
+
+		TchOrientRange(
+			settings[i].XMin,
+			settings[i].XMax,
+			&transform->X,
+			&region.LookupMin,
+			&region.LookupMax);
+
+		TchOrientRange(
+			settings[i].YMin,
+			settings[i].YMax,
+			&transform->Y,
+			&region.BandMin,
+			&region.BandMax);
+
+		//
+		// Insertion sort by the start of the region
+		//
+		for (j = Layout->Count; j > 0 && Layout->Regions[j - 1].LookupMin > region.LookupMin; j--)
 		{
-			ControllerY = Props->TouchPhysicalHeight - 1u;
+			Layout->Regions[j] = Layout->Regions[j - 1];
 		}
 
-		ControllerY = Props->TouchPhysicalHeight - ControllerY - 1u;
+		Layout->Regions[j] = region;
+		Layout->Count++;
+
+		Layout->BandMin = min(Layout->BandMin, region.BandMin);
+		Layout->BandMax = max(Layout->BandMax, region.BandMax);
 	}
 
-	if (ControllerX > ButtonAreaXMin && ControllerX < ButtonAreaXMax && ControllerY > ButtonAreaYMin && ControllerY < ButtonAreaYMax)
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_FLAG_INIT,
+		"Loaded %d virtual button regions, band %d-%d on %s",
+		Layout->Count,
+		Layout->BandMin,
+		Layout->BandMax,
+		Layout->BandIsX ? "X" : "Y");
+}
+
+REPORTED_BUTTON
+TchHandleButtonArea(
+	IN ULONG ControllerX,
+	IN ULONG ControllerY,
+	IN const RMI4_BUTTON_LAYOUT* Layout
+)
+/*++
+
+Routine Description:
+
+	Looks up the virtual button under a contact. Contacts outside the
+	strip of all regions, the common case, are rejected with a single
+	comparison. A button region takes precedence over an overlapping
+	dead zone.
+
+Arguments:
+
+	ControllerX - Raw controller X coordinate of the contact
+	ControllerY - Raw controller Y coordinate of the contact
+	Layout - Button regions loaded by TchLoadButtonLayout
+
+Return Value:
+
+	The button under the contact, BUTTON_UNKNOWN for a dead zone, or
+	BUTTON_NONE
+
+--*/
+{
+	REPORTED_BUTTON button;
+	ULONG lookup;
+	ULONG band;
+	ULONG i;
+
+	if (Layout->Count == 0)
 	{
-		if (ControllerX > BackAreaXMin && ControllerX < BackAreaXMax && ControllerY > BackAreaYMin && ControllerY < BackAreaYMax)
-		{
-			return BUTTON_BACK;
-		}
-		if (ControllerX > StartAreaXMin && ControllerX < StartAreaXMax && ControllerY > StartAreaYMin && ControllerY < StartAreaYMax)
+		return BUTTON_NONE;
+	}
+
+	if (Layout->BandIsX)
+	{
+		band = ControllerX;
+		lookup = ControllerY;
+	}
+	else
+	{
+		band = ControllerY;
+		lookup = ControllerX;
+	}
+
+	if (band <= Layout->BandMin || band >= Layout->BandMax)
+	{
+		return BUTTON_NONE;
+	}
+
+	button = BUTTON_NONE;
+
+	for (i = 0; i < Layout->Count && lookup > Layout->Regions[i].LookupMin; i++)
+	{
+		if (lookup >= Layout->Regions[i].LookupMax ||
+			band <= Layout->Regions[i].BandMin ||
+			band >= Layout->Regions[i].BandMax)
 		{
-			return BUTTON_START;
+			continue;
 		}
-		if (ControllerX > SearchAreaXMin && ControllerX < SearchAreaXMax && ControllerY > SearchAreaYMin && ControllerY < SearchAreaYMax)
+
+		if (Layout->Regions[i].Button != BUTTON_UNKNOWN)
 		{
-			return BUTTON_SEARCH;
+			return (REPORTED_BUTTON)Layout->Regions[i].Button;
 		}
-		return BUTTON_UNKNOWN;
+
+		button = BUTTON_UNKNOWN;
 	}
-#else
-	UNREFERENCED_PARAMETER((ControllerX, ControllerY, Props));
-#endif
-	return BUTTON_NONE;
+
+	return button;
 }
 
 void 
 ButtonsTimerHandler(
     WDFTIMER Timer
 )
+/*++
+
+Routine Description:
+
+    Runs once the earliest pending long press is due, triggers the long
+    press action of each button held long enough.
+
+Arguments:
+
+    Timer - a handle to the framework timer object
+
+Return Value:
+
+    None.
+
+--*/
 {
     WDFDEVICE FxDevice = (WDFDEVICE)WdfTimerGetParentObject(Timer);
     PDEVICE_EXTENSION devContext = GetDeviceContext(FxDevice);
     RMI4_CONTROLLER_CONTEXT* controller = (RMI4_CONTROLLER_CONTEXT*)devContext->TouchContext;
+    RMI4_BUTTONS_CACHE* buttons = &controller->ButtonsCache;
+    BOOLEAN flag = FALSE;
+    ULONG64 now;
+    int i;
 
-    BOOLEAN* Logical = controller->ButtonsCache.LogicalState;
+    WdfWaitLockAcquire(controller->ReportLock, NULL);
 
-    PHID_INPUT_REPORT hidReport = NULL;
-    PHID_KEY_REPORT hidKeys;
-    BOOLEAN flag = FALSE;
+    buttons->TimerArmed = FALSE;
+    now = KeQueryInterruptTime();
 
-    if(Logical[2])
+    for(i = 0; i < RMI4_MAX_BUTTONS; i++)
     {
-        //get two hidReports from Queue
-        //GetNextHidReport(controller, &hidReport);
-        //hidReport->ReportID = REPORTID_CAPKEY_KEYBOARD;
-        //hidKeys = &(hidReport->KeyReport);
-        //hidKeys->bKeys |= (1 << 2);//alt
-
-        GetNextHidReport(controller, &hidReport);
-        hidReport->ReportID = REPORTID_CAPKEY_KEYBOARD;
-        hidKeys = &(hidReport->KeyReport);
-        hidKeys->bKeys |= (1 << 2);//alt
-        hidKeys->bKeys |= (1 << 1);//tab
-
-        GetNextHidReport(controller, &hidReport);
-        hidReport->ReportID = REPORTID_CAPKEY_KEYBOARD;
-        hidKeys = &(hidReport->KeyReport);
-        hidKeys->bKeys |= (1 << 2);//alt
-        //hidKeys->bKeys &= ~(1 << 1);//UP Tab
-
-        Logical[2] = FALSE;
-        flag = TRUE;
+        if(buttons->State[i] == RMI4_BUTTON_STATE_DOWN &&
+            gButtonActions[i].LongPress &&
+            now - buttons->PressTime[i] >= RMI4_BUTTON_LONG_PRESS_MS * RMI4_BUTTON_TICKS_PER_MS)
+        {
+            RmiButtonLongPress(controller, i);
+            flag = TRUE;
+        }
     }
 
+    RmiArmButtonsTimer(controller, now);
+
+    RmiPublishHidReports(controller);
+
+    WdfWaitLockRelease(controller->ReportLock);
+
     if(flag)
     {
         SendHidReports(
             devContext->PingPongQueue,
-            controller->HidQueue,
-            controller->HidQueueCount
+            &controller->ReportQueue
         );
-        controller->HidQueueCount = 0;
     }
-
-    //Trace(TRACE_LEVEL_INFORMATION, TRACE_FLAG_HID, "Buttons Timer reached!");
 }
 
-void
+NTSTATUS
 ButtonsInitTimer(
     RMI4_CONTROLLER_CONTEXT* ControllerContext
 )
+/*++
+
+Routine Description:
+
+    Creates the one-shot timer detecting long button presses
+
+Arguments:
+
+    ControllerContext - Touch controller context
+
+Return Value:
+
+    NTSTATUS indicating success or failure
+
+--*/
 {
     WDF_TIMER_CONFIG       timerConfig;
     WDF_OBJECT_ATTRIBUTES  timerAttributes;
+    NTSTATUS status;
+
     WDF_TIMER_CONFIG_INIT(&timerConfig, ButtonsTimerHandler);
     WDF_OBJECT_ATTRIBUTES_INIT(&timerAttributes);
     timerAttributes.ParentObject = ControllerContext->FxDevice;
 
-    WdfTimerCreate(&timerConfig, &timerAttributes, &ControllerContext->ButtonsTimer);
-}
\ No newline at end of file
+    //
+    // The handler takes the report lock, run it at passive level
+    //
+    timerAttributes.ExecutionLevel = WdfExecutionLevelPassive;
+
+    status = WdfTimerCreate(&timerConfig, &timerAttributes, &ControllerContext->ButtonsTimer);
+
+    if (!NT_SUCCESS(status))
+    {
+        Trace(
+            TRACE_LEVEL_ERROR,
+            TRACE_FLAG_INIT,
+            "Could not create buttons timer - STATUS:%X",
+            status);
+    }
+
+    return status;
+}
+
+VOID
+ButtonsStopTimer(
+    RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+    Cancels a pending long press ahead of a power down
+
+Arguments:
+
+    ControllerContext - Touch controller context
+
+Return Value:
+
+    None.
+
+--*/
+{
+    if (ControllerContext->ButtonsTimer == NULL)
+    {
+        return;
+    }
+
+    //
+    // Wait for a running handler, it takes the report lock
+    //
+    WdfTimerStop(ControllerContext->ButtonsTimer, TRUE);
+
+    ControllerContext->ButtonsCache.TimerArmed = FALSE;
+}
@@ -21,9 +21,10 @@
 #include "internal.h"
 #include "controller.h"
 #include "device.h"
-#include "spb.h"
+#include "spbhelper.h"
 #include "idle.h"
 #include "debug.h"
+#include "etwtrace.h"
 //#include "device.tmh"
 
 #ifdef ALLOC_PRAGMA
@@ -59,13 +60,18 @@ OnInterruptIsr(
 --*/
 {
 	PDEVICE_EXTENSION devContext;
+	TCH_SCAN_TIMESTAMP timestamp;
 	NTSTATUS status;
 	BOOLEAN servicingComplete;
-	PHID_INPUT_REPORT hidReportsFromDriver;
-    int hidReportsCount = 0;
 
 	UNREFERENCED_PARAMETER(MessageID);
 
+	//
+	// Stamp the frame before any bus traffic, so the scan time does not
+	// pick up SPB latency
+	//
+	TchQueryScanTimestamp(&timestamp);
+
 	status = STATUS_SUCCESS;
 	servicingComplete = FALSE;
 	devContext = GetDeviceContext(WdfInterruptGetDevice(Interrupt));
@@ -92,8 +98,7 @@ OnInterruptIsr(
         devContext->TouchContext,
         &devContext->I2CContext,
         devContext->InputMode,
-        &hidReportsFromDriver,
-        &hidReportsCount
+        &timestamp
     );
 
 	if (!NT_SUCCESS(status))
@@ -104,32 +109,202 @@ OnInterruptIsr(
         goto exit;
 	}
 
+	//
+	// A frame was captured for the report work item to parse and complete
+	//
+	if (status == STATUS_PENDING)
+	{
+		WdfWorkItemEnqueue(devContext->ReportWorkItem);
+		goto exit;
+	}
+
     SendHidReports(
         devContext->PingPongQueue,
-        hidReportsFromDriver,
-        hidReportsCount
+        TchGetReportQueue(devContext->TouchContext)
     );
 
 exit:
+	//
+	// Any interrupt counts as activity, the reports are already on their
+	// way when the active settings are restored
+	//
+	if (devContext->DiagnosticMode == FALSE)
+	{
+		TchNotifyTouchActivity(
+			devContext->TouchContext,
+			&devContext->I2CContext);
+	}
+
 	return TRUE;
 }
 
+VOID
+OnReportWorkItem(
+	IN WDFWORKITEM WorkItem
+)
+/*++
+
+  Routine Description:
+
+	This routine drains the frames captured by the interrupt routine when
+	pipelined reporting is enabled, building and completing the HID
+	reports for each while the interrupt routine reads the next frame.
+
+  Arguments:
+
+	WorkItem - a handle to the framework work item object
+
+  Return Value:
+
+	None.
+
+--*/
+{
+	PDEVICE_EXTENSION devContext;
+	NTSTATUS status;
+
+	devContext = GetDeviceContext(WdfWorkItemGetParentObject(WorkItem));
+
+	for (;;)
+	{
+		status = TchServiceCapturedFrame(
+			devContext->TouchContext,
+			devContext->InputMode);
+
+		if (status == STATUS_NO_MORE_ENTRIES)
+		{
+			break;
+		}
+
+		if (NT_SUCCESS(status))
+		{
+			SendHidReports(
+				devContext->PingPongQueue,
+				TchGetReportQueue(devContext->TouchContext));
+		}
+	}
+}
+
+static
+ULONG
+TchGetInputReportLength(
+    IN PHID_REPORT_QUEUE ReportQueue,
+    IN PHID_INPUT_REPORT HidReport
+)
+/*++
+
+  Routine Description:
+
+	Returns the number of bytes HIDClass expects for a queued report, which
+	depends on its report id and on the touch report format in use.
+
+  Arguments:
+
+	ReportQueue - Queue the report belongs to
+	HidReport - Report about to be completed
+
+  Return Value:
+
+	Length of the report in bytes, including the report id
+
+--*/
+{
+#ifdef _TIMESTAMP_
+    UNREFERENCED_PARAMETER(ReportQueue);
+    UNREFERENCED_PARAMETER(HidReport);
+
+    //
+    // The timestamp follows the largest report, send everything
+    //
+    return sizeof(HID_INPUT_REPORT);
+#else
+    ULONG length = FIELD_OFFSET(HID_INPUT_REPORT, TouchReport);
+
+    switch(HidReport->ReportID)
+    {
+    case REPORTID_MTOUCH:
+        length += ReportQueue->WideTouchReports ?
+            sizeof(HID_WIDE_TOUCH_REPORT) :
+            sizeof(HID_TOUCH_REPORT);
+        break;
+    case REPORTID_MOUSE:
+        //
+        // The descriptor has no field for the reserved word
+        //
+        length += FIELD_OFFSET(HID_MOUSE_REPORT, InputReport.wReserved);
+        break;
+    default:
+        length += sizeof(HID_KEY_REPORT);
+        break;
+    }
+
+    return length;
+#endif
+}
+
 void
 SendHidReports(
     WDFQUEUE PingPongQueue,
-    PHID_INPUT_REPORT hidReportsFromDriver,
-    int hidReportsCount
+    PHID_REPORT_QUEUE ReportQueue
 )
+/*++
+
+  Routine Description:
+
+	Completes queued HID reports to pending HIDClass read requests, for as
+	long as both are available. Reports without a request stay queued
+	until TchReadReport delivers the next request.
+
+	With batched completion enabled, as many queued reports as fit in the
+	request's output buffer are packed back to back, so a burst of reports
+	costs a single request completion.
+
+  Arguments:
+
+	PingPongQueue - Manual queue holding HIDClass read requests
+	ReportQueue - Reports waiting to be completed
+
+  Return Value:
+
+	None.
+
+--*/
 {
     NTSTATUS status;
     WDFREQUEST request = NULL;
     PHID_INPUT_REPORT hidReportRequestBuffer;
     size_t hidReportRequestBufferLength;
-
-    for(int i = 0; i < hidReportsCount; i++)
+    PHID_INPUT_REPORT hidReport;
+    ULONG hidReportLength;
+    size_t bytesCopied;
+    LONG64 frameStart;
+    LONG64 readyTime;
+    LONG head;
+    LONG tail;
+
+    for(;;)
     {
+        WdfSpinLockAcquire(ReportQueue->ConsumerLock);
+
+        tail = ReportQueue->Tail;
+        head = ReportQueue->Head;
+
+        if(tail == head)
+        {
+            WdfSpinLockRelease(ReportQueue->ConsumerLock);
+            break;
+        }
+
+        KeMemoryBarrier();
+
+        hidReport = &ReportQueue->Reports[tail & (HID_REPORT_QUEUE_DEPTH - 1)];
+        hidReportLength = TchGetInputReportLength(ReportQueue, hidReport);
+        frameStart = ReportQueue->FrameStart[tail & (HID_REPORT_QUEUE_DEPTH - 1)];
+        readyTime = ReportQueue->ReadyTime[tail & (HID_REPORT_QUEUE_DEPTH - 1)];
+
         //
-        // Complete a HIDClass request if one is available
+        // Complete a HIDClass request if one is available, otherwise
+        // keep the report for the next read request
         //
         status = WdfIoQueueRetrieveNextRequest(
             PingPongQueue,
@@ -137,13 +312,8 @@ SendHidReports(
 
         if(!NT_SUCCESS(status))
         {
-            Trace(
-                TRACE_LEVEL_ERROR,
-                TRACE_FLAG_REPORTING,
-                "No request pending from HIDClass, ignoring report - STATUS:%X",
-                status);
-
-            continue;
+            WdfSpinLockRelease(ReportQueue->ConsumerLock);
+            break;
         }
 
         //
@@ -151,45 +321,96 @@ SendHidReports(
         //
         status = WdfRequestRetrieveOutputBuffer(
             request,
-            sizeof(HID_INPUT_REPORT),
+            hidReportLength,
             &hidReportRequestBuffer,
             &hidReportRequestBufferLength);
 
         if(!NT_SUCCESS(status))
         {
-            Trace(
-                TRACE_LEVEL_WARNING,
-                TRACE_FLAG_SAMPLES,
-                "Error retrieving HID read request output buffer - STATUS:%X",
-                status);
+            TraceLoggingWrite(
+                TchTraceProvider,
+                "HidReadBufferError",
+                TraceLoggingLevel(WINEVENT_LEVEL_WARNING),
+                TraceLoggingKeyword(TCH_TRACE_KEYWORD_REPORTING),
+                TraceLoggingNTStatus(status, "Status"),
+                TraceLoggingUInt32(hidReportLength, "ReportLength"));
         }
         else
         {
             //
             // Validate the size of the output buffer
             //
-            if(hidReportRequestBufferLength < sizeof(HID_INPUT_REPORT))
+            if(hidReportRequestBufferLength < hidReportLength)
             {
                 status = STATUS_BUFFER_TOO_SMALL;
 
-                Trace(
-                    TRACE_LEVEL_WARNING,
-                    TRACE_FLAG_SAMPLES,
-                    "Error HID read request buffer is too small (%lu bytes) - STATUS:%X",
-                    hidReportRequestBufferLength,
-                    status);
+                TraceLoggingWrite(
+                    TchTraceProvider,
+                    "HidReadBufferTooSmall",
+                    TraceLoggingLevel(WINEVENT_LEVEL_WARNING),
+                    TraceLoggingKeyword(TCH_TRACE_KEYWORD_REPORTING),
+                    TraceLoggingUInt64(hidReportRequestBufferLength, "BufferLength"),
+                    TraceLoggingUInt32(hidReportLength, "ReportLength"));
             }
             else
             {
                 RtlCopyMemory(
                     hidReportRequestBuffer,
-                    &hidReportsFromDriver[i],
-                    sizeof(HID_INPUT_REPORT));
-
-                WdfRequestSetInformation(request, sizeof(HID_INPUT_REPORT));
+                    hidReport,
+                    hidReportLength);
+
+                bytesCopied = hidReportLength;
+                tail++;
+
+                //
+                // Append the following reports while they fit, each one
+                // keeps its own report id so HIDClass can split them
+                //
+                while(ReportQueue->BatchReadCompletion && tail != head)
+                {
+                    hidReport = &ReportQueue->Reports[tail & (HID_REPORT_QUEUE_DEPTH - 1)];
+                    hidReportLength = TchGetInputReportLength(ReportQueue, hidReport);
+
+                    if(hidReportRequestBufferLength - bytesCopied < hidReportLength)
+                    {
+                        break;
+                    }
+
+                    RtlCopyMemory(
+                        (PUCHAR)hidReportRequestBuffer + bytesCopied,
+                        hidReport,
+                        hidReportLength);
+
+                    bytesCopied += hidReportLength;
+                    tail++;
+                }
+
+                WdfRequestSetInformation(request, bytesCopied);
             }
         }
 
+        //
+        // Only consume the reports once they have been delivered
+        //
+        if(NT_SUCCESS(status))
+        {
+            InterlockedExchangeAdd(
+                &ReportQueue->Counters->ReportsDelivered,
+                tail - ReportQueue->Tail);
+            InterlockedExchange(&ReportQueue->Tail, tail);
+        }
+
+        WdfSpinLockRelease(ReportQueue->ConsumerLock);
+
+        if(NT_SUCCESS(status) && ReportQueue->Latency != NULL && readyTime != 0)
+        {
+            TchLatencyRecordCompletion(
+                ReportQueue->Latency,
+                frameStart,
+                readyTime,
+                TchLatencyNow());
+        }
+
         WdfRequestComplete(request, status);
     }
 }
@@ -281,6 +502,11 @@ Return Value:
 
 	UNREFERENCED_PARAMETER(TargetState);
 
+	//
+	// Interrupts are disabled by now, let captured frames finish reporting
+	//
+	WdfWorkItemFlush(devContext->ReportWorkItem);
+
 	status = TchStandbyDevice(devContext->TouchContext, &devContext->I2CContext);
 
 	if (!NT_SUCCESS(status))
@@ -416,6 +642,11 @@ OnPrepareHardware(
 		goto exit;
 	}
 
+	//
+	// Diagnostics are optional, the device works without them
+	//
+	(VOID)TchDiagCreateControlDevice(FxDevice);
+
 	//
 	// Start the controller
 	//
@@ -480,7 +711,13 @@ OnReleaseHardware(
 			status);
 	}
 
+	//
+	// No diagnostic request may reach the touch context once it is freed
+	//
+	TchDiagDeleteControlDevice(FxDevice);
+
 	status = TchFreeContext(devContext->TouchContext);
+	devContext->TouchContext = NULL;
 
 	if (!NT_SUCCESS(status))
 	{
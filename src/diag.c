@@ -0,0 +1,863 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		diag.c
+
+	Abstract:
+
+		Aggregates per-stage latency of touch frames and exposes it
+		through a diagnostic control device
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include <ntstrsafe.h>
+#include "internal.h"
+#include "controller.h"
+#include "rmiinternal.h"
+#include "diag.h"
+#include "Function54.h"
+#include "tap.h"
+#include "debug.h"
+
+//
+// System and administrators only
+//
+DECLARE_CONST_UNICODE_STRING(gDiagDeviceSddl, L"D:P(A;;GA;;;SY)(A;;GA;;;BA)");
+
+typedef struct _DIAG_DEVICE_CONTEXT
+{
+	WDFDEVICE TouchDevice;
+
+	//
+	// Handle the raw frame tap was mapped through
+	//
+	WDFFILEOBJECT TapFile;
+} DIAG_DEVICE_CONTEXT, * PDIAG_DEVICE_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DIAG_DEVICE_CONTEXT, GetDiagDeviceContext)
+
+static EVT_WDF_IO_IN_CALLER_CONTEXT OnDiagIoInCallerContext;
+static EVT_WDF_FILE_CLEANUP OnDiagFileCleanup;
+
+static
+VOID
+TchLatencyResetLocked(
+	IN PTCH_LATENCY_CONTEXT Latency
+)
+{
+	int i;
+
+	RtlZeroMemory(&Latency->Stats, sizeof(TCH_LATENCY_STATS));
+
+	Latency->Stats.Version = TCH_LATENCY_STATS_VERSION;
+	Latency->Stats.StageCount = TchLatencyStageCount;
+
+	for (i = 0; i < TchLatencyStageCount; i++)
+	{
+		Latency->Stats.Stages[i].MinUs = MAXULONG;
+	}
+}
+
+static
+VOID
+TchLatencyAddSampleLocked(
+	IN PTCH_LATENCY_CONTEXT Latency,
+	IN TCH_LATENCY_STAGE Stage,
+	IN LONG64 From,
+	IN LONG64 To
+)
+{
+	PTCH_LATENCY_STAGE_STATS stats = &Latency->Stats.Stages[Stage];
+	ULONG64 us;
+	ULONG sample;
+	ULONG bucket;
+	ULONG index;
+
+	if (From == 0 || To < From)
+	{
+		return;
+	}
+
+	us = (ULONG64)(To - From) * 1000000ull / (ULONG64)Latency->Frequency;
+	sample = (us > MAXULONG) ? MAXULONG : (ULONG)us;
+
+	if (sample == 0)
+	{
+		bucket = 0;
+	}
+	else
+	{
+		_BitScanReverse(&index, sample);
+		bucket = min(index + 1, TCH_LATENCY_HISTOGRAM_BUCKETS - 1);
+	}
+
+	stats->Count++;
+	stats->TotalUs += sample;
+	stats->MinUs = min(stats->MinUs, sample);
+	stats->MaxUs = max(stats->MaxUs, sample);
+	stats->Histogram[bucket]++;
+}
+
+VOID
+TchLatencyInitialize(
+	IN PTCH_LATENCY_CONTEXT Latency,
+	IN BOOLEAN Enabled
+)
+/*++
+
+Routine Description:
+
+	Prepares the latency statistics. The lock must already exist.
+
+Arguments:
+
+	Latency - Latency context in the controller context
+	Enabled - Whether frames are stamped at all
+
+Return Value:
+
+	None.
+
+--*/
+{
+	LARGE_INTEGER frequency;
+
+	KeQueryPerformanceCounter(&frequency);
+
+	Latency->Frequency = frequency.QuadPart;
+	RtlZeroMemory(&Latency->Acquire, sizeof(TCH_LATENCY_STAMPS));
+	RtlZeroMemory(&Latency->Build, sizeof(TCH_LATENCY_STAMPS));
+
+	WdfSpinLockAcquire(Latency->Lock);
+	TchLatencyResetLocked(Latency);
+	WdfSpinLockRelease(Latency->Lock);
+
+	Latency->Enabled = Enabled;
+}
+
+VOID
+TchLatencyRecordFrame(
+	IN PTCH_LATENCY_CONTEXT Latency,
+	IN PTCH_LATENCY_STAMPS Stamps
+)
+/*++
+
+Routine Description:
+
+	Adds the acquisition and build stages of one frame to the statistics.
+
+Arguments:
+
+	Latency - Latency context in the controller context
+	Stamps - Stamps of the frame, HID reports are built
+
+Return Value:
+
+	None.
+
+--*/
+{
+	WdfSpinLockAcquire(Latency->Lock);
+
+	TchLatencyAddSampleLocked(
+		Latency,
+		TchLatencyStageInterruptStatus,
+		Stamps->Start,
+		Stamps->InterruptStatus);
+
+	TchLatencyAddSampleLocked(
+		Latency,
+		TchLatencyStageDataRead,
+		Stamps->InterruptStatus,
+		Stamps->DataRead);
+
+	TchLatencyAddSampleLocked(
+		Latency,
+		TchLatencyStageReportBuild,
+		Stamps->DataRead,
+		Stamps->Ready);
+
+	WdfSpinLockRelease(Latency->Lock);
+}
+
+VOID
+TchLatencyRecordCompletion(
+	IN PTCH_LATENCY_CONTEXT Latency,
+	IN LONG64 Start,
+	IN LONG64 Ready,
+	IN LONG64 Completed
+)
+/*++
+
+Routine Description:
+
+	Adds the completion of a HIDClass read request to the statistics.
+
+Arguments:
+
+	Latency - Latency context in the controller context
+	Start - ISR entry stamp of the frame the report belongs to
+	Ready - Stamp taken once the frame's reports were built
+	Completed - Stamp taken when the request was completed
+
+Return Value:
+
+	None.
+
+--*/
+{
+	WdfSpinLockAcquire(Latency->Lock);
+
+	TchLatencyAddSampleLocked(Latency, TchLatencyStageCompletion, Ready, Completed);
+	TchLatencyAddSampleLocked(Latency, TchLatencyStageEndToEnd, Start, Completed);
+
+	WdfSpinLockRelease(Latency->Lock);
+}
+
+VOID
+TchLatencyQuery(
+	IN PTCH_LATENCY_CONTEXT Latency,
+	OUT PTCH_LATENCY_STATS Stats
+)
+{
+	int i;
+
+	WdfSpinLockAcquire(Latency->Lock);
+	RtlCopyMemory(Stats, &Latency->Stats, sizeof(TCH_LATENCY_STATS));
+	WdfSpinLockRelease(Latency->Lock);
+
+	for (i = 0; i < TchLatencyStageCount; i++)
+	{
+		if (Stats->Stages[i].Count == 0)
+		{
+			Stats->Stages[i].MinUs = 0;
+			continue;
+		}
+
+		Stats->Stages[i].MeanUs =
+			(ULONG)(Stats->Stages[i].TotalUs / Stats->Stages[i].Count);
+	}
+}
+
+VOID
+TchLatencyReset(
+	IN PTCH_LATENCY_CONTEXT Latency
+)
+{
+	WdfSpinLockAcquire(Latency->Lock);
+	TchLatencyResetLocked(Latency);
+	WdfSpinLockRelease(Latency->Lock);
+}
+
+VOID
+TchCountersQuery(
+	IN PTCH_RUNTIME_COUNTERS Counters,
+	OUT PTCH_COUNTER_STATS Stats
+)
+/*++
+
+Routine Description:
+
+	Snapshots the runtime counters. Each counter is read atomically, the
+	snapshot as a whole is not.
+
+Arguments:
+
+	Counters - Counters in the controller context
+	Stats - Receives the snapshot
+
+Return Value:
+
+	None.
+
+--*/
+{
+	volatile LONG* source = (volatile LONG*)Counters;
+	LONG* target = (LONG*)&Stats->Counters;
+	ULONG i;
+
+	Stats->Version = TCH_COUNTERS_VERSION;
+	Stats->SpbSiteCount = TchSpbSiteCount;
+
+	for (i = 0; i < sizeof(TCH_RUNTIME_COUNTERS) / sizeof(LONG); i++)
+	{
+		target[i] = InterlockedCompareExchange(&source[i], 0, 0);
+	}
+}
+
+VOID
+TchCountersReset(
+	IN PTCH_RUNTIME_COUNTERS Counters
+)
+{
+	volatile LONG* counter = (volatile LONG*)Counters;
+	ULONG i;
+
+	for (i = 0; i < sizeof(TCH_RUNTIME_COUNTERS) / sizeof(LONG); i++)
+	{
+		InterlockedExchange(&counter[i], 0);
+	}
+}
+
+static
+NTSTATUS
+TchDiagFormatName(
+	OUT PUNICODE_STRING Name,
+	IN PCWSTR Base,
+	IN ULONG Instance
+)
+{
+	if (Instance == 0)
+	{
+		return RtlUnicodeStringPrintf(Name, L"%ws", Base);
+	}
+
+	return RtlUnicodeStringPrintf(Name, L"%ws%u", Base, Instance);
+}
+
+NTSTATUS
+TchDiagCreateControlDevice(
+	IN WDFDEVICE FxDevice
+)
+/*++
+
+Routine Description:
+
+	Creates the control device used by diagnostic tools to reach this
+	driver, HIDClass does not forward private IOCTLs to miniports. Its
+	default queue becomes the device's TestQueue, F54 image reads pend
+	in its manual TestReadQueue. Mapping the raw frame tap is handled in
+	the context of the caller before requests reach the queue.
+
+Arguments:
+
+	FxDevice - The touch device the diagnostics report on
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	PDEVICE_EXTENSION devContext;
+	PWDFDEVICE_INIT deviceInit;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	WDF_FILEOBJECT_CONFIG fileConfig;
+	WDF_IO_QUEUE_CONFIG queueConfig;
+	WDFDEVICE controlDevice;
+	ULONG instance;
+	NTSTATUS status;
+
+	DECLARE_UNICODE_STRING_SIZE(deviceName, 64);
+	DECLARE_UNICODE_STRING_SIZE(symbolicName, 64);
+
+	devContext = GetDeviceContext(FxDevice);
+	controlDevice = NULL;
+	status = STATUS_OBJECT_NAME_COLLISION;
+
+	//
+	// Every controller instance gets a control device of its own, named
+	// after the first instance number not in use yet
+	//
+	for (instance = 0; instance < TCH_DIAG_MAX_INSTANCES; instance++)
+	{
+		status = TchDiagFormatName(&deviceName, TCH_DIAG_DEVICE_NAME, instance);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+
+		deviceInit = WdfControlDeviceInitAllocate(
+			WdfDeviceGetDriver(FxDevice),
+			&gDiagDeviceSddl);
+
+		if (deviceInit == NULL)
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			goto exit;
+		}
+
+		status = WdfDeviceInitAssignName(deviceInit, &deviceName);
+
+		if (!NT_SUCCESS(status))
+		{
+			WdfDeviceInitFree(deviceInit);
+			goto exit;
+		}
+
+		WDF_FILEOBJECT_CONFIG_INIT(
+			&fileConfig,
+			WDF_NO_EVENT_CALLBACK,
+			WDF_NO_EVENT_CALLBACK,
+			OnDiagFileCleanup);
+
+		WdfDeviceInitSetFileObjectConfig(
+			deviceInit,
+			&fileConfig,
+			WDF_NO_OBJECT_ATTRIBUTES);
+
+		WdfDeviceInitSetIoInCallerContextCallback(
+			deviceInit,
+			OnDiagIoInCallerContext);
+
+		WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, DIAG_DEVICE_CONTEXT);
+
+		status = WdfDeviceCreate(&deviceInit, &attributes, &controlDevice);
+
+		if (NT_SUCCESS(status))
+		{
+			break;
+		}
+
+		WdfDeviceInitFree(deviceInit);
+		controlDevice = NULL;
+
+		if (status != STATUS_OBJECT_NAME_COLLISION)
+		{
+			goto exit;
+		}
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	GetDiagDeviceContext(controlDevice)->TouchDevice = FxDevice;
+
+	status = TchDiagFormatName(&symbolicName, TCH_DIAG_SYMBOLIC_NAME, instance);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	status = WdfDeviceCreateSymbolicLink(controlDevice, &symbolicName);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(
+		&queueConfig,
+		WdfIoQueueDispatchSequential);
+
+	queueConfig.EvtIoDeviceControl = OnDiagDeviceControl;
+
+	status = WdfIoQueueCreate(
+		controlDevice,
+		&queueConfig,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&devContext->TestQueue);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
+
+	status = WdfIoQueueCreate(
+		controlDevice,
+		&queueConfig,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&devContext->TestReadQueue);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	WdfControlFinishInitializing(controlDevice);
+
+	devContext->DiagDevice = controlDevice;
+
+exit:
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_WARNING,
+			TRACE_FLAG_INIT,
+			"Diagnostic control device unavailable - STATUS:%X",
+			status);
+
+		if (controlDevice != NULL)
+		{
+			WdfObjectDelete(controlDevice);
+		}
+
+		devContext->TestQueue = NULL;
+		devContext->TestReadQueue = NULL;
+	}
+
+	return status;
+}
+
+VOID
+TchDiagDeleteControlDevice(
+	IN WDFDEVICE FxDevice
+)
+{
+	PDEVICE_EXTENSION devContext = GetDeviceContext(FxDevice);
+
+	if (devContext->DiagDevice != NULL)
+	{
+		if (devContext->TouchContext != NULL)
+		{
+			TchF54StreamStop(devContext->TouchContext);
+			TchTapUnmap(devContext->TouchContext);
+		}
+
+		//
+		// Handles still open keep the control device around, they must
+		// not reach the touch device anymore
+		//
+		GetDiagDeviceContext(devContext->DiagDevice)->TouchDevice = NULL;
+
+		WdfObjectDelete(devContext->DiagDevice);
+		devContext->DiagDevice = NULL;
+		devContext->TestQueue = NULL;
+		devContext->TestReadQueue = NULL;
+	}
+}
+
+static
+VOID
+OnDiagIoInCallerContext(
+	IN WDFDEVICE Device,
+	IN WDFREQUEST Request
+)
+/*++
+
+Routine Description:
+
+	Maps and unmaps the raw frame tap, which has to happen in the
+	context of the client process. Any other request is queued to the
+	TestQueue.
+
+Arguments:
+
+	Device - The diagnostic control device
+	Request - Handle to a framework request object
+
+Return Value:
+
+	None.
+
+--*/
+{
+	PDIAG_DEVICE_CONTEXT diagContext;
+	PDEVICE_EXTENSION devContext;
+	WDF_REQUEST_PARAMETERS parameters;
+	PTCH_TAP_MAP_INPUT mapInput;
+	PTCH_TAP_MAP_OUTPUT mapOutput;
+	WDFFILEOBJECT fileObject;
+	ULONG_PTR information;
+	NTSTATUS status;
+
+	WDF_REQUEST_PARAMETERS_INIT(&parameters);
+	WdfRequestGetParameters(Request, &parameters);
+
+	if (parameters.Type != WdfRequestTypeDeviceIoControl ||
+		(parameters.Parameters.DeviceIoControl.IoControlCode != IOCTL_TCH_DIAG_MAP_TAP &&
+		 parameters.Parameters.DeviceIoControl.IoControlCode != IOCTL_TCH_DIAG_UNMAP_TAP))
+	{
+		status = WdfDeviceEnqueueRequest(Device, Request);
+
+		if (!NT_SUCCESS(status))
+		{
+			WdfRequestComplete(Request, status);
+		}
+
+		return;
+	}
+
+	diagContext = GetDiagDeviceContext(Device);
+	fileObject = WdfRequestGetFileObject(Request);
+	information = 0;
+
+	if (diagContext->TouchDevice == NULL ||
+		GetDeviceContext(diagContext->TouchDevice)->TouchContext == NULL)
+	{
+		status = STATUS_DEVICE_NOT_READY;
+		goto exit;
+	}
+
+	devContext = GetDeviceContext(diagContext->TouchDevice);
+
+	if (parameters.Parameters.DeviceIoControl.IoControlCode == IOCTL_TCH_DIAG_UNMAP_TAP)
+	{
+		if (InterlockedCompareExchangePointer(
+			(PVOID*)&diagContext->TapFile,
+			NULL,
+			fileObject) != fileObject)
+		{
+			status = STATUS_INVALID_DEVICE_STATE;
+			goto exit;
+		}
+
+		TchTapUnmap(devContext->TouchContext);
+		status = STATUS_SUCCESS;
+		goto exit;
+	}
+
+	status = WdfRequestRetrieveInputBuffer(
+		Request,
+		sizeof(TCH_TAP_MAP_INPUT),
+		(PVOID*)&mapInput,
+		NULL);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	status = WdfRequestRetrieveOutputBuffer(
+		Request,
+		sizeof(TCH_TAP_MAP_OUTPUT),
+		(PVOID*)&mapOutput,
+		NULL);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	status = TchTapMap(
+		devContext->TouchContext,
+		(HANDLE)(ULONG_PTR)mapInput->Event,
+		mapOutput);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	diagContext->TapFile = fileObject;
+	information = sizeof(TCH_TAP_MAP_OUTPUT);
+
+exit:
+
+	WdfRequestCompleteWithInformation(Request, status, information);
+}
+
+static
+VOID
+OnDiagFileCleanup(
+	IN WDFFILEOBJECT FileObject
+)
+/*++
+
+Routine Description:
+
+	Unmaps the raw frame tap when the handle it was mapped through is
+	closed, a client exiting without unmapping included
+
+Arguments:
+
+	FileObject - The file object being cleaned up
+
+Return Value:
+
+	None.
+
+--*/
+{
+	PDIAG_DEVICE_CONTEXT diagContext;
+
+	diagContext = GetDiagDeviceContext(WdfFileObjectGetDevice(FileObject));
+
+	if (InterlockedCompareExchangePointer(
+		(PVOID*)&diagContext->TapFile,
+		NULL,
+		FileObject) != FileObject)
+	{
+		return;
+	}
+
+	if (diagContext->TouchDevice != NULL &&
+		GetDeviceContext(diagContext->TouchDevice)->TouchContext != NULL)
+	{
+		TchTapUnmap(GetDeviceContext(diagContext->TouchDevice)->TouchContext);
+	}
+}
+
+VOID
+OnDiagDeviceControl(
+	IN WDFQUEUE Queue,
+	IN WDFREQUEST Request,
+	IN size_t OutputBufferLength,
+	IN size_t InputBufferLength,
+	IN ULONG IoControlCode
+)
+/*++
+
+Routine Description:
+
+	Handles private IOCTLs sent to the diagnostic control device.
+
+Arguments:
+
+	Queue - The TestQueue of the touch device
+	Request - Handle to a framework request object
+	OutputBufferLength - Length of the request's output buffer
+	InputBufferLength - Length of the request's input buffer
+	IoControlCode - The private IOCTL
+
+Return Value:
+
+	None, status is indicated when completing the request
+
+--*/
+{
+	PDEVICE_EXTENSION devContext;
+	RMI4_CONTROLLER_CONTEXT* controller;
+	PTCH_LATENCY_STATS stats;
+	PTCH_COUNTER_STATS counters;
+	PTCH_F54_STREAM_CONFIG streamConfig;
+	PVOID image;
+	size_t imageLength;
+	ULONG_PTR information;
+	NTSTATUS status;
+
+	UNREFERENCED_PARAMETER(OutputBufferLength);
+	UNREFERENCED_PARAMETER(InputBufferLength);
+
+	information = 0;
+
+	if (GetDiagDeviceContext(WdfIoQueueGetDevice(Queue))->TouchDevice == NULL)
+	{
+		status = STATUS_DEVICE_NOT_READY;
+		goto exit;
+	}
+
+	devContext = GetDeviceContext(
+		GetDiagDeviceContext(WdfIoQueueGetDevice(Queue))->TouchDevice);
+	controller = (RMI4_CONTROLLER_CONTEXT*)devContext->TouchContext;
+
+	if (controller == NULL)
+	{
+		status = STATUS_DEVICE_NOT_READY;
+		goto exit;
+	}
+
+	switch (IoControlCode)
+	{
+	case IOCTL_TCH_DIAG_GET_LATENCY:
+		status = WdfRequestRetrieveOutputBuffer(
+			Request,
+			sizeof(TCH_LATENCY_STATS),
+			(PVOID*)&stats,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			break;
+		}
+
+		TchLatencyQuery(&controller->Latency, stats);
+		information = sizeof(TCH_LATENCY_STATS);
+		break;
+
+	case IOCTL_TCH_DIAG_RESET_LATENCY:
+		TchLatencyReset(&controller->Latency);
+		status = STATUS_SUCCESS;
+		break;
+
+	case IOCTL_TCH_DIAG_GET_COUNTERS:
+		status = WdfRequestRetrieveOutputBuffer(
+			Request,
+			sizeof(TCH_COUNTER_STATS),
+			(PVOID*)&counters,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			break;
+		}
+
+		TchCountersQuery(&controller->Counters, counters);
+		information = sizeof(TCH_COUNTER_STATS);
+		break;
+
+	case IOCTL_TCH_DIAG_RESET_COUNTERS:
+		TchCountersReset(&controller->Counters);
+		status = STATUS_SUCCESS;
+		break;
+
+	case IOCTL_TCH_DIAG_START_F54_STREAM:
+		status = WdfRequestRetrieveInputBuffer(
+			Request,
+			sizeof(TCH_F54_STREAM_CONFIG),
+			(PVOID*)&streamConfig,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			break;
+		}
+
+		status = TchF54StreamStart(
+			controller,
+			&devContext->I2CContext,
+			streamConfig);
+		break;
+
+	case IOCTL_TCH_DIAG_STOP_F54_STREAM:
+		TchF54StreamStop(controller);
+		status = STATUS_SUCCESS;
+		break;
+
+	case IOCTL_TCH_DIAG_FLASH_FIRMWARE:
+		status = WdfRequestRetrieveInputBuffer(
+			Request,
+			RMI4_F34_IMAGE_DATA_OFFSET,
+			&image,
+			&imageLength);
+
+		if (!NT_SUCCESS(status))
+		{
+			break;
+		}
+
+		status = TchF34Reflash(
+			controller,
+			&devContext->I2CContext,
+			image,
+			(ULONG)imageLength);
+		break;
+
+	case IOCTL_TCH_DIAG_READ_F54_FRAME:
+		status = TchF54StreamRead(controller, Request, &information);
+
+		//
+		// Queued until the next image is captured
+		//
+		if (status == STATUS_PENDING)
+		{
+			return;
+		}
+
+		break;
+
+	default:
+		status = STATUS_INVALID_DEVICE_REQUEST;
+		break;
+	}
+
+exit:
+
+	WdfRequestCompleteWithInformation(Request, status, information);
+}
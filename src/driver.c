@@ -24,10 +24,20 @@
 #include "device.h"
 #include "hid.h"
 #include "queue.h"
+#include "idle.h"
 #include "debug.h"
+#include "etwtrace.h"
 
 //#include "driver.tmh"
 
+//
+// Structured events for the interrupt and reporting paths
+//
+TRACELOGGING_DEFINE_PROVIDER(
+	TchTraceProvider,
+	TCH_TRACE_PROVIDER_NAME,
+	(0x5e4c1c7b, 0x0a5d, 0x4c86, 0x9f, 0x0b, 0x3d, 0x2e, 0x6b, 0x8a, 0x41, 0xf2));
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, OnDeviceAdd)
 #pragma alloc_text(PAGE, OnContextCleanup)
@@ -140,6 +150,21 @@ Return Value:
 	//
 	//WPP_INIT_TRACING(DriverObject, RegistryPath);
 
+	//
+	// Register the TraceLogging provider, events are no-ops until a
+	// session enables it
+	//
+	status = TraceLoggingRegister(TchTraceProvider);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_WARNING,
+			TRACE_FLAG_INIT,
+			"Error registering TraceLogging provider - STATUS:%X",
+			status);
+	}
+
 	//
 	// Create a framework driver object
 	//
@@ -166,6 +191,7 @@ Return Value:
 			status);
 
 		//WPP_CLEANUP(DriverObject);
+		TraceLoggingUnregister(TchTraceProvider);
 
 		goto exit;
 	}
@@ -206,6 +232,7 @@ Return Value:
 	WDF_INTERRUPT_CONFIG interruptConfig;
 	WDF_PNPPOWER_EVENT_CALLBACKS pnpPowerCallbacks;
 	WDF_IO_QUEUE_CONFIG queueConfig;
+	WDF_WORKITEM_CONFIG workItemConfig;
 	NTSTATUS status;
 
 	UNREFERENCED_PARAMETER(Driver);
@@ -347,6 +374,15 @@ Return Value:
 		NULL);
 	interruptConfig.PassiveHandling = TRUE;
 
+	//
+	// A controller dozing in wakeup gesture mode wakes the device through
+	// its attention interrupt. The interrupt is only armed for wake when
+	// that mode is configured, a controller put to sleep or losing its
+	// power in D3 must not wake the device through a wake capable GPIO.
+	// Enabling the mode at runtime takes effect from the next device add.
+	//
+	interruptConfig.CanWakeDevice = TchRegistryIsWakeGestureStandby();
+
 	status = WdfInterruptCreate(
 		fxDevice,
 		&interruptConfig,
@@ -364,6 +400,57 @@ Return Value:
 		goto exit;
 	}
 
+	//
+	// Create the work item building HID reports from captured frames
+	// when pipelined reporting is enabled
+	//
+	WDF_WORKITEM_CONFIG_INIT(&workItemConfig, OnReportWorkItem);
+	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+	attributes.ParentObject = fxDevice;
+
+	status = WdfWorkItemCreate(
+		&workItemConfig,
+		&attributes,
+		&devContext->ReportWorkItem);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Error creating WDF report work item - STATUS:%X",
+			status);
+
+		goto exit;
+	}
+
+	//
+	// Create the idle notification work item up front, so going idle
+	// never depends on an allocation succeeding
+	//
+	WDF_WORKITEM_CONFIG_INIT(&workItemConfig, TchIdleIrpWorkitem);
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, IDLE_WORKITEM_CONTEXT);
+	attributes.ParentObject = fxDevice;
+
+	status = WdfWorkItemCreate(
+		&workItemConfig,
+		&attributes,
+		&devContext->IdleWorkItem);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Error creating WDF idle work item - STATUS:%X",
+			status);
+
+		goto exit;
+	}
+
+	GetWorkItemContext(devContext->IdleWorkItem)->FxDevice = fxDevice;
+	GetWorkItemContext(devContext->IdleWorkItem)->FxRequest = NULL;
+
 exit:
 
 	return status;
@@ -392,4 +479,5 @@ Return Value:
 	PAGED_CODE();
 	UNREFERENCED_PARAMETER(Driver);
 	//WPP_CLEANUP(WdfDriverWdmGetDriverObject(Driver));    
+	TraceLoggingUnregister(TchTraceProvider);
 }
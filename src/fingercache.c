@@ -0,0 +1,440 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		fingercache.c
+
+	Abstract:
+
+		Maintains the local finger cache from the object slots reported by
+		F11 or F12, and the order in which contacts are reported to HID.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include "rmiinternal.h"
+#include "debug.h"
+#include "bitops.h"
+#include "hweight.h"
+#include "fingercache.h"
+
+static
+VOID
+RmiRebuildFingerDownOrder(
+	IN RMI4_FINGER_CACHE* Cache,
+	IN ULONG SlotCount
+)
+/*++
+
+Routine Description:
+
+	Rebuilds the reporting order from the slot sequence numbers, oldest
+	contact first. Only needed when a contact arrived or was dropped, plain
+	movement leaves the order untouched.
+
+Arguments:
+
+	Cache - The finger cache to update
+	SlotCount - Number of object slots in use
+
+Return Value:
+
+	None.
+
+--*/
+{
+	unsigned long listed;
+	unsigned long slot;
+	int count;
+	int j;
+
+	listed = Cache->FingerSlotValid | Cache->FingerSlotDirty;
+	count = 0;
+
+	slot = find_first_bit(&listed, SlotCount);
+
+	while (slot < SlotCount)
+	{
+		//
+		// Insert by sequence number, at most RMI4_MAX_TOUCHES entries
+		//
+		for (j = count;
+			j > 0 &&
+			(LONG)(Cache->FingerSequence[Cache->FingerDownOrder[j - 1]] -
+				Cache->FingerSequence[slot]) > 0;
+			j--)
+		{
+			Cache->FingerDownOrder[j] = Cache->FingerDownOrder[j - 1];
+		}
+
+		Cache->FingerDownOrder[j] = (UCHAR)slot;
+		count++;
+
+		slot = find_next_bit(&listed, SlotCount, slot + 1);
+	}
+
+	NT_ASSERT(count == (int)hweight32(listed));
+
+	Cache->FingerDownCount = count;
+}
+
+static
+VOID
+RmiTrackAxis(
+	IN OUT LONG64* Position,
+	IN OUT LONG64* Velocity,
+	IN int Measured,
+	IN LONG64 Elapsed
+)
+{
+	LONG64 predicted;
+	LONG64 residual;
+
+	predicted = *Position + *Velocity * Elapsed;
+	residual = ((LONG64)Measured << 8) - predicted;
+
+	*Position = predicted + (residual * RMI4_TRACK_ALPHA) / 256;
+	*Velocity += (residual * RMI4_TRACK_BETA) / 256 / Elapsed;
+}
+
+static
+VOID
+RmiTrackContact(
+	IN RMI4_CONTACT_TRACK* Track,
+	IN RMI4_FINGER_INFO* Finger,
+	IN ULONG64 ScanTime
+)
+/*++
+
+Routine Description:
+
+	Feeds a new sample into the alpha-beta track of a contact. A new
+	contact, or one not seen for a while, restarts at rest on its
+	measured position.
+
+Arguments:
+
+	Track - The contact's track
+	Finger - The sample reported by hardware
+	ScanTime - Scan time of the sample
+
+Return Value:
+
+	None.
+
+--*/
+{
+	LONG64 elapsed;
+
+	elapsed = (LONG64)(ScanTime - Track->Time);
+
+	if (Track->Samples == 0 || elapsed <= 0 || elapsed > RMI4_TRACK_MAX_GAP)
+	{
+		Track->X = (LONG64)Finger->x << 8;
+		Track->Y = (LONG64)Finger->y << 8;
+		Track->VelocityX = 0;
+		Track->VelocityY = 0;
+		Track->Samples = 1;
+	}
+	else
+	{
+		RmiTrackAxis(&Track->X, &Track->VelocityX, Finger->x, elapsed);
+		RmiTrackAxis(&Track->Y, &Track->VelocityY, Finger->y, elapsed);
+
+		if (Track->Samples < 2)
+		{
+			Track->Samples++;
+		}
+	}
+
+	Track->Time = ScanTime;
+}
+
+VOID
+RmiUpdateFingerCache(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN ULONG PresentMask,
+	IN RMI4_FINGER_INFO* Reported
+)
+/*++
+
+Routine Description:
+
+	This routine takes the object slots reported by the Synaptics hardware
+	and updates the local cache of finger states. A contact that lifted is
+	reported once more with its last known position and no tip, then
+	dropped on the next update. Contacts are reported in the order they
+	first touched down.
+
+Arguments:
+
+	ControllerContext - Touch controller context holding the finger cache
+	PresentMask - One bit per object slot, set if a finger is present
+	Reported - Per slot finger data from hardware, only read for slots
+		set in PresentMask
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_FINGER_CACHE* Cache = &ControllerContext->FingerCache;
+	ULONG slotCount;
+	ULONG slotMask;
+	ULONG dropped;
+	ULONG arrived;
+	ULONG lifted;
+	unsigned long bits;
+	unsigned long slot;
+
+	slotCount = min((ULONG)ControllerContext->MaxFingers, RMI4_MAX_TOUCHES);
+	slotMask = (slotCount >= 32) ? (ULONG)-1 : ((1UL << slotCount) - 1);
+
+	PresentMask &= slotMask;
+
+	//
+	// Contacts whose lift was reported on the previous update leave the
+	// list now, the slot may already be reused by a new contact
+	//
+	dropped = Cache->FingerSlotDirty;
+	arrived = PresentMask & ~Cache->FingerSlotValid;
+	lifted = Cache->FingerSlotValid & ~PresentMask;
+
+	bits = arrived;
+	slot = find_first_bit(&bits, slotCount);
+	while (slot < slotCount)
+	{
+		Cache->FingerSequence[slot] = Cache->NextSequence++;
+		Cache->Track[slot].Samples = 0;
+		slot = find_next_bit(&bits, slotCount, slot + 1);
+	}
+
+	bits = PresentMask;
+	slot = find_first_bit(&bits, slotCount);
+	while (slot < slotCount)
+	{
+		Cache->FingerSlot[slot] = Reported[slot];
+
+		if (ControllerContext->Config.PredictionHorizon != 0)
+		{
+			RmiTrackContact(
+				&Cache->Track[slot],
+				&Reported[slot],
+				Cache->ScanTime);
+		}
+
+		slot = find_next_bit(&bits, slotCount, slot + 1);
+	}
+
+	bits = lifted;
+	slot = find_first_bit(&bits, slotCount);
+	while (slot < slotCount)
+	{
+		Cache->FingerSlot[slot].fingerStatus = RMI4_FINGER_STATE_NOT_PRESENT;
+		slot = find_next_bit(&bits, slotCount, slot + 1);
+	}
+
+	Cache->FingerSlotValid = PresentMask;
+	Cache->FingerSlotDirty = lifted;
+
+	if ((dropped | arrived) != 0)
+	{
+		RmiRebuildFingerDownOrder(Cache, slotCount);
+	}
+}
+
+BOOLEAN
+RmiFingerCacheHasChanged(
+	IN RMI4_FINGER_CACHE* Cache,
+	IN ULONG Deadband,
+	IN ULONG64 KeepAliveInterval
+)
+/*++
+
+Routine Description:
+
+	Compares the cached contacts against the state last reported to HID.
+	A contact arriving or leaving, a tip change, or a move larger than the
+	deadband on either axis counts as a change. An unchanged frame is still
+	reported once the keep-alive interval has elapsed.
+
+Arguments:
+
+	Cache - The finger cache
+	Deadband - Movement in controller units that is treated as jitter
+	KeepAliveInterval - Longest time without a report, in scan time units
+
+Return Value:
+
+	TRUE if the frame should be reported
+
+--*/
+{
+	ULONG listed;
+	int i;
+	int slot;
+	LONG dx;
+	LONG dy;
+
+	listed = Cache->FingerSlotValid | Cache->FingerSlotDirty;
+
+	if (listed != Cache->ReportedMask)
+	{
+		return TRUE;
+	}
+
+	if (Cache->ScanTime - Cache->ReportedScanTime >= KeepAliveInterval)
+	{
+		return TRUE;
+	}
+
+	for (i = 0; i < Cache->FingerDownCount; i++)
+	{
+		slot = Cache->FingerDownOrder[i];
+
+		if (Cache->FingerSlot[slot].fingerStatus !=
+			Cache->ReportedSlot[slot].fingerStatus)
+		{
+			return TRUE;
+		}
+
+		dx = Cache->FingerSlot[slot].x - Cache->ReportedSlot[slot].x;
+		dy = Cache->FingerSlot[slot].y - Cache->ReportedSlot[slot].y;
+
+		if ((ULONG)((dx < 0) ? -dx : dx) > Deadband ||
+			(ULONG)((dy < 0) ? -dy : dy) > Deadband)
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+VOID
+RmiFingerCacheMarkReported(
+	IN RMI4_FINGER_CACHE* Cache
+)
+/*++
+
+Routine Description:
+
+	Records the cached contacts as the state HID last received.
+
+Arguments:
+
+	Cache - The finger cache
+
+Return Value:
+
+	None.
+
+--*/
+{
+	int i;
+	int slot;
+
+	for (i = 0; i < Cache->FingerDownCount; i++)
+	{
+		slot = Cache->FingerDownOrder[i];
+		Cache->ReportedSlot[slot] = Cache->FingerSlot[slot];
+	}
+
+	Cache->ReportedMask = Cache->FingerSlotValid | Cache->FingerSlotDirty;
+	Cache->ReportedScanTime = Cache->ScanTime;
+}
+
+static
+int
+RmiPredictAxis(
+	IN int Measured,
+	IN LONG64 Velocity,
+	IN ULONG64 Horizon
+)
+{
+	LONG64 offset;
+
+	offset = (Velocity * (LONG64)Horizon) / 256;
+	offset = max(min(offset, RMI4_PREDICTION_MAX_OFFSET), -RMI4_PREDICTION_MAX_OFFSET);
+
+	return (int)max(Measured + offset, 0);
+}
+
+VOID
+RmiFingerCachePredict(
+	IN RMI4_FINGER_CACHE* Cache,
+	IN int Slot,
+	IN ULONG64 Horizon,
+	IN OUT int* X,
+	IN OUT int* Y
+)
+/*++
+
+Routine Description:
+
+	Extrapolates the position of a contact by the given horizon along
+	its tracked velocity. Contacts that just touched down have no
+	velocity yet, and a lifting contact is reported where it left, so
+	both keep their measured position.
+
+Arguments:
+
+	Cache - The finger cache
+	Slot - Slot of the contact
+	Horizon - How far to extrapolate, in scan time units
+	X, Y - On entry the measured position, receive the predicted one
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_CONTACT_TRACK* track;
+
+	track = &Cache->Track[Slot];
+
+	if (track->Samples < 2 ||
+		Cache->FingerSlot[Slot].fingerStatus == RMI4_FINGER_STATE_NOT_PRESENT)
+	{
+		return;
+	}
+
+	*X = RmiPredictAxis(*X, track->VelocityX, Horizon);
+	*Y = RmiPredictAxis(*Y, track->VelocityY, Horizon);
+}
+
+VOID
+RmiResetFingerCache(
+	IN RMI4_FINGER_CACHE* Cache
+)
+/*++
+
+Routine Description:
+
+	Forgets every tracked contact, used when the controller is reset or
+	powered down.
+
+Arguments:
+
+	Cache - The finger cache to reset
+
+Return Value:
+
+	None.
+
+--*/
+{
+	Cache->FingerSlotValid = 0;
+	Cache->FingerSlotDirty = 0;
+	Cache->FingerDownCount = 0;
+	Cache->ReportedMask = 0;
+}
@@ -28,11 +28,18 @@
 //#include "hid.tmh"
 
 //
-// HID Report Descriptor for a touch device
+// HID Report Descriptor for a touch device, the touch collection comes in
+// two formats and is followed by the collections common to both
 //
-const UCHAR gReportDescriptor[] = {
-	SYNAPTICS_TOUCH_DIGITIZER_COLLECTION,
+const UCHAR gHybridTouchReportDescriptor[] = {
+	SYNAPTICS_TOUCH_DIGITIZER_COLLECTION
+};
+
+const UCHAR gWideTouchReportDescriptor[] = {
+	SYNAPTICS_TOUCH_DIGITIZER_WIDE_COLLECTION
+};
 
+const UCHAR gReportDescriptor[] = {
 	USAGE, 0x0E,                            // USAGE (Configuration)
 	BEGIN_COLLECTION, 0x01,                 // COLLECTION (Application)
 		REPORT_ID, REPORTID_FEATURE,            //   REPORT_ID (Feature)
@@ -93,10 +100,66 @@ const HID_DESCRIPTOR gHidDescriptor =
 	1,                                  //bNumDescriptors
 	{                                   //DescriptorList[0]
 		HID_REPORT_DESCRIPTOR_TYPE,     //bReportType
-		sizeof(gReportDescriptor)       //wReportLength
+		0                               //wReportLength, see TchGetReportDescriptorLength
 	}
 };
 
+static
+VOID
+TchGetTouchReportDescriptor(
+	IN PDEVICE_EXTENSION Context,
+	OUT const UCHAR** Descriptor,
+	OUT ULONG* Length
+)
+/*++
+
+Routine Description:
+
+	Picks the touch collection matching the report format the controller
+	was configured with.
+
+Arguments:
+
+	Context - Pointer to the device extension
+
+	Descriptor - Receives the touch collection
+
+	Length - Receives the size of the touch collection in bytes
+
+Return Value:
+
+	None
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* touchContext = (RMI4_CONTROLLER_CONTEXT*)Context->TouchContext;
+
+	if (touchContext->ReportQueue.WideTouchReports)
+	{
+		*Descriptor = gWideTouchReportDescriptor;
+		*Length = sizeof(gWideTouchReportDescriptor);
+	}
+	else
+	{
+		*Descriptor = gHybridTouchReportDescriptor;
+		*Length = sizeof(gHybridTouchReportDescriptor);
+	}
+}
+
+static
+ULONG
+TchGetReportDescriptorLength(
+	IN PDEVICE_EXTENSION Context
+)
+{
+	const UCHAR* touchDescriptor;
+	ULONG touchDescriptorLength;
+
+	TchGetTouchReportDescriptor(Context, &touchDescriptor, &touchDescriptorLength);
+
+	return touchDescriptorLength + gdwcbReportDescriptor;
+}
+
 NTSTATUS
 TchGenerateHidReportDescriptor
 (
@@ -106,10 +169,16 @@ TchGenerateHidReportDescriptor
 {
 	NTSTATUS status = 0;
 	RMI4_CONTROLLER_CONTEXT* touchContext = (RMI4_CONTROLLER_CONTEXT*)Context->TouchContext;
+	const UCHAR* touchDescriptor;
+	ULONG touchDescriptorLength;
+	ULONG descriptorLength;
+
+	TchGetTouchReportDescriptor(Context, &touchDescriptor, &touchDescriptorLength);
+	descriptorLength = touchDescriptorLength + gdwcbReportDescriptor;
 
 	PUCHAR hidReportDescBuffer = (PUCHAR)ExAllocatePoolWithTag(
 		NonPagedPool,
-		gdwcbReportDescriptor,
+		descriptorLength,
 		TOUCH_POOL_TAG
 	);
 
@@ -132,11 +201,17 @@ TchGenerateHidReportDescriptor
 
 	RtlCopyBytes(
 		hidReportDescBuffer,
+		touchDescriptor,
+		touchDescriptorLength
+	);
+
+	RtlCopyBytes(
+		hidReportDescBuffer + touchDescriptorLength,
 		gReportDescriptor,
 		gdwcbReportDescriptor
 	);
 
-	for (unsigned int i = 0; i < gdwcbReportDescriptor - 2; i++)
+	for (unsigned int i = 0; i < descriptorLength - 2; i++)
 	{
 		if (*(hidReportDescBuffer + i) == LOGICAL_MAXIMUM_2)
 		{
@@ -183,7 +258,7 @@ TchGenerateHidReportDescriptor
 		outMemory,
 		0,
 		(PVOID)hidReportDescBuffer,
-		gdwcbReportDescriptor);
+		descriptorLength);
 
 	if (!NT_SUCCESS(status))
 	{
@@ -258,19 +333,32 @@ Return Value:
 	//
 	if (devContext->ServiceInterruptsAfterD0Entry == TRUE)
 	{
-		HID_INPUT_REPORT* hidReports = NULL;
-        int reportsCount;
+		TCH_SCAN_TIMESTAMP timestamp;
+		NTSTATUS serviceStatus;
+
+		TchQueryScanTimestamp(&timestamp);
 
-			TchServiceInterrupts(
-				devContext->TouchContext,
-				&devContext->I2CContext,
-				devContext->InputMode,
-                &hidReports,
-				&reportsCount);
+		serviceStatus = TchServiceInterrupts(
+			devContext->TouchContext,
+			&devContext->I2CContext,
+			devContext->InputMode,
+			&timestamp);
+
+		if (serviceStatus == STATUS_PENDING)
+		{
+			WdfWorkItemEnqueue(devContext->ReportWorkItem);
+		}
 
 		devContext->ServiceInterruptsAfterD0Entry = FALSE;
 	}
 
+	//
+	// Deliver reports that were queued while no read request was pending
+	//
+	SendHidReports(
+		devContext->PingPongQueue,
+		TchGetReportQueue(devContext->TouchContext));
+
 exit:
 
 	return status;
@@ -382,11 +470,10 @@ Return Value:
 
 --*/
 {
+	HID_DESCRIPTOR hidDescriptor;
 	WDFMEMORY memory;
 	NTSTATUS status;
 
-	UNREFERENCED_PARAMETER(Device);
-
 	//
 	// This IOCTL is METHOD_NEITHER so WdfRequestRetrieveOutputMemory
 	// will correctly retrieve buffer from Irp->UserBuffer.
@@ -409,13 +496,18 @@ Return Value:
 	}
 
 	//
-	// Use hardcoded global HID Descriptor
+	// Use the global HID Descriptor, with the length of the report
+	// descriptor for the configured touch report format
 	//
+	hidDescriptor = gHidDescriptor;
+	hidDescriptor.DescriptorList[0].wReportLength =
+		(USHORT)TchGetReportDescriptorLength(GetDeviceContext(Device));
+
 	status = WdfMemoryCopyFromBuffer(
 		memory,
 		0,
-		(PUCHAR)&gHidDescriptor,
-		sizeof(gHidDescriptor));
+		(PUCHAR)&hidDescriptor,
+		sizeof(hidDescriptor));
 
 	if (!NT_SUCCESS(status))
 	{
@@ -430,7 +522,7 @@ Return Value:
 	//
 	// Report how many bytes were copied
 	//
-	WdfRequestSetInformation(Request, sizeof(gHidDescriptor));
+	WdfRequestSetInformation(Request, sizeof(hidDescriptor));
 
 exit:
 
@@ -501,7 +593,7 @@ Return Value:
 	//
 	// Report how many bytes were copied
 	//
-	WdfRequestSetInformation(Request, gdwcbReportDescriptor);
+	WdfRequestSetInformation(Request, TchGetReportDescriptorLength(devCtx));
 
 exit:
 
@@ -642,6 +734,7 @@ Return Value:
 		}
 
 		if ((inputModeReport->InputMode == MODE_MOUSE) ||
+			(inputModeReport->InputMode == MODE_SINGLE_TOUCH) ||
 			(inputModeReport->InputMode == MODE_MULTI_TOUCH))
 		{
 			devContext->InputMode = inputModeReport->InputMode;
@@ -25,6 +25,96 @@
 #include "debug.h"
 //#include "idle.tmh"
 
+static
+VOID
+TchIssueIdleCallback(
+	IN PDEVICE_EXTENSION DeviceContext,
+	IN WDFREQUEST Request
+)
+/*++
+
+Routine Description:
+
+	Parks the idle notification request in the IdleQueue and invokes the
+	HIDClass idle callback, which powers the device down right away.
+
+	The request is parked first: it then no longer belongs to the
+	power-managed default queue, so the D0 exit the callback starts
+	(and TchStandbyDevice putting the controller to sleep) does not
+	wait on it, and it can be handled inline from the dispatch routine.
+
+Arguments:
+
+	DeviceContext - Pointer to Device Context for the device
+
+	Request - Validated idle notification request
+
+Return Value:
+
+	None.
+
+--*/
+{
+	PHID_SUBMIT_IDLE_NOTIFICATION_CALLBACK_INFO idleCallbackInfo;
+	HID_IDLE_CALLBACK idleCallback;
+	PVOID idleContext;
+	NTSTATUS status;
+
+	//
+	// The request may be cancelled as soon as it is parked, the callback
+	// info is captured before
+	//
+	idleCallbackInfo = (PHID_SUBMIT_IDLE_NOTIFICATION_CALLBACK_INFO)
+		IoGetCurrentIrpStackLocation(WdfRequestWdmGetIrp(Request))->\
+		Parameters.DeviceIoControl.Type3InputBuffer;
+
+	idleCallback = idleCallbackInfo->IdleCallback;
+	idleContext = idleCallbackInfo->IdleContext;
+
+	//
+	// Park this request in our IdleQueue and mark it as pending
+	// This way if the IRP was cancelled, WDF will cancel it for us
+	//
+	status = WdfRequestForwardToIoQueue(
+		Request,
+		DeviceContext->IdleQueue);
+
+	if (!NT_SUCCESS(status))
+	{
+		//
+		// IdleQueue is a manual-dispatch, non-power-managed queue. This should
+		// *never* fail.
+		//
+
+		NT_ASSERTMSG("WdfRequestForwardToIoQueue to IdleQueue failed!", FALSE);
+
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_IDLE,
+			"Error forwarding idle notification Request:0x%p to IdleQueue:0x%p - STATUS:%X",
+			Request,
+			DeviceContext->IdleQueue,
+			status);
+
+		//
+		// Complete the request if we couldnt forward to the Idle Queue,
+		// HIDClass retries going idle later
+		//
+		WdfRequestComplete(Request, status);
+		return;
+	}
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_FLAG_IDLE,
+		"Forwarded idle notification Request:0x%p to IdleQueue:0x%p - STATUS:%X",
+		Request,
+		DeviceContext->IdleQueue,
+		status);
+
+	idleCallback(idleContext);
+}
+
 NTSTATUS
 TchProcessIdleRequest(
 	IN WDFDEVICE Device,
@@ -118,46 +208,50 @@ Return Value:
 		goto exit;
 	}
 
+	status = STATUS_SUCCESS;
+
+	//
+	// Fast path: at passive level the callback is issued right here, so
+	// the D0 exit follows the idle notification without a trip through
+	// a worker thread
+	//
+	if (KeGetCurrentIrql() == PASSIVE_LEVEL)
 	{
-		//
-		// Create a workitem for the idle callback
-		//
-		WDF_OBJECT_ATTRIBUTES workItemAttributes;
-		WDF_WORKITEM_CONFIG workitemConfig;
-		WDFWORKITEM idleWorkItem;
-		PIDLE_WORKITEM_CONTEXT idleWorkItemContext;
+		TchIssueIdleCallback(devContext, Request);
+
+		*Pending = TRUE;
+		goto exit;
+	}
 
-		WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&workItemAttributes, IDLE_WORKITEM_CONTEXT);
-		workItemAttributes.ParentObject = devContext->FxDevice;
+	{
+		PIDLE_WORKITEM_CONTEXT idleWorkItemContext;
 
-		WDF_WORKITEM_CONFIG_INIT(&workitemConfig, TchIdleIrpWorkitem);
+		//
+		// Otherwise hand the request to the preallocated work item.
+		// HIDClass has a single idle notification outstanding at a time.
+		//
+		idleWorkItemContext = GetWorkItemContext(devContext->IdleWorkItem);
 
-		status = WdfWorkItemCreate(
-			&workitemConfig,
-			&workItemAttributes,
-			&idleWorkItem
-		);
+		if (InterlockedCompareExchangePointer(
+			(PVOID volatile*)&idleWorkItemContext->FxRequest,
+			Request,
+			NULL) != NULL)
+		{
+			status = STATUS_DEVICE_BUSY;
 
-		if (!NT_SUCCESS(status)) {
 			Trace(
 				TRACE_LEVEL_ERROR,
 				TRACE_FLAG_HID,
-				"Error creating creating idle work item - STATUS:%X",
+				"Error: Idle Notification request %p while another is in progress - STATUS:%X",
+				Request,
 				status);
 			goto exit;
 		}
 
-		//
-		// Set the workitem context
-		//
-		idleWorkItemContext = GetWorkItemContext(idleWorkItem);
-		idleWorkItemContext->FxDevice = devContext->FxDevice;
-		idleWorkItemContext->FxRequest = Request;
-
 		//
 		// Enqueue a workitem for the idle callback
 		//
-		WdfWorkItemEnqueue(idleWorkItem);
+		WdfWorkItemEnqueue(devContext->IdleWorkItem);
 
 		//
 		// Mark the request as pending so that 
@@ -180,8 +274,10 @@ TchIdleIrpWorkitem(
 Routine Description:
 
 	This is a workitem routine that TchProcessIdleRequest queues when
-	handling the HIDClass's idle notification IRP, so the idle callback can be made in
-	a different thread context, instead of the Idle Irp's dispatch call.
+	handling the HIDClass's idle notification IRP above passive level,
+	so the idle callback can be made in a different thread context,
+	instead of the Idle Irp's dispatch call. The work item is reused
+	for every notification.
 
 Arguments:
 
@@ -193,10 +289,9 @@ Return Value:
 
 --*/
 {
-	NTSTATUS status;
 	PIDLE_WORKITEM_CONTEXT idleWorkItemContext;
 	PDEVICE_EXTENSION deviceContext;
-	PHID_SUBMIT_IDLE_NOTIFICATION_CALLBACK_INFO idleCallbackInfo;
+	WDFREQUEST request;
 
 	idleWorkItemContext = GetWorkItemContext(IdleWorkItem);
 	NT_ASSERT(idleWorkItemContext != NULL);
@@ -204,63 +299,17 @@ Return Value:
 	deviceContext = GetDeviceContext(idleWorkItemContext->FxDevice);
 	NT_ASSERT(deviceContext != NULL);
 
-	//
-	// Get the idle callback info from the workitem context
-	//
-	idleCallbackInfo = (PHID_SUBMIT_IDLE_NOTIFICATION_CALLBACK_INFO)
-		IoGetCurrentIrpStackLocation(WdfRequestWdmGetIrp(idleWorkItemContext->FxRequest))->\
-		Parameters.DeviceIoControl.Type3InputBuffer;
-
-	//
-	// idleCallbackInfo is validated already, so invoke idle callback
-	//
-	idleCallbackInfo->IdleCallback(idleCallbackInfo->IdleContext);
-
-	//
-	// Park this request in our IdleQueue and mark it as pending
-	// This way if the IRP was cancelled, WDF will cancel it for us
-	//
-	status = WdfRequestForwardToIoQueue(
-		idleWorkItemContext->FxRequest,
-		deviceContext->IdleQueue);
-
-	if (!NT_SUCCESS(status))
-	{
-		//
-		// IdleQueue is a manual-dispatch, non-power-managed queue. This should
-		// *never* fail.
-		//
-
-		NT_ASSERTMSG("WdfRequestForwardToIoQueue to IdleQueue failed!", FALSE);
-
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_IDLE,
-			"Error forwarding idle notification Request:0x%p to IdleQueue:0x%p - STATUS:%X",
-			idleWorkItemContext->FxRequest,
-			deviceContext->IdleQueue,
-			status);
+	request = idleWorkItemContext->FxRequest;
+	NT_ASSERT(request != NULL);
 
-		//
-		// Complete the request if we couldnt forward to the Idle Queue
-		//
-		WdfRequestComplete(idleWorkItemContext->FxRequest, status);
-	}
-	else
-	{
-		Trace(
-			TRACE_LEVEL_INFORMATION,
-			TRACE_FLAG_IDLE,
-			"Forwarded idle notification Request:0x%p to IdleQueue:0x%p - STATUS:%X",
-			idleWorkItemContext->FxRequest,
-			deviceContext->IdleQueue,
-			status);
-	}
+	TchIssueIdleCallback(deviceContext, request);
 
 	//
-	// Delete the workitem since we're done with it
+	// The work item is free for the next notification
 	//
-	WdfObjectDelete(IdleWorkItem);
+	InterlockedExchangePointer(
+		(PVOID volatile*)&idleWorkItemContext->FxRequest,
+		NULL);
 
 	return;
 }
@@ -19,13 +19,14 @@
 --*/
 
 #include "rmiinternal.h"
-#include "spb.h"
+#include "spbhelper.h"
 #include "debug.h"
 #include "Function01.h"
 #include "Function1A.h"
 #include "Function11.h"
 #include "Function12.h"
 #include "buttonreporting.h"
+#include "layoutcache.h"
 //#include "init.tmh"
 
 #pragma warning(push)
@@ -133,6 +134,91 @@ RmiGetFunctionIndex(
 	return i;
 }
 
+VOID
+RmiResolveFunctions(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+  Routine Description:
+
+	Builds the direct-indexed table of functions the driver talks to
+	from the discovered function descriptors, so that hot paths can use
+	precomputed register addresses and pages instead of searching the
+	descriptor list.
+
+	Interrupt status bits are handed out by the controller in function
+	table order, each function taking as many consecutive bits as its
+	descriptor's IrqCount, so the bits owned by each function are worked
+	out here as well.
+
+  Arguments:
+
+	ControllerContext - A pointer to the current touch controller context
+
+  Return Value:
+
+	None.
+
+--*/
+{
+	static const int functionNumbers[RMI4_FUNCTION_SLOT_COUNT] =
+	{
+		RMI4_F01_RMI_DEVICE_CONTROL,
+		RMI4_F11_2D_TOUCHPAD_SENSOR,
+		RMI4_F12_2D_TOUCHPAD_SENSOR,
+		RMI4_F1A_0D_CAP_BUTTON_SENSOR,
+		RMI4_F34_FLASH_MEMORY_MANAGEMENT,
+		RMI4_F54_TEST_REPORTING
+	};
+	RMI4_RESOLVED_FUNCTION* function;
+	BYTE irqBase[RMI4_MAX_FUNCTIONS];
+	ULONG irqBit;
+	ULONG irqCount;
+	int index;
+	int slot;
+
+	irqBit = 0;
+
+	for (index = 0; index < ControllerContext->FunctionCount; index++)
+	{
+		irqBase[index] = (BYTE)min(irqBit, (ULONG)RMI4_MAX_INTERRUPT_SOURCES);
+		irqBit += ControllerContext->Descriptors[index].VersionIrq.IrqCount;
+	}
+
+	for (slot = 0; slot < RMI4_FUNCTION_SLOT_COUNT; slot++)
+	{
+		function = &ControllerContext->Functions[slot];
+		RtlZeroMemory(function, sizeof(RMI4_RESOLVED_FUNCTION));
+
+		index = RmiGetFunctionIndex(
+			ControllerContext->Descriptors,
+			ControllerContext->FunctionCount,
+			functionNumbers[slot]);
+
+		if (index == ControllerContext->FunctionCount)
+		{
+			continue;
+		}
+
+		function->Present = TRUE;
+		function->Index = index;
+		function->Page = ControllerContext->FunctionOnPage[index];
+		function->QueryBase = ControllerContext->Descriptors[index].QueryBase;
+		function->CommandBase = ControllerContext->Descriptors[index].CommandBase;
+		function->ControlBase = ControllerContext->Descriptors[index].ControlBase;
+		function->DataBase = ControllerContext->Descriptors[index].DataBase;
+
+		//
+		// Bits beyond the status register we read are never reported
+		//
+		irqCount = ControllerContext->Descriptors[index].VersionIrq.IrqCount;
+		irqCount = min(irqCount, (ULONG)(RMI4_MAX_INTERRUPT_SOURCES - irqBase[index]));
+
+		function->IrqMask = ((1UL << irqCount) - 1) << irqBase[index];
+	}
+}
+
 NTSTATUS
 RmiGetFirmwareVersion(
 	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
@@ -222,6 +308,123 @@ exit:
 }
 
 
+VOID
+RmiPlanBurstRead(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+  Routine Description:
+
+	This function works out whether the F01 interrupt status registers and
+	the F12 data packet can be fetched with a single read on each
+	interrupt. That is the case when both functions sit on the same page
+	and their data registers are close enough together that reading the
+	gap between them is cheaper than a second transaction.
+
+  Arguments:
+
+	ControllerContext - A pointer to the current touch controller context
+
+  Return Value:
+
+	None. BurstReadEnabled is left FALSE if the layout does not allow it.
+
+--*/
+{
+	ULONG end;
+	RMI4_RESOLVED_FUNCTION* f01;
+	ULONG f01Start;
+	RMI4_RESOLVED_FUNCTION* f12;
+	ULONG f12Start;
+	ULONG length;
+	ULONG start;
+	NTSTATUS status;
+
+	ControllerContext->BurstReadEnabled = FALSE;
+	ControllerContext->BurstF12DataValid = FALSE;
+
+	if (!ControllerContext->IsF12Digitizer ||
+		ControllerContext->PacketSize == 0)
+	{
+		goto exit;
+	}
+
+	f01 = &ControllerContext->Functions[RMI4_FUNCTION_SLOT_F01];
+	f12 = &ControllerContext->Functions[RMI4_FUNCTION_SLOT_F12];
+
+	if (!f01->Present ||
+		!f12->Present ||
+		f01->Page != f12->Page)
+	{
+		goto exit;
+	}
+
+	f01Start = f01->DataBase;
+	f12Start = f12->DataBase;
+
+	start = min(f01Start, f12Start);
+	end = max(
+		f01Start + sizeof(RMI4_F01_DATA_REGISTERS),
+		f12Start + (ULONG)ControllerContext->PacketSize);
+	length = end - start;
+
+	if (end > RMI4_PAGE_SELECT_ADDRESS ||
+		length > sizeof(RMI4_F01_DATA_REGISTERS) +
+			ControllerContext->PacketSize + RMI4_MAX_BURST_READ_GAP)
+	{
+		goto exit;
+	}
+
+	if (ControllerContext->BurstReadMemory != NULL &&
+		ControllerContext->BurstReadLength != length)
+	{
+		WdfObjectDelete(ControllerContext->BurstReadMemory);
+		ControllerContext->BurstReadMemory = NULL;
+	}
+
+	if (ControllerContext->BurstReadMemory == NULL)
+	{
+		status = WdfMemoryCreate(
+			WDF_NO_OBJECT_ATTRIBUTES,
+			NonPagedPoolNx,
+			TOUCH_POOL_TAG_F12,
+			length,
+			&ControllerContext->BurstReadMemory,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_WARNING,
+				TRACE_FLAG_INIT,
+				"Could not allocate coalesced read buffer, using separate reads - STATUS:%X",
+				status);
+
+			ControllerContext->BurstReadMemory = NULL;
+			goto exit;
+		}
+	}
+
+
+	ControllerContext->BurstReadAddress = (BYTE)start;
+	ControllerContext->BurstReadLength = (USHORT)length;
+	ControllerContext->BurstF01Offset = (USHORT)(f01Start - start);
+	ControllerContext->BurstF12Offset = (USHORT)(f12Start - start);
+	ControllerContext->BurstReadEnabled = TRUE;
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_FLAG_INIT,
+		"Coalesced interrupt read enabled, address 0x%x length %d",
+		start,
+		length);
+
+exit:
+
+	return;
+}
+
 NTSTATUS
 RmiConfigureFunctions(
 	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
@@ -257,6 +460,30 @@ RmiConfigureFunctions(
 
 	ControllerContext->IsF12Digitizer = FALSE;
 
+	//
+	// Either the chip was just started or it lost its configuration,
+	// none of the shadowed register contents can be assumed
+	//
+	RmiShadowInitialize(
+		&ControllerContext->F01ControlShadow,
+		ControllerContext->Functions[RMI4_FUNCTION_SLOT_F01].Page,
+		ControllerContext->Functions[RMI4_FUNCTION_SLOT_F01].ControlBase,
+		sizeof(RMI4_F01_CTRL_REGISTERS));
+
+	RmiShadowInitialize(
+		&ControllerContext->F11ControlShadow,
+		ControllerContext->Functions[RMI4_FUNCTION_SLOT_F11].Page,
+		ControllerContext->Functions[RMI4_FUNCTION_SLOT_F11].ControlBase,
+		sizeof(RMI4_F11_CTRL_REGISTERS));
+
+	RtlZeroMemory(
+		&ControllerContext->F12ReportingShadow,
+		sizeof(RMI4_REGISTER_SHADOW));
+
+	RtlZeroMemory(
+		&ControllerContext->F12ObjectReportShadow,
+		sizeof(RMI4_REGISTER_SHADOW));
+
 	for (i = 0; i < RMI4_MAX_FUNCTIONS; i++)
 	{
 		switch (ControllerContext->Descriptors[i].Number)
@@ -281,36 +508,39 @@ RmiConfigureFunctions(
 	if (f11Flag && ControllerContext->IsF12Digitizer)
 		f11Flag = FALSE;
 
-	if (f11Flag)
+	//
+	// The digitizer operations are chosen here once, the reporting path
+	// only goes through the table
+	//
+	ControllerContext->DigitizerOps =
+		ControllerContext->IsF12Digitizer ? &RmiF12Ops : &RmiF11Ops;
+
+	if (f11Flag || ControllerContext->IsF12Digitizer)
 	{
-		status = RmiConfigureFunction11(ControllerContext, SpbContext);
+		status = ControllerContext->DigitizerOps->Configure(
+			ControllerContext,
+			SpbContext);
 
 		if (!NT_SUCCESS(status))
 		{
 			Trace(
 				TRACE_LEVEL_ERROR,
 				TRACE_FLAG_INIT,
-				"Error can't configure F11 - STATUS %x",
+				"Error can't configure F%d - STATUS %x",
+				ControllerContext->IsF12Digitizer ? 12 : 11,
 				status
 			);
 			goto exit;
 		}
 	}
 
+	//
+	// Switch to the parsers specialized for the object count that was
+	// just discovered
+	//
 	if (ControllerContext->IsF12Digitizer)
 	{
-		status = RmiConfigureFunction12(ControllerContext, SpbContext);
-
-		if (!NT_SUCCESS(status))
-		{
-			Trace(
-				TRACE_LEVEL_ERROR,
-				TRACE_FLAG_INIT,
-				"Error can't configure F12 - STATUS %x",
-				status
-			);
-			goto exit;
-		}
+		ControllerContext->DigitizerOps = RmiSelectF12Ops(ControllerContext);
 	}
 
 	if (f1aFlag)
@@ -319,8 +549,22 @@ RmiConfigureFunctions(
 	if (f01Flag)
 		status = RmiConfigureFunction01(ControllerContext, SpbContext);
 
-    //temporaly init buttons timer TODO if(f1aflag || touchButtons)
-    ButtonsInitTimer(ControllerContext);
+	//
+	// Work out if F01 and F12 can be read together on each interrupt
+	//
+	RmiPlanBurstRead(ControllerContext);
+
+	//
+	// Order the interrupt sources by register page, the plan depends on
+	// the burst read decided above
+	//
+	RmiPlanServiceOrder(ControllerContext);
+
+	//
+	// Capture frames raw when the digitizer allows it
+	//
+	RmiPlanPipeline(ControllerContext);
+
 exit:
 
 	return status;
@@ -365,6 +609,24 @@ RmiBuildFunctionsTable(
 	address = RMI4_FIRST_FUNCTION_ADDRESS;
 	page = 0;
 
+	//
+	// The scan starts on page 0, whatever page was left selected
+	//
+	status = RmiChangePage(
+		ControllerContext,
+		SpbContext,
+		page);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Error attempting to change page - STATUS:%X",
+			status);
+		goto exit;
+	}
+
 	//
 	// Discover chip functions one by one
 	//
@@ -478,6 +740,27 @@ RmiBuildFunctionsTable(
 	//
 	ControllerContext->FunctionCount = function;
 
+	//
+	// Resolve the functions the driver uses, F01 is mandatory
+	//
+	RmiResolveFunctions(ControllerContext);
+
+	if (!ControllerContext->Functions[RMI4_FUNCTION_SLOT_F01].Present)
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Unexpected - RMI Function 01 missing");
+
+		status = STATUS_INVALID_DEVICE_STATE;
+		goto exit;
+	}
+
+	//
+	// Map interrupt status bits to the routines servicing them
+	//
+	RmiBuildInterruptDispatch(ControllerContext);
+
 	Trace(
 		TRACE_LEVEL_VERBOSE,
 		TRACE_FLAG_INIT,
@@ -517,36 +800,21 @@ RmiCheckInterrupts(
 
 --*/
 {
+	BYTE* burstBuffer;
 	RMI4_F01_DATA_REGISTERS data;
-	int index;
+	RMI4_RESOLVED_FUNCTION* f01;
 	NTSTATUS status;
 
 	RtlZeroMemory(&data, sizeof(data));
 	*InterruptStatus = 0;
+	ControllerContext->BurstF12DataValid = FALSE;
 
-	//
-	// Locate RMI data base address
-	//
-	index = RmiGetFunctionIndex(
-		ControllerContext->Descriptors,
-		ControllerContext->FunctionCount,
-		RMI4_F01_RMI_DEVICE_CONTROL);
-
-	if (index == ControllerContext->FunctionCount)
-	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_INIT,
-			"Unexpected - RMI Function 01 missing");
-
-		status = STATUS_INVALID_DEVICE_STATE;
-		goto exit;
-	}
+	f01 = &ControllerContext->Functions[RMI4_FUNCTION_SLOT_F01];
 
 	status = RmiChangePage(
 		ControllerContext,
 		SpbContext,
-		ControllerContext->FunctionOnPage[index]);
+		f01->Page);
 
 	if (!NT_SUCCESS(status))
 	{
@@ -558,14 +826,45 @@ RmiCheckInterrupts(
 		goto exit;
 	}
 
-	//
-	// Read interrupt status registers
-	//
-	status = SpbReadDataSynchronously(
-		SpbContext,
-		ControllerContext->Descriptors[index].DataBase,
-		&data,
-		sizeof(data));
+	if (ControllerContext->BurstReadEnabled)
+	{
+		burstBuffer = (BYTE*)WdfMemoryGetBuffer(
+			ControllerContext->BurstReadMemory,
+			NULL);
+
+		//
+		// Read interrupt status and F12 data registers in one go, the
+		// F12 part is consumed in place by GetTouchesFromF12 if touch
+		// is signaled
+		//
+		status = SpbReadDataToMemorySynchronously(
+			SpbContext,
+			ControllerContext->BurstReadAddress,
+			ControllerContext->BurstReadMemory,
+			0,
+			ControllerContext->BurstReadLength);
+
+		if (NT_SUCCESS(status))
+		{
+			RtlCopyMemory(
+				&data,
+				burstBuffer + ControllerContext->BurstF01Offset,
+				sizeof(data));
+
+			ControllerContext->BurstF12DataValid = TRUE;
+		}
+	}
+	else
+	{
+		//
+		// Read interrupt status registers
+		//
+		status = SpbReadDataSynchronously(
+			SpbContext,
+			f01->DataBase,
+			&data,
+			sizeof(data));
+	}
 
 	if (!NT_SUCCESS(status))
 	{
@@ -575,6 +874,10 @@ RmiCheckInterrupts(
 			"Error reading interrupt status - STATUS:%X",
 			status);
 
+		TchCountEvent(
+			&ControllerContext->Counters,
+			SpbErrors[TchSpbSiteInterruptStatus]);
+
 		goto exit;
 	}
 
@@ -591,6 +894,17 @@ RmiCheckInterrupts(
 	case RMI4_F01_DATA_STATUS_RESET_OCCURRED:
 	{
 		ControllerContext->ResetOccurred = TRUE;
+		TchCountEvent(&ControllerContext->Counters, ChipResets);
+
+		//
+		// A reset selects page 0 and restores the control registers to
+		// their defaults, the cached page and shadows no longer apply
+		//
+		ControllerContext->CurrentPage = 0;
+		RmiShadowInvalidate(&ControllerContext->F01ControlShadow);
+		RmiShadowInvalidate(&ControllerContext->F11ControlShadow);
+		RmiShadowInvalidate(&ControllerContext->F12ReportingShadow);
+		RmiShadowInvalidate(&ControllerContext->F12ObjectReportShadow);
 		break;
 	}
 	case RMI4_F01_DATA_STATUS_INVALID_CONFIG:
@@ -653,12 +967,26 @@ RmiCheckInterrupts(
 			TRACE_FLAG_INTERRUPT,
 			"Error, device status indicates chip is unconfigured");
 
+		//
+		// Keep the report work item away from the layout while the
+		// functions are reconfigured
+		//
+		WdfWaitLockAcquire(ControllerContext->ReportLock, NULL);
+
 		status = RmiConfigureFunctions(
 			ControllerContext,
 			SpbContext);
 
+		WdfWaitLockRelease(ControllerContext->ReportLock);
+
+		TchCountEvent(&ControllerContext->Counters, Reconfigurations);
+
 		if (!NT_SUCCESS(status))
 		{
+			TchCountEvent(
+				&ControllerContext->Counters,
+				SpbErrors[TchSpbSiteConfiguration]);
+
 			Trace(
 				TRACE_LEVEL_ERROR,
 				TRACE_FLAG_INTERRUPT,
@@ -676,6 +1004,8 @@ RmiCheckInterrupts(
 	}
 	else
 	{
+		TchCountEvent(&ControllerContext->Counters, SpuriousInterrupts);
+
 		Trace(
 			TRACE_LEVEL_VERBOSE,
 			TRACE_FLAG_INTERRUPT,
@@ -713,12 +1043,19 @@ TchStartDevice(
 {
 	RMI4_CONTROLLER_CONTEXT* controller;
 	ULONG interruptStatus;
+	BOOLEAN layoutCached;
 	NTSTATUS status;
 
 	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
 	interruptStatus = 0;
 	status = STATUS_SUCCESS;
 
+	//
+	// Nothing is known about the page selected on the controller, the
+	// first access selects one explicitly
+	//
+	controller->CurrentPage = -1;
+
 	//
 	// Initialize capacitive button LED support
 	//
@@ -733,11 +1070,22 @@ TchStartDevice(
 	}
 
 	//
-	// Populate context with RMI function descriptors
+	// Interrupts are not connected yet, but diagnostic requests may
+	// already reach the controller
 	//
-	status = RmiBuildFunctionsTable(
-		ControllerContext,
-		SpbContext);
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
+	//
+	// Populate context with RMI function descriptors, from the layout
+	// cache when it matches this controller and firmware
+	//
+	layoutCached = NT_SUCCESS(RmiLoadLayoutCache(controller, SpbContext));
+
+	status = layoutCached ?
+		STATUS_SUCCESS :
+		RmiBuildFunctionsTable(
+			ControllerContext,
+			SpbContext);
 
 	if (!NT_SUCCESS(status))
 	{
@@ -756,33 +1104,77 @@ TchStartDevice(
 		ControllerContext,
 		SpbContext);
 
-	if (!NT_SUCCESS(status))
+	//
+	// A cached layout the controller does not accept is stale, drop it
+	// and start over from the full probe instead of failing the start
+	//
+	if (!NT_SUCCESS(status) && layoutCached)
 	{
 		Trace(
-			TRACE_LEVEL_ERROR,
+			TRACE_LEVEL_WARNING,
 			TRACE_FLAG_INIT,
-			"Could not configure RMI functions - STATUS:%X",
+			"Could not configure RMI functions from the layout cache - STATUS:%X",
 			status);
-		goto exit;
-	}
 
-	//
-	// Read and store the firmware version
-	//
-	status = RmiGetFirmwareVersion(
-		ControllerContext,
-		SpbContext);
+		RmiDeleteLayoutCache();
+		layoutCached = FALSE;
+
+		controller->FunctionCount = 0;
+		RtlZeroMemory(controller->Descriptors, sizeof(controller->Descriptors));
+		RtlZeroMemory(controller->FunctionOnPage, sizeof(controller->FunctionOnPage));
+		RtlZeroMemory(controller->Functions, sizeof(controller->Functions));
+
+		status = RmiBuildFunctionsTable(
+			ControllerContext,
+			SpbContext);
+
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_INIT,
+				"Could not build table of RMI functions - STATUS:%X",
+				status);
+			goto exit;
+		}
+
+		status = RmiConfigureFunctions(
+			ControllerContext,
+			SpbContext);
+	}
 
 	if (!NT_SUCCESS(status))
 	{
 		Trace(
 			TRACE_LEVEL_ERROR,
 			TRACE_FLAG_INIT,
-			"Could not get RMI firmware version - STATUS:%X",
+			"Could not configure RMI functions - STATUS:%X",
 			status);
 		goto exit;
 	}
 
+	//
+	// Read and store the firmware version, the layout cache already did
+	//
+	if (!layoutCached)
+	{
+		status = RmiGetFirmwareVersion(
+			ControllerContext,
+			SpbContext);
+
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_INIT,
+				"Could not get RMI firmware version - STATUS:%X",
+				status);
+			goto exit;
+		}
+
+		RmiSaveLayoutCache(controller);
+	}
+
 	//
 	// Clear any pending interrupts
 	//
@@ -803,6 +1195,16 @@ TchStartDevice(
 
 exit:
 
+	WdfWaitLockRelease(controller->ControllerLock);
+
+	//
+	// Settings changes are applied from now on
+	//
+	if (NT_SUCCESS(status))
+	{
+		TchSettingsWatchStart(controller);
+	}
+
 	return status;
 }
 
@@ -834,6 +1236,8 @@ Return Value:
 
 	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
 
+	TchSettingsWatchStop(controller);
+
 	if (NULL != controller->BklContext)
 	{
 		TchBklDeinitialize(controller->BklContext);
@@ -867,8 +1271,13 @@ Return Value:
 	RMI4_CONTROLLER_CONTEXT* context;
 	NTSTATUS status;
 
+	//
+	// The per-frame header and the finger cache are laid out on cache
+	// line boundaries of the context, the allocation must honor them.
+	// The context holds no code, take it from no-execute pool
+	//
 	context = ExAllocatePoolWithTag(
-		NonPagedPool,
+		NonPagedPoolNxCacheAligned,
 		sizeof(RMI4_CONTROLLER_CONTEXT),
 		TOUCH_POOL_TAG);
 
@@ -887,9 +1296,20 @@ Return Value:
 	context->FxDevice = FxDevice;
 
 	//
-	// Get screen properties and populate context
+	// Settings are loaded on start, through query tables built here once
 	//
-	TchGetScreenProperties(&context->Props);
+	status = TchRegistryCreateSettings(context);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Could not allocate settings snapshot - STATUS:%X",
+			status);
+
+		goto exit;
+	}
 
 	//
 	// Allocate a WDFWAITLOCK for guarding access to the
@@ -911,6 +1331,103 @@ Return Value:
 
 	}
 
+	//
+	// Allocate a WDFWAITLOCK for guarding the finger cache and HID
+	// queue while reports are built outside the interrupt routine
+	//
+	status = WdfWaitLockCreate(
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&context->ReportLock);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Could not allocate report lock - STATUS:%X",
+			status);
+
+		goto exit;
+	}
+
+	//
+	// Allocate a WDFSPINLOCK serializing consumers of the report queue,
+	// which may complete reports from the interrupt routine, the report
+	// work item and HIDClass read dispatch
+	//
+	status = WdfSpinLockCreate(
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&context->ReportQueue.ConsumerLock);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Could not allocate report queue lock - STATUS:%X",
+			status);
+
+		goto exit;
+	}
+
+	context->ReportQueue.Counters = &context->Counters;
+
+	//
+	// Allocate a WDFSPINLOCK guarding the latency statistics, updated from
+	// both the reporting and the completion paths
+	//
+	status = WdfSpinLockCreate(
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&context->Latency.Lock);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Could not allocate latency statistics lock - STATUS:%X",
+			status);
+
+		goto exit;
+	}
+
+	status = TchActivityInitialize(context);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	status = TchStormInitialize(context);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	status = TchSettingsWatchInitialize(context);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	TchF34FlashInitialize(context);
+
+	status = TchF54StreamInitialize(context);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	status = ButtonsInitTimer(context);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
 	*ControllerContext = context;
 
 exit:
@@ -949,6 +1466,43 @@ Return Value:
 			WdfObjectDelete(controller->ControllerLock);
 		}
 
+		if (controller->ReportLock != NULL)
+		{
+			WdfObjectDelete(controller->ReportLock);
+		}
+
+		if (controller->ReportQueue.ConsumerLock != NULL)
+		{
+			WdfObjectDelete(controller->ReportQueue.ConsumerLock);
+		}
+
+		if (controller->Latency.Lock != NULL)
+		{
+			WdfObjectDelete(controller->Latency.Lock);
+		}
+
+		if (controller->BurstReadMemory != NULL)
+		{
+			WdfObjectDelete(controller->BurstReadMemory);
+		}
+
+		if (controller->F12PacketMemory != NULL)
+		{
+			WdfObjectDelete(controller->F12PacketMemory);
+		}
+
+		if (controller->F11DataMemory != NULL)
+		{
+			WdfObjectDelete(controller->F11DataMemory);
+		}
+
+		TchF54StreamFree(controller);
+		TchTapFree(controller);
+		TchSettingsWatchFree(controller);
+		TchRegistryFreeSettings(controller);
+
+		RmiFreeRegisterDescriptors(controller);
+
 		ExFreePoolWithTag(controller, TOUCH_POOL_TAG);
 	}
 
@@ -0,0 +1,469 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		layoutcache.c
+
+	Abstract:
+
+		Persists the controller's page description table and F12
+		register descriptors in the controller settings key, keyed by
+		the F01 query registers (product ID and firmware build). A
+		start with a matching cache only reads the query registers,
+		instead of walking the PDT and the register descriptors over
+		dozens of small I2C transactions.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include "config.h"
+#include "rmiinternal.h"
+#include "spbhelper.h"
+#include "debug.h"
+#include "Function12.h"
+#include "layoutcache.h"
+
+//
+// Copy of the registry value and the length the registry returned for it,
+// the header's own Size is only trusted once it matches that length
+//
+typedef struct _RMI4_LAYOUT_CACHE_VALUE
+{
+	RMI4_LAYOUT_CACHE* Cache;
+	ULONG Length;
+} RMI4_LAYOUT_CACHE_VALUE;
+
+static
+PRMI_REGISTER_DESCRIPTOR
+RmiGetCachedRegisterDescriptor(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN ULONG Index
+)
+{
+	switch (Index)
+	{
+	case 0:
+		return &ControllerContext->QueryRegDesc;
+	case 1:
+		return &ControllerContext->ControlRegDesc;
+	default:
+		return &ControllerContext->DataRegDesc;
+	}
+}
+
+static
+NTSTATUS
+RmiLayoutCacheQueryRoutine(
+	IN PWSTR ValueName,
+	IN ULONG ValueType,
+	IN PVOID ValueData,
+	IN ULONG ValueLength,
+	IN PVOID Context,
+	IN PVOID EntryContext
+)
+{
+	RMI4_LAYOUT_CACHE_VALUE* value = (RMI4_LAYOUT_CACHE_VALUE*)EntryContext;
+
+	UNREFERENCED_PARAMETER(ValueName);
+	UNREFERENCED_PARAMETER(Context);
+
+	//
+	// Anything that does not look like a cache is treated as a miss
+	//
+	if (ValueType != REG_BINARY ||
+		ValueLength < RMI4_LAYOUT_CACHE_HEADER_SIZE ||
+		ValueLength > RMI4_LAYOUT_CACHE_MAX_SIZE)
+	{
+		return STATUS_SUCCESS;
+	}
+
+	value->Cache = ExAllocatePoolWithTag(NonPagedPoolNx, ValueLength, TOUCH_POOL_TAG);
+
+	if (value->Cache != NULL)
+	{
+		RtlCopyMemory(value->Cache, ValueData, ValueLength);
+		value->Length = ValueLength;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+static
+BOOLEAN
+RmiLayoutCacheIsValid(
+	IN RMI4_LAYOUT_CACHE* Cache,
+	IN ULONG Length
+)
+{
+	ULONG items;
+	ULONG i;
+
+	//
+	// A truncated value would otherwise have its items restored from
+	// past the end of the copy
+	//
+	if (Cache->Size != Length)
+	{
+		return FALSE;
+	}
+
+	if (Cache->Version != RMI4_LAYOUT_CACHE_VERSION ||
+		Cache->FunctionCount <= 0 ||
+		Cache->FunctionCount > RMI4_MAX_FUNCTIONS ||
+		(Cache->RegisterDescriptorCount != 0 &&
+			Cache->RegisterDescriptorCount != RMI4_LAYOUT_CACHE_REGISTER_DESCRIPTORS))
+	{
+		return FALSE;
+	}
+
+	items = 0;
+
+	for (i = 0; i < Cache->RegisterDescriptorCount; i++)
+	{
+		if (Cache->RegisterDescriptors[i].NumRegisters > RMI_REG_DESC_PRESENSE_BITS)
+		{
+			return FALSE;
+		}
+
+		items += Cache->RegisterDescriptors[i].NumRegisters;
+	}
+
+	return Cache->Size ==
+		RMI4_LAYOUT_CACHE_HEADER_SIZE + items * sizeof(RMI_REGISTER_DESC_ITEM);
+}
+
+static
+NTSTATUS
+RmiRestoreRegisterDescriptors(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN RMI4_LAYOUT_CACHE* Cache
+)
+{
+	PRMI_REGISTER_DESCRIPTOR rdesc;
+	RMI_REGISTER_DESC_ITEM* item;
+	NTSTATUS status;
+	ULONG i;
+
+	status = STATUS_SUCCESS;
+	item = Cache->Items;
+
+	RmiFreeRegisterDescriptors(ControllerContext);
+
+	for (i = 0; i < Cache->RegisterDescriptorCount; i++)
+	{
+		rdesc = RmiGetCachedRegisterDescriptor(ControllerContext, i);
+
+		rdesc->StructSize = Cache->RegisterDescriptors[i].StructSize;
+		rdesc->NumRegisters = (UINT8)Cache->RegisterDescriptors[i].NumRegisters;
+
+		RtlCopyMemory(
+			rdesc->PresenceMap,
+			Cache->RegisterDescriptors[i].PresenceMap,
+			sizeof(rdesc->PresenceMap));
+
+		rdesc->Registers = ExAllocatePoolWithTag(
+			NonPagedPoolNx,
+			max(rdesc->NumRegisters, 1) * sizeof(RMI_REGISTER_DESC_ITEM),
+			TOUCH_POOL_TAG_F12);
+
+		if (rdesc->Registers == NULL)
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			goto exit;
+		}
+
+		RtlCopyMemory(
+			rdesc->Registers,
+			item,
+			rdesc->NumRegisters * sizeof(RMI_REGISTER_DESC_ITEM));
+
+		item += rdesc->NumRegisters;
+	}
+
+	ControllerContext->RegisterDescriptorsValid =
+		(Cache->RegisterDescriptorCount != 0);
+
+exit:
+
+	if (!NT_SUCCESS(status))
+	{
+		RmiFreeRegisterDescriptors(ControllerContext);
+	}
+
+	return status;
+}
+
+NTSTATUS
+RmiLoadLayoutCache(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+  Routine Description:
+
+	Restores the function table and F12 register descriptors from the
+	layout cache. The F01 query registers are read from the cached F01
+	location and must match the cached copy, which both verifies the
+	cache and stores the firmware version as RmiGetFirmwareVersion does.
+
+  Arguments:
+
+	ControllerContext - A pointer to the current touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+  Return Value:
+
+	STATUS_SUCCESS if the layout was restored, otherwise the controller
+	has to be probed with RmiBuildFunctionsTable
+
+--*/
+{
+	RTL_QUERY_REGISTRY_TABLE regTable[2];
+	RMI4_LAYOUT_CACHE_VALUE value;
+	RMI4_LAYOUT_CACHE* cache;
+	NTSTATUS status;
+
+	cache = NULL;
+	RtlZeroMemory(&value, sizeof(value));
+
+	RtlZeroMemory(regTable, sizeof(regTable));
+	regTable[0].QueryRoutine = RmiLayoutCacheQueryRoutine;
+	regTable[0].Name = RMI4_LAYOUT_CACHE_VALUE_NAME;
+	regTable[0].EntryContext = &value;
+
+	status = RtlQueryRegistryValues(
+		RTL_REGISTRY_ABSOLUTE,
+		TOUCH_CONTROLLER_SETTINGS_REG_KEY,
+		regTable,
+		NULL,
+		NULL);
+
+	cache = value.Cache;
+
+	if (!NT_SUCCESS(status) || cache == NULL)
+	{
+		status = STATUS_NOT_FOUND;
+		goto exit;
+	}
+
+	if (!RmiLayoutCacheIsValid(cache, value.Length))
+	{
+		status = STATUS_NOT_FOUND;
+		goto exit;
+	}
+
+	ControllerContext->FunctionCount = cache->FunctionCount;
+
+	RtlCopyMemory(
+		ControllerContext->Descriptors,
+		cache->Descriptors,
+		sizeof(ControllerContext->Descriptors));
+
+	RtlCopyMemory(
+		ControllerContext->FunctionOnPage,
+		cache->FunctionOnPage,
+		sizeof(ControllerContext->FunctionOnPage));
+
+	RmiResolveFunctions(ControllerContext);
+
+	if (!ControllerContext->Functions[RMI4_FUNCTION_SLOT_F01].Present)
+	{
+		status = STATUS_NOT_FOUND;
+		goto exit;
+	}
+
+	//
+	// The single verification read
+	//
+	status = RmiGetFirmwareVersion(ControllerContext, SpbContext);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	if (RtlCompareMemory(
+			&ControllerContext->F01QueryRegisters,
+			cache->F01Query,
+			RMI4_LAYOUT_CACHE_QUERY_BYTES) != RMI4_LAYOUT_CACHE_QUERY_BYTES)
+	{
+		Trace(
+			TRACE_LEVEL_INFORMATION,
+			TRACE_FLAG_INIT,
+			"Controller or firmware changed, discarding layout cache");
+
+		status = STATUS_REVISION_MISMATCH;
+		goto exit;
+	}
+
+	status = RmiRestoreRegisterDescriptors(ControllerContext, cache);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	RmiBuildInterruptDispatch(ControllerContext);
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_FLAG_INIT,
+		"Restored %d RMI functions from the layout cache",
+		ControllerContext->FunctionCount);
+
+exit:
+
+	if (!NT_SUCCESS(status))
+	{
+		ControllerContext->FunctionCount = 0;
+		RtlZeroMemory(ControllerContext->Functions, sizeof(ControllerContext->Functions));
+	}
+
+	if (cache != NULL)
+	{
+		ExFreePoolWithTag(cache, TOUCH_POOL_TAG);
+	}
+
+	return status;
+}
+
+VOID
+RmiSaveLayoutCache(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+  Routine Description:
+
+	Writes the probed function table, the F12 register descriptors if
+	they were read, and the F01 query registers identifying them to the
+	layout cache. Failures only cost the next start a full probe.
+
+  Arguments:
+
+	ControllerContext - A pointer to a fully started controller context
+
+  Return Value:
+
+	None.
+
+--*/
+{
+	PRMI_REGISTER_DESCRIPTOR rdesc;
+	RMI4_LAYOUT_CACHE* cache;
+	RMI_REGISTER_DESC_ITEM* item;
+	ULONG descriptorCount;
+	ULONG items;
+	ULONG size;
+	ULONG i;
+	NTSTATUS status;
+
+	descriptorCount = 0;
+	items = 0;
+
+	if (ControllerContext->IsF12Digitizer && ControllerContext->RegisterDescriptorsValid)
+	{
+		descriptorCount = RMI4_LAYOUT_CACHE_REGISTER_DESCRIPTORS;
+
+		for (i = 0; i < descriptorCount; i++)
+		{
+			items += RmiGetCachedRegisterDescriptor(ControllerContext, i)->NumRegisters;
+		}
+	}
+
+	size = RMI4_LAYOUT_CACHE_HEADER_SIZE + items * sizeof(RMI_REGISTER_DESC_ITEM);
+
+	cache = ExAllocatePoolWithTag(NonPagedPoolNx, size, TOUCH_POOL_TAG);
+
+	if (cache == NULL)
+	{
+		goto exit;
+	}
+
+	RtlZeroMemory(cache, size);
+
+	cache->Version = RMI4_LAYOUT_CACHE_VERSION;
+	cache->Size = size;
+	cache->FunctionCount = ControllerContext->FunctionCount;
+	cache->RegisterDescriptorCount = descriptorCount;
+
+	RtlCopyMemory(
+		cache->F01Query,
+		&ControllerContext->F01QueryRegisters,
+		RMI4_LAYOUT_CACHE_QUERY_BYTES);
+
+	RtlCopyMemory(
+		cache->Descriptors,
+		ControllerContext->Descriptors,
+		sizeof(cache->Descriptors));
+
+	RtlCopyMemory(
+		cache->FunctionOnPage,
+		ControllerContext->FunctionOnPage,
+		sizeof(cache->FunctionOnPage));
+
+	item = cache->Items;
+
+	for (i = 0; i < descriptorCount; i++)
+	{
+		rdesc = RmiGetCachedRegisterDescriptor(ControllerContext, i);
+
+		cache->RegisterDescriptors[i].StructSize = rdesc->StructSize;
+		cache->RegisterDescriptors[i].NumRegisters = rdesc->NumRegisters;
+
+		RtlCopyMemory(
+			cache->RegisterDescriptors[i].PresenceMap,
+			rdesc->PresenceMap,
+			sizeof(rdesc->PresenceMap));
+
+		RtlCopyMemory(
+			item,
+			rdesc->Registers,
+			rdesc->NumRegisters * sizeof(RMI_REGISTER_DESC_ITEM));
+
+		item += rdesc->NumRegisters;
+	}
+
+	status = RtlWriteRegistryValue(
+		RTL_REGISTRY_ABSOLUTE,
+		TOUCH_CONTROLLER_SETTINGS_REG_KEY,
+		RMI4_LAYOUT_CACHE_VALUE_NAME,
+		REG_BINARY,
+		cache,
+		size);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_WARNING,
+			TRACE_FLAG_REGISTRY,
+			"Could not store the layout cache - STATUS:%X",
+			status);
+	}
+
+	ExFreePoolWithTag(cache, TOUCH_POOL_TAG);
+
+exit:
+
+	return;
+}
+
+VOID
+RmiDeleteLayoutCache(
+	VOID
+)
+{
+	(VOID)RtlDeleteRegistryValue(
+		RTL_REGISTRY_ABSOLUTE,
+		TOUCH_CONTROLLER_SETTINGS_REG_KEY,
+		RMI4_LAYOUT_CACHE_VALUE_NAME);
+}
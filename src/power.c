@@ -20,8 +20,10 @@
 
 #include "controller.h"
 #include "rmiinternal.h"
-#include "spb.h"
+#include "spbhelper.h"
 #include "debug.h"
+#include "fingercache.h"
+#include "buttonreporting.h"
 //#include "power.tmh"
 
 NTSTATUS
@@ -53,51 +55,18 @@ Return Value:
 {
 	RMI4_F01_CTRL_REGISTERS* controlF01;
 	UCHAR deviceControl;
-	int index;
 	NTSTATUS status;
 
 	controlF01 = (RMI4_F01_CTRL_REGISTERS*)&deviceControl;
 
 	//
-	// Find RMI device control function housing sleep settings
-	// 
-	index = RmiGetFunctionIndex(
-		ControllerContext->Descriptors,
-		ControllerContext->FunctionCount,
-		RMI4_F01_RMI_DEVICE_CONTROL);
-
-	if (index == ControllerContext->FunctionCount)
-	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_POWER,
-			"Power change failure - RMI Function 01 missing");
-
-		status = STATUS_INVALID_DEVICE_STATE;
-		goto exit;
-	}
-
-	status = RmiChangePage(
-		ControllerContext,
-		SpbContext,
-		ControllerContext->FunctionOnPage[index]);
-
-	if (!NT_SUCCESS(status))
-	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_POWER,
-			"Could not change register page");
-
-		goto exit;
-	}
-
-	//
-	// Read Device Control register
+	// Read Device Control register, normally known from configuration
 	//
-	status = SpbReadDataSynchronously(
+	status = RmiShadowRead(
+		ControllerContext,
 		SpbContext,
-		ControllerContext->Descriptors[index].ControlBase,
+		&ControllerContext->F01ControlShadow,
+		FIELD_OFFSET(RMI4_F01_CTRL_REGISTERS, DeviceControl),
 		&deviceControl,
 		sizeof(deviceControl)
 	);
@@ -121,12 +90,16 @@ Return Value:
 	//
 	// Write setting back to the controller
 	//
-	status = SpbWriteDataSynchronously(
-		SpbContext,
-		ControllerContext->Descriptors[index].ControlBase,
+	RmiShadowWrite(
+		&ControllerContext->F01ControlShadow,
+		FIELD_OFFSET(RMI4_F01_CTRL_REGISTERS, DeviceControl),
 		&deviceControl,
-		sizeof(deviceControl)
-	);
+		sizeof(deviceControl));
+
+	status = RmiShadowFlush(
+		ControllerContext,
+		SpbContext,
+		&ControllerContext->F01ControlShadow);
 
 	if (!NT_SUCCESS(status))
 	{
@@ -144,6 +117,79 @@ exit:
 	return status;
 }
 
+static
+BOOLEAN
+RmiConfigurationRetained(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Checks whether the controller kept the configuration programmed by
+	RmiConfigureFunctions across the last D3 period, which the chip
+	indicates by leaving F01 DeviceStatus.Unconfigured clear.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	TRUE if the controller can be resumed by only changing its sleep mode
+
+--*/
+{
+	RMI4_F01_DATA_REGISTERS data;
+	RMI4_RESOLVED_FUNCTION* f01;
+	NTSTATUS status;
+
+	f01 = &ControllerContext->Functions[RMI4_FUNCTION_SLOT_F01];
+
+	//
+	// A controller that lost power is back on page 0, the cached page
+	// can no longer be trusted either way
+	//
+	ControllerContext->CurrentPage = -1;
+
+	status = RmiChangePage(
+		ControllerContext,
+		SpbContext,
+		f01->Page);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	//
+	// Only the device status is read, the interrupt status stays pending
+	// for the interrupt routine
+	//
+	status = SpbReadDataSynchronously(
+		SpbContext,
+		f01->DataBase,
+		&data.DeviceStatus,
+		sizeof(data.DeviceStatus));
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	if (data.DeviceStatus.Unconfigured)
+	{
+		status = STATUS_DEVICE_CONFIGURATION_ERROR;
+	}
+
+exit:
+
+	return NT_SUCCESS(status);
+}
+
 NTSTATUS
 TchWakeDevice(
 	IN VOID* ControllerContext,
@@ -172,6 +218,12 @@ Return Value:
 
 	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
 
+	//
+	// Interrupts are still disabled, the lock keeps settings changes and
+	// diagnostics off the controller until it is back in D0
+	//
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
 	//
 	// Check if we were already on
 	//
@@ -180,6 +232,86 @@ Return Value:
 		goto exit;
 	}
 
+	//
+	// A controller masked by the storm monitor is brought back now, its
+	// recovery timer was cancelled on the way down
+	//
+	if (controller->Storm.Masked)
+	{
+		RmiStormRecover(controller, SpbContext);
+	}
+
+	//
+	// Warm resume: unless the platform removes power in D3, the
+	// configuration is assumed to be intact and the interrupt routine
+	// reconfigures the chip should it ever report itself unconfigured.
+	// Otherwise the configuration is only reprogrammed if it was lost.
+	// A controller left dozing in wakeup gesture mode kept its power
+	// and only has continuous reporting restored. Settings changed
+	// while in D3 are programmed now.
+	//
+	if (controller->WakeGestureArmed)
+	{
+		controller->WakeGestureArmed = FALSE;
+
+		status = controller->DigitizerOps->SetWakeGesture(
+			controller,
+			SpbContext,
+			FALSE);
+
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_POWER,
+				"Error leaving wakeup gesture mode - STATUS:%X",
+				status);
+		}
+	}
+
+	if (controller->SettingsWatch.ApplyOnWake ||
+		(controller->Config.PepRemovesVoltageInD3 != 0 &&
+		!RmiConfigurationRetained(controller, SpbContext)))
+	{
+		Trace(
+			TRACE_LEVEL_INFORMATION,
+			TRACE_FLAG_POWER,
+			"Controller settings changed or lost in D3, reconfiguring");
+
+		controller->SettingsWatch.ApplyOnWake = FALSE;
+
+		WdfWaitLockAcquire(controller->ReportLock, NULL);
+
+		status = RmiConfigureFunctions(
+			controller,
+			SpbContext);
+
+		WdfWaitLockRelease(controller->ReportLock);
+
+		TchCountEvent(&controller->Counters, Reconfigurations);
+
+		if (!NT_SUCCESS(status))
+		{
+			TchCountEvent(
+				&controller->Counters,
+				SpbErrors[TchSpbSiteConfiguration]);
+
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_POWER,
+				"Error reconfiguring touch controller - STATUS:%X",
+				status);
+		}
+
+		//
+		// The F01 settings may already have started the controller
+		//
+		if (controller->DevicePowerState == PowerDeviceD0)
+		{
+			goto exit;
+		}
+	}
+
 	controller->DevicePowerState = PowerDeviceD0;
 
 	//
@@ -201,6 +333,8 @@ Return Value:
 
 exit:
 
+	WdfWaitLockRelease(controller->ControllerLock);
+
 	return STATUS_SUCCESS;
 }
 
@@ -232,6 +366,14 @@ Return Value:
 
 	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
 
+	//
+	// The idle timer must not program the controller from here on
+	//
+	TchActivityStop(controller);
+	TchStormStop(controller);
+	ButtonsStopTimer(controller);
+	TchF54StreamStop(controller);
+
 	//
 	// Interrupts are now disabled but the ISR may still be
 	// executing, so grab the controller lock to ensure ISR
@@ -240,20 +382,51 @@ Return Value:
 	WdfWaitLockAcquire(controller->ControllerLock, NULL);
 
 	//
-	// Put the chip in sleep mode
+	// If configured, and the controller keeps its power in D3, leave it
+	// dozing with wakeup gesture detection so its attention interrupt
+	// can wake the device and resume skips the sleep exit
 	//
-	status = RmiChangeSleepState(
-		ControllerContext,
-		SpbContext,
-		RMI4_F11_DEVICE_CONTROL_SLEEP_MODE_SLEEPING);
+	if (controller->Config.WakeGestureStandby != 0 &&
+		controller->Config.PepRemovesVoltageInD3 == 0 &&
+		controller->DigitizerOps->SetWakeGesture != NULL)
+	{
+		status = controller->DigitizerOps->SetWakeGesture(
+			controller,
+			SpbContext,
+			TRUE);
+
+		if (NT_SUCCESS(status))
+		{
+			controller->WakeGestureArmed = TRUE;
+		}
+		else
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_POWER,
+				"Error entering wakeup gesture mode - STATUS:%X",
+				status);
+		}
+	}
 
-	if (!NT_SUCCESS(status))
+	//
+	// Otherwise put the chip in sleep mode
+	//
+	if (!controller->WakeGestureArmed)
 	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_POWER,
-			"Error sleeping touch controller - STATUS:%X",
-			status);
+		status = RmiChangeSleepState(
+			ControllerContext,
+			SpbContext,
+			RMI4_F11_DEVICE_CONTROL_SLEEP_MODE_SLEEPING);
+
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_POWER,
+				"Error sleeping touch controller - STATUS:%X",
+				status);
+		}
 	}
 
 	controller->DevicePowerState = PowerDeviceD3;
@@ -261,10 +434,25 @@ Return Value:
 	//
 	// Invalidate state
 	//
-	controller->FingerCache.FingerSlotValid = 0;
-	controller->FingerCache.FingerSlotDirty = 0;
-	controller->FingerCache.FingerDownCount = 0;
-    controller->HidQueueCount = 0;
+	RmiResetFingerCache(&controller->FingerCache);
+	controller->PalmSuppressed = FALSE;
+
+	//
+	// Reports still queued describe contacts from before the power
+	// transition, discard them
+	//
+	WdfWaitLockAcquire(controller->ReportLock, NULL);
+
+	controller->ReportQueue.Staged = 0;
+	controller->ReportQueue.StagedKey = 0;
+	controller->ReportQueue.LastKey = 0;
+	controller->ReportedTipMask = 0;
+
+	WdfSpinLockAcquire(controller->ReportQueue.ConsumerLock);
+	controller->ReportQueue.Tail = controller->ReportQueue.Head;
+	WdfSpinLockRelease(controller->ReportQueue.ConsumerLock);
+
+	WdfWaitLockRelease(controller->ReportLock);
 
 	WdfWaitLockRelease(controller->ControllerLock);
 
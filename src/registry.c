@@ -21,15 +21,19 @@
 --*/
 
 #include "rmiinternal.h"
+#include "buttonreporting.h"
 #include "debug.h"
 //#include "registry.tmh"
 
 //
 // Default RMI4 configuration values can be changed here. Please refer to the
-// RMI4 specification for a full description of the fields and value meanings
+// RMI4 specification for a full description of the fields and value meanings.
+// The defaults and the query table are shared by all instances and never
+// written, each controller queries through a copy of the table built once
+// by TchRegistryCreateSettings.
 //
 
-static RMI4_CONFIGURATION gDefaultConfiguration =
+static const RMI4_CONFIGURATION gDefaultConfiguration =
 {
 	//
 	// RMI4 F01 - Device control settings
@@ -91,12 +95,27 @@ static RMI4_CONFIGURATION gDefaultConfiguration =
 	//
 	// Internal driver settings
 	//
-	{
-		0x0,                                            // Controller stays powered in D3
-	},
+	0x0,                                            // Controller stays powered in D3
+	2,                                              // F11 speculative read slots
+	0,                                              // Pipelined reporting (off)
+	0,                                              // Wide touch reports (off)
+	0,                                              // Batched read completion (off)
+	0,                                              // Contact deadband (controller units)
+	0,                                              // Contact keep-alive in ms (off)
+	0,                                              // Latency instrumentation (off)
+	0,                                              // Idle timeout in ms (off)
+	RMI4_MILLISECONDS_TO_TENTH_MILLISECONDS(100),   // Idle doze interval
+	1,                                              // Reduced reporting when idle
+	100,                                            // Interrupt storm window in ms
+	100,                                            // Interrupts per storm window
+	50,                                             // Spurious interrupts per storm window
+	500,                                            // Storm recovery delay in ms
+	0,                                              // Prediction horizon in ms (off)
+	0,                                              // Wakeup gesture doze in standby (off)
+	1,                                              // Palm suppression (on)
 };
 
-RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
+static const RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 {
 	//
 	// RMI4 F01 - Device control settings
@@ -107,7 +126,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, DeviceSettings) +
 			FIELD_OFFSET(RMI4_F01_CTRL_REGISTERS_LOGICAL, SleepMode)),
 		REG_DWORD,
-		&gDefaultConfiguration.DeviceSettings.SleepMode,
+		(PVOID)&gDefaultConfiguration.DeviceSettings.SleepMode,
 		sizeof(UINT32)
 	},
 	{
@@ -116,7 +135,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, DeviceSettings) +
 			FIELD_OFFSET(RMI4_F01_CTRL_REGISTERS_LOGICAL, NoSleep)),
 		REG_DWORD,
-		&gDefaultConfiguration.DeviceSettings.NoSleep,
+		(PVOID)&gDefaultConfiguration.DeviceSettings.NoSleep,
 		sizeof(UINT32)
 	},
 	{
@@ -125,7 +144,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, DeviceSettings) +
 			FIELD_OFFSET(RMI4_F01_CTRL_REGISTERS_LOGICAL, ReportRate)),
 		REG_DWORD,
-		&gDefaultConfiguration.DeviceSettings.ReportRate,
+		(PVOID)&gDefaultConfiguration.DeviceSettings.ReportRate,
 		sizeof(UINT32)
 	},
 	{
@@ -134,7 +153,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, DeviceSettings) +
 			FIELD_OFFSET(RMI4_F01_CTRL_REGISTERS_LOGICAL, Configured)),
 		REG_DWORD,
-		&gDefaultConfiguration.DeviceSettings.Configured,
+		(PVOID)&gDefaultConfiguration.DeviceSettings.Configured,
 		sizeof(UINT32)
 	},
 	{
@@ -143,7 +162,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, DeviceSettings) +
 			FIELD_OFFSET(RMI4_F01_CTRL_REGISTERS_LOGICAL, InterruptEnable)),
 		REG_DWORD,
-		&gDefaultConfiguration.DeviceSettings.InterruptEnable,
+		(PVOID)&gDefaultConfiguration.DeviceSettings.InterruptEnable,
 		sizeof(UINT32)
 	},
 	{
@@ -152,7 +171,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, DeviceSettings) +
 			FIELD_OFFSET(RMI4_F01_CTRL_REGISTERS_LOGICAL, DozeInterval)),
 		REG_DWORD,
-		&gDefaultConfiguration.DeviceSettings.DozeInterval,
+		(PVOID)&gDefaultConfiguration.DeviceSettings.DozeInterval,
 		sizeof(UINT32)
 	},
 	{
@@ -161,7 +180,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, DeviceSettings) +
 			FIELD_OFFSET(RMI4_F01_CTRL_REGISTERS_LOGICAL, DozeThreshold)),
 		REG_DWORD,
-		&gDefaultConfiguration.DeviceSettings.DozeThreshold,
+		(PVOID)&gDefaultConfiguration.DeviceSettings.DozeThreshold,
 		sizeof(UINT32)
 	},
 	{
@@ -170,7 +189,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, DeviceSettings) +
 			FIELD_OFFSET(RMI4_F01_CTRL_REGISTERS_LOGICAL, DozeHoldoff)),
 		REG_DWORD,
-		&gDefaultConfiguration.DeviceSettings.DozeHoldoff,
+		(PVOID)&gDefaultConfiguration.DeviceSettings.DozeHoldoff,
 		sizeof(UINT32)
 	},
 
@@ -183,7 +202,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, ReportingMode)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.ReportingMode,
+		(PVOID)&gDefaultConfiguration.TouchSettings.ReportingMode,
 		sizeof(UINT32)
 	},
 	{
@@ -192,7 +211,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, AbsPosFilt)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.AbsPosFilt,
+		(PVOID)&gDefaultConfiguration.TouchSettings.AbsPosFilt,
 		sizeof(UINT32)
 	},
 	{
@@ -201,7 +220,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, RelPosFilt)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.RelPosFilt,
+		(PVOID)&gDefaultConfiguration.TouchSettings.RelPosFilt,
 		sizeof(UINT32)
 	},
 	{
@@ -210,7 +229,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, RelBallistics)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.RelBallistics,
+		(PVOID)&gDefaultConfiguration.TouchSettings.RelBallistics,
 		sizeof(UINT32)
 	},
 	{
@@ -219,7 +238,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, Dribble)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.Dribble,
+		(PVOID)&gDefaultConfiguration.TouchSettings.Dribble,
 		sizeof(UINT32)
 	},
 	{
@@ -228,7 +247,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, PalmDetectThreshold)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.PalmDetectThreshold,
+		(PVOID)&gDefaultConfiguration.TouchSettings.PalmDetectThreshold,
 		sizeof(UINT32)
 	},
 	{
@@ -237,7 +256,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, MotionSensitivity)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.MotionSensitivity,
+		(PVOID)&gDefaultConfiguration.TouchSettings.MotionSensitivity,
 		sizeof(UINT32)
 	},
 	{
@@ -246,7 +265,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, ManTrackEn)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.ManTrackEn,
+		(PVOID)&gDefaultConfiguration.TouchSettings.ManTrackEn,
 		sizeof(UINT32)
 	},
 	{
@@ -255,7 +274,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, ManTrackedFinger)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.ManTrackedFinger,
+		(PVOID)&gDefaultConfiguration.TouchSettings.ManTrackedFinger,
 		sizeof(UINT32)
 	},
 	{
@@ -264,7 +283,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, DeltaXPosThreshold)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.DeltaXPosThreshold,
+		(PVOID)&gDefaultConfiguration.TouchSettings.DeltaXPosThreshold,
 		sizeof(UINT32)
 	},
 	{
@@ -273,7 +292,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, DeltaYPosThreshold)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.DeltaYPosThreshold,
+		(PVOID)&gDefaultConfiguration.TouchSettings.DeltaYPosThreshold,
 		sizeof(UINT32)
 	},
 	{
@@ -282,7 +301,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, Velocity)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.Velocity,
+		(PVOID)&gDefaultConfiguration.TouchSettings.Velocity,
 		sizeof(UINT32)
 	},
 	{
@@ -291,7 +310,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, Acceleration)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.Acceleration,
+		(PVOID)&gDefaultConfiguration.TouchSettings.Acceleration,
 		sizeof(UINT32)
 	},
 	{
@@ -300,7 +319,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, SensorMaxXPos)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.SensorMaxXPos,
+		(PVOID)&gDefaultConfiguration.TouchSettings.SensorMaxXPos,
 		sizeof(UINT32)
 	},
 	{
@@ -309,7 +328,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, SensorMaxYPos)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.SensorMaxYPos,
+		(PVOID)&gDefaultConfiguration.TouchSettings.SensorMaxYPos,
 		sizeof(UINT32)
 	},
 		{
@@ -318,7 +337,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, ZTouchThreshold)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.ZTouchThreshold,
+		(PVOID)&gDefaultConfiguration.TouchSettings.ZTouchThreshold,
 		sizeof(UINT32)
 	},
 	{
@@ -327,7 +346,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, ZHysteresis)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.ZHysteresis,
+		(PVOID)&gDefaultConfiguration.TouchSettings.ZHysteresis,
 		sizeof(UINT32)
 	},
 	{
@@ -336,7 +355,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, SmallZThreshold)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.SmallZThreshold,
+		(PVOID)&gDefaultConfiguration.TouchSettings.SmallZThreshold,
 		sizeof(UINT32)
 	},
 	{
@@ -345,7 +364,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, SmallZScaleFactor)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.SmallZScaleFactor,
+		(PVOID)&gDefaultConfiguration.TouchSettings.SmallZScaleFactor,
 		sizeof(UINT32)
 	},
 	{
@@ -354,7 +373,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, LargeZScaleFactor)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.LargeZScaleFactor,
+		(PVOID)&gDefaultConfiguration.TouchSettings.LargeZScaleFactor,
 		sizeof(UINT32)
 	},
 	{
@@ -363,7 +382,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, AlgorithmSelection)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.AlgorithmSelection,
+		(PVOID)&gDefaultConfiguration.TouchSettings.AlgorithmSelection,
 		sizeof(UINT32)
 	},
 	{
@@ -372,7 +391,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, WxScaleFactor)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.WxScaleFactor,
+		(PVOID)&gDefaultConfiguration.TouchSettings.WxScaleFactor,
 		sizeof(UINT32)
 	},
 	{
@@ -381,7 +400,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, WxOffset)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.WxOffset,
+		(PVOID)&gDefaultConfiguration.TouchSettings.WxOffset,
 		sizeof(UINT32)
 	},
 	{
@@ -390,7 +409,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, WyScaleFactor)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.WyScaleFactor,
+		(PVOID)&gDefaultConfiguration.TouchSettings.WyScaleFactor,
 		sizeof(UINT32)
 	},
 	{
@@ -399,7 +418,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, WyOffset)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.WyOffset,
+		(PVOID)&gDefaultConfiguration.TouchSettings.WyOffset,
 		sizeof(UINT32)
 	},
 	{
@@ -408,7 +427,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, XPitch)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.XPitch,
+		(PVOID)&gDefaultConfiguration.TouchSettings.XPitch,
 		sizeof(UINT32)
 	},
 	{
@@ -417,7 +436,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, YPitch)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.YPitch,
+		(PVOID)&gDefaultConfiguration.TouchSettings.YPitch,
 		sizeof(UINT32)
 	},
 	{
@@ -426,7 +445,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, FingerWidthX)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.FingerWidthX,
+		(PVOID)&gDefaultConfiguration.TouchSettings.FingerWidthX,
 		sizeof(UINT32)
 	},
 	{
@@ -435,7 +454,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, FingerWidthY)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.FingerWidthY,
+		(PVOID)&gDefaultConfiguration.TouchSettings.FingerWidthY,
 		sizeof(UINT32)
 	},
 	{
@@ -444,7 +463,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, ReportMeasuredSize)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.ReportMeasuredSize,
+		(PVOID)&gDefaultConfiguration.TouchSettings.ReportMeasuredSize,
 		sizeof(UINT32)
 	},
 	{
@@ -453,7 +472,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, SegmentationSensitivity)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.SegmentationSensitivity,
+		(PVOID)&gDefaultConfiguration.TouchSettings.SegmentationSensitivity,
 		sizeof(UINT32)
 	},
 	{
@@ -462,7 +481,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, XClipLo)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.XClipLo,
+		(PVOID)&gDefaultConfiguration.TouchSettings.XClipLo,
 		sizeof(UINT32)
 	},
 	{
@@ -471,7 +490,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, XClipHi)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.XClipHi,
+		(PVOID)&gDefaultConfiguration.TouchSettings.XClipHi,
 		sizeof(UINT32)
 	},
 	{
@@ -480,7 +499,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, YClipLo)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.YClipLo,
+		(PVOID)&gDefaultConfiguration.TouchSettings.YClipLo,
 		sizeof(UINT32)
 	},
 	{
@@ -489,7 +508,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, YClipHi)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.YClipHi,
+		(PVOID)&gDefaultConfiguration.TouchSettings.YClipHi,
 		sizeof(UINT32)
 	},
 	{
@@ -498,7 +517,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, MinFingerSeparation)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.MinFingerSeparation,
+		(PVOID)&gDefaultConfiguration.TouchSettings.MinFingerSeparation,
 		sizeof(UINT32)
 	},
 	{
@@ -507,7 +526,7 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, TouchSettings) +
 			FIELD_OFFSET(RMI4_F11_CTRL_REGISTERS_LOGICAL, MaxFingerMovement)),
 		REG_DWORD,
-		&gDefaultConfiguration.TouchSettings.MaxFingerMovement,
+		(PVOID)&gDefaultConfiguration.TouchSettings.MaxFingerMovement,
 		sizeof(UINT32)
 	},
 
@@ -523,7 +542,143 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 		L"PepRemovesVoltageInD3",
 		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, PepRemovesVoltageInD3)),
 		REG_DWORD,
-		&gDefaultConfiguration.PepRemovesVoltageInD3,
+		(PVOID)&gDefaultConfiguration.PepRemovesVoltageInD3,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"F11SpeculativeReadSlots",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, F11SpeculativeReadSlots)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.F11SpeculativeReadSlots,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"PipelinedReporting",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, PipelinedReporting)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.PipelinedReporting,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"WideTouchReports",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, WideTouchReports)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.WideTouchReports,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"BatchedReadCompletion",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, BatchedReadCompletion)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.BatchedReadCompletion,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"ContactDeadband",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, ContactDeadband)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.ContactDeadband,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"ContactKeepAliveInterval",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, ContactKeepAliveInterval)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.ContactKeepAliveInterval,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"LatencyInstrumentation",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, LatencyInstrumentation)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.LatencyInstrumentation,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"IdleTimeout",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, IdleTimeout)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.IdleTimeout,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"IdleDozeInterval",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, IdleDozeInterval)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.IdleDozeInterval,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"IdleReducedReporting",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, IdleReducedReporting)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.IdleReducedReporting,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"StormWindow",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, StormWindow)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.StormWindow,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"StormInterruptLimit",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, StormInterruptLimit)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.StormInterruptLimit,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"StormSpuriousLimit",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, StormSpuriousLimit)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.StormSpuriousLimit,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"StormRecoveryDelay",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, StormRecoveryDelay)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.StormRecoveryDelay,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"PredictionHorizon",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, PredictionHorizon)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.PredictionHorizon,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"WakeGestureStandby",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, WakeGestureStandby)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.WakeGestureStandby,
+		sizeof(UINT32)
+	},
+	{
+		NULL, RTL_QUERY_REGISTRY_DIRECT,
+		L"PalmSuppression",
+		(PVOID)(FIELD_OFFSET(RMI4_CONFIGURATION, PalmSuppression)),
+		REG_DWORD,
+		(PVOID)&gDefaultConfiguration.PalmSuppression,
 		sizeof(UINT32)
 	},
 
@@ -540,46 +695,43 @@ RTL_QUERY_REGISTRY_TABLE gRegistryTable[] =
 	}
 };
 static const ULONG gcbRegistryTable = sizeof(gRegistryTable);
-static const ULONG gcRegistryTable =
-sizeof(gRegistryTable) / sizeof(gRegistryTable[0]);
 
 
-NTSTATUS
-TchRegistryGetControllerSettings(
-	IN VOID* ControllerContext
+PRTL_QUERY_REGISTRY_TABLE
+TchRegistryCreateQueryTable(
+	IN const RTL_QUERY_REGISTRY_TABLE* Template,
+	IN ULONG TemplateSize,
+	IN PVOID Base
 )
 /*++
 
   Routine Description:
 
-	This routine retrieves controller wide settings
-	from the registry.
+	Copies a query table whose entries hold field offsets as their
+	EntryContext and rebases them onto the structure they are read into
 
   Arguments:
 
-	FxDevice - a handle to the framework device object
-	Settings - A pointer to the chip settings structure
+	Template - Query table, terminated by an empty entry
+	TemplateSize - Size of the table in bytes
+	Base - Structure the values are read into
 
   Return Value:
 
-	NTSTATUS indicating success or failure
+	The table, freed with ExFreePoolWithTag, or NULL
 
 --*/
 {
-	RMI4_CONTROLLER_CONTEXT* controller;
+	PRTL_QUERY_REGISTRY_TABLE regTable;
+	ULONG count;
 	ULONG i;
-	PRTL_QUERY_REGISTRY_TABLE regTable = NULL;
-	NTSTATUS status = STATUS_SUCCESS;
-
-	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
 
 	//
 	// RtlQueryRegistryValues table must be allocated from NonPagedPool
 	//
-
 	regTable = ExAllocatePoolWithTag(
-		NonPagedPool,
-		gcbRegistryTable,
+		NonPagedPoolNx,
+		TemplateSize,
 		TOUCH_POOL_TAG);
 
 	if (regTable == NULL)
@@ -589,44 +741,65 @@ TchRegistryGetControllerSettings(
 
 	RtlCopyMemory(
 		regTable,
-		gRegistryTable,
-		gcbRegistryTable);
+		Template,
+		TemplateSize);
 
 	//
 	// Update offset values with base pointer
-	// 
+	//
+	count = TemplateSize / sizeof(RTL_QUERY_REGISTRY_TABLE);
 
-	for (i = 0; i < gcRegistryTable - 1; i++)
+	for (i = 0; i < count - 1; i++)
 	{
 		(regTable + i)->EntryContext = (PVOID)(
 			((SIZE_T)(regTable + i)->EntryContext) +
-			((ULONG_PTR)&controller->Config));
+			((ULONG_PTR)Base));
 	}
 
+exit:
+
+	return regTable;
+}
+
+NTSTATUS
+TchRegistryQueryControllerSettings(
+	IN PRTL_QUERY_REGISTRY_TABLE QueryTable,
+	IN PTOUCH_SCREEN_PROPERTIES Props,
+	OUT RMI4_CONFIGURATION* Config
+)
+/*++
+
+  Routine Description:
+
+	This routine reads controller wide settings from the registry
+	into a configuration snapshot.
+
+  Arguments:
+
+	QueryTable - Controller settings table rebased onto Config
+	Props - Screen properties the sensor extents default to
+	Config - Receives the configuration, defaults on failure
+
+  Return Value:
+
+	NTSTATUS indicating success or failure. Config holds the defaults
+	on failure, a caller refreshing a running configuration should keep
+	its current one instead.
+
+--*/
+{
+	NTSTATUS status;
+
 	//
-	// Populate device context with registry or default configurations
+	// Populate the snapshot with registry or default configurations
 	//
-
 	status = RtlQueryRegistryValues(
 		RTL_REGISTRY_ABSOLUTE,
 		TOUCH_CONTROLLER_SETTINGS_REG_KEY,
-		regTable,
+		QueryTable,
 		NULL,
 		NULL);
 
-	if (!NT_SUCCESS(status))
-	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_REGISTRY,
-			"Error retrieving registry configuration - STATUS:%X",
-			status);
-
-		goto exit;
-	}
-
-exit:
-
 	if (!NT_SUCCESS(status))
 	{
 		//
@@ -634,7 +807,7 @@ exit:
 		// issue reading configuration data from the registry
 		//
 		RtlCopyMemory(
-			&controller->Config,
+			Config,
 			&gDefaultConfiguration,
 			sizeof(RMI4_CONFIGURATION));
 
@@ -643,23 +816,318 @@ exit:
 			TRACE_FLAG_REGISTRY,
 			"Error reading registry config, using defaults! - STATUS:%X",
 			status);
+	}
 
-		status = STATUS_SUCCESS;
+	if (Config->TouchSettings.SensorMaxXPos == 254)
+	{
+		Config->TouchSettings.SensorMaxXPos = Props->DisplayPhysicalWidth;
 	}
+	if (Config->TouchSettings.SensorMaxYPos == 253)
+	{
+		Config->TouchSettings.SensorMaxYPos = Props->DisplayPhysicalHeight;
+	}
+
+	return status;
+}
+
+NTSTATUS
+TchRegistryCreateSettings(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+  Routine Description:
+
+	Allocates the settings snapshot of a controller along with the
+	query tables reading into it. The tables are built once and used
+	by every load, at start and on each change of the settings keys.
+
+  Arguments:
+
+	ControllerContext - Touch controller context
+
+  Return Value:
 
-	if (controller->Config.TouchSettings.SensorMaxXPos == 254)
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_SETTINGS_SNAPSHOT* settings;
+	NTSTATUS status;
+
+	status = STATUS_SUCCESS;
+
+	settings = ExAllocatePoolWithTag(
+		NonPagedPoolNx,
+		sizeof(RMI4_SETTINGS_SNAPSHOT),
+		TOUCH_POOL_TAG);
+
+	if (settings == NULL)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto exit;
+	}
+
+	RtlZeroMemory(settings, sizeof(RMI4_SETTINGS_SNAPSHOT));
+	ControllerContext->Settings = settings;
+
+	settings->PropsQuery = TchCreateScreenPropertiesQuery(&settings->Props);
+	settings->ConfigQuery = TchRegistryCreateQueryTable(
+		gRegistryTable,
+		gcbRegistryTable,
+		&settings->Config);
+
+	if (settings->PropsQuery == NULL || settings->ConfigQuery == NULL)
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_REGISTRY,
+			"Could not allocate settings query tables");
+
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto exit;
+	}
+
+exit:
+
+	return status;
+}
+
+VOID
+TchRegistryFreeSettings(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+  Routine Description:
+
+	Frees the settings snapshot and its query tables
+
+  Arguments:
+
+	ControllerContext - Touch controller context
+
+  Return Value:
+
+	None
+
+--*/
+{
+	RMI4_SETTINGS_SNAPSHOT* settings;
+
+	settings = ControllerContext->Settings;
+
+	if (settings == NULL)
 	{
-		controller->Config.TouchSettings.SensorMaxXPos = controller->Props.DisplayPhysicalWidth;
+		goto exit;
 	}
-	if (controller->Config.TouchSettings.SensorMaxYPos == 253)
+
+	if (settings->PropsQuery != NULL)
 	{
-		controller->Config.TouchSettings.SensorMaxYPos = controller->Props.DisplayPhysicalHeight;
+		ExFreePoolWithTag(settings->PropsQuery, TOUCH_POOL_TAG);
 	}
 
-	if (regTable != NULL)
+	if (settings->ConfigQuery != NULL)
 	{
-		ExFreePoolWithTag(regTable, TOUCH_POOL_TAG);
+		ExFreePoolWithTag(settings->ConfigQuery, TOUCH_POOL_TAG);
 	}
 
+	ExFreePoolWithTag(settings, TOUCH_POOL_TAG);
+	ControllerContext->Settings = NULL;
+
+exit:
+
+	return;
+}
+
+NTSTATUS
+TchRegistryLoadSettings(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN BOOLEAN Started
+)
+/*++
+
+  Routine Description:
+
+	Reads the screen properties, the controller settings and the button
+	layout derived from both into the settings snapshot of the
+	controller. The values in use are not touched, the caller puts the
+	snapshot in place. Used on start and on every settings change, one
+	load at a time.
+
+  Arguments:
+
+	ControllerContext - Touch controller context
+
+	Started - TRUE when the device is running on a previous snapshot,
+	  the display extents it published are then kept
+
+  Return Value:
+
+	NTSTATUS indicating success or failure. The snapshot holds the
+	defaults of whatever could not be read.
+
+--*/
+{
+	RMI4_SETTINGS_SNAPSHOT* settings;
+	NTSTATUS propsStatus;
+	NTSTATUS status;
+
+	settings = ControllerContext->Settings;
+
+	propsStatus = TchGetScreenProperties(
+		settings->PropsQuery,
+		&settings->Props,
+		Started ? &ControllerContext->Props : NULL);
+
+	status = TchRegistryQueryControllerSettings(
+		settings->ConfigQuery,
+		&settings->Props,
+		&settings->Config);
+
+	TchLoadButtonLayout(&settings->ButtonLayout, &settings->Props);
+
+	//
+	// A key that does not exist leaves its defaults in place, which is
+	// the configuration wanted, only failures to read one are errors
+	//
+	if (status == STATUS_OBJECT_NAME_NOT_FOUND)
+	{
+		status = STATUS_SUCCESS;
+	}
+
+	if (propsStatus == STATUS_OBJECT_NAME_NOT_FOUND)
+	{
+		propsStatus = STATUS_SUCCESS;
+	}
+
+	if (NT_SUCCESS(status))
+	{
+		status = propsStatus;
+	}
+
+	return status;
+}
+
+BOOLEAN
+TchRegistryIsWakeGestureStandby(
+	VOID
+)
+/*++
+
+  Routine Description:
+
+	Tells if the controller is configured to doze in wakeup gesture mode
+	while in D3, keeping its power. Read before the controller context
+	exists, when the interrupt is created.
+
+  Arguments:
+
+	None
+
+  Return Value:
+
+	TRUE if the wakeup gesture standby is configured
+
+--*/
+{
+	RTL_QUERY_REGISTRY_TABLE regTable[3];
+	ULONG wakeGestureStandby;
+	ULONG pepRemovesVoltage;
+
+	wakeGestureStandby = gDefaultConfiguration.WakeGestureStandby;
+	pepRemovesVoltage = gDefaultConfiguration.PepRemovesVoltageInD3;
+
+	RtlZeroMemory(regTable, sizeof(regTable));
+
+	regTable[0].Flags = RTL_QUERY_REGISTRY_DIRECT;
+	regTable[0].Name = L"WakeGestureStandby";
+	regTable[0].EntryContext = &wakeGestureStandby;
+	regTable[0].DefaultType = REG_DWORD;
+	regTable[0].DefaultData = (PVOID)&gDefaultConfiguration.WakeGestureStandby;
+	regTable[0].DefaultLength = sizeof(UINT32);
+
+	regTable[1].Flags = RTL_QUERY_REGISTRY_DIRECT;
+	regTable[1].Name = L"PepRemovesVoltageInD3";
+	regTable[1].EntryContext = &pepRemovesVoltage;
+	regTable[1].DefaultType = REG_DWORD;
+	regTable[1].DefaultData = (PVOID)&gDefaultConfiguration.PepRemovesVoltageInD3;
+	regTable[1].DefaultLength = sizeof(UINT32);
+
+	//
+	// The defaults stay in place if the key cannot be read
+	//
+	(VOID)RtlQueryRegistryValues(
+		RTL_REGISTRY_ABSOLUTE,
+		TOUCH_CONTROLLER_SETTINGS_REG_KEY,
+		regTable,
+		NULL,
+		NULL);
+
+	return wakeGestureStandby != 0 && pepRemovesVoltage == 0;
+}
+
+NTSTATUS
+TchRegistryGetControllerSettings(
+	IN VOID* ControllerContext
+)
+/*++
+
+  Routine Description:
+
+	This routine retrieves the screen properties, controller wide
+	settings and button layout from the registry when the device
+	starts, and latches the settings that only apply on start.
+
+  Arguments:
+
+	ControllerContext - Touch controller context
+
+  Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	NTSTATUS status;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+
+	//
+	// A device still starts on the defaults
+	//
+	(VOID)TchRegistryLoadSettings(controller, FALSE);
+
+	RtlCopyMemory(
+		&controller->Props,
+		&controller->Settings->Props,
+		sizeof(TOUCH_SCREEN_PROPERTIES));
+	RtlCopyMemory(
+		&controller->Config,
+		&controller->Settings->Config,
+		sizeof(RMI4_CONFIGURATION));
+	RtlCopyMemory(
+		&controller->ButtonLayout,
+		&controller->Settings->ButtonLayout,
+		sizeof(RMI4_BUTTON_LAYOUT));
+
+	status = STATUS_SUCCESS;
+
+	//
+	// The report format has to match the report descriptor HIDClass reads
+	// after start, so latch it here rather than on every report
+	//
+	controller->ReportQueue.WideTouchReports =
+		(controller->Config.WideTouchReports != 0);
+	controller->ReportQueue.BatchReadCompletion =
+		(controller->Config.BatchedReadCompletion != 0);
+
+	TchLatencyInitialize(
+		&controller->Latency,
+		(controller->Config.LatencyInstrumentation != 0));
+	controller->ReportQueue.Latency =
+		controller->Latency.Enabled ? &controller->Latency : NULL;
+
 	return status;
 }
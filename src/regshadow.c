@@ -0,0 +1,326 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		regshadow.c
+
+	Abstract:
+
+		Write-combining control register shadow
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include "rmiinternal.h"
+#include "spbhelper.h"
+#include "debug.h"
+#include "regshadow.h"
+
+#define RMI4_SHADOW_BIT(i)          (1ull << (i))
+
+static
+ULONG64
+RmiShadowRangeMask(
+	IN ULONG Offset,
+	IN ULONG Length
+)
+{
+	if (Length >= 64)
+	{
+		return ~0ull << Offset;
+	}
+
+	return ((RMI4_SHADOW_BIT(Length)) - 1) << Offset;
+}
+
+VOID
+RmiShadowInitialize(
+	IN RMI4_REGISTER_SHADOW* Shadow,
+	IN int Page,
+	IN BYTE Base,
+	IN ULONG Length
+)
+/*++
+
+Routine Description:
+
+	Describes the register block a shadow mirrors. Nothing is known about
+	the block's contents yet, so the first flush writes every byte that
+	was set.
+
+Arguments:
+
+	Shadow - The shadow to initialize
+	Page - Register page of the block
+	Base - Address of the first register of the block
+	Length - Length of the block in bytes
+
+Return Value:
+
+	None.
+
+--*/
+{
+	NT_ASSERT(Length <= RMI4_SHADOW_MAX_LENGTH);
+
+	RtlZeroMemory(Shadow, sizeof(RMI4_REGISTER_SHADOW));
+
+	Shadow->Page = Page;
+	Shadow->Base = Base;
+	Shadow->Length = (BYTE)min(Length, RMI4_SHADOW_MAX_LENGTH);
+}
+
+VOID
+RmiShadowInvalidate(
+	IN RMI4_REGISTER_SHADOW* Shadow
+)
+{
+	Shadow->Valid = 0;
+	Shadow->Dirty = 0;
+}
+
+NTSTATUS
+RmiShadowRead(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN RMI4_REGISTER_SHADOW* Shadow,
+	IN ULONG Offset,
+	OUT PVOID Data,
+	IN ULONG Length
+)
+/*++
+
+Routine Description:
+
+	Returns the contents of shadowed registers, only going to the bus
+	for bytes whose contents are not known yet. Bytes read from the bus
+	never replace pending writes.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+	Shadow - The shadow of the register block
+	Offset - Offset of the first register within the block
+	Data - Receives the register contents
+	Length - Number of bytes to read
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	BYTE buffer[RMI4_SHADOW_MAX_LENGTH];
+	ULONG64 range;
+	NTSTATUS status;
+	ULONG i;
+
+	if (Offset + Length > Shadow->Length)
+	{
+		status = STATUS_INVALID_PARAMETER;
+		goto exit;
+	}
+
+	range = RmiShadowRangeMask(Offset, Length);
+	status = STATUS_SUCCESS;
+
+	if ((Shadow->Valid & range) != range)
+	{
+		status = RmiChangePage(
+			(RMI4_CONTROLLER_CONTEXT*)ControllerContext,
+			SpbContext,
+			Shadow->Page);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+
+		status = SpbReadDataSynchronously(
+			SpbContext,
+			(UCHAR)(Shadow->Base + Offset),
+			buffer,
+			Length);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+
+		for (i = 0; i < Length; i++)
+		{
+			if (!(Shadow->Valid & RMI4_SHADOW_BIT(Offset + i)))
+			{
+				Shadow->Data[Offset + i] = buffer[i];
+				Shadow->Valid |= RMI4_SHADOW_BIT(Offset + i);
+			}
+		}
+	}
+
+	RtlCopyMemory(Data, &Shadow->Data[Offset], Length);
+
+exit:
+
+	return status;
+}
+
+VOID
+RmiShadowWrite(
+	IN RMI4_REGISTER_SHADOW* Shadow,
+	IN ULONG Offset,
+	IN PVOID Data,
+	IN ULONG Length
+)
+/*++
+
+Routine Description:
+
+	Updates shadowed registers. Bytes already known to hold the value are
+	left clean, others are marked dirty until the next flush.
+
+Arguments:
+
+	Shadow - The shadow of the register block
+	Offset - Offset of the first register within the block
+	Data - New register contents
+	Length - Number of bytes to write
+
+Return Value:
+
+	None.
+
+--*/
+{
+	BYTE* bytes = (BYTE*)Data;
+	ULONG64 bit;
+	ULONG i;
+
+	NT_ASSERT(Offset + Length <= Shadow->Length);
+
+	for (i = 0; i < Length && Offset + i < Shadow->Length; i++)
+	{
+		bit = RMI4_SHADOW_BIT(Offset + i);
+
+		if ((Shadow->Valid & bit) && Shadow->Data[Offset + i] == bytes[i])
+		{
+			continue;
+		}
+
+		Shadow->Data[Offset + i] = bytes[i];
+		Shadow->Valid |= bit;
+		Shadow->Dirty |= bit;
+	}
+}
+
+NTSTATUS
+RmiShadowFlush(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN RMI4_REGISTER_SHADOW* Shadow
+)
+/*++
+
+Routine Description:
+
+	Writes the dirty bytes of a shadow to the controller. Dirty ranges
+	separated by a short run of known clean bytes are merged, so each
+	write covers as much as possible.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+	Shadow - The shadow of the register block
+
+Return Value:
+
+	NTSTATUS indicating success or failure, bytes that could not be
+	written stay dirty
+
+--*/
+{
+	NTSTATUS status;
+	ULONG first;
+	ULONG last;
+	ULONG next;
+
+	status = STATUS_SUCCESS;
+
+	if (Shadow->Dirty == 0)
+	{
+		goto exit;
+	}
+
+	status = RmiChangePage(
+		(RMI4_CONTROLLER_CONTEXT*)ControllerContext,
+		SpbContext,
+		Shadow->Page);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	first = 0;
+
+	while (Shadow->Dirty != 0)
+	{
+		while (!(Shadow->Dirty & RMI4_SHADOW_BIT(first)))
+		{
+			first++;
+		}
+
+		//
+		// Grow the range over following dirty bytes, and over short
+		// known gaps that lead to more dirty bytes
+		//
+		last = first;
+		next = first + 1;
+
+		while (next < Shadow->Length &&
+			next - last <= RMI4_SHADOW_MERGE_GAP + 1 &&
+			(Shadow->Valid & RMI4_SHADOW_BIT(next)))
+		{
+			if (Shadow->Dirty & RMI4_SHADOW_BIT(next))
+			{
+				last = next;
+			}
+
+			next++;
+		}
+
+		status = SpbWriteDataSynchronously(
+			SpbContext,
+			(UCHAR)(Shadow->Base + first),
+			&Shadow->Data[first],
+			last - first + 1);
+
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_SPB,
+				"Error flushing registers 0x%x-0x%x - STATUS:%X",
+				Shadow->Base + first,
+				Shadow->Base + last,
+				status);
+
+			goto exit;
+		}
+
+		Shadow->Dirty &= ~RmiShadowRangeMask(first, last - first + 1);
+		first = last + 1;
+	}
+
+exit:
+
+	return status;
+}
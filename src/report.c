@@ -21,12 +21,15 @@
 #include "controller.h"
 #include "config.h"
 #include "rmiinternal.h"
-#include "spb.h"
+#include "spbhelper.h"
 #include "debug.h"
 #include "buttonreporting.h"
 #include "hid.h"
 #include "Function11.h"
 #include "Function12.h"
+#include "fingercache.h"
+#include "bitops.h"
+#include "etwtrace.h"
 //#include "report.tmh"
 
 NTSTATUS
@@ -35,21 +38,338 @@ RmiGetTouchesFromController(
 	IN SPB_CONTEXT* SpbContext
 )
 {
-	NTSTATUS status;
+	return ControllerContext->DigitizerOps->GetTouches(
+		ControllerContext,
+		SpbContext);
+}
 
-	if (ControllerContext->IsF12Digitizer)
-	{
-		status = GetTouchesFromF12(ControllerContext, SpbContext);
-	}
-	else
-	{
-		status = GetTouchesFromF11(ControllerContext, SpbContext);
-	}
+static
+int
+RmiReportButtonAreas(
+    IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
 
-	return status;
+Routine Description:
+
+	Reports contacts landing on the capacitive button areas as key
+	presses and marks them in the finger cache key mask, so they are not
+	reported as touches.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	Number of contacts on button areas
+
+--*/
+{
+    NTSTATUS status;
+    RMI4_FINGER_CACHE* fingerCache = &(ControllerContext->FingerCache);
+    RMI4_BUTTONS_CACHE* buttonsCache = &(ControllerContext->ButtonsCache);
+    int keyTouchesReported = 0;
+    int i;
+
+    for(i = 0; i < fingerCache->FingerDownCount; i++)
+    {
+        USHORT X1 = fingerCache->FingerSlot[fingerCache->FingerDownOrder[i]].x;
+        USHORT Y1 = fingerCache->FingerSlot[fingerCache->FingerDownOrder[i]].y;
+
+        ULONG ButtonIndex = TchHandleButtonArea(X1, Y1, &ControllerContext->ButtonLayout);
+
+        if(ButtonIndex != BUTTON_NONE)
+        {
+            fingerCache->IsKeyMask |= (1UL << i);
+            keyTouchesReported++;
+            if(ButtonIndex != BUTTON_UNKNOWN)
+            {
+                if(fingerCache->FingerSlot[fingerCache->FingerDownOrder[i]].fingerStatus)
+                    buttonsCache->PhysicalMask |= (1UL << (ButtonIndex - 1));
+                else
+                    buttonsCache->PhysicalMask &= ~(1UL << (ButtonIndex - 1));
+            }
+        }
+    }
+    if(keyTouchesReported > 0)
+    {
+        status = FillButtonsReportFromCache(ControllerContext);
+        if(!NT_SUCCESS(status))
+        {
+            TraceLoggingWrite(
+                TchTraceProvider,
+                "ButtonReportError",
+                TraceLoggingLevel(WINEVENT_LEVEL_ERROR),
+                TraceLoggingKeyword(TCH_TRACE_KEYWORD_REPORTING),
+                TraceLoggingNTStatus(status, "Status"));
+        }
+    }
+
+    return keyTouchesReported;
 }
 
+static
 VOID
+RmiGetReportedPosition(
+    IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+    IN int Slot,
+    OUT USHORT* X,
+    OUT USHORT* Y
+)
+{
+    RMI4_FINGER_CACHE* fingerCache = &(ControllerContext->FingerCache);
+    int x = fingerCache->FingerSlot[Slot].x;
+    int y = fingerCache->FingerSlot[Slot].y;
+
+    //
+    // Optionally move the contact ahead along its track to hide part
+    // of the pipeline latency
+    //
+    if(ControllerContext->Config.PredictionHorizon != 0)
+    {
+        RmiFingerCachePredict(
+            fingerCache,
+            Slot,
+            ControllerContext->Config.PredictionHorizon * 10ull,
+            &x,
+            &y);
+    }
+
+    *X = (USHORT)x;
+    *Y = (USHORT)y;
+}
+
+static
+ULONG
+RmiGetUnreportedLifts(
+    IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+    IN ULONG ListedMask
+)
+/*++
+
+Routine Description:
+
+	Returns the contacts last queued to HID with the tip switch set that
+	the current frame no longer reports as the same contact. Their tip-up
+	was lost with a frame that could not be queued, or their slot was
+	taken by a new contact in the meantime.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	ListedMask - Slots the current frame reports as touches
+
+Return Value:
+
+	Mask of the contacts that still need a report lifting them
+
+--*/
+{
+    RMI4_FINGER_CACHE* fingerCache = &(ControllerContext->FingerCache);
+    ULONG lifts = ControllerContext->ReportedTipMask;
+    unsigned long bits = lifts & ListedMask;
+    unsigned long slot;
+
+    slot = find_first_bit(&bits, RMI4_MAX_TOUCHES);
+    while(slot < RMI4_MAX_TOUCHES)
+    {
+        if(fingerCache->FingerSequence[slot] ==
+            ControllerContext->ReportedContacts[slot].Sequence)
+        {
+            lifts &= ~(1UL << slot);
+        }
+
+        slot = find_next_bit(&bits, RMI4_MAX_TOUCHES, slot + 1);
+    }
+
+    return lifts;
+}
+
+static
+NTSTATUS
+RmiFillSingleContactReportFromCache(
+    IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+    IN PTOUCH_SCREEN_PROPERTIES Props,
+    IN UCHAR InputMode
+)
+/*++
+
+Routine Description:
+
+	Single-input and mouse modes. Stages exactly one report per frame for
+	the primary contact, the contact down the longest that is not on a
+	button area: a touch report with a single contact, or an absolute
+	mouse report scaled to MAX_MOUSE_COORD with the left button held
+	while the contact touches. A contact HIDClass still believes down is
+	lifted first, the primary contact then follows with the next frame.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	Props - information on how to adjust X/Y coordinates to match the display
+	InputMode - MODE_SINGLE_TOUCH or MODE_MOUSE
+
+Return Value:
+
+	STATUS_MORE_ENTRIES if a contact is left for the next frame, otherwise
+	NTSTATUS indicating whether the report was queued
+
+--*/
+{
+    NTSTATUS status;
+    RMI4_FINGER_CACHE* fingerCache = &(ControllerContext->FingerCache);
+    PHID_INPUT_REPORT hidReport;
+    LONG stagedBefore = ControllerContext->ReportQueue.Staged;
+    LONG stagedTouches;
+    USHORT displayX;
+    USHORT displayY;
+    ULONG contactMask;
+    ULONG tipMask;
+    ULONG lifts;
+    unsigned long bits;
+    BOOLEAN deferred;
+    int keyTouchesReported;
+    int primary;
+    int slot;
+
+    status = STATUS_SUCCESS;
+    deferred = FALSE;
+
+    keyTouchesReported = RmiReportButtonAreas(ControllerContext);
+    stagedTouches = ControllerContext->ReportQueue.Staged;
+
+    for(primary = 0; primary < fingerCache->FingerDownCount; primary++)
+    {
+        if(!(fingerCache->IsKeyMask & (1UL << primary)))
+        {
+            break;
+        }
+    }
+
+    lifts = RmiGetUnreportedLifts(
+        ControllerContext,
+        (primary < fingerCache->FingerDownCount) ?
+            (1UL << fingerCache->FingerDownOrder[primary]) : 0);
+
+    if(lifts != 0)
+    {
+        //
+        // Lift the contact at the position it was last reported at
+        //
+        bits = lifts;
+        slot = (int)find_first_bit(&bits, RMI4_MAX_TOUCHES);
+        contactMask = 1UL << slot;
+        tipMask = 0;
+
+        displayX = ControllerContext->ReportedContacts[slot].X;
+        displayY = ControllerContext->ReportedContacts[slot].Y;
+
+        if(primary < fingerCache->FingerDownCount || lifts != contactMask)
+        {
+            deferred = TRUE;
+        }
+    }
+    else if(primary == fingerCache->FingerDownCount)
+    {
+        ControllerContext->ReportedTipMask = 0;
+        goto exit;
+    }
+    else
+    {
+        slot = fingerCache->FingerDownOrder[primary];
+        contactMask = 1UL << slot;
+        tipMask = fingerCache->FingerSlot[slot].fingerStatus ? contactMask : 0;
+
+        RmiGetReportedPosition(ControllerContext, slot, &displayX, &displayY);
+        TchTranslateToDisplayCoordinatesBatch(&displayX, &displayY, 1, Props);
+    }
+
+    status = GetNextHidReport(ControllerContext, &hidReport);
+    if(!NT_SUCCESS(status))
+    {
+        TraceLoggingWrite(
+            TchTraceProvider,
+            "TouchReportSlotError",
+            TraceLoggingLevel(WINEVENT_LEVEL_ERROR),
+            TraceLoggingKeyword(TCH_TRACE_KEYWORD_REPORTING),
+            TraceLoggingNTStatus(status, "Status"));
+
+        //
+        // HIDClass keeps the state of the last queued report, the tip
+        // mask is left as is so the next frame reports what was lost
+        //
+        ControllerContext->ReportQueue.Staged = stagedTouches;
+        goto exit;
+    }
+
+    if(InputMode == MODE_MOUSE)
+    {
+        hidReport->ReportID = REPORTID_MOUSE;
+        hidReport->MouseReport.InputReport.bButtons = tipMask ? 1 : 0;
+        hidReport->MouseReport.InputReport.wXData = (USHORT)(
+            ((ULONG)displayX * MAX_MOUSE_COORD) / max(Props->DisplayPhysicalWidth, 1));
+        hidReport->MouseReport.InputReport.wYData = (USHORT)(
+            ((ULONG)displayY * MAX_MOUSE_COORD) / max(Props->DisplayPhysicalHeight, 1));
+    }
+    else
+    {
+        HID_CONTACT_POINT* contacts;
+
+        hidReport->ReportID = REPORTID_MTOUCH;
+
+        if(ControllerContext->ReportQueue.WideTouchReports)
+        {
+            contacts = hidReport->WideTouchReport.InputReport.Contacts;
+            hidReport->WideTouchReport.InputReport.ActualCount = 1;
+            hidReport->WideTouchReport.InputReport.ScanTime = fingerCache->ScanTime & 0xFFFF;
+        }
+        else
+        {
+            contacts = hidReport->TouchReport.InputReport.Contacts;
+            hidReport->TouchReport.InputReport.ActualCount = 1;
+            hidReport->TouchReport.InputReport.ScanTime = fingerCache->ScanTime & 0xFFFF;
+        }
+
+        contacts[0].ContactId = (UCHAR)slot;
+        contacts[0].wXData = displayX;
+        contacts[0].wYData = displayY;
+        contacts[0].bStatus = tipMask ? FINGER_STATUS : 0;
+    }
+
+    //
+    // Same coalescing rule as the multi-touch path: a lone move of the
+    // contact that was already down may be merged with the next one
+    //
+    if(stagedBefore == 0 &&
+        keyTouchesReported == 0 &&
+        tipMask != 0 &&
+        tipMask == ControllerContext->ReportedTipMask)
+    {
+        ControllerContext->ReportQueue.StagedKey = contactMask;
+    }
+
+    if(tipMask != 0)
+    {
+        ControllerContext->ReportedContacts[slot].Sequence =
+            fingerCache->FingerSequence[slot];
+        ControllerContext->ReportedContacts[slot].X = displayX;
+        ControllerContext->ReportedContacts[slot].Y = displayY;
+    }
+
+    ControllerContext->ReportedTipMask =
+        (ControllerContext->ReportedTipMask & ~contactMask) | tipMask;
+
+    if(deferred)
+    {
+        status = STATUS_MORE_ENTRIES;
+    }
+
+exit:
+    return status;
+}
+
+NTSTATUS
 RmiFillHidReportFromCache(
     IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
 	IN PTOUCH_SCREEN_PROPERTIES Props
@@ -58,277 +378,1071 @@ RmiFillHidReportFromCache(
 
 Routine Description:
 
-	This routine fills a HID report with the next one or two touch entries in
-	the local device finger cache.
+	This routine fills HID reports with the touch entries in the local
+	device finger cache, two contacts per report in hybrid mode or up to
+	ten in the wide report format.
 
 	The routine also adjusts X/Y coordinates to match the desired display
-	coordinates.
+	coordinates. Contacts HIDClass still believes down but that the frame
+	no longer reports are lifted at their last reported position, a new
+	contact reusing such a slot is reported with the next frame.
 
 Arguments:
 
-	HidReport - pointer to the HID report structure to fill
-	Cache - pointer to the local device finger cache
+	ControllerContext - Touch controller context
 	Props - information on how to adjust X/Y coordinates to match the display
-	TouchesReported - On entry, the number of touches (against total) that
-		have already been reported. As touches are transferred from the local
-		device cache to a HID report, this number is incremented.
-	TouchesTotal - total number of touches in the touch cache
 
 Return Value:
 
-	None.
+	STATUS_MORE_ENTRIES if a contact is left for the next frame, otherwise
+	NTSTATUS indicating whether the reports were queued
 
 --*/
 {
     NTSTATUS status;
     RMI4_FINGER_CACHE* fingerCache = &(ControllerContext->FingerCache);
-    RMI4_BUTTONS_CACHE* buttonsCache = &(ControllerContext->ButtonsCache);
 
-	int currentFingerIndex;
+	int frameCount;
+	int touchesReported;
 	int fingersToReport;
 	int i;
-    USHORT SctatchX = 0;
-    USHORT ScratchY = 0;
+	int slot;
+    HID_CONTACT_POINT frame[RMI4_MAX_TOUCHES];
+    USHORT displayX[RMI4_MAX_TOUCHES];
+    USHORT displayY[RMI4_MAX_TOUCHES];
 
-    int touchesReported = 0;
     int keyTouchesReported = 0;
 
+    LONG stagedBefore = ControllerContext->ReportQueue.Staged;
+    LONG stagedTouches;
+    ULONG listedMask = 0;
+    ULONG contactMask = 0;
+    ULONG tipMask = 0;
+    ULONG lifts;
+    ULONG deferred;
+    unsigned long bits;
+    unsigned long liftSlot;
+    BOOLEAN wideReports = ControllerContext->ReportQueue.WideTouchReports;
+    int contactsPerReport = wideReports ?
+        SYNAPTICS_TOUCH_DIGITIZER_WIDE_FINGER_REPORT_COUNT :
+        SYNAPTICS_TOUCH_DIGITIZER_FINGER_REPORT_COUNT;
+
+    status = STATUS_SUCCESS;
+
     //first report keys
+    keyTouchesReported = RmiReportButtonAreas(ControllerContext);
+    stagedTouches = ControllerContext->ReportQueue.Staged;
+
     for(i = 0; i < fingerCache->FingerDownCount; i++)
     {
-        USHORT X1 = (USHORT)fingerCache->FingerSlot[fingerCache->FingerDownOrder[i]].x;
-        USHORT Y1 = (USHORT)fingerCache->FingerSlot[fingerCache->FingerDownOrder[i]].y;
-
-        ULONG ButtonIndex = TchHandleButtonArea(X1, Y1, Props);
-
-        if(ButtonIndex != BUTTON_NONE)
+        if(!(fingerCache->IsKeyMask & (1UL << i)))
         {
-            fingerCache->IsKey[i] = TRUE;
-            keyTouchesReported++;
-            if(ButtonIndex != BUTTON_UNKNOWN)
-                buttonsCache->PhysicalState[ButtonIndex - 1] = fingerCache->FingerSlot[fingerCache->FingerDownOrder[i]].fingerStatus;
+            listedMask |= 1UL << fingerCache->FingerDownOrder[i];
         }
     }
-    if(keyTouchesReported > 0)
+
+    lifts = RmiGetUnreportedLifts(ControllerContext, listedMask);
+    deferred = lifts & listedMask;
+
+    //
+    // Perform per-platform x/y adjustments to controller coordinates for
+    // the whole frame at once, in finger down order
+    //
+    for(i = 0; i < fingerCache->FingerDownCount; i++)
     {
-        status = FillButtonsReportFromCache(ControllerContext);
-        if(!NT_SUCCESS(status))
+        RmiGetReportedPosition(
+            ControllerContext,
+            fingerCache->FingerDownOrder[i],
+            &displayX[i],
+            &displayY[i]);
+    }
+
+    TchTranslateToDisplayCoordinatesBatch(
+        displayX,
+        displayY,
+        (ULONG)fingerCache->FingerDownCount,
+        Props);
+
+    //
+    // Collect the contacts of the frame, touches not on button areas in
+    // finger down order followed by the lifts still owed to HIDClass
+    //
+    frameCount = 0;
+
+    for(i = 0; i < fingerCache->FingerDownCount; i++)
+    {
+        slot = fingerCache->FingerDownOrder[i];
+
+        if((fingerCache->IsKeyMask & (1UL << i)) ||
+            (deferred & (1UL << slot)))
         {
-            Trace(
-                TRACE_LEVEL_ERROR,
-                TRACE_FLAG_HID,
-                "error reporting touch buttons, status: %x",
-                status
-            );
+            continue;
         }
+
+        frame[frameCount].ContactId = (UCHAR)slot;
+        frame[frameCount].wXData = displayX[i];
+        frame[frameCount].wYData = displayY[i];
+        frame[frameCount].bStatus = 0;
+
+        contactMask |= (1UL << slot);
+
+        if(fingerCache->FingerSlot[slot].fingerStatus)
+        {
+            frame[frameCount].bStatus = FINGER_STATUS;
+            tipMask |= (1UL << slot);
+        }
+
+        frameCount++;
+    }
+
+    bits = lifts;
+    liftSlot = find_first_bit(&bits, RMI4_MAX_TOUCHES);
+    while(liftSlot < RMI4_MAX_TOUCHES)
+    {
+        frame[frameCount].ContactId = (UCHAR)liftSlot;
+        frame[frameCount].wXData = ControllerContext->ReportedContacts[liftSlot].X;
+        frame[frameCount].wYData = ControllerContext->ReportedContacts[liftSlot].Y;
+        frame[frameCount].bStatus = 0;
+
+        contactMask |= (1UL << liftSlot);
+        frameCount++;
+
+        liftSlot = find_next_bit(&bits, RMI4_MAX_TOUCHES, liftSlot + 1);
     }
-    
-    UCHAR touchesToReport = ((fingerCache->FingerDownCount - keyTouchesReported) & 0xFF);
 
     //and report touches
-    while(touchesToReport>0)
+    for(touchesReported = 0; touchesReported < frameCount; touchesReported += fingersToReport)
     {
         fingersToReport = min(
-            touchesToReport,
-            SYNAPTICS_TOUCH_DIGITIZER_FINGER_REPORT_COUNT
+            frameCount - touchesReported,
+            contactsPerReport
         );
 
         PHID_INPUT_REPORT hidReport;
         status = GetNextHidReport(ControllerContext, &hidReport);
         if(!NT_SUCCESS(status))
         {
-            Trace(
-                TRACE_LEVEL_ERROR,
-                TRACE_FLAG_HID,
-                "can't get report queue slot [fillHidReport(touches)], status: %x",
-                status
-            );
+            TraceLoggingWrite(
+                TchTraceProvider,
+                "TouchReportSlotError",
+                TraceLoggingLevel(WINEVENT_LEVEL_ERROR),
+                TraceLoggingKeyword(TCH_TRACE_KEYWORD_REPORTING),
+                TraceLoggingNTStatus(status, "Status"));
+
+            //
+            // Never publish part of a frame. HIDClass keeps the state of
+            // the last queued frame, the tip mask is left as is so the
+            // next frame reports the transitions lost with this one.
+            //
+            ControllerContext->ReportQueue.Staged = stagedTouches;
             goto exit;
         }
         hidReport->ReportID = REPORTID_MTOUCH;
 
-        PHID_TOUCH_REPORT hidTouch = &(hidReport->TouchReport);
         //
-        // There are only 16-bits for ScanTime, truncate it
+        // Both formats share the contact layout and differ only in how
+        // many contacts precede the count and scan time
         //
-        hidTouch->InputReport.ScanTime = fingerCache->ScanTime & 0xFFFF;
+        HID_CONTACT_POINT* contacts;
+        UCHAR* actualCount;
+        USHORT* scanTime;
 
-        //
-        // Report the count
-        // We're sending touches using hybrid mode with 2 fingers in our
-        // report descriptor. The first report must indicate the
-        // total count of touch fingers detected by the digitizer.
-        // The remaining reports must indicate 0 for the count.
-        // The first report will have the TouchesReported integer set to 0
-        // The others will have it set to something else.
-        //
-        if(touchesReported == 0)
+        if(wideReports)
         {
-            hidTouch->InputReport.ActualCount = touchesToReport;
+            contacts = hidReport->WideTouchReport.InputReport.Contacts;
+            actualCount = &hidReport->WideTouchReport.InputReport.ActualCount;
+            scanTime = &hidReport->WideTouchReport.InputReport.ScanTime;
         }
         else
         {
-            hidTouch->InputReport.ActualCount = 0;
+            contacts = hidReport->TouchReport.InputReport.Contacts;
+            actualCount = &hidReport->TouchReport.InputReport.ActualCount;
+            scanTime = &hidReport->TouchReport.InputReport.ScanTime;
         }
 
         //
-        // Only two fingers supported yet
+        // There are only 16-bits for ScanTime, truncate it
         //
-        for(currentFingerIndex = 0; currentFingerIndex < fingersToReport; currentFingerIndex++)
-        {
-            //if this touch reported as key ignore it
-            if(fingerCache->IsKey[touchesReported])
-            {
-                touchesReported++;
-                currentFingerIndex--;
-                continue;
-            }
-
-            int currentlyReporting = fingerCache->FingerDownOrder[touchesReported];
-
-            hidTouch->InputReport.Contacts[currentFingerIndex].ContactId = (UCHAR)currentlyReporting;
-
-            SctatchX = (USHORT)fingerCache->FingerSlot[currentlyReporting].x;
-            ScratchY = (USHORT)fingerCache->FingerSlot[currentlyReporting].y;
-
-            //
-            // Perform per-platform x/y adjustments to controller coordinates
-            //
-            TchTranslateToDisplayCoordinates(
-                &SctatchX,
-                &ScratchY,
-                Props);
+        *scanTime = fingerCache->ScanTime & 0xFFFF;
 
-            hidTouch->InputReport.Contacts[currentFingerIndex].wXData = SctatchX;
-            hidTouch->InputReport.Contacts[currentFingerIndex].wYData = ScratchY;
-
-            if(fingerCache->FingerSlot[currentlyReporting].fingerStatus)
-            {
-                hidTouch->InputReport.Contacts[currentFingerIndex].bStatus = FINGER_STATUS;
-            }
+        //
+        // Report the count
+        // We're sending touches using hybrid mode when more fingers are
+        // down than fit in one report. The first report must indicate the
+        // total count of touch fingers detected by the digitizer.
+        // The remaining reports must indicate 0 for the count.
+        //
+        *actualCount = (touchesReported == 0) ? (UCHAR)frameCount : 0;
 
-            touchesReported++;
-            touchesToReport--;
+        RtlCopyMemory(
+            contacts,
+            &frame[touchesReported],
+            fingersToReport * sizeof(HID_CONTACT_POINT));
 
 #ifdef COORDS_DEBUG
+        for(i = 0; i < fingersToReport; i++)
+        {
             Trace(
                 TRACE_LEVEL_NOISE,
                 TRACE_FLAG_REPORTING,
                 "ActualCount %d, ContactId %u X %u Y %u Tip %u",
-                hidTouch->InputReport.ActualCount,
-                hidTouch->InputReport.Contacts[currentFingerIndex].ContactId,
-                hidTouch->InputReport.Contacts[currentFingerIndex].wXData,
-                hidTouch->InputReport.Contacts[currentFingerIndex].wYData,
-                hidTouch->InputReport.Contacts[currentFingerIndex].bStatus
+                *actualCount,
+                contacts[i].ContactId,
+                contacts[i].wXData,
+                contacts[i].wYData,
+                contacts[i].bStatus
             );
+        }
 #endif
+    }
+
+    //
+    // A touch-only frame moving the same contacts that were already down
+    // may be merged with the next one if HIDClass falls behind
+    //
+    if(stagedBefore == 0 &&
+        keyTouchesReported == 0 &&
+        contactMask != 0 &&
+        tipMask == contactMask &&
+        contactMask == ControllerContext->ReportedTipMask)
+    {
+        ControllerContext->ReportQueue.StagedKey = contactMask;
+    }
+
+    for(i = 0; i < frameCount; i++)
+    {
+        if(frame[i].bStatus != 0)
+        {
+            slot = frame[i].ContactId;
+
+            ControllerContext->ReportedContacts[slot].Sequence =
+                fingerCache->FingerSequence[slot];
+            ControllerContext->ReportedContacts[slot].X = frame[i].wXData;
+            ControllerContext->ReportedContacts[slot].Y = frame[i].wYData;
         }
+    }
+
+    ControllerContext->ReportedTipMask = tipMask;
 
+    if(deferred != 0)
+    {
+        status = STATUS_MORE_ENTRIES;
     }
 
 exit:
-    return;
+    return status;
 }
 
 NTSTATUS
-RmiServiceTouchDataInterrupt(
+RmiReportTouchesFromCache(
 	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
-	IN SPB_CONTEXT* SpbContext,
 	IN UCHAR InputMode
 )
 /*++
 
 Routine Description:
 
-	Called when a touch interrupt needs service. Because we fill HID reports
-	with two touches at a time, if more than two touches were read from
-	hardware, we may need to complete this request from local cached state.
+	Builds HID reports from the touches held in the local finger cache.
+	No bus access is performed.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	InputMode - Specifies mouse, single-touch, or multi-touch reporting modes
+
+Return Value:
+
+	NTSTATUS indicating whether or not HID reports were queued
+
+--*/
+{
+	NTSTATUS status;
+
+	status = STATUS_SUCCESS;
+
+	//
+	// Prepare to report touches via HID reports
+	//
+	ControllerContext->FingerCache.IsKeyMask = 0;
+
+	//
+	// If no touches are present return that no data needed to be reported,
+	// unless HIDClass still has to see contacts lifted
+	//
+	if (ControllerContext->FingerCache.FingerDownCount == 0 &&
+		ControllerContext->ReportedTipMask == 0)
+	{
+		status = STATUS_NO_DATA_DETECTED;
+		goto exit;
+	}
+
+	if (InputMode != MODE_MULTI_TOUCH &&
+		InputMode != MODE_SINGLE_TOUCH &&
+		InputMode != MODE_MOUSE)
+	{
+		status = STATUS_NOT_SUPPORTED;
+		goto exit;
+	}
+
+	//
+	// With a keep-alive interval configured, frames where no contact
+	// changed beyond the deadband are not reported at all
+	//
+	if (ControllerContext->Config.ContactKeepAliveInterval != 0 &&
+		RmiGetUnreportedLifts(
+			ControllerContext,
+			ControllerContext->FingerCache.FingerSlotValid |
+				ControllerContext->FingerCache.FingerSlotDirty) == 0 &&
+		!RmiFingerCacheHasChanged(
+			&ControllerContext->FingerCache,
+			ControllerContext->Config.ContactDeadband,
+			ControllerContext->Config.ContactKeepAliveInterval * 10ull))
+	{
+		status = STATUS_NO_DATA_DETECTED;
+		goto exit;
+	}
+
+	//
+	// Fill report with the cached touches
+	//
+	if (InputMode == MODE_MULTI_TOUCH)
+	{
+		status = RmiFillHidReportFromCache(
+			ControllerContext,
+			&ControllerContext->Props);
+	}
+	else
+	{
+		status = RmiFillSingleContactReportFromCache(
+			ControllerContext,
+			&ControllerContext->Props,
+			InputMode);
+	}
+
+	//
+	// A frame that could not be queued is not what HIDClass last received
+	//
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	RmiFingerCacheMarkReported(&ControllerContext->FingerCache);
+
+	//
+	// A contact left for the next frame must not be filtered out by the
+	// deadband then
+	//
+	if (status == STATUS_MORE_ENTRIES)
+	{
+		ControllerContext->FingerCache.ReportedMask = 0;
+		status = STATUS_SUCCESS;
+	}
+
+	if (ControllerContext->Latency.Build.Start != 0)
+	{
+		ControllerContext->Latency.Build.Ready = TchLatencyNow();
+	}
+
+exit:
+
+	return status;
+}
+
+NTSTATUS
+RmiServiceTouchDataInterrupt(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR InputMode
+)
+/*++
+
+Routine Description:
+
+	Called when a touch interrupt needs service. Because we fill HID reports
+	with two touches at a time, if more than two touches were read from
+	hardware, we may need to complete this request from local cached state.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current SPB context (I2C, etc)
+	HidReport- Buffer to fill with a hid report if touch data is available
+	InputMode - Specifies mouse, single-touch, or multi-touch reporting modes
+	PendingTouches - Notifies caller if there are more touches to report, to
+		complete reporting the full state of fingers on the screen
+
+Return Value:
+
+	NTSTATUS indicating whether or not the current hid report buffer was filled
+
+	PendingTouches also indicates whether the caller should expect more than
+		one request to be completed to indicate the full state of fingers on
+		the screen
+--*/
+{
+	NTSTATUS status;
+
+	//
+	// Read the next set of touches from hardware
+	//
+	status = RmiGetTouchesFromController(ControllerContext, SpbContext);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceLoggingWrite(
+			TchTraceProvider,
+			"TouchDataReadError",
+			TraceLoggingLevel(WINEVENT_LEVEL_ERROR),
+			TraceLoggingKeyword(TCH_TRACE_KEYWORD_INTERRUPT),
+			TraceLoggingNTStatus(status, "Status"));
+
+		TchCountEvent(
+			&ControllerContext->Counters,
+			SpbErrors[TchSpbSiteTouchData]);
+
+		goto exit;
+	}
+
+	if (ControllerContext->Latency.Acquire.Start != 0)
+	{
+		ControllerContext->Latency.Acquire.DataRead = TchLatencyNow();
+		ControllerContext->Latency.Build = ControllerContext->Latency.Acquire;
+	}
+
+	status = RmiReportTouchesFromCache(ControllerContext, InputMode);
+
+exit:
+
+	return status;
+}
+
+NTSTATUS
+RmiServiceTouchInterrupt(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR InputMode,
+	IN ULONG IrqMask
+)
+{
+	UNREFERENCED_PARAMETER(IrqMask);
+
+	return RmiServiceTouchDataInterrupt(
+		ControllerContext,
+		SpbContext,
+		InputMode);
+}
+
+NTSTATUS
+RmiServiceButtonInterrupt(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR InputMode,
+	IN ULONG IrqMask
+)
+{
+	UNREFERENCED_PARAMETER(InputMode);
+
+	//
+	// Parts wiring F$1A to the higher button bit report keys in the
+	// opposite order
+	//
+	return RmiServiceCapacitiveButtonInterrupt(
+		ControllerContext,
+		SpbContext,
+		(IrqMask & RMI4_INTERRUPT_BIT_0D_CAP_BUTTON_REVERSED) != 0);
+}
+
+VOID
+RmiBuildInterruptDispatch(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Maps the interrupt status bits of each function to the routine
+	servicing it. Functions without a handler (F$34, F$54) are left
+	unmapped and their interrupts are masked away when they fire. The
+	entries are put in servicing order by RmiPlanServiceOrder once the
+	read layout is known.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	PRMI4_INTERRUPT_HANDLER handlers[RMI4_FUNCTION_SLOT_COUNT] = { NULL };
+	RMI4_RESOLVED_FUNCTION* function;
+	RMI4_INTERRUPT_DISPATCH* dispatch;
+	int slot;
+
+	if (ControllerContext->Functions[RMI4_FUNCTION_SLOT_F12].Present)
+	{
+		handlers[RMI4_FUNCTION_SLOT_F12] = RmiServiceTouchInterrupt;
+	}
+	else
+	{
+		handlers[RMI4_FUNCTION_SLOT_F11] = RmiServiceTouchInterrupt;
+	}
+
+	handlers[RMI4_FUNCTION_SLOT_F1A] = RmiServiceButtonInterrupt;
+
+	RtlZeroMemory(
+		ControllerContext->ServiceOrder,
+		sizeof(ControllerContext->ServiceOrder));
+
+	ControllerContext->ServiceOrderCount = 0;
+	ControllerContext->InterruptServicedMask = 0;
+
+	for (slot = 0; slot < RMI4_FUNCTION_SLOT_COUNT; slot++)
+	{
+		function = &ControllerContext->Functions[slot];
+
+		if (!function->Present || handlers[slot] == NULL)
+		{
+			continue;
+		}
+
+		if (function->IrqMask == 0)
+		{
+			continue;
+		}
+
+		NT_ASSERT(ControllerContext->ServiceOrderCount < RMI4_INTERRUPT_HANDLER_COUNT);
+
+		dispatch = &ControllerContext->ServiceOrder[ControllerContext->ServiceOrderCount++];
+		dispatch->Handler = handlers[slot];
+		dispatch->IrqMask = function->IrqMask;
+		dispatch->Slot = slot;
+
+		ControllerContext->InterruptServicedMask |= function->IrqMask;
+	}
+
+	Trace(
+		TRACE_LEVEL_VERBOSE,
+		TRACE_FLAG_INIT,
+		"Servicing interrupt sources 0x%x",
+		ControllerContext->InterruptServicedMask);
+}
+
+static
+int
+RmiGetServicePage(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN int Slot
+)
+{
+	//
+	// F12 data fetched with the interrupt status needs no page of its own
+	//
+	if (Slot == RMI4_FUNCTION_SLOT_F12 && ControllerContext->BurstReadEnabled)
+	{
+		return ControllerContext->Functions[RMI4_FUNCTION_SLOT_F01].Page;
+	}
+
+	return ControllerContext->Functions[Slot].Page;
+}
+
+VOID
+RmiPlanServiceOrder(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Orders the functions serviced on each interrupt so that a frame
+	first completes all reads on the page the interrupt status was just
+	read from, then visits every other page once, in ascending order.
+	That keeps page select writes to one per page actually visited.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_INTERRUPT_DISPATCH entry;
+	int statusPage;
+	int pageA;
+	int pageB;
+	ULONG i;
+	ULONG j;
+
+	statusPage = ControllerContext->Functions[RMI4_FUNCTION_SLOT_F01].Page;
+
+	//
+	// Insertion sort, there are at most a handful of entries
+	//
+	for (i = 1; i < ControllerContext->ServiceOrderCount; i++)
+	{
+		entry = ControllerContext->ServiceOrder[i];
+		pageA = RmiGetServicePage(ControllerContext, entry.Slot);
+
+		for (j = i; j > 0; j--)
+		{
+			pageB = RmiGetServicePage(
+				ControllerContext,
+				ControllerContext->ServiceOrder[j - 1].Slot);
+
+			//
+			// The status page sorts first, then pages in ascending order
+			//
+			if (pageB == statusPage ||
+				(pageA != statusPage && pageB <= pageA))
+			{
+				break;
+			}
+
+			ControllerContext->ServiceOrder[j] = ControllerContext->ServiceOrder[j - 1];
+		}
+
+		ControllerContext->ServiceOrder[j] = entry;
+	}
+}
+
+VOID
+RmiPlanPipeline(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Decides if frames are captured raw and parsed later by the report
+	work item. That is only possible for F12 packets that fit a frame
+	slot, F11 reads depend on the parsed finger state.
+
+Arguments:
+
+	ControllerContext - Touch controller context, with its digitizer
+	  operations and packet size configured
+
+Return Value:
+
+	None.
+
+--*/
+{
+	ControllerContext->PipelineEnabled =
+		ControllerContext->Config.PipelinedReporting != 0 &&
+		ControllerContext->DigitizerOps->ParsePacket != NULL &&
+		ControllerContext->PacketSize <= RMI4_PIPELINE_FRAME_DATA_SIZE;
+}
+
+static
+VOID
+RmiSetScanTime(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN PTCH_SCAN_TIMESTAMP Timestamp
+)
+{
+	//
+	// HID scan time is in 100us units
+	//
+	ControllerContext->FingerCache.ScanTime = Timestamp->InterruptTime / 1000;
+	ControllerContext->FingerCache.ScanPerformanceCounter = Timestamp->PerformanceCounter;
+}
+
+static
+NTSTATUS
+RmiChainRegisterRead(
+	IN OUT PSPB_CHAIN Chain,
+	IN OUT int* Page,
+	IN int DesiredPage,
+	IN UCHAR Address,
+	IN PVOID Buffer,
+	IN ULONG Length,
+	OUT ULONG* Transfer
+)
+/*++
+
+Routine Description:
+
+	Appends a register read to a capture chain, preceded by a page
+	select if the chain leaves the controller on another page
+
+Arguments:
+
+	Chain - Capture chain
+	Page - Page the chain leaves the controller on, updated
+	DesiredPage - Page of the register
+	Address - Register address
+	Buffer - Receives the register data
+	Length - Length of the data
+	Transfer - Receives the index of the read in the chain
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	BYTE page;
+	NTSTATUS status;
+
+	if (*Page != DesiredPage)
+	{
+		page = (BYTE)DesiredPage;
+
+		status = SpbChainAddWrite(
+			Chain,
+			RMI4_PAGE_SELECT_ADDRESS,
+			&page,
+			sizeof(BYTE));
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+
+		*Page = DesiredPage;
+	}
+
+	*Transfer = Chain->Count;
+
+	status = SpbChainAddRead(Chain, Address, Buffer, Length);
+
+exit:
+	return status;
+}
+
+NTSTATUS
+RmiCaptureFrame(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Pipelined reporting, first stage. Acquires the raw register data for
+	the pending interrupt sources into the next free frame slot and
+	publishes it to the report work item. Nothing is parsed here.
+
+	The page selects and register reads of all sources are issued as a
+	single chain, back to back on the preformatted SPB request.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	STATUS_PENDING if a frame was published for the work item
+
+--*/
+{
+	RMI4_INTERRUPT_DISPATCH* dispatch;
+	RMI4_RESOLVED_FUNCTION* function;
+	RMI4_RAW_FRAME* frame;
+	PSPB_CHAIN chain;
+	ULONG buttonsRead;
+	ULONG buttonsMask;
+	ULONG touchRead;
+	ULONG touchMask;
+	LONG head;
+	BYTE* packet;
+	int page;
+	NTSTATUS status;
+	ULONG i;
+
+	head = ControllerContext->FrameHead;
+
+	//
+	// Drop the frame rather than stall the bus if the work item fell
+	// behind, F12 packets carry the full contact state anyway
+	//
+	if (head - ControllerContext->FrameTail >= RMI4_PIPELINE_DEPTH)
+	{
+		TchCountEvent(&ControllerContext->Counters, CapturedFramesDropped);
+
+		TraceLoggingWrite(
+			TchTraceProvider,
+			"CapturedFrameDropped",
+			TraceLoggingLevel(WINEVENT_LEVEL_WARNING),
+			TraceLoggingKeyword(TCH_TRACE_KEYWORD_INTERRUPT),
+			TraceLoggingInt32(
+				ControllerContext->Counters.CapturedFramesDropped,
+				"FramesDropped"));
+
+		status = STATUS_PENDING;
+		goto exit;
+	}
+
+	frame = &ControllerContext->Frames[head & (RMI4_PIPELINE_DEPTH - 1)];
+	frame->InterruptStatus = ControllerContext->InterruptStatus;
+	frame->Timestamp = ControllerContext->Timestamp;
+
+	chain = &ControllerContext->CaptureChain;
+	SpbChainInitialize(chain);
+
+	page = ControllerContext->CurrentPage;
+	buttonsRead = SPB_CHAIN_MAX_TRANSFERS;
+	buttonsMask = 0;
+	touchRead = SPB_CHAIN_MAX_TRANSFERS;
+	touchMask = 0;
+
+	//
+	// Plan the reads of the sources in page order, see
+	// RmiPlanServiceOrder
+	//
+	for (i = 0; i < ControllerContext->ServiceOrderCount; i++)
+	{
+		dispatch = &ControllerContext->ServiceOrder[i];
+
+		if (!(frame->InterruptStatus & dispatch->IrqMask))
+		{
+			continue;
+		}
+
+		function = &ControllerContext->Functions[dispatch->Slot];
+		status = STATUS_SUCCESS;
+
+		switch (dispatch->Slot)
+		{
+		case RMI4_FUNCTION_SLOT_F1A:
+			if (ControllerContext->HasButtons == FALSE)
+			{
+				status = STATUS_NOT_IMPLEMENTED;
+				break;
+			}
+
+			buttonsMask = dispatch->IrqMask;
+
+			status = RmiChainRegisterRead(
+				chain,
+				&page,
+				function->Page,
+				function->DataBase,
+				&frame->ButtonData,
+				sizeof(RMI4_F1A_DATA_REGISTERS),
+				&buttonsRead);
+			break;
+
+		case RMI4_FUNCTION_SLOT_F12:
+			touchMask = dispatch->IrqMask;
+
+			//
+			// The packet may already have been fetched together with
+			// the interrupt status
+			//
+			if (ControllerContext->BurstF12DataValid)
+			{
+				ControllerContext->BurstF12DataValid = FALSE;
+
+				packet = (BYTE*)WdfMemoryGetBuffer(
+					ControllerContext->BurstReadMemory,
+					NULL);
+
+				RtlCopyMemory(
+					frame->F12Packet,
+					packet + ControllerContext->BurstF12Offset,
+					ControllerContext->PacketSize);
+				break;
+			}
+
+			status = RmiChainRegisterRead(
+				chain,
+				&page,
+				function->Page,
+				function->DataBase,
+				frame->F12Packet,
+				(ULONG)ControllerContext->PacketSize,
+				&touchRead);
+			break;
+
+		default:
+			break;
+		}
+
+		if (!NT_SUCCESS(status))
+		{
+			frame->InterruptStatus &= ~dispatch->IrqMask;
+		}
+	}
+
+	if (chain->Count != 0)
+	{
+		status = SpbExecuteChainSynchronously(SpbContext, chain);
+
+		//
+		// The page is unknown if the chain stopped part way
+		//
+		ControllerContext->CurrentPage = NT_SUCCESS(status) ? page : -1;
+
+		if (!NT_SUCCESS(status))
+		{
+			TraceLoggingWrite(
+				TchTraceProvider,
+				"FrameReadError",
+				TraceLoggingLevel(WINEVENT_LEVEL_ERROR),
+				TraceLoggingKeyword(TCH_TRACE_KEYWORD_INTERRUPT),
+				TraceLoggingUInt32(chain->Completed, "TransfersDone"),
+				TraceLoggingUInt32(chain->Count, "Transfers"),
+				TraceLoggingNTStatus(status, "Status"));
+		}
+
+		if (buttonsRead != SPB_CHAIN_MAX_TRANSFERS &&
+			buttonsRead >= chain->Completed)
+		{
+			TchCountEvent(
+				&ControllerContext->Counters,
+				SpbErrors[TchSpbSiteButtons]);
+
+			frame->InterruptStatus &= ~buttonsMask;
+		}
+
+		if (touchRead != SPB_CHAIN_MAX_TRANSFERS &&
+			touchRead >= chain->Completed)
+		{
+			TchCountEvent(
+				&ControllerContext->Counters,
+				SpbErrors[TchSpbSiteTouchData]);
+
+			frame->InterruptStatus &= ~touchMask;
+		}
+	}
+
+	if (frame->InterruptStatus & touchMask)
+	{
+		RmiTapWrite(
+			ControllerContext,
+			TCH_TAP_SOURCE_F12,
+			frame->Timestamp.InterruptTime,
+			frame->F12Packet,
+			(ULONG)ControllerContext->PacketSize);
+
+		if (ControllerContext->Latency.Acquire.Start != 0)
+		{
+			ControllerContext->Latency.Acquire.DataRead = TchLatencyNow();
+		}
+	}
+
+	frame->Latency = ControllerContext->Latency.Acquire;
+
+	//
+	// Publish the frame once its contents are in place
+	//
+	InterlockedExchange(&ControllerContext->FrameHead, head + 1);
+
+	status = STATUS_PENDING;
+
+exit:
+	ControllerContext->InterruptStatus = 0;
+
+	return status;
+}
+
+NTSTATUS
+TchServiceCapturedFrame(
+	IN VOID* ControllerContext,
+	IN UCHAR InputMode
+)
+/*++
+
+Routine Description:
+
+	Pipelined reporting, second stage. Called from the report work item
+	to parse the oldest captured frame, translate its contacts and queue
+	the HID reports for it, while the interrupt routine is free to
+	acquire the next frame from the bus.
 
 Arguments:
 
 	ControllerContext - Touch controller context
-	SpbContext - A pointer to the current SPB context (I2C, etc)
-	HidReport- Buffer to fill with a hid report if touch data is available
 	InputMode - Specifies mouse, single-touch, or multi-touch reporting modes
-	PendingTouches - Notifies caller if there are more touches to report, to
-		complete reporting the full state of fingers on the screen
 
 Return Value:
 
-	NTSTATUS indicating whether or not the current hid report buffer was filled
+	STATUS_NO_MORE_ENTRIES once all captured frames have been consumed,
+	otherwise NTSTATUS indicating whether reports were built
 
-	PendingTouches also indicates whether the caller should expect more than
-		one request to be completed to indicate the full state of fingers on
-		the screen
 --*/
 {
+	RMI4_CONTROLLER_CONTEXT* controller;
+	RMI4_RAW_FRAME* frame;
+	NTSTATUS handlerStatus;
 	NTSTATUS status;
+	LONG tail;
 
-	status = STATUS_SUCCESS;
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
 
-	//
-	// If no touches are unreported in our cache, read the next set of touches
-	// from hardware.
-	//
-	//if (ControllerContext->TouchesReported == ControllerContext->TouchesTotal)
-	//{
-		RmiGetTouchesFromController(ControllerContext, SpbContext);
+	WdfWaitLockAcquire(controller->ReportLock, NULL);
 
-		if (!NT_SUCCESS(status))
-		{
-			Trace(
-				TRACE_LEVEL_ERROR,
-				TRACE_FLAG_SAMPLES,
-				"Error. Can't GetTouches from controller - STATUS %x",
-				status
-			);
+	tail = controller->FrameTail;
 
-			goto exit;
-		}
+	if (tail == controller->FrameHead)
+	{
+		status = STATUS_NO_MORE_ENTRIES;
+		goto exit;
+	}
 
-		//
-		// Prepare to report touches via HID reports
-		//
-        for(int i = 0; i < RMI4_MAX_TOUCHES; i++)
-            ControllerContext->FingerCache.IsKey[i] = FALSE;
+	KeMemoryBarrier();
 
-		//
-		// If no touches are present return that no data needed to be reported
-		//
-		if (ControllerContext->FingerCache.FingerDownCount == 0)
+	frame = &controller->Frames[tail & (RMI4_PIPELINE_DEPTH - 1)];
+	status = STATUS_UNSUCCESSFUL;
+
+	RmiSetScanTime(controller, &frame->Timestamp);
+
+	if (frame->InterruptStatus &
+		controller->Functions[RMI4_FUNCTION_SLOT_F1A].IrqMask)
+	{
+		handlerStatus = RmiReportCapacitiveButtons(
+			controller,
+			&frame->ButtonData,
+			(controller->Functions[RMI4_FUNCTION_SLOT_F1A].IrqMask &
+				RMI4_INTERRUPT_BIT_0D_CAP_BUTTON_REVERSED) != 0);
+
+		if (NT_SUCCESS(handlerStatus) || !NT_SUCCESS(status))
 		{
-			status = STATUS_NO_DATA_DETECTED;
-			goto exit;
+			status = handlerStatus;
 		}
-	//}
+	}
 
-	//
-	// Single-finger and HID-mouse input modes not implemented
-	//
-	if (MODE_MULTI_TOUCH != InputMode)
+	if (frame->InterruptStatus &
+		controller->Functions[RMI4_FUNCTION_SLOT_F12].IrqMask)
 	{
-		Trace(
-			TRACE_LEVEL_WARNING,
-			TRACE_FLAG_SAMPLES,
-			"Unable to report touches, only multitouch mode is supported");
+		controller->DigitizerOps->ParsePacket(controller, frame->F12Packet);
+		controller->Latency.Build = frame->Latency;
 
-		status = STATUS_NOT_IMPLEMENTED;
-		goto exit;
+		handlerStatus = RmiReportTouchesFromCache(controller, InputMode);
+
+		if (NT_SUCCESS(handlerStatus) || !NT_SUCCESS(status))
+		{
+			status = handlerStatus;
+		}
 	}
 
 	//
-	// Fill report with the next (max of two) cached touches
+	// Hand the slot back to the interrupt routine
 	//
-    RmiFillHidReportFromCache(
-        ControllerContext,
-        &ControllerContext->Props
-    );
+	InterlockedExchange(&controller->FrameTail, tail + 1);
+
+	RmiPublishHidReports(controller);
 
 	//
-	// Update the caller if we still have outstanding touches to report
+	// Turn on capacitive key backlights that may have timed out
+	// due to user inactivity
 	//
+	if (NT_SUCCESS(status) && (controller->BklContext != NULL))
+	{
+		TchBklNotifyTouchActivity(controller->BklContext, (DWORD)GetTickCount());
+	}
 
 exit:
+	WdfWaitLockRelease(controller->ReportLock);
 
 	return status;
 }
@@ -338,8 +1452,7 @@ TchServiceInterrupts(
 	IN VOID* ControllerContext,
 	IN SPB_CONTEXT* SpbContext,
 	IN UCHAR InputMode,
-    IN PHID_INPUT_REPORT* HidReports,
-    IN int* HidReportsLength
+	IN PTCH_SCAN_TIMESTAMP Timestamp
 )
 /*++
 
@@ -347,36 +1460,60 @@ Routine Description:
 
 	This routine is called in response to an interrupt. The driver will
 	service chip interrupts, and if data is available to report to HID,
-	fill the Request object buffer with a HID report.
+	queue HID reports to be completed to HIDClass read requests.
 
 Arguments:
 
 	ControllerContext - Touch controller context
 	SpbContext - A pointer to the current i2c context
-	HidReport - Pointer to a HID_INPUT_REPORT structure to report to the OS
 	InputMode - Specifies mouse, single-touch, or multi-touch reporting modes
-	ServicingComplete - Notifies caller if there are more reports needed to
-		complete servicing interrupts coming from the hardware.
+	Timestamp - Time the interrupt was taken
 
 Return Value:
 
-	NTSTATUS indicating whether or not the current HidReport has been filled
-
-	ServicingComplete indicates whether or not a new report buffer is required
-		to complete interrupt processing.
+	NTSTATUS indicating whether or not HID reports were queued, or
+	STATUS_PENDING if a frame was captured for the report work item
 --*/
 {
 	NTSTATUS status = STATUS_NO_DATA_DETECTED;
+	NTSTATUS handlerStatus;
 	RMI4_CONTROLLER_CONTEXT* controller;
+	RMI4_INTERRUPT_DISPATCH* dispatch;
+	ULONG i;
+	LONG64 entryTime;
 
 	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
 
+	//
+	// Frames are stamped for the latency statistics, or for the frame
+	// events while a trace session is listening
+	//
+	entryTime = (controller->Latency.Enabled || TchTraceFramesEnabled()) ?
+		(LONG64)Timestamp->PerformanceCounter : 0;
+
 	//
 	// Grab a waitlock to ensure the ISR executes serially and is 
 	// protected against power state transitions
 	//
 	WdfWaitLockAcquire(controller->ControllerLock, NULL);
 
+	TchCountEvent(&controller->Counters, InterruptsServiced);
+
+	controller->Timestamp = *Timestamp;
+
+	RtlZeroMemory(&controller->Latency.Acquire, sizeof(TCH_LATENCY_STAMPS));
+	controller->Latency.Acquire.Start = entryTime;
+
+	//
+	// While flashing, interrupts only tell the flash engine that the
+	// controller completed a command
+	//
+	if (controller->F34Flash.Active)
+	{
+		RmiF34ServiceAttention(controller, SpbContext);
+		goto exit;
+	}
+
 	//
 	// Check the interrupt source if no interrupts are pending processing
 	//
@@ -389,38 +1526,70 @@ Return Value:
 
 		if (!NT_SUCCESS(status))
 		{
-			Trace(
-				TRACE_LEVEL_ERROR,
-				TRACE_FLAG_INTERRUPT,
-				"Error servicing interrupts - STATUS:%X",
-				status);
+			TraceLoggingWrite(
+				TchTraceProvider,
+				"InterruptStatusError",
+				TraceLoggingLevel(WINEVENT_LEVEL_ERROR),
+				TraceLoggingKeyword(TCH_TRACE_KEYWORD_INTERRUPT),
+				TraceLoggingNTStatus(status, "Status"));
+
+			RmiStormCheck(controller, SpbContext, TRUE);
 
 			goto exit;
 		}
+
+		if (controller->Latency.Acquire.Start != 0)
+		{
+			controller->Latency.Acquire.InterruptStatus = TchLatencyNow();
+		}
+	}
+
+	//
+	// A controller interrupting faster than it can sensibly report is
+	// masked, its interrupts are only acknowledged until it recovers
+	//
+	if (RmiStormCheck(controller, SpbContext, controller->InterruptStatus == 0))
+	{
+		controller->InterruptStatus = 0;
+		status = STATUS_NO_DATA_DETECTED;
+		goto exit;
 	}
 
 	//
-	// Driver only services 0D cap button and 2D touch messages currently
+	// Driver only services interrupt sources with a handler in the
+	// dispatch table
 	//
-	if (controller->InterruptStatus &
-		~(RMI4_INTERRUPT_BIT_0D_CAP_BUTTON | RMI4_INTERRUPT_BIT_0D_CAP_BUTTON_REVERSED | RMI4_INTERRUPT_BIT_2D_TOUCH))
+	if (controller->InterruptStatus & ~controller->InterruptServicedMask)
 	{
-		Trace(
-			TRACE_LEVEL_WARNING,
-			TRACE_FLAG_INTERRUPT,
-			"Ignoring following interrupt flags - STATUS:%X",
-			controller->InterruptStatus &
-			~(RMI4_INTERRUPT_BIT_0D_CAP_BUTTON | 
-				RMI4_INTERRUPT_BIT_0D_CAP_BUTTON_REVERSED |
-				RMI4_INTERRUPT_BIT_2D_TOUCH));
+		TraceLoggingWrite(
+			TchTraceProvider,
+			"InterruptSourcesIgnored",
+			TraceLoggingLevel(WINEVENT_LEVEL_WARNING),
+			TraceLoggingKeyword(TCH_TRACE_KEYWORD_INTERRUPT),
+			TraceLoggingHexInt32(
+				controller->InterruptStatus & ~controller->InterruptServicedMask,
+				"IgnoredMask"));
 
 		//
 		// Mask away flags we don't service
 		//
-		controller->InterruptStatus &=
-			(RMI4_INTERRUPT_BIT_0D_CAP_BUTTON |
-				RMI4_INTERRUPT_BIT_0D_CAP_BUTTON_REVERSED |
-				RMI4_INTERRUPT_BIT_2D_TOUCH);
+		controller->InterruptStatus &= controller->InterruptServicedMask;
+	}
+
+	//
+	// With pipelined reporting only the raw data is acquired here, the
+	// report work item builds and completes the reports
+	//
+	if (controller->PipelineEnabled)
+	{
+		status = STATUS_UNSUCCESSFUL;
+
+		if (controller->InterruptStatus != 0)
+		{
+			status = RmiCaptureFrame(controller, SpbContext);
+		}
+
+		goto exit;
 	}
 
 	//
@@ -429,81 +1598,61 @@ Return Value:
 	//
 	status = STATUS_UNSUCCESSFUL;
 
-    BOOLEAN reversedKeys = FALSE;
+	WdfWaitLockAcquire(controller->ReportLock, NULL);
+
+	RmiSetScanTime(controller, &controller->Timestamp);
+
 	//
-	// Service a capacitive button event if indicated by hardware
+	// Service each function with a pending interrupt in page order, so
+	// the page select register is written at most once per page. A
+	// function owning several bits is only serviced once
 	//
-	if (controller->InterruptStatus & RMI4_INTERRUPT_BIT_0D_CAP_BUTTON || 
-		controller->InterruptStatus & RMI4_INTERRUPT_BIT_0D_CAP_BUTTON_REVERSED)
+	for (i = 0; i < controller->ServiceOrderCount; i++)
 	{
+		dispatch = &controller->ServiceOrder[i];
 
-		if (controller->InterruptStatus & RMI4_INTERRUPT_BIT_0D_CAP_BUTTON_REVERSED)
+		if (!(controller->InterruptStatus & dispatch->IrqMask))
 		{
-			reversedKeys = TRUE;
+			continue;
 		}
 
-		status = RmiServiceCapacitiveButtonInterrupt(
-			ControllerContext,
+		handlerStatus = dispatch->Handler(
+			controller,
 			SpbContext,
-			reversedKeys);
+			InputMode,
+			dispatch->IrqMask);
 
 		//
-		// mask cap buttons interupts after service
+		// clear interupt
 		//
-		controller->InterruptStatus &= ~RMI4_INTERRUPT_BIT_0D_CAP_BUTTON;
-		controller->InterruptStatus &= ~RMI4_INTERRUPT_BIT_0D_CAP_BUTTON_REVERSED;
+		controller->InterruptStatus &= ~dispatch->IrqMask;
 
-        //
-        //report if status unsuccess
 		//
-		if (!NT_SUCCESS(status))
+		// Report success if any source produced data
+		//
+		if (NT_SUCCESS(handlerStatus) || !NT_SUCCESS(status))
 		{
-			Trace(
-				TRACE_LEVEL_ERROR,
-				TRACE_FLAG_INTERRUPT,
-				"Error processing cap button event - STATUS:%X",
-				status);
+			status = handlerStatus;
 		}
-	}
-
-	//
-	// Service a touch data event if indicated by hardware 
-	//
-	if (controller->InterruptStatus & RMI4_INTERRUPT_BIT_2D_TOUCH)
-	{
-
-		status = RmiServiceTouchDataInterrupt(
-			ControllerContext,
-			SpbContext,
-			InputMode);
-
-		//
-		// clear interupt
-		//
-		controller->InterruptStatus &= ~RMI4_INTERRUPT_BIT_2D_TOUCH;
 
 		//
 		// report error
 		//
-		if (!NT_SUCCESS(status))
+		if (!NT_SUCCESS(handlerStatus))
 		{
-			Trace(
-				TRACE_LEVEL_ERROR,
-				TRACE_FLAG_INTERRUPT,
-				"Error processing touch event - STATUS:%X",
-				status);
+			TraceLoggingWrite(
+				TchTraceProvider,
+				"InterruptHandlerError",
+				TraceLoggingLevel(WINEVENT_LEVEL_ERROR),
+				TraceLoggingKeyword(TCH_TRACE_KEYWORD_INTERRUPT),
+				TraceLoggingHexInt32(dispatch->IrqMask, "IrqMask"),
+				TraceLoggingNTStatus(handlerStatus, "Status"));
 		}
 	}
 
-	//
-	// Add servicing for additional touch interrupts here
-	//
+	RmiPublishHidReports(controller);
 
-exit:
-    
-    *HidReports = controller->HidQueue;
-    (*HidReportsLength) = controller->HidQueueCount;
-    controller->HidQueueCount = 0;
+	WdfWaitLockRelease(controller->ReportLock);
 
 	//
 	// Turn on capacitive key backlights that may have timed out
@@ -514,28 +1663,356 @@ exit:
 		TchBklNotifyTouchActivity(controller->BklContext, (DWORD)GetTickCount());
 	}
 
+exit:
+	//
+	// A diagnostic F54 capture advances by one bounded step per frame
+	//
+	RmiF54StreamStep(controller, SpbContext);
+
 	WdfWaitLockRelease(controller->ControllerLock);
 
+	RmiStormThrottle(controller);
+
 	return status;
 }
 
 
+static
+BOOLEAN
+RmiEvictMoveOnlyFrame(
+    IN PHID_REPORT_QUEUE Queue
+)
+/*++
+
+Routine Description:
+
+	Discards the oldest queued frame that only moves contacts already
+	down, moving the older reports up over it. Frames carrying a tip
+	transition and a frame HIDClass has started reading are left alone.
+	The caller must hold the report lock and the consumer lock.
+
+Arguments:
+
+	Queue - The report queue
+
+Return Value:
+
+	TRUE if a frame was discarded
+
+--*/
+{
+    LONG first;
+    LONG reports;
+    LONG index;
+    LONG from;
+    LONG to;
+
+    reports = 0;
+
+    for(first = Queue->Tail; first - Queue->Head < 0; first += max(reports, 1))
+    {
+        reports = Queue->FrameReports[first & (HID_REPORT_QUEUE_DEPTH - 1)];
+
+        //
+        // Reports of a frame already partly delivered have no count
+        //
+        if(reports != 0 &&
+            Queue->FrameKey[first & (HID_REPORT_QUEUE_DEPTH - 1)] != 0)
+        {
+            break;
+        }
+    }
+
+    if(first - Queue->Head >= 0)
+    {
+        return FALSE;
+    }
+
+    for(index = first - 1; index - Queue->Tail >= 0; index--)
+    {
+        from = index & (HID_REPORT_QUEUE_DEPTH - 1);
+        to = (index + reports) & (HID_REPORT_QUEUE_DEPTH - 1);
+
+        Queue->Reports[to] = Queue->Reports[from];
+        Queue->FrameStart[to] = Queue->FrameStart[from];
+        Queue->ReadyTime[to] = Queue->ReadyTime[from];
+        Queue->FrameReports[to] = Queue->FrameReports[from];
+        Queue->FrameKey[to] = Queue->FrameKey[from];
+    }
+
+    //
+    // The newest frame may no longer be replaced once it is gone
+    //
+    if(first == Queue->LastStart)
+    {
+        Queue->LastKey = 0;
+    }
+
+    InterlockedExchangeAdd(&Queue->Tail, reports);
+    InterlockedExchangeAdd(&Queue->Counters->ReportsDropped, reports);
+
+    return TRUE;
+}
+
 NTSTATUS
 GetNextHidReport(
     IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
     IN PHID_INPUT_REPORT* HidReport
 )
+/*++
+
+Routine Description:
+
+	Stages the next HID report slot in the report queue. The caller must
+	hold the report lock, and the report is only handed to HIDClass once
+	RmiPublishHidReports is called.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	HidReport - Receives the zeroed report slot to fill
+
+Return Value:
+
+	NTSTATUS indicating whether a report slot was available
+
+--*/
 {
-    if(ControllerContext->HidQueueCount < MAX_REPORTS_IN_QUEUE)
+    PHID_REPORT_QUEUE queue = &ControllerContext->ReportQueue;
+    LONG slot;
+
+    //
+    // Whatever gets staged now is no longer a single move-only frame
+    //
+    queue->StagedKey = 0;
+
+    if(queue->Staged >= HID_REPORT_QUEUE_DEPTH)
     {
-        *HidReport = &(ControllerContext->HidQueue[ControllerContext->HidQueueCount]);
-        ControllerContext->HidQueueCount++;
-        RtlZeroMemory(*HidReport, sizeof(HID_INPUT_REPORT));
+        TchCountEvent(queue->Counters, ReportQueueOverflows);
+        return STATUS_NO_MEMORY;
     }
-    else
+
+    slot = queue->Head + queue->Staged;
+
+    //
+    // Make room if HIDClass fell behind, only frames that merely move
+    // contacts can be discarded
+    //
+    if(slot - queue->Tail >= HID_REPORT_QUEUE_DEPTH)
     {
-        return STATUS_NO_MEMORY;
+        BOOLEAN evicted = TRUE;
+
+        WdfSpinLockAcquire(queue->ConsumerLock);
+
+        if(slot - queue->Tail >= HID_REPORT_QUEUE_DEPTH)
+        {
+            evicted = RmiEvictMoveOnlyFrame(queue);
+        }
+
+        WdfSpinLockRelease(queue->ConsumerLock);
+
+        TraceLoggingWrite(
+            TchTraceProvider,
+            "ReportQueueOverflow",
+            TraceLoggingLevel(WINEVENT_LEVEL_WARNING),
+            TraceLoggingKeyword(TCH_TRACE_KEYWORD_REPORTING),
+            TraceLoggingBoolean(evicted, "Evicted"),
+            TraceLoggingInt32(queue->Counters->ReportsDropped, "ReportsDropped"));
+
+        if(!evicted)
+        {
+            TchCountEvent(queue->Counters, ReportQueueOverflows);
+            return STATUS_NO_MEMORY;
+        }
     }
 
+    *HidReport = &queue->Reports[slot & (HID_REPORT_QUEUE_DEPTH - 1)];
+    queue->Staged++;
+    RtlZeroMemory(*HidReport, sizeof(HID_INPUT_REPORT));
+
+#ifdef _TIMESTAMP_
+    //
+    // Performance counter value of the interrupt the report stems from
+    //
+    (*HidReport)->TimeStamp.QuadPart =
+        (LONGLONG)ControllerContext->FingerCache.ScanPerformanceCounter;
+#endif
+
     return STATUS_SUCCESS;
-}
\ No newline at end of file
+}
+
+static
+VOID
+RmiTraceFrame(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN LONG Reports,
+	IN BOOLEAN Coalesced
+)
+{
+	PHID_REPORT_QUEUE queue = &ControllerContext->ReportQueue;
+	PTCH_LATENCY_STAMPS stamps = &ControllerContext->Latency.Build;
+	LONG64 frequency = ControllerContext->Latency.Frequency;
+
+	TraceLoggingWrite(
+		TchTraceProvider,
+		"TouchFrame",
+		TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+		TraceLoggingKeyword(TCH_TRACE_KEYWORD_FRAME),
+		TraceLoggingUInt32(ControllerContext->FrameId, "FrameId"),
+		TraceLoggingInt32(ControllerContext->FingerCache.FingerDownCount, "ContactCount"),
+		TraceLoggingInt32(Reports, "Reports"),
+		TraceLoggingBoolean(Coalesced, "Coalesced"),
+		TraceLoggingUInt32(
+			TchTraceTicksToUs(frequency, stamps->Start, stamps->InterruptStatus),
+			"InterruptStatusUs"),
+		TraceLoggingUInt32(
+			TchTraceTicksToUs(frequency, stamps->Start, stamps->DataRead),
+			"DataReadUs"),
+		TraceLoggingUInt32(
+			TchTraceTicksToUs(frequency, stamps->DataRead, stamps->Ready),
+			"ReportBuildUs"),
+		TraceLoggingInt32(queue->Counters->ReportsDropped, "ReportsDropped"),
+		TraceLoggingInt32(queue->Counters->ReportsCoalesced, "ReportsCoalesced"),
+		TraceLoggingInt32(
+			ControllerContext->Counters.CapturedFramesDropped,
+			"FramesDropped"));
+}
+
+static
+VOID
+RmiStampStagedReports(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN LONG First
+)
+{
+	PHID_REPORT_QUEUE queue = &ControllerContext->ReportQueue;
+	LONG i;
+	LONG slot;
+
+	for (i = 0; i < queue->Staged; i++)
+	{
+		slot = (First + i) & (HID_REPORT_QUEUE_DEPTH - 1);
+
+		queue->FrameStart[slot] = ControllerContext->Latency.Build.Start;
+		queue->ReadyTime[slot] = ControllerContext->Latency.Build.Ready;
+	}
+}
+
+VOID
+RmiPublishHidReports(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Makes the reports staged with GetNextHidReport visible to the
+	consumer. The caller must hold the report lock.
+
+	A move-only frame replaces the newest published frame in place when
+	that frame reports the same contacts and HIDClass has not started
+	reading it yet.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	PHID_REPORT_QUEUE queue = &ControllerContext->ReportQueue;
+	BOOLEAN coalesced;
+	LONG i;
+
+	if (queue->Staged == 0)
+	{
+		goto exit;
+	}
+
+	coalesced = FALSE;
+
+	if (queue->StagedKey != 0 &&
+		queue->StagedKey == queue->LastKey &&
+		queue->Staged == queue->LastLength &&
+		queue->LastStart + queue->LastLength == queue->Head)
+	{
+		WdfSpinLockAcquire(queue->ConsumerLock);
+
+		if (queue->LastStart - queue->Tail >= 0)
+		{
+			for (i = 0; i < queue->Staged; i++)
+			{
+				RtlCopyMemory(
+					&queue->Reports[(queue->LastStart + i) & (HID_REPORT_QUEUE_DEPTH - 1)],
+					&queue->Reports[(queue->Head + i) & (HID_REPORT_QUEUE_DEPTH - 1)],
+					sizeof(HID_INPUT_REPORT));
+			}
+
+			if (queue->Latency != NULL)
+			{
+				RmiStampStagedReports(ControllerContext, queue->LastStart);
+			}
+
+			TchCountEvent(queue->Counters, ReportsCoalesced);
+			coalesced = TRUE;
+		}
+
+		WdfSpinLockRelease(queue->ConsumerLock);
+	}
+
+	if (!coalesced)
+	{
+		queue->LastStart = queue->Head;
+		queue->LastLength = queue->Staged;
+		queue->LastKey = queue->StagedKey;
+
+		for (i = 0; i < queue->Staged; i++)
+		{
+			queue->FrameReports[(queue->Head + i) & (HID_REPORT_QUEUE_DEPTH - 1)] =
+				(i == 0) ? queue->Staged : 0;
+			queue->FrameKey[(queue->Head + i) & (HID_REPORT_QUEUE_DEPTH - 1)] =
+				(i == 0) ? queue->StagedKey : 0;
+		}
+
+		if (queue->Latency != NULL)
+		{
+			RmiStampStagedReports(ControllerContext, queue->Head);
+		}
+
+		InterlockedExchange(&queue->Head, queue->Head + queue->Staged);
+	}
+
+	ControllerContext->FrameId++;
+	InterlockedExchangeAdd(&queue->Counters->ReportsGenerated, queue->Staged);
+
+	if (TchTraceFramesEnabled())
+	{
+		RmiTraceFrame(ControllerContext, queue->Staged, coalesced);
+	}
+
+	queue->Staged = 0;
+	queue->StagedKey = 0;
+
+	//
+	// Only frames that built touch reports are accounted for
+	//
+	if (queue->Latency != NULL && ControllerContext->Latency.Build.Ready != 0)
+	{
+		TchLatencyRecordFrame(queue->Latency, &ControllerContext->Latency.Build);
+	}
+
+exit:
+	RtlZeroMemory(&ControllerContext->Latency.Build, sizeof(TCH_LATENCY_STAMPS));
+	return;
+}
+
+PHID_REPORT_QUEUE
+TchGetReportQueue(
+	IN VOID* ControllerContext
+)
+{
+	return &((RMI4_CONTROLLER_CONTEXT*)ControllerContext)->ReportQueue;
+}
@@ -23,6 +23,7 @@
 #include "rmiinternal.h"
 #include "config.h"
 #include "debug.h"
+#include "simd.h"
 //#include "resolutions.tmh"
 
 //
@@ -34,7 +35,7 @@
 // aligned.
 //
 
-TOUCH_SCREEN_PROPERTIES gDefaultProperties =
+static const TOUCH_SCREEN_PROPERTIES gDefaultProperties =
 {
 	0,
 	0,
@@ -62,14 +63,14 @@ TOUCH_SCREEN_PROPERTIES gDefaultProperties =
 };
 
 
-RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
+static const RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 {
 	{
 		NULL, RTL_QUERY_REGISTRY_DIRECT,
 		L"TouchSwapAxes",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, TouchSwapAxes),
 		REG_DWORD,
-		&gDefaultProperties.TouchSwapAxes,
+		(PVOID)&gDefaultProperties.TouchSwapAxes,
 		sizeof(ULONG)
 	},
 	{
@@ -77,7 +78,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"TouchInvertXAxis",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, TouchInvertXAxis),
 		REG_DWORD,
-		&gDefaultProperties.TouchInvertXAxis,
+		(PVOID)&gDefaultProperties.TouchInvertXAxis,
 		sizeof(ULONG)
 	},
 	{
@@ -85,7 +86,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"TouchInvertYAxis",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, TouchInvertYAxis),
 		REG_DWORD,
-		&gDefaultProperties.TouchInvertYAxis,
+		(PVOID)&gDefaultProperties.TouchInvertYAxis,
 		sizeof(ULONG)
 	},
 	{
@@ -93,7 +94,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"TouchPhysicalWidth",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, TouchPhysicalWidth),
 		REG_DWORD,
-		&gDefaultProperties.TouchPhysicalWidth,
+		(PVOID)&gDefaultProperties.TouchPhysicalWidth,
 		sizeof(ULONG)
 	},
 	{
@@ -101,7 +102,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"TouchPhysicalHeight",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, TouchPhysicalHeight),
 		REG_DWORD,
-		&gDefaultProperties.TouchPhysicalHeight,
+		(PVOID)&gDefaultProperties.TouchPhysicalHeight,
 		sizeof(ULONG)
 	},
 	{
@@ -109,7 +110,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"TouchPhysicalButtonHeight",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, TouchPhysicalButtonHeight),
 		REG_DWORD,
-		&gDefaultProperties.TouchPhysicalButtonHeight,
+		(PVOID)&gDefaultProperties.TouchPhysicalButtonHeight,
 		sizeof(ULONG)
 	},
 	{
@@ -117,7 +118,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"TouchPillarBoxWidthLeft",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, TouchPillarBoxWidthLeft),
 		REG_DWORD,
-		&gDefaultProperties.TouchPillarBoxWidthLeft,
+		(PVOID)&gDefaultProperties.TouchPillarBoxWidthLeft,
 		sizeof(ULONG)
 	},
 	{
@@ -125,7 +126,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"TouchPillarBoxWidthRight",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, TouchPillarBoxWidthRight),
 		REG_DWORD,
-		&gDefaultProperties.TouchPillarBoxWidthRight,
+		(PVOID)&gDefaultProperties.TouchPillarBoxWidthRight,
 		sizeof(ULONG)
 	},
 	{
@@ -133,7 +134,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"TouchLetterBoxHeightTop",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, TouchLetterBoxHeightTop),
 		REG_DWORD,
-		&gDefaultProperties.TouchLetterBoxHeightTop,
+		(PVOID)&gDefaultProperties.TouchLetterBoxHeightTop,
 		sizeof(ULONG)
 	},
 	{
@@ -141,7 +142,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"TouchLetterBoxHeightBottom",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, TouchLetterBoxHeightBottom),
 		REG_DWORD,
-		&gDefaultProperties.TouchLetterBoxHeightBottom,
+		(PVOID)&gDefaultProperties.TouchLetterBoxHeightBottom,
 		sizeof(ULONG)
 	},
 	{
@@ -149,7 +150,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"DisplayPhysicalWidth",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, DisplayPhysicalWidth),
 		REG_DWORD,
-		&gDefaultProperties.DisplayPhysicalWidth,
+		(PVOID)&gDefaultProperties.DisplayPhysicalWidth,
 		sizeof(ULONG)
 	},
 	{
@@ -157,7 +158,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"DisplayPhysicalHeight",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, DisplayPhysicalHeight),
 		REG_DWORD,
-		&gDefaultProperties.DisplayPhysicalHeight,
+		(PVOID)&gDefaultProperties.DisplayPhysicalHeight,
 		sizeof(ULONG)
 	},
 	{
@@ -165,7 +166,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"DisplayViewableWidth",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, DisplayViewableWidth),
 		REG_DWORD,
-		&gDefaultProperties.DisplayViewableWidth,
+		(PVOID)&gDefaultProperties.DisplayViewableWidth,
 		sizeof(ULONG)
 	},
 	{
@@ -173,7 +174,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"DisplayViewableHeight",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, DisplayViewableHeight),
 		REG_DWORD,
-		&gDefaultProperties.DisplayViewableHeight,
+		(PVOID)&gDefaultProperties.DisplayViewableHeight,
 		sizeof(ULONG)
 	},
 	{
@@ -181,7 +182,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"DisplayPillarBoxWidthLeft",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, DisplayPillarBoxWidthLeft),
 		REG_DWORD,
-		&gDefaultProperties.DisplayPillarBoxWidthLeft,
+		(PVOID)&gDefaultProperties.DisplayPillarBoxWidthLeft,
 		sizeof(ULONG)
 	},
 	{
@@ -189,7 +190,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"DisplayPillarBoxWidthRight",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, DisplayPillarBoxWidthRight),
 		REG_DWORD,
-		&gDefaultProperties.DisplayPillarBoxWidthRight,
+		(PVOID)&gDefaultProperties.DisplayPillarBoxWidthRight,
 		sizeof(ULONG)
 	},
 	{
@@ -197,7 +198,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"DisplayLetterBoxHeightTop",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, DisplayLetterBoxHeightTop),
 		REG_DWORD,
-		&gDefaultProperties.DisplayLetterBoxHeightTop,
+		(PVOID)&gDefaultProperties.DisplayLetterBoxHeightTop,
 		sizeof(ULONG)
 	},
 	{
@@ -205,7 +206,7 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 		L"DisplayLetterBoxHeightBottom",
 		(PVOID)FIELD_OFFSET(TOUCH_SCREEN_PROPERTIES, DisplayLetterBoxHeightBottom),
 		REG_DWORD,
-		&gDefaultProperties.DisplayLetterBoxHeightBottom,
+		(PVOID)&gDefaultProperties.DisplayLetterBoxHeightBottom,
 		sizeof(ULONG)
 	},
 	//
@@ -222,218 +223,541 @@ RTL_QUERY_REGISTRY_TABLE gResParamsRegTable[] =
 };
 
 static const ULONG gcbRegistryTable = sizeof(gResParamsRegTable);
-static const ULONG gcRegistryTable =
-sizeof(gResParamsRegTable) / sizeof(gResParamsRegTable[0]);
-
-static counter = 0;
 
+static
 VOID
-TchTranslateToDisplayCoordinates(
-	IN PUSHORT PX,
-	IN PUSHORT PY,
-	IN PTOUCH_SCREEN_PROPERTIES Props
+TchBuildAxisTransform(
+	OUT PTOUCH_AXIS_TRANSFORM Axis,
+	IN ULONG Invert,
+	IN ULONG TouchPhysical,
+	IN ULONG TouchBoxLow,
+	IN ULONG TouchAdjusted,
+	IN ULONG DisplayNumerator,
+	IN ULONG DisplayDenominator,
+	IN ULONG DisplayBoxLow,
+	IN ULONG DisplayAdjusted,
+	IN ULONG ViewableNumerator,
+	IN ULONG ViewableDenominator
 )
 /*++
 
   Routine Description:
 
-	This routine performs translations on touch coordinates
-	to ensure points reported to the OS match pixels on the
-	display.
+	Folds the clip, scale, clip, scale chain applied to one axis into a
+	single fixed point scale and offset. Every stage is monotonic and
+	clamps at zero, so the chain reduces to one affine map clamped to the
+	image of the largest touch coordinate.
 
   Arguments:
 
-	X - pointer to the pre-processed X coordinate
-	Y - pointer the pre-processed Y coordinate
-	Props - pointer to screen information
+	Axis - receives the transform
+	Invert - whether the axis is inverted
+	TouchPhysical - touch controller extent of the axis
+	TouchBoxLow - touch pillar/letter box on the low side
+	TouchAdjusted - touch extent without the boxes
+	DisplayNumerator, DisplayDenominator - touch to display scale
+	DisplayBoxLow - display pillar/letter box on the low side
+	DisplayAdjusted - display extent without the boxes
+	ViewableNumerator, ViewableDenominator - display to viewable scale
 
   Return Value:
 
-	None. The X/Y values will be modified by this function.
+	None.
 
 --*/
 {
-	ULONG X;
-	ULONG Y;
+	LONG64 scale1 = 0;
+	LONG64 scale2 = 0;
+	ULONG max;
 
-	//
-	// Avoid overflow
-	//
-	X = (ULONG)*PX;
-	Y = (ULONG)*PY;
+	Axis->Invert = (Invert != 0);
+	Axis->InvertLimit = (TouchPhysical != 0) ? TouchPhysical - 1u : 0;
 
-	Props->DisplayAdjustedButtonHeight;
-
-	//
-	 // Swap the axes reported by the touch controller if requested
-	 //
-	if (Props->TouchSwapAxes)
+	if (DisplayDenominator != 0)
 	{
-		ULONG temp = Y;
-		Y = X;
-		X = temp;
+		scale1 = ((LONG64)DisplayNumerator << TOUCH_TRANSFORM_SHIFT) /
+			DisplayDenominator;
 	}
-
-	//
-	// Invert the coordinates as requested
-	//
-	if (Props->TouchInvertXAxis)
+	if (ViewableDenominator != 0)
 	{
-		if (X >= Props->TouchPhysicalWidth)
-		{
-			X = Props->TouchPhysicalWidth - 1u;
-		}
-
-		X = Props->TouchPhysicalWidth - X - 1u;
+		scale2 = ((LONG64)ViewableNumerator << TOUCH_TRANSFORM_SHIFT) /
+			ViewableDenominator;
 	}
-	if (Props->TouchInvertYAxis)
-	{
-		if (Y >= Props->TouchPhysicalHeight)
-		{
-			Y = Props->TouchPhysicalHeight - 1u;
-		}
 
-		Y = Props->TouchPhysicalHeight - Y - 1u;
-	}
+	Axis->Scale = (scale1 * scale2) >> TOUCH_TRANSFORM_SHIFT;
+	Axis->Offset =
+		(((LONG64)TouchBoxLow * scale1 >> TOUCH_TRANSFORM_SHIFT) +
+		(LONG64)DisplayBoxLow) * scale2;
 
 	//
-	// Handle touch clipping boundaries so touch matches
-	// the physical display
+	// Largest output, computed with the exact divisions once
 	//
-	if (X <= Props->TouchPillarBoxWidthLeft)
-	{
-		X = 0;
-	}
-	else
-	{
-		X -= Props->TouchPillarBoxWidthLeft;
-	}
-	if (Y <= Props->TouchLetterBoxHeightTop)
-	{
-		Y = 0;
-	}
-	else
-	{
-		Y -= Props->TouchLetterBoxHeightTop;
-	}
-	if (X >= Props->TouchAdjustedWidth)
+	max = (TouchAdjusted != 0) ? TouchAdjusted - 1u : 0;
+	max = (DisplayDenominator != 0) ?
+		(ULONG)((ULONG64)max * DisplayNumerator / DisplayDenominator) : 0;
+	max = (max > DisplayBoxLow) ? max - DisplayBoxLow : 0;
+	if (DisplayAdjusted != 0 && max >= DisplayAdjusted)
 	{
-		X = Props->TouchAdjustedWidth - 1u;
-	}
-	if (Y >= Props->TouchAdjustedHeight)
-	{
-		Y = Props->TouchAdjustedHeight - 1u;
+		max = DisplayAdjusted - 1u;
 	}
+	max = (ViewableDenominator != 0) ?
+		(ULONG)((ULONG64)max * ViewableNumerator / ViewableDenominator) : 0;
+
+	Axis->Max = min(max, 0xFFFF);
 
 	//
-	// Scale the raw touch pixel units into physical display pixels,
-	// leaving off the capacitive button region.
+	// Out = In * ScaleHigh + (In * ScaleLow >> 16) - OffsetHigh, less
+	// one when the low word of In * ScaleLow is below OffsetLow
 	//
-	X = X * Props->DisplayPhysicalWidth / Props->TouchAdjustedWidth;
-	Y = Y * Props->DisplayPhysicalHeight /
-		(Props->TouchAdjustedHeight - Props->TouchPhysicalButtonHeight);
+	Axis->Vector =
+		Axis->Scale >= 0 &&
+		(Axis->Scale >> TOUCH_TRANSFORM_SHIFT) <= MAXSHORT &&
+		Axis->Offset >= 0 &&
+		(Axis->Offset >> TOUCH_TRANSFORM_SHIFT) <= MAXLONG &&
+		(!Axis->Invert || Axis->InvertLimit <= MAXUSHORT);
+
+	if (Axis->Vector)
+	{
+		Axis->ScaleLow = (USHORT)(Axis->Scale & 0xFFFF);
+		Axis->ScaleHigh = (USHORT)(Axis->Scale >> TOUCH_TRANSFORM_SHIFT);
+		Axis->OffsetLow = (USHORT)(Axis->Offset & 0xFFFF);
+		Axis->OffsetHigh = (LONG)(Axis->Offset >> TOUCH_TRANSFORM_SHIFT);
+	}
+}
+
+static
+VOID
+TchBuildCoordinateTransform(
+	IN PTOUCH_SCREEN_PROPERTIES Props
+)
+/*++
+
+  Routine Description:
+
+	Precomputes the controller to display coordinate transform from the
+	screen properties, so translating a contact needs no division.
+
+  Arguments:
+
+	Props - screen information, receives the transform
+
+  Return Value:
+
+	None.
+
+--*/
+{
+	Props->Transform.SwapAxes = (Props->TouchSwapAxes != 0);
+
+	TchBuildAxisTransform(
+		&Props->Transform.X,
+		Props->TouchInvertXAxis,
+		Props->TouchPhysicalWidth,
+		Props->TouchPillarBoxWidthLeft,
+		Props->TouchAdjustedWidth,
+		Props->DisplayPhysicalWidth,
+		Props->TouchAdjustedWidth,
+		Props->DisplayPillarBoxWidthLeft,
+		Props->DisplayAdjustedWidth,
+		Props->DisplayViewableWidth,
+		Props->DisplayAdjustedWidth);
 
 	//
-	// If the display is additionally being letterboxed or pillarboxed, make
-	// further adjustments to the touch coordinates.
+	// The capacitive button region is left off the vertical scale
 	//
-	if (X <= Props->DisplayPillarBoxWidthLeft)
+	TchBuildAxisTransform(
+		&Props->Transform.Y,
+		Props->TouchInvertYAxis,
+		Props->TouchPhysicalHeight,
+		Props->TouchLetterBoxHeightTop,
+		Props->TouchAdjustedHeight,
+		Props->DisplayPhysicalHeight,
+		Props->TouchAdjustedHeight - Props->TouchPhysicalButtonHeight,
+		Props->DisplayLetterBoxHeightTop,
+		Props->DisplayAdjustedHeight,
+		Props->DisplayViewableHeight,
+		Props->DisplayAdjustedHeight - Props->DisplayAdjustedButtonHeight);
+}
+
+__inline
+ULONG
+TchOrientAxis(
+	IN ULONG Value,
+	IN const TOUCH_AXIS_TRANSFORM* Axis
+)
+{
+	if (Axis->Invert)
 	{
-		X = 0;
+		Value = Axis->InvertLimit - min(Value, Axis->InvertLimit);
 	}
-	else
+
+	return Value;
+}
+
+__inline
+USHORT
+TchTranslateAxis(
+	IN ULONG Value,
+	IN const TOUCH_AXIS_TRANSFORM* Axis
+)
+{
+	LONG64 scaled;
+
+	Value = TchOrientAxis(Value, Axis);
+
+	scaled = ((LONG64)Value * Axis->Scale - Axis->Offset) >> TOUCH_TRANSFORM_SHIFT;
+
+	if (scaled <= 0)
 	{
-		X -= Props->DisplayPillarBoxWidthLeft;
+		return 0;
 	}
-	if (Y <= Props->DisplayLetterBoxHeightTop)
+
+	return (USHORT)min((ULONG64)scaled, (ULONG64)Axis->Max);
+}
+
+VOID
+TchTranslateToDisplayCoordinates(
+	IN PUSHORT PX,
+	IN PUSHORT PY,
+	IN PTOUCH_SCREEN_PROPERTIES Props
+)
+/*++
+
+  Routine Description:
+
+	This routine performs translations on touch coordinates
+	to ensure points reported to the OS match pixels on the
+	display, using the transform precomputed by
+	TchGetScreenProperties.
+
+  Arguments:
+
+	X - pointer to the pre-processed X coordinate
+	Y - pointer the pre-processed Y coordinate
+	Props - pointer to screen information
+
+  Return Value:
+
+	None. The X/Y values will be modified by this function.
+
+--*/
+{
+	const TOUCH_COORDINATE_TRANSFORM* transform = &Props->Transform;
+	ULONG X;
+	ULONG Y;
+
+	//
+	// Swap the axes reported by the touch controller if requested
+	//
+	if (transform->SwapAxes)
 	{
-		Y = 0;
+		X = *PY;
+		Y = *PX;
 	}
 	else
 	{
-		Y -= Props->DisplayLetterBoxHeightTop;
-	}
-	if (X >= Props->DisplayAdjustedWidth)
-	{
-		X = Props->DisplayAdjustedWidth - 1u;
-	}
-	if (Y >= Props->DisplayAdjustedHeight)
-	{
-		Y = Props->DisplayAdjustedHeight - 1u;
+		X = *PX;
+		Y = *PY;
 	}
 
-	X = X * Props->DisplayViewableWidth / Props->DisplayAdjustedWidth;
-	Y = Y * Props->DisplayViewableHeight /
-		(Props->DisplayAdjustedHeight - Props->DisplayAdjustedButtonHeight);
-
-#ifdef COORDS_DEBUG	
+#ifdef COORDS_DEBUG
 	Trace(
 		TRACE_LEVEL_INFORMATION,
 		TRACE_FLAG_REPORTING,
 		"In (%d,%d), Out (%d,%d)",
-		*PX, *PY, X, Y);
+		*PX, *PY,
+		TchTranslateAxis(X, &transform->X),
+		TchTranslateAxis(Y, &transform->Y));
 #endif
 
-	* PX = (USHORT)X;
-	*PY = (USHORT)Y;
+	*PX = TchTranslateAxis(X, &transform->X);
+	*PY = TchTranslateAxis(Y, &transform->Y);
 }
 
+#if defined(TCH_SIMD_NEON) || defined(TCH_SIMD_SSE2)
+
+#define TCH_TRANSLATE_LANES 8
+
+static
 VOID
-TchGetScreenProperties(
-	IN PTOUCH_SCREEN_PROPERTIES Props
+TchTranslateAxisVector(
+	IN OUT PUSHORT Values,
+	IN const TOUCH_AXIS_TRANSFORM* Axis
 )
 /*++
 
   Routine Description:
 
-	This routine retrieves coordinate translation settings
-	from the registry.
+	Translates TCH_TRANSLATE_LANES coordinates of one axis at once with
+	the split transform, giving the same results as TchTranslateAxis.
 
   Arguments:
 
-	Props - receives the Props
+	Values - coordinates to translate in place
+	Axis - transform of the axis, Vector must be set
 
   Return Value:
 
-	None. On failure, defaults are returned.
+	None.
 
 --*/
 {
-	ULONG i;
-	PRTL_QUERY_REGISTRY_TABLE regTable;
-	NTSTATUS status;
+#if defined(TCH_SIMD_NEON)
+	uint16x8_t value;
+	uint16x4_t half[2];
+	uint32x4_t fraction;
+	int32x4_t sum;
+	int i;
+
+	value = vld1q_u16(Values);
+
+	if (Axis->Invert)
+	{
+		value = vsubq_u16(
+			vdupq_n_u16((USHORT)Axis->InvertLimit),
+			vminq_u16(value, vdupq_n_u16((USHORT)Axis->InvertLimit)));
+	}
 
-	regTable = NULL;
+	half[0] = vget_low_u16(value);
+	half[1] = vget_high_u16(value);
+
+	for (i = 0; i < 2; i++)
+	{
+		fraction = vmull_n_u16(half[i], Axis->ScaleLow);
+
+		sum = vreinterpretq_s32_u32(vmull_n_u16(half[i], Axis->ScaleHigh));
+		sum = vaddq_s32(sum, vreinterpretq_s32_u32(vshrq_n_u32(fraction, 16)));
+		sum = vaddq_s32(sum, vreinterpretq_s32_u32(vcltq_u32(
+			vandq_u32(fraction, vdupq_n_u32(0xFFFF)),
+			vdupq_n_u32(Axis->OffsetLow))));
+		sum = vsubq_s32(sum, vdupq_n_s32(Axis->OffsetHigh));
+		sum = vminq_s32(
+			vmaxq_s32(sum, vdupq_n_s32(0)),
+			vdupq_n_s32((LONG)Axis->Max));
+
+		half[i] = vmovn_u32(vreinterpretq_u32_s32(sum));
+	}
+
+	vst1q_u16(Values, vcombine_u16(half[0], half[1]));
+#else
+	__m128i value;
+	__m128i limit;
+	__m128i fractionHigh;
+	__m128i fractionLow;
+	__m128i borrow;
+	__m128i wholeLow;
+	__m128i wholeHigh;
+	__m128i sum[2];
+	__m128i over;
+	__m128i zero;
+	int i;
+
+	zero = _mm_setzero_si128();
+	value = _mm_loadu_si128((const __m128i*)Values);
+
+	if (Axis->Invert)
+	{
+		//
+		// Limit - min(Value, Limit), SSE2 has no unsigned 16 bit min
+		//
+		limit = _mm_set1_epi16((SHORT)Axis->InvertLimit);
+		value = _mm_add_epi16(
+			_mm_sub_epi16(limit, value),
+			_mm_subs_epu16(value, limit));
+	}
+
+	fractionHigh = _mm_mulhi_epu16(value, _mm_set1_epi16((SHORT)Axis->ScaleLow));
+	fractionLow = _mm_mullo_epi16(value, _mm_set1_epi16((SHORT)Axis->ScaleLow));
+	wholeHigh = _mm_mulhi_epu16(value, _mm_set1_epi16((SHORT)Axis->ScaleHigh));
+	wholeLow = _mm_mullo_epi16(value, _mm_set1_epi16((SHORT)Axis->ScaleHigh));
 
 	//
-	// Table passed to RtlQueryRegistryValues must be allocated 
-	// from NonPagedPool
+	// All ones where the low word is below the low offset word
 	//
-	regTable = ExAllocatePoolWithTag(
-		NonPagedPool,
-		gcbRegistryTable,
-		TOUCH_POOL_TAG);
+	borrow = _mm_xor_si128(
+		_mm_cmpeq_epi16(
+			_mm_subs_epu16(_mm_set1_epi16((SHORT)Axis->OffsetLow), fractionLow),
+			zero),
+		_mm_set1_epi16(-1));
+
+	sum[0] = _mm_add_epi32(
+		_mm_unpacklo_epi16(wholeLow, wholeHigh),
+		_mm_unpacklo_epi16(fractionHigh, zero));
+	sum[0] = _mm_add_epi32(sum[0], _mm_unpacklo_epi16(borrow, borrow));
+
+	sum[1] = _mm_add_epi32(
+		_mm_unpackhi_epi16(wholeLow, wholeHigh),
+		_mm_unpackhi_epi16(fractionHigh, zero));
+	sum[1] = _mm_add_epi32(sum[1], _mm_unpackhi_epi16(borrow, borrow));
+
+	for (i = 0; i < 2; i++)
+	{
+		sum[i] = _mm_sub_epi32(sum[i], _mm_set1_epi32(Axis->OffsetHigh));
+		sum[i] = _mm_andnot_si128(_mm_cmpgt_epi32(zero, sum[i]), sum[i]);
+
+		over = _mm_cmpgt_epi32(sum[i], _mm_set1_epi32((LONG)Axis->Max));
+		sum[i] = _mm_or_si128(
+			_mm_and_si128(over, _mm_set1_epi32((LONG)Axis->Max)),
+			_mm_andnot_si128(over, sum[i]));
+
+		//
+		// Biased as the pack saturates signed
+		//
+		sum[i] = _mm_sub_epi32(sum[i], _mm_set1_epi32(0x8000));
+	}
+
+	_mm_storeu_si128((__m128i*)Values, _mm_add_epi16(
+		_mm_packs_epi32(sum[0], sum[1]),
+		_mm_set1_epi16((SHORT)0x8000)));
+#endif
+}
+
+#endif
+
+static
+VOID
+TchTranslateAxisBatch(
+	IN OUT PUSHORT Values,
+	IN ULONG Count,
+	IN const TOUCH_AXIS_TRANSFORM* Axis
+)
+{
+	ULONG i = 0;
+
+#if defined(TCH_SIMD_NEON) || defined(TCH_SIMD_SSE2)
+	USHORT tail[TCH_TRANSLATE_LANES];
+
+	if (Axis->Vector)
+	{
+		for (; i + TCH_TRANSLATE_LANES <= Count; i += TCH_TRANSLATE_LANES)
+		{
+			TchTranslateAxisVector(&Values[i], Axis);
+		}
+
+		if (i < Count)
+		{
+			RtlZeroMemory(tail, sizeof(tail));
+			RtlCopyMemory(tail, &Values[i], (Count - i) * sizeof(USHORT));
+
+			TchTranslateAxisVector(tail, Axis);
 
-	if (regTable == NULL)
+			RtlCopyMemory(&Values[i], tail, (Count - i) * sizeof(USHORT));
+			i = Count;
+		}
+	}
+#endif
+
+	for (; i < Count; i++)
 	{
-		return;
+		Values[i] = TchTranslateAxis(Values[i], Axis);
 	}
+}
 
-	RtlCopyMemory(
-		regTable,
-		gResParamsRegTable,
-		gcbRegistryTable);
+VOID
+TchTranslateToDisplayCoordinatesBatch(
+	IN OUT PUSHORT X,
+	IN OUT PUSHORT Y,
+	IN ULONG Count,
+	IN PTOUCH_SCREEN_PROPERTIES Props
+)
+/*++
 
-	//
-	// Update offset values with base pointer
-	// 
-	for (i = 0; i < gcRegistryTable - 1; i++)
+  Routine Description:
+
+	Translates the coordinates of every contact of a frame in one pass,
+	one vector per axis where available.
+
+  Arguments:
+
+	X - array of Count X coordinates, translated in place
+	Y - array of Count Y coordinates, translated in place
+	Count - number of contacts
+	Props - pointer to screen information
+
+  Return Value:
+
+	None.
+
+--*/
+{
+	const TOUCH_COORDINATE_TRANSFORM* transform = &Props->Transform;
+	ULONG i;
+	USHORT swap;
+
+	if (transform->SwapAxes)
 	{
-		(regTable + i)->EntryContext = (PVOID)(
-			((SIZE_T)(regTable + i)->EntryContext) +
-			((ULONG_PTR)Props));
+		for (i = 0; i < Count; i++)
+		{
+			swap = X[i];
+			X[i] = Y[i];
+			Y[i] = swap;
+		}
 	}
 
+	TchTranslateAxisBatch(X, Count, &transform->X);
+	TchTranslateAxisBatch(Y, Count, &transform->Y);
+}
+
+PRTL_QUERY_REGISTRY_TABLE
+TchCreateScreenPropertiesQuery(
+	IN PTOUCH_SCREEN_PROPERTIES Props
+)
+/*++
+
+  Routine Description:
+
+	Builds the query table TchGetScreenProperties reads the screen
+	properties into Props with
+
+  Arguments:
+
+	Props - Properties the table is rebased onto
+
+  Return Value:
+
+	The table, freed with ExFreePoolWithTag, or NULL
+
+--*/
+{
+	return TchRegistryCreateQueryTable(
+		gResParamsRegTable,
+		gcbRegistryTable,
+		Props);
+}
+
+NTSTATUS
+TchGetScreenProperties(
+	IN PRTL_QUERY_REGISTRY_TABLE QueryTable,
+	OUT PTOUCH_SCREEN_PROPERTIES Props,
+	IN PTOUCH_SCREEN_PROPERTIES Started OPTIONAL
+)
+/*++
+
+  Routine Description:
+
+	This routine retrieves coordinate translation settings
+	from the registry.
+
+  Arguments:
+
+	QueryTable - Table built by TchCreateScreenPropertiesQuery for Props
+
+	Props - receives the Props
+
+	Started - properties of the started device when the settings are
+	  re-read at runtime, or NULL. The display extents are then kept,
+	  the mouse scaling and the published report descriptor rely on
+	  them until the next device start.
+
+  Return Value:
+
+	NTSTATUS indicating success or failure. On failure, defaults are
+	returned.
+
+--*/
+{
+	NTSTATUS status;
+
 	//
 	// Start with default values
 	//
@@ -448,7 +772,7 @@ TchGetScreenProperties(
 	status = RtlQueryRegistryValues(
 		RTL_REGISTRY_ABSOLUTE,
 		TOUCH_SCREEN_PROPERTIES_REG_KEY,
-		regTable,
+		QueryTable,
 		NULL,
 		NULL);
 
@@ -461,6 +785,19 @@ TchGetScreenProperties(
 			status);
 	}
 
+	if (Started != NULL &&
+		(Props->DisplayPhysicalWidth != Started->DisplayPhysicalWidth ||
+		Props->DisplayPhysicalHeight != Started->DisplayPhysicalHeight))
+	{
+		Trace(
+			TRACE_LEVEL_WARNING,
+			TRACE_FLAG_REGISTRY,
+			"Display extents changed, they apply from the next device start");
+
+		Props->DisplayPhysicalWidth = Started->DisplayPhysicalWidth;
+		Props->DisplayPhysicalHeight = Started->DisplayPhysicalHeight;
+	}
+
 	//
 	// Assign a sane value if we couldn't retrieve settings properly
 	//
@@ -564,8 +901,7 @@ TchGetScreenProperties(
 		Props->DisplayLetterBoxHeightBottom +
 		Props->DisplayAdjustedButtonHeight;
 
-	if (regTable != NULL)
-	{
-		ExFreePoolWithTag(regTable, TOUCH_POOL_TAG);
-	}
+	TchBuildCoordinateTransform(Props);
+
+	return status;
 }
@@ -0,0 +1,539 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		settings.c
+
+	Abstract:
+
+		Watches the settings keys for changes and swaps a new settings
+		snapshot in while the device stays started
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include "internal.h"
+#include "controller.h"
+#include "rmiinternal.h"
+#include "spbhelper.h"
+#include "debug.h"
+#include "buttonreporting.h"
+#include "config.h"
+#include "settings.h"
+
+static const PCWSTR gSettingsKeyPaths[TchSettingsKeyCount] =
+{
+	TOUCH_CONTROLLER_SETTINGS_REG_KEY,
+	TOUCH_SCREEN_PROPERTIES_REG_KEY
+};
+
+static
+NTSTATUS
+TchSettingsArmKey(
+	IN TCH_SETTINGS_KEY_WATCH* KeyWatch
+)
+/*++
+
+Routine Description:
+
+	Requests a notification for the next change of a watched key. Must
+	be called with the watch lock held.
+
+Arguments:
+
+	KeyWatch - The key to watch
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	//
+	// The configuration manager queues the work item itself once the
+	// key changes, or once its handle is closed
+	//
+	return ZwNotifyChangeKey(
+		KeyWatch->Key,
+		NULL,
+		(PIO_APC_ROUTINE)&KeyWatch->ChangeItem,
+		(PVOID)(UINT_PTR)DelayedWorkQueue,
+		&KeyWatch->IoStatus,
+		REG_NOTIFY_CHANGE_LAST_SET,
+		FALSE,
+		NULL,
+		0,
+		TRUE);
+}
+
+static
+VOID
+TchSettingsReleasePending(
+	IN TCH_SETTINGS_WATCH* Watch
+)
+{
+	if (InterlockedDecrement(&Watch->Pending) == 0)
+	{
+		KeSetEvent(&Watch->Idle, IO_NO_INCREMENT, FALSE);
+	}
+}
+
+static
+VOID
+OnSettingsKeyChanged(
+	IN PVOID Parameter
+)
+/*++
+
+Routine Description:
+
+	Runs from a system worker thread once a watched key changed. Hands
+	the change to the apply work item and re-arms the notification.
+
+Arguments:
+
+	Parameter - The key watch that fired
+
+Return Value:
+
+	None
+
+--*/
+{
+	TCH_SETTINGS_KEY_WATCH* keyWatch;
+	TCH_SETTINGS_WATCH* watch;
+	NTSTATUS status;
+
+	keyWatch = (TCH_SETTINGS_KEY_WATCH*)Parameter;
+	watch = keyWatch->Watch;
+
+	WdfWaitLockAcquire(watch->Lock, NULL);
+
+	if (watch->Stopping ||
+		keyWatch->IoStatus.Status == STATUS_NOTIFY_CLEANUP)
+	{
+		WdfWaitLockRelease(watch->Lock);
+		TchSettingsReleasePending(watch);
+		goto exit;
+	}
+
+	//
+	// Several changes before the work item runs are read at once
+	//
+	WdfWorkItemEnqueue(watch->ApplyItem);
+
+	status = TchSettingsArmKey(keyWatch);
+
+	WdfWaitLockRelease(watch->Lock);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_REGISTRY,
+			"Could not re-arm settings change notification - STATUS:%X",
+			status);
+
+		TchSettingsReleasePending(watch);
+	}
+
+exit:
+
+	return;
+}
+
+static
+VOID
+OnSettingsApplyWorkItem(
+	IN WDFWORKITEM WorkItem
+)
+/*++
+
+Routine Description:
+
+	Reads a new settings snapshot and swaps it in. The controller is
+	reprogrammed with it right away when in D0, otherwise on wake.
+
+	The report format, read completion batching and the latency
+	instrumentation are latched when the device starts and the display
+	extents were handed to HIDClass with the report descriptor, changes
+	to those still take a restart of the device.
+
+Arguments:
+
+	WorkItem - The apply work item, parented to the device
+
+Return Value:
+
+	None
+
+--*/
+{
+	PDEVICE_EXTENSION devContext;
+	RMI4_CONTROLLER_CONTEXT* controller;
+	RMI4_SETTINGS_SNAPSHOT* settings;
+	NTSTATUS status;
+
+	devContext = GetDeviceContext(WdfWorkItemGetParentObject(WorkItem));
+	controller = (RMI4_CONTROLLER_CONTEXT*)devContext->TouchContext;
+
+	if (controller == NULL)
+	{
+		goto exit;
+	}
+
+	settings = controller->Settings;
+
+	//
+	// Build the complete snapshot before touching the current one, with
+	// the loader the start uses. The display extents of the started
+	// device are kept, everything derived from them is rebuilt with the
+	// new properties. The snapshot is only written here while started,
+	// the apply work item never runs concurrently with itself.
+	//
+	// A transient failure must not reset the running settings to the
+	// defaults, the current snapshot stays in use until the next change
+	//
+	status = TchRegistryLoadSettings(controller, TRUE);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_REGISTRY,
+			"Could not read changed settings, keeping current ones - STATUS:%X",
+			status);
+
+		goto exit;
+	}
+
+	//
+	// Neither the interrupt routine nor the report path may see a mix of
+	// old and new settings
+	//
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+	WdfWaitLockAcquire(controller->ReportLock, NULL);
+
+	RtlCopyMemory(&controller->Config, &settings->Config, sizeof(RMI4_CONFIGURATION));
+	RtlCopyMemory(&controller->Props, &settings->Props, sizeof(TOUCH_SCREEN_PROPERTIES));
+	RtlCopyMemory(&controller->ButtonLayout, &settings->ButtonLayout, sizeof(RMI4_BUTTON_LAYOUT));
+
+	if (controller->DevicePowerState != PowerDeviceD0 ||
+		controller->Storm.Masked ||
+		controller->F34Flash.Active)
+	{
+		controller->SettingsWatch.ApplyOnWake = TRUE;
+	}
+	else
+	{
+		status = RmiConfigureFunctions(
+			controller,
+			&devContext->I2CContext);
+
+		TchCountEvent(&controller->Counters, Reconfigurations);
+
+		if (!NT_SUCCESS(status))
+		{
+			TchCountEvent(
+				&controller->Counters,
+				SpbErrors[TchSpbSiteConfiguration]);
+
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_REGISTRY,
+				"Could not apply changed settings - STATUS:%X",
+				status);
+		}
+
+		//
+		// The controller runs the new active settings now
+		//
+		controller->Activity.Idle = FALSE;
+	}
+
+	WdfWaitLockRelease(controller->ReportLock);
+	WdfWaitLockRelease(controller->ControllerLock);
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_FLAG_REGISTRY,
+		"Settings changed, new snapshot in use");
+
+exit:
+
+	return;
+}
+
+NTSTATUS
+TchSettingsWatchInitialize(
+	IN VOID* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Creates the lock and the apply work item of the settings watch
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	TCH_SETTINGS_WATCH* watch;
+	WDF_WORKITEM_CONFIG workItemConfig;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	int i;
+	NTSTATUS status;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+	watch = &controller->SettingsWatch;
+
+	for (i = 0; i < TchSettingsKeyCount; i++)
+	{
+		watch->Keys[i].Watch = watch;
+		ExInitializeWorkItem(
+			&watch->Keys[i].ChangeItem,
+			OnSettingsKeyChanged,
+			&watch->Keys[i]);
+	}
+
+	KeInitializeEvent(&watch->Idle, NotificationEvent, TRUE);
+
+	//
+	// Nothing to stop until the watch is started
+	//
+	watch->Stopping = TRUE;
+
+	status = WdfWaitLockCreate(
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&watch->Lock);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Could not create settings watch lock - STATUS:%X",
+			status);
+
+		goto exit;
+	}
+
+	WDF_WORKITEM_CONFIG_INIT(&workItemConfig, OnSettingsApplyWorkItem);
+	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+	attributes.ParentObject = controller->FxDevice;
+
+	status = WdfWorkItemCreate(
+		&workItemConfig,
+		&attributes,
+		&watch->ApplyItem);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Could not create settings apply work item - STATUS:%X",
+			status);
+	}
+
+exit:
+
+	return status;
+}
+
+VOID
+TchSettingsWatchStart(
+	IN VOID* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Starts watching the settings keys. Keys that are missing are not
+	watched, the device works on its defaults regardless.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	TCH_SETTINGS_WATCH* watch;
+	OBJECT_ATTRIBUTES attributes;
+	UNICODE_STRING path;
+	int i;
+	NTSTATUS status;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+	watch = &controller->SettingsWatch;
+
+	WdfWaitLockAcquire(watch->Lock, NULL);
+
+	watch->Stopping = FALSE;
+	watch->ApplyOnWake = FALSE;
+	watch->Pending = 1;
+	KeClearEvent(&watch->Idle);
+
+	for (i = 0; i < TchSettingsKeyCount; i++)
+	{
+		RtlInitUnicodeString(&path, gSettingsKeyPaths[i]);
+		InitializeObjectAttributes(
+			&attributes,
+			&path,
+			OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+			NULL,
+			NULL);
+
+		status = ZwOpenKey(&watch->Keys[i].Key, KEY_NOTIFY, &attributes);
+
+		if (!NT_SUCCESS(status))
+		{
+			watch->Keys[i].Key = NULL;
+			continue;
+		}
+
+		InterlockedIncrement(&watch->Pending);
+
+		status = TchSettingsArmKey(&watch->Keys[i]);
+
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_WARNING,
+				TRACE_FLAG_REGISTRY,
+				"Could not watch settings key %S - STATUS:%X",
+				gSettingsKeyPaths[i],
+				status);
+
+			InterlockedDecrement(&watch->Pending);
+		}
+	}
+
+	WdfWaitLockRelease(watch->Lock);
+}
+
+VOID
+TchSettingsWatchStop(
+	IN VOID* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Stops watching the settings keys and waits for notifications and
+	changes still being applied
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	TCH_SETTINGS_WATCH* watch;
+	int i;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+	watch = &controller->SettingsWatch;
+
+	if (watch->Lock == NULL)
+	{
+		goto exit;
+	}
+
+	WdfWaitLockAcquire(watch->Lock, NULL);
+
+	if (watch->Stopping)
+	{
+		WdfWaitLockRelease(watch->Lock);
+		goto exit;
+	}
+
+	watch->Stopping = TRUE;
+
+	//
+	// Closing a key completes its pending notification
+	//
+	for (i = 0; i < TchSettingsKeyCount; i++)
+	{
+		if (watch->Keys[i].Key != NULL)
+		{
+			ZwClose(watch->Keys[i].Key);
+			watch->Keys[i].Key = NULL;
+		}
+	}
+
+	WdfWaitLockRelease(watch->Lock);
+
+	TchSettingsReleasePending(watch);
+
+	KeWaitForSingleObject(
+		&watch->Idle,
+		Executive,
+		KernelMode,
+		FALSE,
+		NULL);
+
+	if (watch->ApplyItem != NULL)
+	{
+		WdfWorkItemFlush(watch->ApplyItem);
+	}
+
+exit:
+
+	return;
+}
+
+VOID
+TchSettingsWatchFree(
+	IN VOID* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Deletes the lock of the settings watch, the watch must be stopped
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+
+	if (controller->SettingsWatch.Lock != NULL)
+	{
+		WdfObjectDelete(controller->SettingsWatch.Lock);
+		controller->SettingsWatch.Lock = NULL;
+	}
+}
@@ -21,8 +21,76 @@
 #include "internal.h"
 #include "controller.h"
 #include "debug.h"
+#include <spb.h>
 //#include "spb.tmh"
 
+typedef struct _SPB_CHAIN_ENGINE
+{
+	SPB_CONTEXT* SpbContext;
+
+	//
+	// Request and memory objects created once, each transaction of a
+	// chain reformats the request over one of them
+	//
+	WDFREQUEST Request;
+	WDFMEMORY SequenceMemory;
+	WDFMEMORY WriteMemory;
+	WDFMEMORY ReadMemory;
+	SPB_TRANSFER_LIST_AND_ENTRIES(2) Sequence;
+	UCHAR WriteBuffer[SPB_CHAIN_MAX_WRITE + 1];
+
+	//
+	// Running chain, its transfer in flight and the bytes that transfer
+	// must move. Without sequence support a read takes two requests.
+	//
+	PSPB_CHAIN Chain;
+	ULONG Current;
+	BOOLEAN AddressWritten;
+	BOOLEAN SequenceRead;
+	ULONG_PTR Expected;
+} SPB_CHAIN_ENGINE;
+
+static
+WDFREQUEST
+SpbReuseSyncRequest(
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+  Routine Description:
+
+	Prepares the request synchronous transactions are sent on, so the
+	framework does not allocate one for each. Must be called with the
+	controller lock held, which serializes the shared request and the
+	bounce buffers.
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+
+  Return Value:
+
+	The request to send, or NULL to have the framework allocate one
+
+--*/
+{
+	WDF_REQUEST_REUSE_PARAMS reuseParams;
+
+	if (SpbContext->SyncRequest == NULL)
+	{
+		return NULL;
+	}
+
+	WDF_REQUEST_REUSE_PARAMS_INIT(
+		&reuseParams,
+		WDF_REQUEST_REUSE_NO_FLAGS,
+		STATUS_SUCCESS);
+
+	WdfRequestReuse(SpbContext->SyncRequest, &reuseParams);
+
+	return SpbContext->SyncRequest;
+}
+
 NTSTATUS
 SpbDoWriteDataSynchronously(
 	IN SPB_CONTEXT* SpbContext,
@@ -63,7 +131,7 @@ SpbDoWriteDataSynchronously(
 	length = Length + 1;
 	memory = NULL;
 
-	if (length > DEFAULT_SPB_BUFFER_SIZE)
+	if (length > SpbContext->WriteMemorySize)
 	{
 		status = WdfMemoryCreate(
 			WDF_NO_OBJECT_ATTRIBUTES,
@@ -110,7 +178,7 @@ SpbDoWriteDataSynchronously(
 
 	status = WdfIoTargetSendWriteSynchronously(
 		SpbContext->SpbIoTarget,
-		NULL,
+		SpbReuseSyncRequest(SpbContext),
 		&memoryDescriptor,
 		NULL,
 		NULL,
@@ -148,8 +216,8 @@ SpbWriteDataSynchronously(
   Routine Description:
 
 	This routine abstracts creating and sending an I/O
-	request (I2C Write) to the Spb I/O target and utilizes
-	a helper routine to do work inside of locked code.
+	request (I2C Write) to the Spb I/O target. Must be called with
+	the controller lock held, like every transfer on the context.
 
   Arguments:
 
@@ -164,40 +232,33 @@ SpbWriteDataSynchronously(
 
 --*/
 {
-	NTSTATUS status;
-
-	WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
-
-	status = SpbDoWriteDataSynchronously(
+	return SpbDoWriteDataSynchronously(
 		SpbContext,
 		Address,
 		Data,
 		Length);
-
-	WdfWaitLockRelease(SpbContext->SpbLock);
-
-	return status;
 }
 
 NTSTATUS
-SpbReadDataSynchronously(
+SpbDoReadSequenceSynchronously(
 	IN SPB_CONTEXT* SpbContext,
 	IN UCHAR Address,
-	IN PVOID Data,
+	IN PUCHAR Buffer,
 	IN ULONG Length
 )
 /*++
 
   Routine Description:
 
-	This helper routine abstracts creating and sending an I/O
-	request (I2C Read) to the Spb I/O target.
+	This helper routine sends the address pointer write and the data
+	read as a single SPB sequence, so the controller issues a repeated
+	start between them instead of a STOP and a second transaction.
 
   Arguments:
 
 	SpbContext - Pointer to the current device context
 	Address    - The I2C register address to read from
-	Data       - A buffer to receive the data at at the above address
+	Buffer     - A nonpaged buffer to receive the data at the above address
 	Length     - The amount of data to be read from the above address
 
   Return Value:
@@ -206,9 +267,83 @@ SpbReadDataSynchronously(
 
 --*/
 {
-	PUCHAR buffer;
-	WDFMEMORY memory;
 	WDF_MEMORY_DESCRIPTOR memoryDescriptor;
+	SPB_TRANSFER_LIST_AND_ENTRIES(2) sequence;
+	NTSTATUS status;
+
+#if ARM || X86
+	ULONG bytesTransferred;
+#else
+	ULONGLONG bytesTransferred;
+#endif
+
+	bytesTransferred = 0;
+
+	SPB_TRANSFER_LIST_INIT(&(sequence.List), 2);
+
+	sequence.List.Transfers[0] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+		SpbTransferDirectionToDevice,
+		0,
+		&Address,
+		sizeof(Address));
+
+	sequence.List.Transfers[1] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+		SpbTransferDirectionFromDevice,
+		0,
+		Buffer,
+		Length);
+
+	WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
+		&memoryDescriptor,
+		(PVOID)&sequence,
+		sizeof(sequence));
+
+	status = WdfIoTargetSendIoctlSynchronously(
+		SpbContext->SpbIoTarget,
+		SpbReuseSyncRequest(SpbContext),
+		IOCTL_SPB_EXECUTE_SEQUENCE,
+		&memoryDescriptor,
+		NULL,
+		NULL,
+		&bytesTransferred);
+
+	if (NT_SUCCESS(status) &&
+		bytesTransferred != sizeof(Address) + Length)
+	{
+		status = STATUS_DEVICE_PROTOCOL_ERROR;
+	}
+
+	return status;
+}
+
+NTSTATUS
+SpbDoReadDataSynchronously(
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR Address,
+	IN WDF_MEMORY_DESCRIPTOR* MemoryDescriptor,
+	IN ULONG Length
+)
+/*++
+
+  Routine Description:
+
+	This helper routine performs a register read as two separate
+	transactions, an address pointer write followed by a read. It is
+	only used when the SPB controller does not support sequences.
+
+  Arguments:
+
+	SpbContext       - Pointer to the current device context
+	Address          - The I2C register address to read from
+	MemoryDescriptor - Describes the buffer receiving the data
+	Length           - The amount of data to be read from the above address
+
+  Return Value:
+
+	NTSTATUS Status indicating success or failure
+
+--*/
+{
 	NTSTATUS status;
 
 #if ARM || X86
@@ -217,10 +352,6 @@ SpbReadDataSynchronously(
 	ULONGLONG bytesRead;
 #endif
 
-	WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
-
-	memory = NULL;
-	status = STATUS_INVALID_PARAMETER;
 	bytesRead = 0;
 
 	//
@@ -242,7 +373,63 @@ SpbReadDataSynchronously(
 		goto exit;
 	}
 
-	if (Length > DEFAULT_SPB_BUFFER_SIZE)
+	status = WdfIoTargetSendReadSynchronously(
+		SpbContext->SpbIoTarget,
+		SpbReuseSyncRequest(SpbContext),
+		MemoryDescriptor,
+		NULL,
+		NULL,
+		&bytesRead);
+
+	if (NT_SUCCESS(status) &&
+		bytesRead != Length)
+	{
+		status = STATUS_DEVICE_PROTOCOL_ERROR;
+	}
+
+exit:
+
+	return status;
+}
+
+NTSTATUS
+SpbReadDataSynchronously(
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR Address,
+	IN PVOID Data,
+	IN ULONG Length
+)
+/*++
+
+  Routine Description:
+
+	This helper routine abstracts creating and sending an I/O
+	request (I2C Read) to the Spb I/O target. The address write and
+	the data read are issued as one write + repeated-start read
+	sequence when the SPB controller supports it.
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+	Address    - The I2C register address to read from
+	Data       - A buffer to receive the data at at the above address
+	Length     - The amount of data to be read from the above address
+
+  Return Value:
+
+	NTSTATUS Status indicating success or failure
+
+--*/
+{
+	PUCHAR buffer;
+	WDFMEMORY memory;
+	WDF_MEMORY_DESCRIPTOR memoryDescriptor;
+	NTSTATUS status;
+
+	memory = NULL;
+	status = STATUS_INVALID_PARAMETER;
+
+	if (Length > SpbContext->ReadMemorySize)
 	{
 		status = WdfMemoryCreate(
 			WDF_NO_OBJECT_ATTRIBUTES,
@@ -277,17 +464,41 @@ SpbReadDataSynchronously(
 			Length);
 	}
 
+	if (SpbContext->SequenceUnsupported == FALSE)
+	{
+		status = SpbDoReadSequenceSynchronously(
+			SpbContext,
+			Address,
+			buffer,
+			Length);
 
-	status = WdfIoTargetSendReadSynchronously(
-		SpbContext->SpbIoTarget,
-		NULL,
-		&memoryDescriptor,
-		NULL,
-		NULL,
-		&bytesRead);
+		//
+		// Sequence support is optional for SPB controllers, remember
+		// if it is missing and use separate transactions from now on
+		//
+		if (status == STATUS_NOT_SUPPORTED ||
+			status == STATUS_INVALID_DEVICE_REQUEST)
+		{
+			Trace(
+				TRACE_LEVEL_WARNING,
+				TRACE_FLAG_SPB,
+				"Spb controller does not support sequences, using separate transactions - STATUS:%X",
+				status);
 
-	if (!NT_SUCCESS(status) ||
-		bytesRead != Length)
+			SpbContext->SequenceUnsupported = TRUE;
+		}
+	}
+
+	if (SpbContext->SequenceUnsupported != FALSE)
+	{
+		status = SpbDoReadDataSynchronously(
+			SpbContext,
+			Address,
+			&memoryDescriptor,
+			Length);
+	}
+
+	if (!NT_SUCCESS(status))
 	{
 		Trace(
 			TRACE_LEVEL_ERROR,
@@ -308,28 +519,33 @@ exit:
 		WdfObjectDelete(memory);
 	}
 
-	WdfWaitLockRelease(SpbContext->SpbLock);
-
 	return status;
 }
 
-VOID
-SpbTargetDeinitialize(
-	IN WDFDEVICE FxDevice,
-	IN SPB_CONTEXT* SpbContext
+NTSTATUS
+SpbReadDataToMemorySynchronously(
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR Address,
+	IN WDFMEMORY Memory,
+	IN size_t Offset,
+	IN ULONG Length
 )
 /*++
 
   Routine Description:
 
-	This helper routine is used to free any members added to the SPB_CONTEXT,
-	note the SPB I/O target is parented to the device and will be
-	closed and free'd when the device is removed.
+	This helper routine reads registers straight into a caller-owned,
+	nonpaged WDFMEMORY buffer, without going through the shared
+	SPB_CONTEXT read buffer. The caller owns the buffer for the whole
+	transfer and may parse the data in place afterwards.
 
   Arguments:
 
-	FxDevice   - Handle to the framework device object
 	SpbContext - Pointer to the current device context
+	Address    - The I2C register address to read from
+	Memory     - Caller-owned nonpaged memory receiving the data
+	Offset     - Byte offset in Memory at which the data is stored
+	Length     - The amount of data to be read from the above address
 
   Return Value:
 
@@ -337,45 +553,92 @@ SpbTargetDeinitialize(
 
 --*/
 {
-	UNREFERENCED_PARAMETER(FxDevice);
-	UNREFERENCED_PARAMETER(SpbContext);
+	PUCHAR buffer;
+	size_t bufferSize;
+	WDFMEMORY_OFFSET memoryOffset;
+	WDF_MEMORY_DESCRIPTOR memoryDescriptor;
+	NTSTATUS status;
 
-	//
-	// Free any SPB_CONTEXT allocations here
-	//
-	if (SpbContext->SpbLock != NULL)
+	buffer = (PUCHAR)WdfMemoryGetBuffer(Memory, &bufferSize);
+
+	if (Offset > bufferSize || Length > bufferSize - Offset)
 	{
-		WdfObjectDelete(SpbContext->SpbLock);
+		status = STATUS_BUFFER_TOO_SMALL;
+		goto exit;
 	}
 
-	if (SpbContext->ReadMemory != NULL)
+	status = STATUS_NOT_SUPPORTED;
+
+	if (SpbContext->SequenceUnsupported == FALSE)
 	{
-		WdfObjectDelete(SpbContext->ReadMemory);
+		status = SpbDoReadSequenceSynchronously(
+			SpbContext,
+			Address,
+			buffer + Offset,
+			Length);
+
+		if (status == STATUS_NOT_SUPPORTED ||
+			status == STATUS_INVALID_DEVICE_REQUEST)
+		{
+			Trace(
+				TRACE_LEVEL_WARNING,
+				TRACE_FLAG_SPB,
+				"Spb controller does not support sequences, using separate transactions - STATUS:%X",
+				status);
+
+			SpbContext->SequenceUnsupported = TRUE;
+		}
 	}
 
-	if (SpbContext->WriteMemory != NULL)
+	if (SpbContext->SequenceUnsupported != FALSE)
 	{
-		WdfObjectDelete(SpbContext->WriteMemory);
+		memoryOffset.BufferOffset = Offset;
+		memoryOffset.BufferLength = Length;
+
+		WDF_MEMORY_DESCRIPTOR_INIT_HANDLE(
+			&memoryDescriptor,
+			Memory,
+			&memoryOffset);
+
+		status = SpbDoReadDataSynchronously(
+			SpbContext,
+			Address,
+			&memoryDescriptor,
+			Length);
+	}
+
+exit:
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_SPB,
+			"Error reading from Spb - STATUS:%X",
+			status);
 	}
+
+	return status;
 }
 
 NTSTATUS
-SpbTargetInitialize(
-	IN WDFDEVICE FxDevice,
-	IN SPB_CONTEXT* SpbContext
+SpbReserveBufferSize(
+	IN SPB_CONTEXT* SpbContext,
+	IN ULONG Length
 )
 /*++
 
   Routine Description:
 
-	This helper routine opens the Spb I/O target and
-	initializes a request object used for the lifetime
-	of communication between this driver and Spb.
+	This routine grows the preallocated read and write buffers so that
+	transfers of up to Length data bytes can be issued without
+	allocating memory on each transaction. It is meant to be called at
+	configuration time once the largest transfer size is known.
 
   Arguments:
 
-	FxDevice   - Handle to the framework device object
 	SpbContext - Pointer to the current device context
+	Length     - The largest data payload expected on the bus
 
   Return Value:
 
@@ -383,30 +646,816 @@ SpbTargetInitialize(
 
 --*/
 {
-	WDF_OBJECT_ATTRIBUTES objectAttributes;
-	WDF_IO_TARGET_OPEN_PARAMS openParams;
-	UNICODE_STRING spbDeviceName;
-	WCHAR spbDeviceNameBuffer[RESOURCE_HUB_PATH_SIZE];
+	WDFMEMORY memory;
 	NTSTATUS status;
 
-	WDF_OBJECT_ATTRIBUTES_INIT(&objectAttributes);
-	objectAttributes.ParentObject = FxDevice;
-
-	status = WdfIoTargetCreate(
-		FxDevice,
-		&objectAttributes,
-		&SpbContext->SpbIoTarget);
+	status = STATUS_SUCCESS;
 
-	if (!NT_SUCCESS(status))
+	if (Length > SpbContext->ReadMemorySize)
 	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			TRACE_FLAG_SPB,
-			"Error creating IoTarget object - STATUS:%X",
-			status);
+		status = WdfMemoryCreate(
+			WDF_NO_OBJECT_ATTRIBUTES,
+			NonPagedPool,
+			TOUCH_POOL_TAG,
+			Length,
+			&memory,
+			NULL);
 
-		WdfObjectDelete(SpbContext->SpbIoTarget);
-		goto exit;
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_SPB,
+				"Error growing memory for Spb read - STATUS:%X",
+				status);
+			goto exit;
+		}
+
+		WdfObjectDelete(SpbContext->ReadMemory);
+		SpbContext->ReadMemory = memory;
+		SpbContext->ReadMemorySize = Length;
+	}
+
+	//
+	// Writes carry the address byte in front of the payload
+	//
+	if (Length + 1 > SpbContext->WriteMemorySize)
+	{
+		status = WdfMemoryCreate(
+			WDF_NO_OBJECT_ATTRIBUTES,
+			NonPagedPool,
+			TOUCH_POOL_TAG,
+			Length + 1,
+			&memory,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				TRACE_FLAG_SPB,
+				"Error growing memory for Spb write - STATUS:%X",
+				status);
+			goto exit;
+		}
+
+		WdfObjectDelete(SpbContext->WriteMemory);
+		SpbContext->WriteMemory = memory;
+		SpbContext->WriteMemorySize = Length + 1;
+	}
+
+exit:
+
+	return status;
+}
+
+VOID
+SpbChainInitialize(
+	OUT PSPB_CHAIN Chain
+)
+/*++
+
+  Routine Description:
+
+	Empties a transaction chain so transfers can be added to it
+
+  Arguments:
+
+	Chain - Chain to initialize
+
+  Return Value:
+
+	None.
+
+--*/
+{
+	Chain->Count = 0;
+	Chain->Completed = 0;
+	Chain->Status = STATUS_SUCCESS;
+	Chain->Completion = NULL;
+	Chain->CompletionContext = NULL;
+}
+
+NTSTATUS
+SpbChainAddRead(
+	IN OUT PSPB_CHAIN Chain,
+	IN UCHAR Address,
+	IN PVOID Buffer,
+	IN ULONG Length
+)
+/*++
+
+  Routine Description:
+
+	Appends a register read to a transaction chain
+
+  Arguments:
+
+	Chain   - Chain to append to
+	Address - The I2C register address to read from
+	Buffer  - A nonpaged buffer to receive the data, must stay valid
+			  until the chain completes
+	Length  - The amount of data to be read
+
+  Return Value:
+
+	NTSTATUS Status indicating success or failure
+
+--*/
+{
+	SPB_CHAIN_TRANSFER* transfer;
+
+	if (Chain->Count == SPB_CHAIN_MAX_TRANSFERS || Length == 0)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	transfer = &Chain->Transfers[Chain->Count++];
+	transfer->Write = FALSE;
+	transfer->Address = Address;
+	transfer->Length = Length;
+	transfer->Buffer = Buffer;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+SpbChainAddWrite(
+	IN OUT PSPB_CHAIN Chain,
+	IN UCHAR Address,
+	IN PVOID Data,
+	IN ULONG Length
+)
+/*++
+
+  Routine Description:
+
+	Appends a short register write to a transaction chain, the data is
+	copied so the caller's buffer may go away right after
+
+  Arguments:
+
+	Chain   - Chain to append to
+	Address - The I2C register address to write to
+	Data    - Data to write
+	Length  - Length of the data, up to SPB_CHAIN_MAX_WRITE
+
+  Return Value:
+
+	NTSTATUS Status indicating success or failure
+
+--*/
+{
+	SPB_CHAIN_TRANSFER* transfer;
+
+	if (Chain->Count == SPB_CHAIN_MAX_TRANSFERS ||
+		Length == 0 ||
+		Length > SPB_CHAIN_MAX_WRITE)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	transfer = &Chain->Transfers[Chain->Count++];
+	transfer->Write = TRUE;
+	transfer->Address = Address;
+	transfer->Length = Length;
+	transfer->Buffer = NULL;
+
+	RtlCopyMemory(transfer->WriteData, Data, Length);
+
+	return STATUS_SUCCESS;
+}
+
+static
+VOID
+SpbChainFinish(
+	IN SPB_CHAIN_ENGINE* Engine,
+	IN NTSTATUS Status
+)
+/*++
+
+  Routine Description:
+
+	Records the outcome of the running chain and calls the completion
+	routine of the chain
+
+  Arguments:
+
+	Engine - Chain engine
+	Status - Outcome of the chain
+
+  Return Value:
+
+	None.
+
+--*/
+{
+	PSPB_CHAIN chain;
+
+	chain = Engine->Chain;
+	chain->Status = Status;
+	chain->Completed = Engine->Current;
+
+	Engine->Chain = NULL;
+
+	chain->Completion(chain, chain->CompletionContext);
+}
+
+static
+NTSTATUS
+SpbChainFormatNext(
+	IN SPB_CHAIN_ENGINE* Engine
+)
+/*++
+
+  Routine Description:
+
+	Formats the engine request for the next bus transaction of the
+	running chain. Only buffers are reassigned, nothing is allocated.
+
+  Arguments:
+
+	Engine - Chain engine
+
+  Return Value:
+
+	NTSTATUS Status indicating success or failure
+
+--*/
+{
+	WDF_REQUEST_REUSE_PARAMS reuseParams;
+	SPB_CHAIN_TRANSFER* transfer;
+	WDFIOTARGET target;
+	NTSTATUS status;
+
+	transfer = &Engine->Chain->Transfers[Engine->Current];
+	target = Engine->SpbContext->SpbIoTarget;
+
+	WDF_REQUEST_REUSE_PARAMS_INIT(
+		&reuseParams,
+		WDF_REQUEST_REUSE_NO_FLAGS,
+		STATUS_SUCCESS);
+
+	status = WdfRequestReuse(Engine->Request, &reuseParams);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	Engine->SequenceRead = FALSE;
+	Engine->WriteBuffer[0] = transfer->Address;
+
+	if (transfer->Write)
+	{
+		RtlCopyMemory(
+			&Engine->WriteBuffer[1],
+			transfer->WriteData,
+			transfer->Length);
+
+		status = WdfMemoryAssignBuffer(
+			Engine->WriteMemory,
+			Engine->WriteBuffer,
+			transfer->Length + 1);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+
+		status = WdfIoTargetFormatRequestForWrite(
+			target,
+			Engine->Request,
+			Engine->WriteMemory,
+			NULL,
+			NULL);
+
+		Engine->Expected = transfer->Length + 1;
+	}
+	else if (Engine->SpbContext->SequenceUnsupported == FALSE)
+	{
+		SPB_TRANSFER_LIST_INIT(&(Engine->Sequence.List), 2);
+
+		Engine->Sequence.List.Transfers[0] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+			SpbTransferDirectionToDevice,
+			0,
+			Engine->WriteBuffer,
+			sizeof(UCHAR));
+
+		Engine->Sequence.List.Transfers[1] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+			SpbTransferDirectionFromDevice,
+			0,
+			transfer->Buffer,
+			transfer->Length);
+
+		status = WdfIoTargetFormatRequestForIoctl(
+			target,
+			Engine->Request,
+			IOCTL_SPB_EXECUTE_SEQUENCE,
+			Engine->SequenceMemory,
+			NULL,
+			NULL,
+			NULL);
+
+		Engine->SequenceRead = TRUE;
+		Engine->Expected = sizeof(UCHAR) + transfer->Length;
+	}
+	else if (Engine->AddressWritten == FALSE)
+	{
+		status = WdfMemoryAssignBuffer(
+			Engine->WriteMemory,
+			Engine->WriteBuffer,
+			sizeof(UCHAR));
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+
+		status = WdfIoTargetFormatRequestForWrite(
+			target,
+			Engine->Request,
+			Engine->WriteMemory,
+			NULL,
+			NULL);
+
+		Engine->Expected = sizeof(UCHAR);
+	}
+	else
+	{
+		status = WdfMemoryAssignBuffer(
+			Engine->ReadMemory,
+			transfer->Buffer,
+			transfer->Length);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+
+		status = WdfIoTargetFormatRequestForRead(
+			target,
+			Engine->Request,
+			Engine->ReadMemory,
+			NULL,
+			NULL);
+
+		Engine->Expected = transfer->Length;
+	}
+
+exit:
+
+	return status;
+}
+
+static EVT_WDF_REQUEST_COMPLETION_ROUTINE SpbChainOnRequestComplete;
+
+static
+VOID
+SpbChainSendNext(
+	IN SPB_CHAIN_ENGINE* Engine
+)
+/*++
+
+  Routine Description:
+
+	Sends the next bus transaction of the running chain, or finishes
+	the chain once all of its transfers are done
+
+  Arguments:
+
+	Engine - Chain engine
+
+  Return Value:
+
+	None.
+
+--*/
+{
+	NTSTATUS status;
+
+	if (Engine->Current == Engine->Chain->Count)
+	{
+		SpbChainFinish(Engine, STATUS_SUCCESS);
+		return;
+	}
+
+	status = SpbChainFormatNext(Engine);
+
+	if (!NT_SUCCESS(status))
+	{
+		SpbChainFinish(Engine, status);
+		return;
+	}
+
+	WdfRequestSetCompletionRoutine(
+		Engine->Request,
+		SpbChainOnRequestComplete,
+		Engine);
+
+	if (WdfRequestSend(
+		Engine->Request,
+		Engine->SpbContext->SpbIoTarget,
+		WDF_NO_SEND_OPTIONS) == FALSE)
+	{
+		SpbChainFinish(Engine, WdfRequestGetStatus(Engine->Request));
+	}
+}
+
+static
+VOID
+SpbChainOnRequestComplete(
+	IN WDFREQUEST Request,
+	IN WDFIOTARGET Target,
+	IN PWDF_REQUEST_COMPLETION_PARAMS Params,
+	IN WDFCONTEXT Context
+)
+/*++
+
+  Routine Description:
+
+	Completion routine of the chain engine request, moves the running
+	chain on to its next bus transaction
+
+  Arguments:
+
+	Request - Engine request
+	Target  - SPB I/O target
+	Params  - Completion parameters
+	Context - Chain engine
+
+  Return Value:
+
+	None.
+
+--*/
+{
+	SPB_CHAIN_ENGINE* engine;
+	NTSTATUS status;
+
+	UNREFERENCED_PARAMETER(Request);
+	UNREFERENCED_PARAMETER(Target);
+
+	engine = (SPB_CHAIN_ENGINE*)Context;
+	status = Params->IoStatus.Status;
+
+	if (engine->SequenceRead &&
+		(status == STATUS_NOT_SUPPORTED ||
+		status == STATUS_INVALID_DEVICE_REQUEST))
+	{
+		Trace(
+			TRACE_LEVEL_WARNING,
+			TRACE_FLAG_SPB,
+			"Spb controller does not support sequences, using separate transactions - STATUS:%X",
+			status);
+
+		//
+		// Retry the same transfer as separate transactions
+		//
+		engine->SpbContext->SequenceUnsupported = TRUE;
+		engine->AddressWritten = FALSE;
+
+		SpbChainSendNext(engine);
+		return;
+	}
+
+	if (NT_SUCCESS(status) &&
+		Params->IoStatus.Information != engine->Expected)
+	{
+		status = STATUS_DEVICE_PROTOCOL_ERROR;
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		SpbChainFinish(engine, status);
+		return;
+	}
+
+	if (engine->Chain->Transfers[engine->Current].Write == FALSE &&
+		engine->SequenceRead == FALSE &&
+		engine->AddressWritten == FALSE)
+	{
+		engine->AddressWritten = TRUE;
+	}
+	else
+	{
+		engine->AddressWritten = FALSE;
+		engine->Current++;
+	}
+
+	SpbChainSendNext(engine);
+}
+
+VOID
+SpbSubmitChain(
+	IN SPB_CONTEXT* SpbContext,
+	IN PSPB_CHAIN Chain,
+	IN PFN_SPB_CHAIN_COMPLETION Completion,
+	IN PVOID Context
+)
+/*++
+
+  Routine Description:
+
+	Issues the transfers of a chain back to back on the preformatted
+	engine request, each one sent from the completion of the previous
+	one. No other transfer may be issued on the context until the
+	chain completed, see SPB_CONTEXT. The completion routine is called
+	once the chain is done or a transfer failed, possibly before this
+	returns.
+
+	The chain does not own the bus, it is not bracketed by a controller
+	lock and other clients of the SPB controller can be served between
+	its transfers. Only this driver addresses the touch controller, so
+	a page selected by the chain stays selected for the transfers that
+	follow it.
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+	Chain      - Chain to issue, must stay valid until it completes
+	Completion - Routine called with the outcome of the chain
+	Context    - Context passed to the completion routine
+
+  Return Value:
+
+	None.
+
+--*/
+{
+	SPB_CHAIN_ENGINE* engine;
+
+	engine = SpbContext->ChainEngine;
+
+	Chain->Completion = Completion;
+	Chain->CompletionContext = Context;
+	Chain->Completed = 0;
+	Chain->Status = STATUS_PENDING;
+
+	engine->Chain = Chain;
+	engine->Current = 0;
+	engine->AddressWritten = FALSE;
+
+	SpbChainSendNext(engine);
+}
+
+static
+VOID
+SpbChainSignal(
+	IN PSPB_CHAIN Chain,
+	IN PVOID Context
+)
+/*++
+
+  Routine Description:
+
+	Chain completion routine of SpbExecuteChainSynchronously
+
+  Arguments:
+
+	Chain   - Completed chain
+	Context - Event the caller waits on
+
+  Return Value:
+
+	None.
+
+--*/
+{
+	UNREFERENCED_PARAMETER(Chain);
+
+	KeSetEvent((PKEVENT)Context, IO_NO_INCREMENT, FALSE);
+}
+
+NTSTATUS
+SpbExecuteChainSynchronously(
+	IN SPB_CONTEXT* SpbContext,
+	IN PSPB_CHAIN Chain
+)
+/*++
+
+  Routine Description:
+
+	Issues a chain and waits for it to complete
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+	Chain      - Chain to issue
+
+  Return Value:
+
+	NTSTATUS Status of the first failed transfer, the chain's Completed
+	count tells how many transfers succeeded before it
+
+--*/
+{
+	KEVENT done;
+
+	KeInitializeEvent(&done, NotificationEvent, FALSE);
+
+	SpbSubmitChain(SpbContext, Chain, SpbChainSignal, &done);
+
+	KeWaitForSingleObject(&done, Executive, KernelMode, FALSE, NULL);
+
+	return Chain->Status;
+}
+
+static
+NTSTATUS
+SpbChainEngineInitialize(
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+  Routine Description:
+
+	Creates the chain engine request and the memory objects it is
+	formatted over. They are parented to the engine allocation and go
+	away with it.
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+
+  Return Value:
+
+	NTSTATUS Status indicating success or failure
+
+--*/
+{
+	WDF_OBJECT_ATTRIBUTES objectAttributes;
+	SPB_CHAIN_ENGINE* engine;
+	NTSTATUS status;
+
+	status = WdfMemoryCreate(
+		WDF_NO_OBJECT_ATTRIBUTES,
+		NonPagedPoolNx,
+		TOUCH_POOL_TAG,
+		sizeof(SPB_CHAIN_ENGINE),
+		&SpbContext->ChainEngineMemory,
+		(PVOID*)&engine);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	RtlZeroMemory(engine, sizeof(SPB_CHAIN_ENGINE));
+	engine->SpbContext = SpbContext;
+	SpbContext->ChainEngine = engine;
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&objectAttributes);
+	objectAttributes.ParentObject = SpbContext->ChainEngineMemory;
+
+	status = WdfRequestCreate(
+		&objectAttributes,
+		SpbContext->SpbIoTarget,
+		&engine->Request);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	status = WdfMemoryCreatePreallocated(
+		&objectAttributes,
+		&engine->Sequence,
+		sizeof(engine->Sequence),
+		&engine->SequenceMemory);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	status = WdfMemoryCreatePreallocated(
+		&objectAttributes,
+		engine->WriteBuffer,
+		sizeof(engine->WriteBuffer),
+		&engine->WriteMemory);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	//
+	// Reads are assigned the caller's buffer before each transfer
+	//
+	status = WdfMemoryCreatePreallocated(
+		&objectAttributes,
+		engine->WriteBuffer,
+		sizeof(engine->WriteBuffer),
+		&engine->ReadMemory);
+
+exit:
+
+	return status;
+}
+
+VOID
+SpbTargetDeinitialize(
+	IN WDFDEVICE FxDevice,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+  Routine Description:
+
+	This helper routine is used to free any members added to the SPB_CONTEXT,
+	note the SPB I/O target is parented to the device and will be
+	closed and free'd when the device is removed.
+
+  Arguments:
+
+	FxDevice   - Handle to the framework device object
+	SpbContext - Pointer to the current device context
+
+  Return Value:
+
+	NTSTATUS Status indicating success or failure
+
+--*/
+{
+	UNREFERENCED_PARAMETER(FxDevice);
+	UNREFERENCED_PARAMETER(SpbContext);
+
+	//
+	// Free any SPB_CONTEXT allocations here
+	//
+	if (SpbContext->ChainEngineMemory != NULL)
+	{
+		WdfObjectDelete(SpbContext->ChainEngineMemory);
+		SpbContext->ChainEngineMemory = NULL;
+		SpbContext->ChainEngine = NULL;
+	}
+
+	if (SpbContext->SyncRequest != NULL)
+	{
+		WdfObjectDelete(SpbContext->SyncRequest);
+		SpbContext->SyncRequest = NULL;
+	}
+
+	if (SpbContext->ReadMemory != NULL)
+	{
+		WdfObjectDelete(SpbContext->ReadMemory);
+	}
+
+	if (SpbContext->WriteMemory != NULL)
+	{
+		WdfObjectDelete(SpbContext->WriteMemory);
+	}
+}
+
+NTSTATUS
+SpbTargetInitialize(
+	IN WDFDEVICE FxDevice,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+  Routine Description:
+
+	This helper routine opens the Spb I/O target and
+	initializes a request object used for the lifetime
+	of communication between this driver and Spb.
+
+  Arguments:
+
+	FxDevice   - Handle to the framework device object
+	SpbContext - Pointer to the current device context
+
+  Return Value:
+
+	NTSTATUS Status indicating success or failure
+
+--*/
+{
+	WDF_OBJECT_ATTRIBUTES objectAttributes;
+	WDF_IO_TARGET_OPEN_PARAMS openParams;
+	UNICODE_STRING spbDeviceName;
+	WCHAR spbDeviceNameBuffer[RESOURCE_HUB_PATH_SIZE];
+	NTSTATUS status;
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&objectAttributes);
+	objectAttributes.ParentObject = FxDevice;
+
+	status = WdfIoTargetCreate(
+		FxDevice,
+		&objectAttributes,
+		&SpbContext->SpbIoTarget);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_SPB,
+			"Error creating IoTarget object - STATUS:%X",
+			status);
+
+		WdfObjectDelete(SpbContext->SpbIoTarget);
+		goto exit;
 	}
 
 	RtlInitEmptyUnicodeString(
@@ -472,6 +1521,8 @@ SpbTargetInitialize(
 		goto exit;
 	}
 
+	SpbContext->WriteMemorySize = DEFAULT_SPB_BUFFER_SIZE;
+
 	status = WdfMemoryCreate(
 		WDF_NO_OBJECT_ATTRIBUTES,
 		NonPagedPool,
@@ -490,19 +1541,38 @@ SpbTargetInitialize(
 		goto exit;
 	}
 
+	SpbContext->ReadMemorySize = DEFAULT_SPB_BUFFER_SIZE;
+
 	//
-	// Allocate a waitlock to guard access to the default buffers
+	// Synchronous transactions are all sent on one request instead of
+	// one allocated by the framework for each
 	//
-	status = WdfWaitLockCreate(
-		WDF_NO_OBJECT_ATTRIBUTES,
-		&SpbContext->SpbLock);
+	WDF_OBJECT_ATTRIBUTES_INIT(&objectAttributes);
+	objectAttributes.ParentObject = SpbContext->SpbIoTarget;
+
+	status = WdfRequestCreate(
+		&objectAttributes,
+		SpbContext->SpbIoTarget,
+		&SpbContext->SyncRequest);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_SPB,
+			"Error creating Spb request - STATUS:%X",
+			status);
+		goto exit;
+	}
+
+	status = SpbChainEngineInitialize(SpbContext);
 
 	if (!NT_SUCCESS(status))
 	{
 		Trace(
 			TRACE_LEVEL_ERROR,
 			TRACE_FLAG_SPB,
-			"Error creating Spb Waitlock - STATUS:%X",
+			"Error creating Spb chain engine - STATUS:%X",
 			status);
 		goto exit;
 	}
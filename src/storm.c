@@ -0,0 +1,482 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		storm.c
+
+	Abstract:
+
+		Detects interrupt storms, masks the controller while one lasts
+		and brings it back through the reconfiguration path
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include "internal.h"
+#include "controller.h"
+#include "rmiinternal.h"
+#include "spbhelper.h"
+#include "debug.h"
+#include "etwtrace.h"
+#include "storm.h"
+
+#define TCH_STORM_TICKS_PER_MS      10000
+
+static
+ULONG
+RmiStormEstimate(
+	IN ULONG Current,
+	IN ULONG Previous,
+	IN LONG64 Overlap,
+	IN LONG64 Window
+)
+{
+	return Current + (ULONG)((Previous * Overlap) / Window);
+}
+
+static
+NTSTATUS
+RmiStormMask(
+	IN RMI4_CONTROLLER_CONTEXT* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Disables all interrupt sources at F01 and arms the recovery timer,
+	backing off further on each storm that follows a recovery directly.
+	Must be called with the controller lock held.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	TCH_STORM_CONTEXT* storm;
+	BYTE interruptEnable;
+	ULONG delay;
+	NTSTATUS status;
+
+	storm = &ControllerContext->Storm;
+
+	interruptEnable = 0;
+
+	RmiShadowWrite(
+		&ControllerContext->F01ControlShadow,
+		FIELD_OFFSET(RMI4_F01_CTRL_REGISTERS, InterruptEnable),
+		&interruptEnable,
+		sizeof(interruptEnable));
+
+	status = RmiShadowFlush(
+		ControllerContext,
+		SpbContext,
+		&ControllerContext->F01ControlShadow);
+
+	delay = ControllerContext->Config.StormRecoveryDelay <<
+		min(storm->Trips, TCH_STORM_MAX_BACKOFF);
+
+	storm->Masked = TRUE;
+	storm->Trips++;
+
+	TchCountEvent(&ControllerContext->Counters, InterruptStorms);
+
+	TraceLoggingWrite(
+		TchTraceProvider,
+		"InterruptStorm",
+		TraceLoggingLevel(WINEVENT_LEVEL_WARNING),
+		TraceLoggingKeyword(TCH_TRACE_KEYWORD_INTERRUPT),
+		TraceLoggingUInt32(storm->Interrupts, "Interrupts"),
+		TraceLoggingUInt32(storm->Spurious, "Spurious"),
+		TraceLoggingUInt32(storm->Trips, "Trips"),
+		TraceLoggingUInt32(delay, "RecoveryDelayMs"),
+		TraceLoggingNTStatus(status, "MaskStatus"));
+
+	WdfTimerStart(storm->RecoveryTimer, WDF_REL_TIMEOUT_IN_MS(delay));
+
+	return status;
+}
+
+BOOLEAN
+RmiStormCheck(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext,
+	IN BOOLEAN Spurious
+)
+/*++
+
+Routine Description:
+
+	Accounts for one interrupt in the sliding window and masks the
+	controller if the interrupt or spurious interrupt rate exceeds its
+	limit. Must be called with the controller lock held.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+	Spurious - The interrupt had no status bit set or its status could
+		not be read
+
+Return Value:
+
+	TRUE if the interrupt must not be serviced because the controller
+	is masked
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	TCH_STORM_CONTEXT* storm;
+	LONG64 window;
+	LONG64 elapsed;
+	LONG64 now;
+	ULONG interrupts;
+	ULONG spurious;
+	BOOLEAN storming;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+	storm = &controller->Storm;
+
+	if (controller->Config.StormWindow == 0)
+	{
+		return FALSE;
+	}
+
+	window = (LONG64)controller->Config.StormWindow * TCH_STORM_TICKS_PER_MS;
+	now = (LONG64)KeQueryInterruptTime();
+	elapsed = now - storm->WindowStart;
+
+	//
+	// Slide to the window containing now, the previous window only
+	// counts if it is the one right before
+	//
+	if (elapsed >= window)
+	{
+		if (elapsed >= 2 * window)
+		{
+			storm->PreviousInterrupts = 0;
+			storm->PreviousSpurious = 0;
+		}
+		else
+		{
+			storm->PreviousInterrupts = storm->Interrupts;
+			storm->PreviousSpurious = storm->Spurious;
+		}
+
+		//
+		// A quiet window after a recovery ends the back-off
+		//
+		if (!storm->Masked &&
+			storm->PreviousInterrupts <= controller->Config.StormInterruptLimit &&
+			storm->PreviousSpurious <= controller->Config.StormSpuriousLimit)
+		{
+			storm->Trips = 0;
+		}
+
+		storm->Interrupts = 0;
+		storm->Spurious = 0;
+		storm->WindowStart = now - (elapsed % window);
+		elapsed = now - storm->WindowStart;
+	}
+
+	storm->Interrupts++;
+
+	if (Spurious)
+	{
+		storm->Spurious++;
+	}
+
+	interrupts = RmiStormEstimate(
+		storm->Interrupts,
+		storm->PreviousInterrupts,
+		window - elapsed,
+		window);
+
+	spurious = RmiStormEstimate(
+		storm->Spurious,
+		storm->PreviousSpurious,
+		window - elapsed,
+		window);
+
+	storming =
+		(controller->Config.StormInterruptLimit != 0 &&
+			interrupts > controller->Config.StormInterruptLimit) ||
+		(controller->Config.StormSpuriousLimit != 0 &&
+			spurious > controller->Config.StormSpuriousLimit);
+
+	if (storm->Masked)
+	{
+		//
+		// The masked controller keeps interrupting, slow the interrupt
+		// routine down instead
+		//
+		storm->Throttle = storming;
+		return TRUE;
+	}
+
+	if (storming)
+	{
+		RmiStormMask(controller, SpbContext);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+VOID
+RmiStormThrottle(
+	IN VOID* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Delays the interrupt routine if the last interrupt arrived during a
+	storm while the controller was masked. Called without locks held.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	LARGE_INTEGER delay;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+
+	if (!controller->Storm.Throttle)
+	{
+		return;
+	}
+
+	delay.QuadPart = -(LONG64)TCH_STORM_THROTTLE_MS * TCH_STORM_TICKS_PER_MS;
+
+	KeDelayExecutionThread(KernelMode, FALSE, &delay);
+}
+
+NTSTATUS
+RmiStormRecover(
+	IN VOID* ControllerContext,
+	IN SPB_CONTEXT* SpbContext
+)
+/*++
+
+Routine Description:
+
+	Unmasks a controller masked by the storm monitor by reconfiguring
+	it, which restores the configured interrupt enables. Must be called
+	with the controller lock held or with interrupts disabled.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	SpbContext - A pointer to the current i2c context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	NTSTATUS status;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+
+	WdfWaitLockAcquire(controller->ReportLock, NULL);
+
+	status = RmiConfigureFunctions(
+		controller,
+		SpbContext);
+
+	WdfWaitLockRelease(controller->ReportLock);
+
+	TchCountEvent(&controller->Counters, Reconfigurations);
+
+	if (!NT_SUCCESS(status))
+	{
+		TchCountEvent(
+			&controller->Counters,
+			SpbErrors[TchSpbSiteConfiguration]);
+
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INTERRUPT,
+			"Could not reconfigure chip after an interrupt storm - STATUS:%X",
+			status);
+
+		goto exit;
+	}
+
+	controller->Storm.Masked = FALSE;
+	controller->Storm.Throttle = FALSE;
+	controller->Storm.Interrupts = 0;
+	controller->Storm.Spurious = 0;
+	controller->Storm.PreviousInterrupts = 0;
+	controller->Storm.PreviousSpurious = 0;
+	controller->Storm.WindowStart = (LONG64)KeQueryInterruptTime();
+
+exit:
+
+	return status;
+}
+
+static
+VOID
+OnStormRecoveryTimer(
+	IN WDFTIMER Timer
+)
+/*++
+
+Routine Description:
+
+	Attempts to bring a masked controller back once the back-off delay
+	has passed, retrying later if the reconfiguration fails
+
+Arguments:
+
+	Timer - a handle to the framework timer object
+
+Return Value:
+
+	None.
+
+--*/
+{
+	PDEVICE_EXTENSION devContext;
+	RMI4_CONTROLLER_CONTEXT* controller;
+	NTSTATUS status;
+
+	devContext = GetDeviceContext(WdfTimerGetParentObject(Timer));
+	controller = (RMI4_CONTROLLER_CONTEXT*)devContext->TouchContext;
+
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
+	//
+	// A powered down controller is recovered on wake
+	//
+	if (!controller->Storm.Masked ||
+		controller->DevicePowerState != PowerDeviceD0)
+	{
+		goto exit;
+	}
+
+	status = RmiStormRecover(controller, &devContext->I2CContext);
+
+	if (!NT_SUCCESS(status))
+	{
+		WdfTimerStart(Timer, WDF_REL_TIMEOUT_IN_MS(
+			controller->Config.StormRecoveryDelay << TCH_STORM_MAX_BACKOFF));
+	}
+
+exit:
+
+	WdfWaitLockRelease(controller->ControllerLock);
+}
+
+NTSTATUS
+TchStormInitialize(
+	IN VOID* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Creates the recovery timer of the interrupt storm monitor
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	WDF_TIMER_CONFIG timerConfig;
+	WDF_OBJECT_ATTRIBUTES timerAttributes;
+	NTSTATUS status;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+
+	WDF_TIMER_CONFIG_INIT(&timerConfig, OnStormRecoveryTimer);
+	WDF_OBJECT_ATTRIBUTES_INIT(&timerAttributes);
+	timerAttributes.ParentObject = controller->FxDevice;
+
+	//
+	// The handler reconfigures the controller, run it at passive level
+	//
+	timerAttributes.ExecutionLevel = WdfExecutionLevelPassive;
+
+	status = WdfTimerCreate(
+		&timerConfig,
+		&timerAttributes,
+		&controller->Storm.RecoveryTimer);
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_INIT,
+			"Could not create interrupt storm recovery timer - STATUS:%X",
+			status);
+	}
+
+	return status;
+}
+
+VOID
+TchStormStop(
+	IN VOID* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Cancels a pending recovery ahead of a power down, a controller still
+	masked is recovered by the next wake
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+
+	if (controller->Storm.RecoveryTimer == NULL)
+	{
+		return;
+	}
+
+	//
+	// Wait for a running handler, it takes the controller lock
+	//
+	WdfTimerStop(controller->Storm.RecoveryTimer, TRUE);
+}
@@ -0,0 +1,474 @@
+/*++
+	Copyright (c) Microsoft Corporation. All Rights Reserved.
+	Sample code. Dealpoint ID #843729.
+
+	Module Name:
+
+		tap.c
+
+	Abstract:
+
+		Shares a ring of raw register data with one user mode client,
+		written in place by the interrupt routine
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include "internal.h"
+#include "controller.h"
+#include "rmiinternal.h"
+#include "debug.h"
+#include "etwtrace.h"
+#include "tap.h"
+
+#define TCH_TAP_RING_SIZE           (TCH_TAP_SIZE - TCH_TAP_HEADER_SIZE)
+
+static
+NTSTATUS
+TchTapAllocate(
+	IN TCH_TAP_CONTEXT* Tap
+)
+/*++
+
+Routine Description:
+
+	Allocates the tap pages and maps them into system space. Whole pages
+	are allocated so mapping them exposes nothing else to the client.
+
+Arguments:
+
+	Tap - Tap context
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	PHYSICAL_ADDRESS lowAddress;
+	PHYSICAL_ADDRESS highAddress;
+	PHYSICAL_ADDRESS skipBytes;
+	NTSTATUS status;
+
+	lowAddress.QuadPart = 0;
+	highAddress.QuadPart = (LONGLONG)-1;
+	skipBytes.QuadPart = 0;
+
+	Tap->Mdl = MmAllocatePagesForMdlEx(
+		lowAddress,
+		highAddress,
+		skipBytes,
+		TCH_TAP_SIZE,
+		MmCached,
+		MM_ALLOCATE_FULLY_REQUIRED);
+
+	if (Tap->Mdl == NULL)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto exit;
+	}
+
+	Tap->Header = (PTCH_TAP_HEADER)MmMapLockedPagesSpecifyCache(
+		Tap->Mdl,
+		KernelMode,
+		MmCached,
+		NULL,
+		FALSE,
+		NormalPagePriority | MdlMappingNoExecute);
+
+	if (Tap->Header == NULL)
+	{
+		MmFreePagesFromMdl(Tap->Mdl);
+		ExFreePool(Tap->Mdl);
+		Tap->Mdl = NULL;
+
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto exit;
+	}
+
+	Tap->Ring = (PUCHAR)Tap->Header + TCH_TAP_HEADER_SIZE;
+	status = STATUS_SUCCESS;
+
+exit:
+
+	if (!NT_SUCCESS(status))
+	{
+		Trace(
+			TRACE_LEVEL_ERROR,
+			TRACE_FLAG_OTHER,
+			"Could not allocate raw frame tap - STATUS:%X",
+			status);
+	}
+
+	return status;
+}
+
+NTSTATUS
+TchTapMap(
+	IN VOID* ControllerContext,
+	IN HANDLE Event,
+	OUT PTCH_TAP_MAP_OUTPUT Output
+)
+/*++
+
+Routine Description:
+
+	Maps the tap into the calling process and starts writing records to
+	it. Must be called in the context of the client process, a single
+	mapping can exist at a time.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	Event - Handle to an event of the caller signaled for each record,
+		or NULL
+	Output - Receives the address and size of the mapping
+
+Return Value:
+
+	NTSTATUS indicating success or failure
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	PDEVICE_EXTENSION devContext;
+	TCH_TAP_CONTEXT* tap;
+	PKEVENT event;
+	PVOID userAddress;
+	NTSTATUS status;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+	devContext = GetDeviceContext(controller->FxDevice);
+	tap = &controller->Tap;
+	event = NULL;
+	userAddress = NULL;
+
+	PAGED_CODE();
+
+	//
+	// The session count owns the tap while a client has it mapped
+	//
+	if (InterlockedCompareExchange(&devContext->TestSessionRefCnt, 1, 0) != 0)
+	{
+		return STATUS_DEVICE_BUSY;
+	}
+
+	if (tap->Mdl == NULL)
+	{
+		status = TchTapAllocate(tap);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+	}
+
+	if (Event != NULL)
+	{
+		status = ObReferenceObjectByHandle(
+			Event,
+			EVENT_MODIFY_STATE,
+			*ExEventObjectType,
+			UserMode,
+			(PVOID*)&event,
+			NULL);
+
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
+	}
+
+	__try
+	{
+		userAddress = MmMapLockedPagesSpecifyCache(
+			tap->Mdl,
+			UserMode,
+			MmCached,
+			NULL,
+			FALSE,
+			NormalPagePriority | MdlMappingNoExecute);
+
+		status = (userAddress != NULL) ?
+			STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER)
+	{
+		status = GetExceptionCode();
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
+	RtlZeroMemory(tap->Header, TCH_TAP_SIZE);
+
+	tap->Header->Version = TCH_TAP_VERSION;
+	tap->Header->HeaderSize = TCH_TAP_HEADER_SIZE;
+	tap->Header->RingSize = TCH_TAP_RING_SIZE;
+
+	tap->WritePosition = 0;
+	tap->Sequence = 0;
+	tap->UserAddress = userAddress;
+	tap->Process = PsGetCurrentProcess();
+	tap->Event = event;
+
+	ObReferenceObject(tap->Process);
+
+	tap->Mapped = TRUE;
+
+	WdfWaitLockRelease(controller->ControllerLock);
+
+	Output->Address = (ULONG64)(ULONG_PTR)userAddress;
+	Output->Size = TCH_TAP_SIZE;
+	Output->Reserved = 0;
+
+exit:
+
+	if (!NT_SUCCESS(status))
+	{
+		if (event != NULL)
+		{
+			ObDereferenceObject(event);
+		}
+
+		InterlockedDecrement(&devContext->TestSessionRefCnt);
+	}
+
+	Trace(
+		TRACE_LEVEL_INFORMATION,
+		TRACE_FLAG_OTHER,
+		"Raw frame tap mapped at %p - STATUS:%X",
+		userAddress,
+		status);
+
+	return status;
+}
+
+VOID
+TchTapUnmap(
+	IN VOID* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Stops writing records and unmaps the tap from the client process,
+	attaching to it if called from another process. Does nothing if the
+	tap is not mapped.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	PDEVICE_EXTENSION devContext;
+	TCH_TAP_CONTEXT* tap;
+	KAPC_STATE apcState;
+	PVOID userAddress;
+	PEPROCESS process;
+	PKEVENT event;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+	devContext = GetDeviceContext(controller->FxDevice);
+	tap = &controller->Tap;
+
+	PAGED_CODE();
+
+	//
+	// The interrupt routine writes under the controller lock, it no
+	// longer touches the mapping or the event once this is released
+	//
+	WdfWaitLockAcquire(controller->ControllerLock, NULL);
+
+	if (!tap->Mapped)
+	{
+		WdfWaitLockRelease(controller->ControllerLock);
+		return;
+	}
+
+	tap->Mapped = FALSE;
+	userAddress = tap->UserAddress;
+	process = tap->Process;
+	event = tap->Event;
+	tap->UserAddress = NULL;
+	tap->Process = NULL;
+	tap->Event = NULL;
+
+	WdfWaitLockRelease(controller->ControllerLock);
+
+	if (process != PsGetCurrentProcess())
+	{
+		KeStackAttachProcess(process, &apcState);
+		MmUnmapLockedPages(userAddress, tap->Mdl);
+		KeUnstackDetachProcess(&apcState);
+	}
+	else
+	{
+		MmUnmapLockedPages(userAddress, tap->Mdl);
+	}
+
+	if (event != NULL)
+	{
+		ObDereferenceObject(event);
+	}
+
+	ObDereferenceObject(process);
+
+	InterlockedDecrement(&devContext->TestSessionRefCnt);
+}
+
+VOID
+TchTapFree(
+	IN VOID* ControllerContext
+)
+/*++
+
+Routine Description:
+
+	Unmaps the tap if a client still has it mapped and frees its pages
+
+Arguments:
+
+	ControllerContext - Touch controller context
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	TCH_TAP_CONTEXT* tap;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+	tap = &controller->Tap;
+
+	if (tap->Mdl == NULL)
+	{
+		return;
+	}
+
+	TchTapUnmap(controller);
+
+	MmUnmapLockedPages(tap->Header, tap->Mdl);
+	MmFreePagesFromMdl(tap->Mdl);
+	ExFreePool(tap->Mdl);
+
+	tap->Mdl = NULL;
+	tap->Header = NULL;
+	tap->Ring = NULL;
+}
+
+VOID
+RmiTapWrite(
+	IN VOID* ControllerContext,
+	IN USHORT Source,
+	IN ULONG64 Timestamp,
+	IN CONST VOID* Data,
+	IN ULONG Length
+)
+/*++
+
+Routine Description:
+
+	Appends a record to the tap if a client has it mapped. Data is
+	copied once, straight into the shared pages. Must be called with
+	the controller lock held.
+
+Arguments:
+
+	ControllerContext - Touch controller context
+	Source - TCH_TAP_SOURCE_XXX the data was read from
+	Timestamp - Interrupt time of the frame the data belongs to
+	Data - Raw register data
+	Length - Length of the data
+
+Return Value:
+
+	None.
+
+--*/
+{
+	RMI4_CONTROLLER_CONTEXT* controller;
+	TCH_TAP_CONTEXT* tap;
+	PTCH_TAP_RECORD record;
+	ULONG recordLength;
+	ULONG offset;
+
+	controller = (RMI4_CONTROLLER_CONTEXT*)ControllerContext;
+	tap = &controller->Tap;
+
+	if (!tap->Mapped)
+	{
+		return;
+	}
+
+	recordLength = ALIGN_UP_BY(
+		sizeof(TCH_TAP_RECORD) + Length,
+		TCH_TAP_RECORD_ALIGNMENT);
+
+	if (recordLength > TCH_TAP_RING_SIZE / 4)
+	{
+		return;
+	}
+
+	offset = (ULONG)(tap->WritePosition % TCH_TAP_RING_SIZE);
+
+	//
+	// Records never wrap, the rest of the ring is skipped instead
+	//
+	if (TCH_TAP_RING_SIZE - offset < recordLength)
+	{
+		if (TCH_TAP_RING_SIZE - offset >= sizeof(TCH_TAP_RECORD))
+		{
+			record = (PTCH_TAP_RECORD)(tap->Ring + offset);
+			record->Length = TCH_TAP_RING_SIZE - offset;
+			record->Source = TCH_TAP_SOURCE_PADDING;
+			record->Reserved = 0;
+			record->Sequence = 0;
+			record->DataLength = 0;
+			record->Timestamp = 0;
+		}
+
+		tap->WritePosition += TCH_TAP_RING_SIZE - offset;
+		offset = 0;
+	}
+
+	InterlockedExchange64(
+		&tap->Header->ReservePosition,
+		tap->WritePosition + recordLength);
+
+	record = (PTCH_TAP_RECORD)(tap->Ring + offset);
+	record->Length = recordLength;
+	record->Source = Source;
+	record->Reserved = 0;
+	record->Sequence = tap->Sequence++;
+	record->DataLength = Length;
+	record->Timestamp = Timestamp;
+
+	RtlCopyMemory(record + 1, Data, Length);
+
+	tap->WritePosition += recordLength;
+
+	InterlockedExchange64(&tap->Header->WritePosition, tap->WritePosition);
+
+	if (tap->Event != NULL)
+	{
+		KeSetEvent(tap->Event, IO_NO_INCREMENT, FALSE);
+	}
+}